@@ -1,5 +1,23 @@
 #include "IotaWatt.h"
 
+        // Query result cache, described with its functions below.
+
+struct queryCacheEntry {
+        String      key;                        // select|group|format|missing
+        uint32_t    endKey;                     // End of last group 
+        uint32_t    lastUsed;                   // millis() of last lookup
+        uint16_t    used;                       // Bytes of rows
+        bool        busy;                       // In use by a query
+        char        rows[QUERY_CACHE_SIZE];
+        queryCacheEntry():endKey(0),lastUsed(0),used(0),busy(false){}
+};
+
+struct cacheRow {
+        uint32_t    begin;                      // Beginning of group
+        uint32_t    end;                        // End of group
+        uint16_t    len;                        // Length of text
+};
+
 CSVquery::CSVquery()
     :_oldRec(nullptr)
     ,_newRec(nullptr)
@@ -7,6 +25,7 @@ CSVquery::CSVquery()
     ,_end(0)
     ,_limit(1000)
     ,_format(formatJson)
+    ,_binSize(sizeof(float))
     ,_query(none)
     ,_header(false)
     ,_highRes(false)
@@ -17,6 +36,16 @@ CSVquery::CSVquery()
     ,_missingNull(true)
     ,_missingZero(false)
     ,_timeOnly(false)
+    ,_cursor(false)
+    ,_queryHash(0)
+    ,_reread(false)
+    ,_cache(nullptr)
+    ,_cachePos(0)
+    ,_aggregates(false)
+    ,_scan(nullptr)
+    ,_batch(nullptr)
+    ,_batchCount(0)
+    ,_batchWork(nullptr)
     ,_columns(nullptr)
     {}
 
@@ -24,9 +53,20 @@ CSVquery::~CSVquery(){
     trace(T_CSVquery,1,0);
     delete _oldRec;
     delete _newRec;
+    delete _scan;
+    if(_batch){
+        for(int i=0; i<=QUERY_SCAN_BATCH; i++){
+            delete _batch[i];
+        }
+        delete[] _batch;
+        delete[] _batchWork;
+    }
     trace(T_CSVquery,1,2);
     delete _columns;
     trace(T_CSVquery,1,3);
+    if(_cache){
+        _cache->busy = false;
+    }
 }
 
 bool    CSVquery::setup(){
@@ -47,17 +87,38 @@ bool    CSVquery::setup(){
                 // query - select=[  ] 
 
     else if (server.hasArg(F("select"))){
+
+                // A cursor from a previous response (since=)
+                // replaces begin, and end defaults to now.
+
+        if(server.hasArg(F("since"))){
+            if( ! server.hasArg(F("group"))){
+                _failReason = F("Missing group.");
+                return false;
+            }
+            if( ! parseCursor(server.arg(F("since")))){
+                _failReason = F("Invalid cursor");
+                return false;
+            }
+            _cursor = true;
+            _end = server.hasArg(F("end")) ? parseTimeArg(server.arg(F("end"))) : Current_log.lastKey();
+        }
     
-        if( ! (server.hasArg(F("begin")) && server.hasArg(F("end")) && server.hasArg(F("group")) )){
-            _failReason = F("Missing begin, end or group.");
-            return false;
+        else {
+            if( ! (server.hasArg(F("begin")) && server.hasArg(F("end")) && server.hasArg(F("group")) )){
+                _failReason = F("Missing begin, end or group.");
+                return false;
+            }
+            _begin = parseTimeArg(server.arg(F("begin")));
+            _end = parseTimeArg(server.arg(F("end")));
+            if(server.hasArg(F("cursor"))){
+                _cursor = server.arg(F("cursor")).equalsIgnoreCase("yes");
+            }
         }
        
-        _begin = parseTimeArg(server.arg(F("begin")));
         if(_begin % Current_log.interval()){
             _begin += Current_log.interval() - (_begin % Current_log.interval());
         }
-        _end = parseTimeArg(server.arg(F("end")));
         if(_end % Current_log.interval()){
             _end -= _end % Current_log.interval();
         }
@@ -110,6 +171,10 @@ bool    CSVquery::setup(){
                 return false;
             }
         }
+        if(_cursor && (group.equals("auto") || group.equals("all"))){
+            _failReason = F("Invalid group for cursor");
+            return false;
+        }
         if((_begin % 60 == 0) && (_end % 60 == 0) && (_groupUnits != tUnitsSeconds || _groupMult % 60 == 0)){
             _integrations = true;
         }
@@ -136,6 +201,14 @@ bool    CSVquery::setup(){
             else if(arg.equalsIgnoreCase("CSV")){
                 _format = formatCSV;
             }
+            else if(arg.equalsIgnoreCase("bin")){
+                _format = formatBin;
+                _binSize = sizeof(float);
+            }
+            else if(arg.equalsIgnoreCase("bin64")){
+                _format = formatBin;
+                _binSize = sizeof(double);
+            }
             else {
                 _failReason = F("Invalid format");
                 return false;
@@ -240,7 +313,15 @@ bool    CSVquery::setup(){
                         else if(strcmp(script->getUnits(),"Watts") == 0){
                             col->unit = Watts;
                         }
-                        else col->decimals = script->precision();
+                        else {
+                            col->decimals = script->precision();
+                            col->unit = Watts;
+                            for(int u=0; u<unitsNone; u++){
+                                if(strcmp(script->getUnits(), unitstr((units)u)) == 0){
+                                    col->unit = (units)u;
+                                }
+                            }
+                        }
                         col->script = script;
                         break;
                     } 
@@ -313,6 +394,24 @@ bool    CSVquery::setup(){
                     col->unit = VARh;
                     col->decimals = 0;
                 }
+                else if(method.equals("min")){
+                    col->agg = aggMin;
+                }
+                else if(method.equals("max")){
+                    col->agg = aggMax;
+                }
+                else if(method.equals("stddev")){
+                    col->agg = aggStddev;
+                }
+                else if(method.startsWith("p") && isdigit(method[1])){
+                    int pct = method.substring(1).toInt();
+                    if(pct < 1 || pct > 99 || method.length() > 3){
+                        _failReason = String(F("Invalid percentile: ")) + method;
+                        return false;
+                    }
+                    col->agg = aggPct;
+                    col->pct = pct;
+                }
                 else if(method.startsWith("d")){
                     if(method.length() != 2 | method[1] < '0' | method[1] > '9') return false;
                     col->decimals = method[1] - '0';
@@ -336,6 +435,10 @@ bool    CSVquery::setup(){
                 snprintf(newscript,4,"@%d",input);
                 col->script = new Script(inputChannel[input]->_name, unitstr(col->unit), newscript);
             }
+            if(col->agg != aggAvg){
+                col->stats = new aggStats;
+                _aggregates = true;
+            }
 
             column* next = col->next;
             col->next = prev;
@@ -363,7 +466,21 @@ bool    CSVquery::setup(){
         }
 
         trace(T_CSVquery,19);
-        if(_header){
+        if(_cursor){
+            uint32_t hash = 2166136261UL;
+            String key = queryKey();
+            for(int i=0; i<key.length(); i++){
+                hash = (hash ^ (uint8_t)key[i]) * 16777619UL;
+            }
+            if(server.hasArg(F("since")) && hash != _queryHash){
+                _failReason = F("Cursor doesn't match query");
+                return false;
+            }
+            _queryHash = hash;
+            _end = lastCompleteGroup(MIN(_end, Current_log.lastKey()));
+        }
+
+        if(_header || _format == formatBin){
             buildHeader();
         }
         if(_format == formatJson){
@@ -372,7 +489,15 @@ bool    CSVquery::setup(){
         _oldRec = new IotaLogRecord;
         _newRec = new IotaLogRecord;
         _newRec->UNIXtime = _begin;
-        logReadKey(_newRec);
+        if( ! (_timeOnly || _cursor)){
+            cacheLookup();
+        }
+        if(_cache && _cachePos < _cache->used){
+            _reread = true;
+        }
+        else {
+            logReadKey(_newRec);
+        }
         trace(T_CSVquery,20);
         _query = select;
         return true;
@@ -388,7 +513,9 @@ bool    CSVquery::setup(){
 const char*  CSVquery::unitstr(units units){
     if(units == Volts) return "Volts";
     if(units == Watts) return "Watts";
+    if(units == Wh)    return "Wh";
     if(units == kWh)   return "kWh";
+    if(units == VAh)   return "VAh";
     if(units == Hz)    return "Hz";
     if(units == Amps)  return "Amps";
     if(units == VA)    return "VA";
@@ -405,18 +532,95 @@ bool    CSVquery::isJson(){
 bool    CSVquery::isCSV(){
     return _format == formatCSV;
 }
+bool    CSVquery::isBinary(){
+    return _format == formatBin;
+}
 
 String  CSVquery::failReason(){
     return _failReason.length() ? _failReason : "unspecified";
 }
 
+//*****************************************************************************************
+//                  Cursors
+//
+//  With cursor=yes or since=<cursor>, only complete groups are produced, those that end
+//  at or before the last datalog entry, and the response includes a cursor that is the
+//  end of the last of them.  A request with since=<cursor> begins there, so a polling
+//  client gets only the groups that have completed since its last request.
+//
+//  The cursor is the group boundary and a hash of the select list, group, format and
+//  missing option, as 16 hex digits.  A cursor is only accepted for the query it came from.
+//*****************************************************************************************
+
+String  CSVquery::cursor(){
+    if( ! _cursor){
+        return String();
+    }
+    char cursor[20];
+    snprintf_P(cursor, sizeof(cursor), PSTR("%08x%08x"), _end, _queryHash);
+    return String(cursor);
+}
+
+bool    CSVquery::parseCursor(String arg){
+    if(arg.length() != 16){
+        return false;
+    }
+    for(int i=0; i<16; i++){
+        if( ! isxdigit(arg[i])){
+            return false;
+        }
+    }
+    _begin = strtoul(arg.substring(0,8).c_str(), nullptr, 16);
+    _queryHash = strtoul(arg.substring(8).c_str(), nullptr, 16);
+    return _begin != 0;
+}
+
+String  CSVquery::queryKey(){
+    String key = server.arg(F("select"));
+    key += '|';
+    key += _groupMult;
+    key += (char)('a' + _groupUnits);
+    key += (char)('a' + _format);
+    key += (char)('0' + _binSize);
+    key += _highRes ? 'h' : 'l';
+    key += _missingSkip ? 's' : (_missingNull ? 'n' : (_missingZero ? 'z' : '-'));
+    return key;
+}
+
+        // Find the end of the last group that ends at or before limit,
+        // and no more than _limit groups from the beginning.
+
+uint32_t CSVquery::lastCompleteGroup(uint32_t limit){
+    uint32_t end = _end;
+    uint32_t last = _begin;
+    int32_t groups = _limit;
+    _end = UINT32_MAX;
+    while(groups--){
+        uint32_t next = nextGroup(last, _groupUnits, _groupMult);
+        if(next > limit || next <= last){
+            break;
+        }
+        last = next;
+    }
+    _end = end;
+    return last;
+}
+
 //*****************************************************************************************
 //                  buildHeader
 //*****************************************************************************************
 void CSVquery::buildHeader(){
 
+    if(_format == formatBin){
+        buildBinHeader();
+        return;
+    }
     if(_format == formatJson){
-        _buffer.printf_P(PSTR("{\"range\":[%d,%d],\"labels\":["), _begin, _end);
+        _buffer.printf_P(PSTR("{\"range\":[%d,%d],"), _begin, _end);
+        if(_cursor){
+            _buffer.printf_P(PSTR("\"cursor\":\"%s\","), cursor().c_str());
+        }
+        _buffer.print("\"labels\":[");
     }
     column* col = _columns;
     bool first = true;
@@ -431,18 +635,7 @@ void CSVquery::buildHeader(){
         if(_format == formatJson){
             _buffer.print('"');
         }
-        if(col->source == 'T'){
-            _buffer.print("Time");
-        }
-        else if (col->source == 'I'){
-            _buffer.print(inputChannel[col->input]->_name);
-        }
-        else if(col->source == 'O'){
-            _buffer.print(col->script->name());
-        }
-        else if(col->source == 'N'){
-            _buffer.print(col->script->name());
-        }
+        _buffer.print(columnName(col));
         if(_format == formatJson){
             _buffer.print('"');
         }
@@ -458,6 +651,72 @@ void CSVquery::buildHeader(){
     return;
 }
 
+//*****************************************************************************************
+//                  buildBinHeader
+//
+//  The binary formats (bin and bin64) start with a header describing the columns,
+//  followed by the rows with no delimiters. All numbers are little-endian.
+//
+//      char[4]     "IWQB"
+//      uint8       version (1)
+//      uint8       number of columns
+//      uint8       size of values, 4 (float) or 8 (double)
+//      uint8       reserved (0)
+//      uint32      begin (UTC)
+//      uint32      end (UTC)
+//      For each column:
+//          char    type 'T' (time) or 'V' (value)
+//          uint8   length of name, followed by the name
+//          uint8   length of units, followed by the units ("local" or "utc" for time)
+//
+//  Each row has a uint32 UNIXtime for time columns and a float or double for values.
+//  Missing values are NaN, or zero with missing=zero.
+//*****************************************************************************************
+void CSVquery::buildBinHeader(){
+    uint8_t count = 0;
+    for(column* col = _columns; col; col = col->next){
+        count++;
+    }
+    _buffer.write("IWQB");
+    _buffer.write((uint8_t)1);
+    _buffer.write(count);
+    _buffer.write(_binSize);
+    _buffer.write((uint8_t)0);
+    _buffer.write((uint8_t*)&_begin, sizeof(_begin));
+    _buffer.write((uint8_t*)&_end, sizeof(_end));
+    for(column* col = _columns; col; col = col->next){
+        String name = columnName(col);
+        const char* unit = col->source == 'T' ? (col->timeLocal ? "local" : "utc") : unitstr(col->unit);
+        _buffer.write((uint8_t)(col->source == 'T' ? 'T' : 'V'));
+        _buffer.write((uint8_t)name.length());
+        _buffer.write(name.c_str());
+        _buffer.write((uint8_t)strlen(unit));
+        _buffer.write(unit);
+    }
+}
+
+//*****************************************************************************************
+//                  columnName
+//
+//  Label of a column in the header.  Aggregate columns carry the method
+//  so that, for instance, mains.min and mains.max can be told apart.
+//*****************************************************************************************
+String CSVquery::columnName(column* col){
+    String name;
+    if(col->source == 'T'){
+        return String("Time");
+    }
+    name = col->source == 'I' ? inputChannel[col->input]->_name : col->script->name();
+    switch (col->agg){
+        case aggMin:    name += F(".min"); break;
+        case aggMax:    name += F(".max"); break;
+        case aggStddev: name += F(".stddev"); break;
+        case aggPct:    name += ".p" + String(col->pct); break;
+        default:        break;
+    }
+    return name;
+}
+
 //*****************************************************************************************
 //                  buildLine
 //*****************************************************************************************
@@ -465,6 +724,7 @@ void CSVquery::buildLine(){
     trace(T_CSVquery,60);
     column* col = _columns;
     double elapsedHours = _newRec->logHours - _oldRec->logHours;
+    ScriptContext context(_oldRec, _newRec);
     bool first = true;
         
     while(col){
@@ -473,7 +733,7 @@ void CSVquery::buildLine(){
         if( ! first){
             if(_format == formatJson){
                 _buffer.print(',');
-            } else {
+            } else if(_format == formatCSV){
                 _buffer.print(", ");
             }
         } 
@@ -485,7 +745,11 @@ void CSVquery::buildLine(){
 
         else if(col->source == 'T'){
             time_t Time = col->timeLocal ? UTC2Local(_oldRec->UNIXtime) : _oldRec->UNIXtime;
-            if(col->timeFormat == unix){
+            if(_format == formatBin){
+                uint32_t binTime = Time;
+                _buffer.write((uint8_t*)&binTime, sizeof(binTime));
+            }
+            else if(col->timeFormat == unix){
                 _buffer.print(Time);
             }
             else {
@@ -501,9 +765,12 @@ void CSVquery::buildLine(){
             }
         }
 
-        else if(elapsedHours == 0){
+        else if(elapsedHours == 0 || (col->stats && col->stats->count == 0)){
             trace(T_CSVquery,63);
-            if(_missingZero){
+            if(_format == formatBin){
+                printValue(_missingZero ? 0.0 : NAN, 0);
+            }
+            else if(_missingZero){
                 _buffer.print('0');
             }
             else if(_missingNull){
@@ -514,7 +781,11 @@ void CSVquery::buildLine(){
         else {
             trace(T_CSVquery,64);
             double value = 0.0;
-            value = col->script->run(_oldRec, _newRec, col->unit);
+            if(col->stats){
+                value = col->stats->result(col->agg, col->pct / 100.0);
+            } else {
+                value = col->script->run(&context, col->unit);
+            }
             trace(T_CSVquery,65);
             printValue(value, col->decimals);
         }
@@ -525,13 +796,17 @@ void CSVquery::buildLine(){
 }
 
 void CSVquery::printValue(const double value, const int8_t decimals){
-    char str[20];
-    snprintf(str,20,"%#.*f",decimals,value);
-    int len = strlen(str);
-    while(str[--len] == '0');
-    if(str[len] == '.') --len;
-    str[len+1] = 0;
-    _buffer.write(str);
+    if(_format == formatBin){
+        if(_binSize == sizeof(float)){
+            float binValue = value;
+            _buffer.write((uint8_t*)&binValue, sizeof(binValue));
+        }
+        else {
+            _buffer.write((uint8_t*)&value, sizeof(value));
+        }
+        return;
+    }
+    printFixed(_buffer, value, decimals, true);
 }
 
 //*****************************************************************************************
@@ -625,6 +900,26 @@ size_t  CSVquery::readResult(uint8_t* buf, int len){
                     return written;
                 }
 
+                    // Out of time before the next AC cycle,
+                    // return what there is so far.
+
+                else if((written || _scan) && (micros() + 2500) >= bingoTime){
+                    trace(T_CSVquery,47);
+                    return written;
+                }
+
+                    // Continue scanning the group for aggregates,
+                    // generate the line when done.
+
+                else if(_scan){
+                    trace(T_CSVquery,48);
+                    if(scanGroup()){
+                        delete _scan;
+                        _scan = nullptr;
+                        groupLine();
+                    }
+                }
+
                     // If at end of range, or limit reached
                     // Finish output stream and break.
 
@@ -637,7 +932,7 @@ size_t  CSVquery::readResult(uint8_t* buf, int len){
                         if(_format == formatCSV){
                             _buffer.printf_P(PSTR("\r\nLimit exceeded at %d"), _newRec->UNIXtime);
                         }
-                        else if(_header){
+                        else if(_format == formatJson && _header){
                             _buffer.printf_P(PSTR(",\"limit\":%d"), _newRec->UNIXtime);
                         }
                     }
@@ -647,11 +942,25 @@ size_t  CSVquery::readResult(uint8_t* buf, int len){
                     _lastLine = true;
                 }
 
+                    // Serve completed groups from the cache
+
+                else if(_cache && cacheServe()){
+                    trace(T_CSVquery,46);
+                }
+
                     // Process next group
 
                 else {
                     trace(T_CSVquery,50);
 
+                        // If the cache served the previous groups,
+                        // read the record where they ended.
+
+                    if(_reread){
+                        logReadKey(_newRec);
+                        _reread = false;
+                    }
+
                         // Age the log record
                     
                     IotaLogRecord* swapRec = _oldRec;
@@ -674,39 +983,604 @@ size_t  CSVquery::readResult(uint8_t* buf, int len){
                         _lastLine = true;
                     }
 
-                        // If there is data or not skipping missing data, 
-                        // Generate a line.             
+                        // Aggregates need a scan of the group first.
 
-                    if( _timeOnly || (! (_newRec->logHours == _oldRec->logHours && _missingSkip))){
-                        trace(T_CSVquery,53);    
-                        if( ! _firstLine){
-                            if(_format == formatJson){
-                                _buffer.print(',');
-                            }
-                            if(_format == formatCSV){
-                                _buffer.print("\r\n");
-                            }
-                        }
+                    if(_aggregates && _newRec->logHours != _oldRec->logHours){
+                        startScan();
+                    }
+                    else {
+                        groupLine();
+                    }
+                }
+            }
+        }
+    }
+}
 
-                        if(_format == formatJson){
-                            _buffer.print('[');
-                        }
-                        trace(T_CSVquery,54);    
-                        buildLine();
-                        _limit--;
-                        trace(T_CSVquery,55);
-
-                        if(_format == formatJson){
-                            trace(T_CSVquery,56);
-                            _buffer.print(']');
-                        }
+//*****************************************************************************************
+//                  groupLine
+//
+//  Output the line for the group from _oldRec to _newRec.
+//*****************************************************************************************
+void CSVquery::groupLine(){
+        // If there is data or not skipping missing data, 
+        // Generate a line.
+
+    size_t sepLen = 0;
+    if( _timeOnly || (! (_newRec->logHours == _oldRec->logHours && _missingSkip))){
+        trace(T_CSVquery,53);    
+        if( ! _firstLine){
+            if(_format == formatJson){
+                _buffer.print(',');
+            }
+            if(_format == formatCSV){
+                _buffer.print("\r\n");
+            }
+            sepLen = _buffer.available();
+        }
 
-                        _firstLine = false;
-                    }
+        if(_format == formatJson){
+            _buffer.print('[');
+        }
+        trace(T_CSVquery,54);    
+        buildLine();
+        _limit--;
+        trace(T_CSVquery,55);
+
+        if(_format == formatJson){
+            trace(T_CSVquery,56);
+            _buffer.print(']');
+        }
+
+        _firstLine = false;
+    }
+    if(_cache){
+        cacheAppend(sepLen);
+    }
+}
+
+//*****************************************************************************************
+//                  Group aggregates
+//
+//  The min, max, stddev and percentile methods are computed from the intervals 
+//  within the group rather than from its boundary records.  The log is read 
+//  sequentially with an IotaLogScan, a block at a time, and each pair of records 
+//  with data is run through the column Scripts.  The scan holds its place, so a 
+//  long group is processed over several calls to readResult.
+//
+//  Groups of an hour or less, or with resolution=high, scan the five second 
+//  Current_log.  Longer groups, and groups before the Current_log, use the one minute
+//  History_log when it covers the group.
+//
+//  Percentiles use the P-square algorithm (Jain and Chlamtac, 1985), which 
+//  estimates a quantile with five markers, so memory is fixed regardless of the
+//  number of intervals in the group.  It is exact for groups of five or fewer.
+//
+//  Runs of consecutive records with data are collected and evaluated 
+//  QUERY_SCAN_BATCH pairs at a time with Script::runBatch, which dispatches each
+//  Script instruction once per batch rather than once per pair.
+//*****************************************************************************************
+void CSVquery::startScan(){
+    trace(T_CSVquery,57);
+    uint32_t begin = _oldRec->UNIXtime;
+    uint32_t end = _newRec->UNIXtime;
+    IotaLog* scanLog = &Current_log;
+    if(History_log.isOpen() && end <= History_log.lastKey() &&
+       (begin < Current_log.firstKey() || ( ! _highRes && (end - begin) > 3600))){
+        scanLog = &History_log;
+    }
+    for(column* col = _columns; col; col = col->next){
+        if(col->stats){
+            col->stats->reset();
+        }
+    }
+    if( ! _batch){
+        _batch = new IotaLogRecord*[QUERY_SCAN_BATCH + 1];
+        for(int i=0; i<=QUERY_SCAN_BATCH; i++){
+            _batch[i] = new IotaLogRecord;
+        }
+        _batchWork = new double[(SCRIPT_STACK_DEPTH + 2) * QUERY_SCAN_BATCH];
+    }
+    _batchCount = 0;
+    _scan = new IotaLogScan(scanLog, begin, scanLog->interval(), end);
+}
+
+bool CSVquery::scanGroup(){
+    while(_scan->next()){
+        IotaLogRecord* newRec = _scan->newRec();
+        if(_batchCount == 0){
+            memcpy(_batch[0], _scan->oldRec(), sizeof(IotaLogRecord));
+            _batchCount = 1;
+        }
+
+            // An interval without data ends the run,
+            // the next run starts with its newRec.
+
+        if(newRec->logHours == _batch[_batchCount - 1]->logHours){
+            scanBatch();
+            memcpy(_batch[0], newRec, sizeof(IotaLogRecord));
+        }
+        else {
+            memcpy(_batch[_batchCount++], newRec, sizeof(IotaLogRecord));
+            if(_batchCount > QUERY_SCAN_BATCH){
+                scanBatch();
+            }
+        }
+        if((micros() + 2500) >= bingoTime){
+            return false;
+        }
+    }
+    scanBatch();
+    return true;
+}
+
+    // Add the pairs in _batch to the column statistics.
+    // The last record is kept as the first of the next batch.
+
+void CSVquery::scanBatch(){
+    int pairs = _batchCount - 1;
+    if(pairs > 0){
+        double* results = _batchWork + (SCRIPT_STACK_DEPTH + 1) * QUERY_SCAN_BATCH;
+        for(column* col = _columns; col; col = col->next){
+            if(col->stats){
+                col->script->runBatch(_batch, pairs, results, col->unit, _batchWork);
+                for(int i=0; i<pairs; i++){
+                    col->stats->add(results[i], col->pct / 100.0);
                 }
             }
         }
+        IotaLogRecord* last = _batch[pairs];
+        _batch[pairs] = _batch[0];
+        _batch[0] = last;
+    }
+    _batchCount = 1;
+}
+
+void CSVquery::aggStats::reset(){
+    count = 0;
+    min = max = mean = m2 = 0.0;
+}
+
+void CSVquery::aggStats::add(double value, double p){
+    count++;
+    if(count == 1 || value < min) min = value;
+    if(count == 1 || value > max) max = value;
+    double delta = value - mean;
+    mean += delta / count;
+    m2 += delta * (value - mean);
+
+        // First five values are the markers.
+
+    if(count <= 5){
+        int i = count - 1;
+        while(i > 0 && q[i-1] > value){
+            q[i] = q[i-1];
+            i--;
+        }
+        q[i] = value;
+        if(count == 5){
+            for(int i=0; i<5; i++){
+                n[i] = i;
+            }
+            np[0] = 0;
+            np[1] = 2 * p;
+            np[2] = 4 * p;
+            np[3] = 2 + 2 * p;
+            np[4] = 4;
+        }
+        return;
+    }
+
+        // Find the cell containing the value and
+        // increment the positions of the markers above it.
+
+    int k;
+    if(value < q[0]){
+        q[0] = value;
+        k = 0;
+    }
+    else if(value >= q[4]){
+        q[4] = value;
+        k = 3;
+    }
+    else {
+        k = 0;
+        while(value >= q[k+1]) k++;
+    }
+    for(int i=k+1; i<5; i++){
+        n[i]++;
+    }
+    np[1] += p / 2;
+    np[2] += p;
+    np[3] += (1 + p) / 2;
+    np[4] += 1;
+
+        // Adjust the middle markers if they are off their desired
+        // positions, parabolic if that keeps them in order, else linear.
+
+    for(int i=1; i<4; i++){
+        double d = np[i] - n[i];
+        if((d >= 1 && n[i+1] - n[i] > 1) || (d <= -1 && n[i-1] - n[i] < -1)){
+            int ds = d > 0 ? 1 : -1;
+            double qp = q[i] + (double)ds / (n[i+1] - n[i-1]) *
+                        ((n[i] - n[i-1] + ds) * (q[i+1] - q[i]) / (n[i+1] - n[i]) +
+                         (n[i+1] - n[i] - ds) * (q[i] - q[i-1]) / (n[i] - n[i-1]));
+            if(q[i-1] < qp && qp < q[i+1]){
+                q[i] = qp;
+            }
+            else {
+                q[i] += ds * (q[i+ds] - q[i]) / (n[i+ds] - n[i]);
+            }
+            n[i] += ds;
+        }
+    }
+}
+
+double CSVquery::aggStats::result(aggregate agg, double p){
+    switch (agg){
+        case aggMin:    return min;
+        case aggMax:    return max;
+        case aggStddev: return sqrt(m2 / count);
+        case aggPct:
+            if(count > 5){
+                return q[2];
+            }
+            else {
+                double pos = p * (count - 1);
+                int i = pos;
+                return (i + 1 < count) ? q[i] + (pos - i) * (q[i+1] - q[i]) : q[i];
+            }
+        default:        return mean;
+    }
+}
+
+bool CSVquery::complete(){
+    return _query == none || (_lastLine && ! _scan && _buffer.available() == 0);
+}
+
+//*****************************************************************************************
+//
+//      queryService SERVICE
+//
+//      handleQuery sets up the query and sends the response headers, then hands the
+//      client to this service, which produces the result a chunk at a time between
+//      AC cycles.  The web server is free to accept other requests while a query is 
+//      in progress, and up to QUERY_MAX_ACTIVE queries are served round-robin,
+//      one chunk each per turn, so a large export doesn't hold up a dashboard.
+//
+//      The response is written to the client directly in chunked transfer encoding.
+//      A chunk is only written when the client has room for all of it, so a slow
+//      client never blocks the service.  A client that takes nothing for 
+//      QUERY_TIMEOUT ms is dropped.
+//
+//*****************************************************************************************
+
+struct queryContext {
+        queryContext*   next;                   // -> next in round-robin list
+        CSVquery*       query;                  // -> query being served
+        WiFiClient      client;                 // Detached server client
+        uint8_t*        buf;                    // Chunk not yet written
+        uint16_t        len;                    // Bytes in buf
+        bool            done;                   // readResult has ended
+        uint32_t        lastSent;               // millis() of last write
+        queryContext():next(nullptr),query(nullptr),buf(nullptr),len(0),done(false),lastSent(millis()){}
+        ~queryContext(){
+            delete query;
+            delete[] buf;
+        }
+};
+
+static queryContext* queryList = nullptr;       // Active queries, next to run first
+static int queryCount = 0;                      // Number of active queries
+
+bool queryAvailable(){
+    return queryCount < QUERY_MAX_ACTIVE;
+}
+
+void queryStart(CSVquery* query, const String& contentType){
+    trace(T_CSVquery,80);
+    queryContext* ctx = new queryContext;
+    ctx->query = query;
+    ctx->client = server.client();
+    ctx->buf = new uint8_t[QUERY_CHUNK_SIZE];
+
+    String header(F("HTTP/1.1 200 OK\r\nContent-Type: "));
+    header += contentType;
+    header += F("\r\nTransfer-Encoding: chunked\r\nConnection: close\r\n");
+    String cursor = query->cursor();
+    if(cursor.length()){
+        header += F("X-IotaWatt-Cursor: ");
+        header += cursor;
+        header += "\r\n";
+    }
+    header += "\r\n";
+    ctx->client.write(header.c_str(), header.length());
+
+        // Add to end of list, start service if first.
+
+    queryContext** link = &queryList;
+    while(*link){
+        link = &(*link)->next;
+    }
+    *link = ctx;
+    if(queryCount++ == 0){
+        serviceBlock* sb = NewService(queryService, T_CSVquery);
+        sb->priority = priorityLow;
+    }
+}
+
+        // Advance one query by a chunk.
+        // Returns 1 if a chunk was written, 0 if waiting on the client,
+        // -1 if the query is finished or abandoned.
+
+static int queryStep(queryContext* ctx){
+    if( ! ctx->client.connected()){
+        trace(T_CSVquery,82);
+        return -1;
+    }
+    if(ctx->len == 0 && ! ctx->done){
+        trace(T_CSVquery,83);
+        ctx->len = ctx->query->readResult(ctx->buf, QUERY_CHUNK_SIZE);
+
+            // Nothing yet from a long group,
+            // working is not stalling.
+
+        if(ctx->len == 0 && ! ctx->query->complete()){
+            ctx->lastSent = millis();
+            return 1;
+        }
+        ctx->done = ctx->len == 0;
+    }
+    size_t needed = ctx->done ? 5 : ctx->len + 10;
+    if(ctx->client.availableForWrite() < needed){
+        if(millis() - ctx->lastSent > QUERY_TIMEOUT){
+            log("query: client stalled, query abandoned.");
+            ctx->client.stop();
+            return -1;
+        }
+        return 0;
+    }
+    trace(T_CSVquery,84);
+    if(ctx->done){
+        ctx->client.write("0\r\n\r\n", 5);
+        ctx->client.stop();
+        return -1;
+    }
+    char chunkSize[8];
+    int sizeLen = sprintf_P(chunkSize, PSTR("%x\r\n"), ctx->len);
+    ctx->client.write(chunkSize, sizeLen);
+    ctx->client.write(ctx->buf, ctx->len);
+    ctx->client.write("\r\n", 2);
+    ctx->len = 0;
+    ctx->lastSent = millis();
+    return 1;
+}
+
+uint32_t queryService(struct serviceBlock* _serviceBlock){
+    trace(T_CSVquery,81);
+    int waiting = 0;                            // Consecutive queries waiting on client
+    while(queryList){
+
+            // Take the query at the head of the list and
+            // move it to the end after one step.
+
+        queryContext* ctx = queryList;
+        queryList = ctx->next;
+        ctx->next = nullptr;
+        int result = queryStep(ctx);
+        if(result < 0){
+            trace(T_CSVquery,85);
+            delete ctx;
+            queryCount--;
+            continue;
+        }
+        queryContext** link = &queryList;
+        while(*link){
+            link = &(*link)->next;
+        }
+        *link = ctx;
+
+        waiting = result ? 0 : waiting + 1;
+        if(waiting >= queryCount){
+            return 10;
+        }
+        if((micros() + 2500) >= bingoTime){
+            return 1;
+        }
+    }
+    trace(T_CSVquery,86);
+    return 0;
+}
+
+        // Abandon all active queries before the configuration is changed.
+        // Their columns point to the output and integration Scripts
+        // that are about to be deleted. Each query is deleted now and its
+        // client closed, so queryService drops the context when it next runs.
+
+void queryAbortAll(){
+    for(queryContext* ctx = queryList; ctx; ctx = ctx->next){
+        trace(T_CSVquery,87);
+        delete ctx->query;
+        ctx->query = nullptr;
+        ctx->client.stop();
+    }
+    if(queryCount){
+        log("query: configuration changed, %d queries abandoned.", queryCount);
+    }
+}
+
+//*****************************************************************************************
+//
+//      Query result cache
+//
+//      Dashboards poll the same query repeatedly, and all but the last few groups are
+//      the same as last time.  Completed groups (those ending before the end of the 
+//      query and at or before the last datalog entry) are saved as their output text
+//      along with the group boundaries, keyed by the select list, group and format.
+//      A later query with the same key that begins at one of the saved groups 
+//      is served the saved text up to the end of the saved groups, and then 
+//      resumes from the log, adding new completed groups as it goes.
+//      
+//      The cache is cleared when the configuration is changed or an integration
+//      is synchronized.
+//
+//      Each saved group is a cacheRow followed by len bytes of text.
+//      A group that was skipped (missing=skip) has len zero.
+//
+//*****************************************************************************************
+
+static queryCacheEntry* queryCache[QUERY_CACHE_ENTRIES] = {nullptr};
+
+static struct {
+        uint32_t    hits;                       // Queries served in part from cache
+        uint32_t    misses;                     // Queries not found in cache
+        uint32_t    rows;                       // Groups served from cache
+} queryCacheStats = {0, 0, 0};
+
+void queryCacheClear(){
+    for(int i=0; i<QUERY_CACHE_ENTRIES; i++){
+        queryCacheEntry* entry = queryCache[i];
+        if(entry && entry->busy){
+            entry->key = "";
+            entry->used = 0;
+            entry->endKey = 0;
+        }
+        else {
+            delete entry;
+            queryCache[i] = nullptr;
+        }
+    }
+}
+
+void queryCacheStatus(JsonObject& status){
+    uint32_t bytes = 0;
+    for(int i=0; i<QUERY_CACHE_ENTRIES; i++){
+        if(queryCache[i]){
+            bytes += queryCache[i]->used;
+        }
+    }
+    status.set(F("hits"), queryCacheStats.hits);
+    status.set(F("misses"), queryCacheStats.misses);
+    status.set(F("rows"), queryCacheStats.rows);
+    status.set(F("bytes"), bytes);
+}
+
+void CSVquery::cacheLookup(){
+    trace(T_CSVquery,70);
+    String key = queryKey();
+
+    int slot = -1;
+    for(int i=0; i<QUERY_CACHE_ENTRIES; i++){
+        queryCacheEntry* entry = queryCache[i];
+        if( ! entry){
+            if(slot < 0 || queryCache[slot]) slot = i;
+            continue;
+        }
+        if(entry->busy){
+            continue;
+        }
+        if(entry->key == key){
+
+                // Find the group beginning the query and
+                // discard those before it.
+
+            cacheRow row;
+            uint16_t pos = 0;
+            while(pos < entry->used){
+                memcpy(&row, entry->rows + pos, sizeof(row));
+                if(row.begin >= _begin) break;
+                pos += sizeof(row) + row.len;
+            }
+            slot = i;
+            if(pos < entry->used && row.begin == _begin){
+                memmove(entry->rows, entry->rows + pos, entry->used - pos);
+                entry->used -= pos;
+                entry->busy = true;
+                entry->lastUsed = millis();
+                _cache = entry;
+                _cachePos = 0;
+                queryCacheStats.hits++;
+                return;
+            }
+            break;
+        }
+        if(slot < 0 || (queryCache[slot] && entry->lastUsed < queryCache[slot]->lastUsed)){
+            slot = i;
+        }
+    }
+
+        // Miss. Start a new entry in an unused or least recently used slot.
+
+    queryCacheStats.misses++;
+    if(slot < 0){
+        return;
+    }
+    if( ! queryCache[slot]){
+        queryCache[slot] = new queryCacheEntry;
+    }
+    _cache = queryCache[slot];
+    _cache->key = key;
+    _cache->used = 0;
+    _cache->endKey = _begin;
+    _cache->busy = true;
+    _cache->lastUsed = millis();
+    _cachePos = 0;
+}
+
+bool CSVquery::cacheServe(){
+    if(_cachePos >= _cache->used){
+        return false;
+    }
+    cacheRow row;
+    memcpy(&row, _cache->rows + _cachePos, sizeof(row));
+    if(row.begin != _newRec->UNIXtime || row.end > _end){
+        _cachePos = _cache->used;
+        return false;
+    }
+    _cachePos += sizeof(row);
+    if(row.len){
+        if( ! _firstLine && _format != formatBin){
+            _buffer.print(_format == formatJson ? "," : "\r\n");
+        }
+        _buffer.write(_cache->rows + _cachePos, row.len);
+        _limit--;
+        _firstLine = false;
+    }
+    _cachePos += row.len;
+    _newRec->UNIXtime = row.end;
+    _reread = true;
+    queryCacheStats.rows++;
+    return true;
+}
+
+        // Add the group just generated, which is in _buffer
+        // after the separator, if it is complete and follows 
+        // the last group in the cache. When the cache is full,
+        // the earlier groups are kept.
+
+void CSVquery::cacheAppend(size_t sepLen){
+    if(_cache->endKey != _oldRec->UNIXtime || _lastLine ||
+       _newRec->UNIXtime >= _end || _newRec->UNIXtime > Current_log.lastKey()){
+        return;
+    }
+    size_t len = _buffer.available();
+    if(_cache->used + sizeof(cacheRow) + len > QUERY_CACHE_SIZE){
+        return;
+    }
+    len -= sepLen;
+    cacheRow row;
+    row.begin = _oldRec->UNIXtime;
+    row.end = _newRec->UNIXtime;
+    row.len = len;
+    char* text = _cache->rows + _cache->used + sizeof(row);
+    if(len){
+        _buffer.peek((uint8_t*)text, sepLen + len);
+        memmove(text, text + sepLen, len);
     }
+    memcpy(_cache->rows + _cache->used, &row, sizeof(row));
+    _cache->used += sizeof(row) + len;
+    _cache->endKey = row.end;
+    _cachePos = _cache->used;
 }
 
 time_t  CSVquery::nextGroup(time_t time, tUnits units, int32_t inc){
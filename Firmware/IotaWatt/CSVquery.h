@@ -2,6 +2,23 @@
 
 #include "IotaWatt.h"
 
+#define QUERY_CACHE_ENTRIES 2           // Number of queries with cached results
+#define QUERY_CACHE_SIZE 3072           // Bytes of cached rows per query
+#define QUERY_MAX_ACTIVE 2              // Queries served concurrently by queryService
+#define QUERY_CHUNK_SIZE 1440           // Bytes of result per response chunk
+#define QUERY_TIMEOUT 30000             // ms client can stall before query is dropped
+#define QUERY_SCAN_BATCH 4              // Record pairs evaluated together in aggregate scans
+
+struct queryCacheEntry;
+void queryCacheClear();
+void queryCacheStatus(JsonObject&);
+
+class CSVquery;
+bool queryAvailable();
+void queryStart(CSVquery* query, const String& contentType);
+uint32_t queryService(struct serviceBlock*);
+void queryAbortAll();
+
 class  CSVquery {
 
     public:
@@ -11,7 +28,10 @@ class  CSVquery {
         size_t  readResult(uint8_t* buf, int len);
         bool    isJson();
         bool    isCSV();
+        bool    isBinary();
         String  failReason();
+        String  cursor();
+        bool    complete();
 
     private:
 
@@ -37,11 +57,32 @@ class  CSVquery {
                             tUnitsYears};
 
         enum        format {formatJson,         // Output format
-                            formatCSV}; 
+                            formatCSV,
+                            formatBin}; 
 
         enum        tformat {iso,
                              unix};
 
+        enum        aggregate {aggAvg,          // Column aggregate over group
+                               aggMin,          // Average is from the group boundary records,
+                               aggMax,          // the others scan the log within the group.
+                               aggStddev,
+                               aggPct};
+
+        struct aggStats {                       // Running statistics of a scanned group
+                    uint32_t count;             // Intervals with data
+                    double  min;
+                    double  max;
+                    double  mean;               // Welford running mean
+                    double  m2;                 // and sum of squared differences
+                    double  q[5];               // P-square marker heights
+                    int32_t n[5];               // P-square marker positions
+                    double  np[5];              // P-square desired positions
+                    void    reset();
+                    void    add(double value, double p);
+                    double  result(aggregate agg, double p);
+                    };
+
         IotaLogRecord*  _oldRec;                // -> aged logRecord
         IotaLogRecord*  _newRec;                // -> new logRecord
         xbuf            _buffer;                // work buffer to build response lines
@@ -53,7 +94,8 @@ class  CSVquery {
         uint32_t    _groupMult;                 // Group unit muliplier as in 7d
         tUnits      _groupUnits;                // Basic group time unit
         tformat     _timeFormat;                // Time output format
-        format      _format;                    // Output format (Json or CSV)
+        format      _format;                    // Output format (Json, CSV or binary)
+        uint8_t     _binSize;                   // Size of binary values (float or double)
         struct tm*  _tm;                        // -> external tm struct
         query       _query;                     // Type of query 
         bool        _header;                    // True if header = yes
@@ -65,6 +107,16 @@ class  CSVquery {
         bool        _missingNull;               // Produce null values when no data
         bool        _missingZero;               // Produce zero values when no data
         bool        _timeOnly;                  // Query is for time only, no data needed    
+        bool        _cursor;                    // Cursor mode, complete groups only
+        uint32_t    _queryHash;                 // Hash of queryKey()
+        bool        _reread;                    // _newRec key advanced by cache, needs to be read
+        queryCacheEntry* _cache;                // -> cache entry owned by this query
+        uint16_t    _cachePos;                  // Offset of next cached row to serve
+        bool        _aggregates;                // Some column needs a scan of each group
+        IotaLogScan* _scan;                     // -> scan of current group
+        IotaLogRecord** _batch;                 // -> consecutive records with data, for runBatch
+        int         _batchCount;                // Records in _batch
+        double*     _batchWork;                 // runBatch results and work area
 
         struct column {                         // Output column descriptor - built lifo then made fifo    
                     column* next;               // -> next in chain
@@ -77,6 +129,9 @@ class  CSVquery {
                     int8_t  decimals;           // Overide decimal positions    
                     bool    timeLocal;          // output local time if source=='T'
                     bool    delta;              // Output change in value;
+                    aggregate agg;              // Group aggregate
+                    uint8_t pct;                // Percentile if aggPct
+                    aggStats* stats;            // -> statistics if scanned aggregate
                     Script* script;             // -> Script
                     int32_t input;              // input number if source=='I'
                     column()
@@ -85,6 +140,9 @@ class  CSVquery {
                         ,source(' ')
                         ,timeLocal(true)
                         ,delta(false)
+                        ,agg(aggAvg)
+                        ,pct(0)
+                        ,stats(nullptr)
                         ,script(nullptr)
                         ,decimals(1)
                         ,input(0)
@@ -93,6 +151,7 @@ class  CSVquery {
                         if(source == 'I'){
                             delete script;
                         }
+                        delete stats;
                         delete next;}
                     };
 
@@ -101,7 +160,19 @@ class  CSVquery {
                 // Private functions
 
         void        buildHeader();
+        void        buildBinHeader();
         void        buildLine();
+        void        groupLine();
+        void        startScan();
+        bool        scanGroup();
+        void        scanBatch();
+        String      columnName(column* col);
+        String      queryKey();
+        bool        parseCursor(String arg);
+        uint32_t    lastCompleteGroup(uint32_t limit);
+        void        cacheLookup();
+        bool        cacheServe();
+        void        cacheAppend(size_t sepLen);
         void        printValue(const double value, const int8_t decimals);
         time_t      nextGroup(time_t time, tUnits units, int32_t mult);
         time_t      parseTimeArg(String timeArg);
@@ -9,6 +9,7 @@ uint32_t emoncms_uploader::handle_query_s(){
     endpoint += _node;
     _encrypted = false;
     HTTPPost(endpoint.c_str(), checkQuery_s, "application/x-www-form-urlencoded");
+    _response = new emoncmsQueryParser;
     return 1;
 }
 
@@ -22,8 +23,8 @@ uint32_t emoncms_uploader::handle_checkQuery_s(){
         delay(5, query_s);
         return 15;
     }
-    String response = _request->responseText();
-    if (response.startsWith("\"Node does not exist\"")){
+    emoncmsQueryParser* parser = (emoncmsQueryParser*)_response;
+    if(parser && parser->nodeMissing()){
         trace(T_Emoncms,31);
         log("%s: No existing inputs found for node %s.", _id, _node);
         _lastSent = Current_log.lastKey();
@@ -37,12 +38,9 @@ uint32_t emoncms_uploader::handle_checkQuery_s(){
 
     else {
         trace(T_Emoncms,32);
-        int pos = 0;
         _lastSent = _uploadStartDate;
-        while((pos = response.indexOf("\"time\":", pos)) > 0) {      
-            pos += 7;
-            uint32_t _time = (uint32_t)response.substring(pos, response.indexOf(',',pos)).toInt();
-            _lastSent = MAX(_lastSent, _time);
+        if(parser){
+            _lastSent = MAX(_lastSent, parser->lastTime());
         }
     }
     _lastSent = MAX(_lastSent, Current_log.firstKey());
@@ -52,6 +50,63 @@ uint32_t emoncms_uploader::handle_checkQuery_s(){
     return 1;
 }
 
+/*****************************************************************************************
+ *          emoncmsQueryParser
+ * **************************************************************************************/
+static const char emoncmsNodeMissing_P[] PROGMEM = "\"Node does not exist\"";
+static const char emoncmsTime_P[] PROGMEM = "\"time\":";
+
+emoncmsQueryParser::emoncmsQueryParser()
+    :_message(0)
+    ,_match(0)
+    ,_number(false)
+    ,_time(0)
+    ,_lastTime(0)
+{}
+
+bool emoncmsQueryParser::nodeMissing(){
+    return _message != 0xFF && pgm_read_byte(emoncmsNodeMissing_P + _message) == 0;
+}
+
+    // "time": is matched with a simple match that restarts on the first character,
+    // which is sufficient as it doesn't repeat a prefix.  The value after it is
+    // accumulated across calls, and a key "time": that isn't followed by a
+    // number (an input named time) is skipped.
+
+void emoncmsQueryParser::parse(const char* data, size_t len){
+    for(size_t i=0; i<len; i++){
+        char c = data[i];
+        if(_message != 0xFF && pgm_read_byte(emoncmsNodeMissing_P + _message)){
+            _message = (c == pgm_read_byte(emoncmsNodeMissing_P + _message)) ? _message + 1 : 0xFF;
+        }
+        if(_number){
+            if(isdigit(c)){
+                _time = _time * 10 + (c - '0');
+                continue;
+            }
+            end();
+        }
+        char t = pgm_read_byte(emoncmsTime_P + _match);
+        if(c == t){
+            if(pgm_read_byte(emoncmsTime_P + ++_match) == 0){
+                _match = 0;
+                _number = true;
+                _time = 0;
+            }
+        }
+        else {
+            _match = (c == '"') ? 1 : 0;
+        }
+    }
+}
+
+void emoncmsQueryParser::end(){
+    if(_number){
+        _lastTime = MAX(_lastTime, _time);
+        _number = false;
+    }
+}
+
 /*****************************************************************************************
  *          handle_write_s())
  * **************************************************************************************/
@@ -73,33 +128,28 @@ uint32_t emoncms_uploader::handle_write_s(){
         return UTCtime() + 1;
     }
 
-    // If datalog buffers not allocated, do so now and prime latest.
+    // If datalog scan not started, do so now and prime latest.
 
     trace(T_Emoncms,60);
-    if(! oldRecord){
+    if(! _scan){
         trace(T_Emoncms,61);
-        oldRecord = new IotaLogRecord;
-        newRecord = new IotaLogRecord;
-        newRecord->UNIXtime = _lastSent + _interval;
-        Current_log.readKey(newRecord);
+        _scan = new uploadFeed(_lastSent + _interval, _interval);
     }
 
     // Build post transaction from datalog records.
 
-    while(reqData.available() < uploaderBufferLimit && newRecord->UNIXtime < Current_log.lastKey()){
+    while(reqData.available() < _batchLimit && _scan->key() < Current_log.lastKey()){
 
         if(micros() > bingoTime){
             return 15;
         }
 
-        // Swap newRecord top oldRecord, read next into newRecord.
+        // Advance the scan to the next pair of records.
 
         trace(T_Emoncms,60);
-        IotaLogRecord *swap = oldRecord;
-        oldRecord = newRecord;
-        newRecord = swap;
-        newRecord->UNIXtime = oldRecord->UNIXtime + _interval;
-        Current_log.readKey(newRecord);
+        _scan->next();
+        IotaLogRecord *oldRecord = _scan->oldRec();
+        IotaLogRecord *newRecord = _scan->newRec();
 
         // Compute the time difference between log entries.
         // If zero, don't bother.
@@ -135,39 +185,23 @@ uint32_t emoncms_uploader::handle_write_s(){
                 if( ! _input || value1 != value1){
                     reqData.write(",null");
                 }
-                else if(_input->_type == channelTypeVoltage){
-                    reqData.printf(",%.1f", value1);
-                }
-                else if(_input->_type == channelTypePower){
-                    reqData.printf(",%.1f", value1);
-                }
-                else{
-                    reqData.printf(",%.0f", value1);
+                else {
+                    reqData.write(',');
+                    printFixed(reqData, value1, (_input->_type == channelTypeVoltage || _input->_type == channelTypePower) ? 1 : 0);
                 }
             }
         }
         else {
             trace(T_Emoncms,64);
+            ScriptContext context(oldRecord, newRecord);
             Script* script = _outputs->first();
             int index=1;
             while(script){
                 while(index++ < String(script->name()).toInt()) reqData.write(",null");
-                double value1 = script->run(oldRecord, newRecord);
+                double value1 = script->run(&context);
                 if(value1 == value1){
-                    if(script->precision()){
-                        char valstr[20];
-                        int end = sprintf(valstr,",%.*f", script->precision(), value1);
-                        while(valstr[--end] == '0'){
-                            valstr[end] = 0;
-                        }
-                        if(valstr[end] == '.'){
-                            valstr[end] = 0;
-                        }
-                        reqData.write(valstr);
-                    }
-                    else {
-                        reqData.printf(",%.*f", script->precision(), value1);
-                    }
+                    reqData.write(',');
+                    printFixed(reqData, value1, script->precision(), true);
                 } else {
                     reqData.write(",null");
                 }
@@ -178,20 +212,19 @@ uint32_t emoncms_uploader::handle_write_s(){
         reqData.write(']');
     }
     reqData.write(']');
-    _lastPost = oldRecord->UNIXtime;
+    _lastPost = _scan->oldRec()->UNIXtime;
 
-    // Free the buffers
+    // Free the scan
 
-    delete oldRecord;
-    oldRecord = nullptr;
-    delete newRecord;
-    newRecord = nullptr;
+    delete _scan;
+    _scan = nullptr;
 
     // if not encrypted protocol, send plaintext payload.
 
     if(!_encrypt){
         _encrypted = false;
         HTTPPost("/input/bulk", checkWrite_s, "application/x-www-form-urlencoded");
+        _response = new headParser(81);
         return 1;
     }
 
@@ -204,61 +237,21 @@ uint32_t emoncms_uploader::handle_write_s(){
         iv[i] = random(256);
     }
 
-        // Initialize sha256, shaHMAC and cypher
+        // Hash, encrypt and base64 encode the payload in one pass.
+        // The encoded payload is appended as the plaintext is consumed.
 
-    trace(T_Emoncms, 70);  
-    SHA256* sha256 = new SHA256;
-    sha256->reset();
-    SHA256* shaHMAC = new SHA256;
-    shaHMAC->resetHMAC(_cryptoKey,16);
-    CBC<AES128>* cypher = new CBC<AES128>;
-    cypher->setIV(iv, 16);
-    cypher->setKey(_cryptoKey, 16);
-
-    // Process payload while
-    // updating SHAs and encrypting. 
-
-    trace(T_Emoncms,70);     
-    uint8_t* temp = new uint8_t[64+16];
-    size_t supply = reqData.available();
-    reqData.write(iv, 16);
-    while(supply){
-        size_t len = supply < 64 ? supply : 64;
-        reqData.read(temp, len);
-        supply -= len;
-        sha256->update(temp, len);
-        shaHMAC->update(temp, len);
-        if(len < 64 || supply == 0){
-            size_t padlen = 16 - (len % 16);
-            for(int i=0; i<padlen; i++){
-                temp[len+i] = padlen;
-            }
-            len += padlen;
-        }
-        cypher->encrypt(temp, temp, len);
-        reqData.write(temp, len);
-    }
     trace(T_Emoncms,70);
-    delete[] temp;
-    delete cypher;
-    
-    // finalize the Sha256 and shaHMAC
-
-    trace(T_Emoncms,71); 
-    sha256->finalize(_sha256, 32);
+    uint8_t hash[32];
+    size_t supply = reqData.available();
+    _crypto->begin(reqData, iv);
+    _crypto->encode(reqData, reqData, supply);
+    _crypto->finish(reqData, hash, _sha256);
     delete[] _base64Sha;
-    _base64Sha = charstar(base64encode(_sha256, 32).c_str());
-    shaHMAC->finalizeHMAC(_cryptoKey, 16, _sha256, 32);
-    delete sha256;
-    delete shaHMAC;
-
-    // Now base64 encode and send
-
-    trace(T_Emoncms,71); 
-    base64encode(&reqData); 
+    _base64Sha = charstar(base64encode(hash, 32).c_str());
     trace(T_Emoncms,71);
     _encrypted = true;
     HTTPPost("/input/bulk", checkWrite_s, "aes128cbc");
+    _response = new headParser(81);
     return 1;
 }
 
@@ -275,16 +268,16 @@ uint32_t emoncms_uploader::handle_checkWrite_s(){
     if(_request->responseHTTPcode() == 200){
         delete[] _statusMessage;
         _statusMessage = nullptr;
-        String response = _request->responseText();
-        if((!_encrypted && response.startsWith("ok")) || (_encrypted && response.startsWith(_base64Sha))){
-            _lastSent = _lastPost; 
+        const char* response = _response ? ((headParser*)_response)->text() : "";
+        if((!_encrypted && strncmp(response, "ok", 2) == 0) || (_encrypted && _base64Sha && strncmp(response, _base64Sha, strlen(_base64Sha)) == 0)){
+            _lastSent = _lastPost;
+            writeCheckpoint();
             _state = write_s;
             trace(T_Emoncms,93);
             return 1;
         }
-        Serial.println(response.substring(0, 80));
-        String msg = "Invalid response: " + response.substring(0, 80);
-        _statusMessage = charstar(msg.c_str());
+        Serial.println(response);
+        _statusMessage = charstar(F("Invalid response: "), response);
     }
     
     // Deal with failure.
@@ -349,6 +342,8 @@ bool emoncms_uploader::configCB(JsonObject& config){
     }
     delete[] _userID;
     _userID = charstar(config["userid"].as<char*>());
+    delete _crypto;
+    _crypto = nullptr;
     if(!_userID || strlen(_userID) == 0){
         _encrypt = false;
         delete[] _sha256;
@@ -356,7 +351,10 @@ bool emoncms_uploader::configCB(JsonObject& config){
     }
     else {
         _encrypt = true;
-        _sha256 = new uint8_t[32];
+        if( ! _sha256){
+            _sha256 = new uint8_t[32];
+        }
+        _crypto = new encryptEncoder(_cryptoKey);
     }
     trace(T_Emoncms,101);
     Script* script = _outputs->first();
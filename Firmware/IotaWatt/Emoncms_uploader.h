@@ -2,9 +2,32 @@
 #define emoncms_uploader_h
 
 #include "IotaWatt.h"
+#include "encryptEncoder.h"
 
 extern uint32_t emoncms_dispatch(struct serviceBlock *serviceBlock);
 
+        // Scans the input/get response for the latest "time": value,
+        // or the "Node does not exist" message.
+
+class emoncmsQueryParser : public responseParser
+{
+    public:
+        emoncmsQueryParser();
+        bool        nodeMissing();                  // Response is the "Node does not exist" message
+        uint32_t    lastTime(){return _lastTime;};  // Latest input time, 0 if none
+        void        end();
+
+    protected:
+        void        parse(const char* data, size_t len);
+
+    private:
+        uint8_t     _message;                       // Characters of the message matched, 0xFF if not
+        uint8_t     _match;                         // Characters of "time": matched
+        bool        _number;                        // Reading a time value
+        uint32_t    _time;
+        uint32_t    _lastTime;
+};
+
 class emoncms_uploader : public uploader 
 {
     public:
@@ -12,6 +35,7 @@ class emoncms_uploader : public uploader
                             _userID(0),
                             _sha256(0),
                             _base64Sha(0),
+                            _crypto(0),
                             _revision(0),
                             _encrypt(false),
                             _encrypted(false)
@@ -20,7 +44,7 @@ class emoncms_uploader : public uploader
         };
 
         ~emoncms_uploader(){
-            
+            delete _crypto;
             Emoncms = nullptr;
         };
 
@@ -32,6 +56,7 @@ class emoncms_uploader : public uploader
         char *_userID;
         uint8_t *_sha256;
         char *_base64Sha;
+        encryptEncoder *_crypto;
         uint8_t _cryptoKey[16];
         int _revision;
         bool _encrypt;
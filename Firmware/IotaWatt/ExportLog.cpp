@@ -0,0 +1,350 @@
+#include "IotaWatt.h"
+
+/***************************************************************************************************
+ *  exportLog SERVICE.
+ *
+ *  GET /export streams a range of the History_log (or Current_log) as binary records, read from
+ *  the SD in blocks and written to the client with no formatting. It's intended for bulk backup
+ *  and for external analysis that would otherwise need thousands of /query requests.
+ *
+ *  handleExport validates the request, resolves begin and end to a range of serials, and sends
+ *  the headers with an exact Content-Length. As with queryService, the client is then detached
+ *  from the web server and the body is sent by this SERVICE, one buffer per export per turn,
+ *  while there is time before bingoTime. The web server stays available to other requests,
+ *  and up to EXPORT_MAX_ACTIVE exports are served round-robin.
+ *
+ *  Because the length and content of a range of serials is fixed, the response supports
+ *  single "Range: bytes=" requests so an interrupted download can be resumed.
+ *
+ *  Parameters:
+ *
+ *  log=history|current   Which log to export (default history).
+ *  begin=UNIXtime        First record is the entry at or preceding begin (default first entry).
+ *  end=UNIXtime          Last record is the entry at or preceding end (default last entry).
+ *  channels=list         Datalog projection. Comma separated input channel numbers or names.
+ *                        Each record is then UNIXtime, serial, logHours followed by
+ *                        accum1, accum2 for each channel in the order listed.
+ *                        Without channels, records are exported as they are in the log.
+ *
+ *  The format is documented in Docs/query.rst.
+ **************************************************************************************************/
+
+#define EXPORT_BUFFER_SIZE 1440           // Bytes written to client per write
+#define EXPORT_TIMEOUT 30000              // ms client can stall before export is dropped
+#define EXPORT_MAX_ACTIVE 2               // Exports served concurrently by exportLog
+
+struct exportContext {
+      exportContext* next;                // -> next in round-robin list
+      WiFiClient client;                  // Detached server client
+      IotaLog*  iotaLog;                  // Log being exported
+      int32_t   serial;                   // Next serial to read
+      int32_t   endSerial;                // Last serial to export
+      uint32_t  recPos;                   // Bytes of current record already sent (Range skip)
+      uint32_t  remaining;                // Bytes remaining to send
+      uint32_t  lastSent;                 // millis() of last write to client
+      uint8_t*  block;                    // Records read from log
+      int       blockCount;               // Records in block
+      int       blockIndex;               // Current record in block
+      uint8_t*  proj;                     // Projected record
+      char*     buf;                      // Output buffer
+      uint16_t  bufPos;
+      uint8_t   channels;                 // Number of projected channels (0 = raw)
+      uint8_t   channel[MAXINPUTS];       // Projected channel numbers
+      exportContext()
+      :next(nullptr), iotaLog(nullptr), serial(0), endSerial(-1), recPos(0), remaining(0), lastSent(0)
+      ,block(nullptr), blockCount(0), blockIndex(0), proj(nullptr), buf(nullptr), bufPos(0), channels(0){};
+      ~exportContext(){
+        delete[] block;
+        delete[] proj;
+        delete[] buf;
+      }
+    };
+
+static exportContext* exportList = nullptr;     // Active exports, next to run first
+static int exportCount = 0;                     // Number of active exports
+
+static uint32_t exportRecordSize(exportContext* ctx){
+  if(ctx->channels){
+    return sizeof(IotaLogKey) + sizeof(double) + ctx->channels * 2 * sizeof(double);
+  }
+  return ctx->iotaLog->recordSize();
+}
+
+static bool exportParseChannels(exportContext* ctx, String list){
+  int pos = 0;
+  while(pos < list.length()){
+    int comma = list.indexOf(',', pos);
+    if(comma < 0) comma = list.length();
+    String item = list.substring(pos, comma);
+    item.trim();
+    pos = comma + 1;
+    int channel = -1;
+    if(item.length() && item[0] >= '0' && item[0] <= '9'){
+      channel = item.toInt();
+    }
+    else {
+      for(int i=0; i<maxInputs; i++){
+        if(inputChannel[i] && inputChannel[i]->_name && item.equals(inputChannel[i]->_name)){
+          channel = i;
+          break;
+        }
+      }
+    }
+    if(channel < 0 || channel >= MAXINPUTS || ctx->channels >= MAXINPUTS){
+      return false;
+    }
+    ctx->channel[ctx->channels++] = channel;
+  }
+  return ctx->channels > 0;
+}
+
+    // Parse a single "bytes=first-last" or "bytes=-suffix" range.
+    // Returns false if there is no usable range, in which case
+    // the whole entity is sent.
+
+static bool exportParseRange(String range, uint32_t length, uint32_t* first, uint32_t* last){
+  if( ! range.startsWith(F("bytes=")) || range.indexOf(',') >= 0){
+    return false;
+  }
+  int dash = range.indexOf('-');
+  if(dash < 0) return false;
+  String low = range.substring(6, dash);
+  String high = range.substring(dash + 1);
+  low.trim();
+  high.trim();
+  if(low.length() == 0){
+    uint32_t suffix = high.toInt();
+    *first = suffix >= length ? 0 : length - suffix;
+    *last = length - 1;
+    return high.length() > 0;
+  }
+  *first = low.toInt();
+  *last = high.length() ? MIN((uint32_t)high.toInt(), length - 1) : length - 1;
+  return true;
+}
+
+void handleExport(){
+  trace(T_EXPORTLOG,1);
+  if(exportCount >= EXPORT_MAX_ACTIVE){
+    server.sendHeader(F("Retry-After"), F("5"));
+    server.send(503, "text/plain", "Too many exports in progress");
+    return;
+  }
+  exportContext* ctx = new exportContext;
+  ctx->iotaLog = &History_log;
+  if(server.hasArg(F("log")) && server.arg(F("log")) == F("current")){
+    ctx->iotaLog = &Current_log;
+  }
+  IotaLog* logFile = ctx->iotaLog;
+  if( ! logFile->isOpen() || logFile->fileSize() == 0){
+    delete ctx;
+    server.send(404, "text/plain", "Log not available");
+    return;
+  }
+  if(server.hasArg(F("channels"))){
+    if(logFile->recordSize() != sizeof(IotaLogRecord) || ! exportParseChannels(ctx, server.arg(F("channels")))){
+      delete ctx;
+      server.send(400, "text/plain", "Invalid channels");
+      return;
+    }
+  }
+
+      // Resolve begin and end to serials.
+
+  uint32_t begin = server.hasArg(F("begin")) ? server.arg(F("begin")).toInt() : logFile->firstKey();
+  uint32_t end = server.hasArg(F("end")) ? server.arg(F("end")).toInt() : logFile->lastKey();
+  if(begin == 0 || end < begin){
+    delete ctx;
+    server.send(400, "text/plain", "Invalid begin or end");
+    return;
+  }
+  begin = MAX(begin, logFile->firstKey());
+  end = MIN(end, logFile->lastKey());
+  if(end < begin){
+    delete ctx;
+    server.send(416, "text/plain", "No records in range");
+    return;
+  }
+  IotaLogRecord* record = new IotaLogRecord;
+  record->UNIXtime = begin;
+  logFile->readKey(record);
+  ctx->serial = record->serial;
+  record->UNIXtime = end;
+  logFile->readKey(record);
+  ctx->endSerial = record->serial;
+  delete record;
+
+      // Apply any Range.
+
+  uint32_t recordSize = exportRecordSize(ctx);
+  uint32_t length = (ctx->endSerial - ctx->serial + 1) * recordSize;
+  uint32_t first = 0;
+  uint32_t last = length - 1;
+  String header;
+  if(server.hasHeader(F("Range")) && exportParseRange(server.header(F("Range")), length, &first, &last)){
+    if(first > last || first >= length){
+      delete ctx;
+      server.sendHeader(F("Content-Range"), String(F("bytes */")) + String(length));
+      server.send(416, "text/plain", "");
+      return;
+    }
+    char range[48];
+    sprintf_P(range, PSTR("bytes %u-%u/%u"), first, last, length);
+    header = F("HTTP/1.1 206 Partial Content\r\nContent-Range: ");
+    header += range;
+    header += "\r\n";
+  }
+  else {
+    header = F("HTTP/1.1 200 OK\r\n");
+  }
+  ctx->serial += first / recordSize;
+  ctx->recPos = first % recordSize;
+  ctx->remaining = last - first + 1;
+
+  ctx->block = new uint8_t[EXPORT_BUFFER_SIZE];
+  ctx->buf = new char[EXPORT_BUFFER_SIZE];
+  if(ctx->channels){
+    ctx->proj = new uint8_t[recordSize];
+  }
+  ctx->lastSent = millis();
+
+  header += F("Content-Type: application/octet-stream\r\nContent-Length: ");
+  header += String(ctx->remaining);
+  header += F("\r\nAccept-Ranges: bytes\r\nX-IotaWatt-RecordSize: ");
+  header += String(recordSize);
+  header += F("\r\nConnection: close\r\n\r\n");
+  ctx->client = server.client();
+  ctx->client.write(header.c_str(), header.length());
+
+      // Add to end of list, start service if first.
+
+  exportContext** link = &exportList;
+  while(*link){
+    link = &(*link)->next;
+  }
+  *link = ctx;
+  if(exportCount++ == 0){
+    serviceBlock* sb = NewService(exportLog, T_EXPORTLOG);
+    sb->priority = priorityLow;
+  }
+}
+
+      // Advance one export by at most a buffer.
+      // Returns 1 if a buffer was written, 0 if waiting on the client,
+      // -1 if the export is finished or abandoned.
+
+static int exportStep(exportContext* ctx){
+  IotaLog* logFile = ctx->iotaLog;
+  uint32_t recordSize = exportRecordSize(ctx);
+  int maxRecords = MAX(1, EXPORT_BUFFER_SIZE / logFile->recordSize());
+
+  while(ctx->client.connected()){
+
+        // Write a full buffer, or the last partial one, when the client can take it.
+
+    if(ctx->bufPos == EXPORT_BUFFER_SIZE || (ctx->bufPos && ctx->remaining == 0)){
+      if(ctx->client.availableForWrite() < ctx->bufPos){
+        if(millis() - ctx->lastSent > EXPORT_TIMEOUT){
+          log("exportLog: client stalled, export abandoned.");
+          break;
+        }
+        return 0;
+      }
+      trace(T_EXPORTLOG,5);
+      if(ctx->client.write(ctx->buf, ctx->bufPos) != ctx->bufPos){
+        log("exportLog: write failed, export abandoned.");
+        break;
+      }
+      ctx->lastSent = millis();
+      ctx->bufPos = 0;
+      return 1;
+    }
+
+    else if(ctx->remaining == 0){
+      break;
+    }
+
+        // Read the next block of records.
+
+    else if(ctx->blockIndex >= ctx->blockCount){
+      ctx->blockCount = logFile->readBlock(ctx->block, ctx->serial, MIN(maxRecords, ctx->endSerial - ctx->serial + 1));
+      if(ctx->blockCount == 0){
+        log("exportLog: Serial %d no longer in log, export ended.", ctx->serial);
+        break;
+      }
+      trace(T_EXPORTLOG,3);
+      ctx->serial += ctx->blockCount;
+      ctx->blockIndex = 0;
+    }
+
+        // Copy as much of the current record, or its projection,
+        // as fits in the output buffer.
+
+    else {
+      uint8_t* rec = ctx->block + ctx->blockIndex * logFile->recordSize();
+      if(ctx->channels){
+        IotaLogRecord* logRec = (IotaLogRecord*)rec;
+        uint8_t* proj = ctx->proj;
+        memcpy(proj, rec, sizeof(IotaLogKey) + sizeof(double));
+        proj += sizeof(IotaLogKey) + sizeof(double);
+        for(int j=0; j<ctx->channels; j++){
+          memcpy(proj, &logRec->accum1[ctx->channel[j]], sizeof(double));
+          proj += sizeof(double);
+          memcpy(proj, &logRec->accum2[ctx->channel[j]], sizeof(double));
+          proj += sizeof(double);
+        }
+        rec = ctx->proj;
+      }
+      uint32_t len = MIN(recordSize - ctx->recPos, EXPORT_BUFFER_SIZE - ctx->bufPos);
+      len = MIN(len, ctx->remaining);
+      memcpy(ctx->buf + ctx->bufPos, rec + ctx->recPos, len);
+      ctx->bufPos += len;
+      ctx->remaining -= len;
+      ctx->recPos += len;
+      if(ctx->recPos == recordSize){
+        ctx->recPos = 0;
+        ctx->blockIndex++;
+      }
+    }
+  }
+
+      // Done, or client gone.
+
+  trace(T_EXPORTLOG,4);
+  ctx->client.stop();
+  return -1;
+}
+
+uint32_t exportLog(struct serviceBlock* _serviceBlock){
+  trace(T_EXPORTLOG,2);
+  int waiting = 0;                              // Consecutive exports waiting on client
+  while(exportList){
+
+        // Take the export at the head of the list and
+        // move it to the end after one step.
+
+    exportContext* ctx = exportList;
+    exportList = ctx->next;
+    ctx->next = nullptr;
+    int result = exportStep(ctx);
+    if(result < 0){
+      delete ctx;
+      exportCount--;
+      continue;
+    }
+    exportContext** link = &exportList;
+    while(*link){
+      link = &(*link)->next;
+    }
+    *link = ctx;
+
+    waiting = result ? 0 : waiting + 1;
+    if(waiting >= exportCount){
+      return 10;
+    }
+    if((micros() + 2500) >= bingoTime){
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -1,296 +1,346 @@
 #include "IotaWatt.h"
 
 /***************************************************************************************************
- *  GetFeedData SERVICE.
- *  
- *  The web server does a pretty good job of handling file downloads and uploads asynchronously, 
- *  but assumes that any callbacks to new handlers get the job completely done befor returning. 
- *  The GET /feed/data/ request takes a long time and generates a lot of data so it needs to 
- *  run as a SERVICE so that sampling can continue while it works on providing the data.  
- *  To accomplish that without modifying ESP8266WebServer, we schedule this SERVICE and
- *  block subsequent calls to server.handleClient() until the request is satisfied, at which time
- *  this SERVICE returns with code 0 to cause it's serviceBlock to be deleted.  When a new /feed/data
- *  request comes in, the web server handler will reshedule this SERVICE with NewService.
- * 
- *  The process time per dispatch is determined to try to balance sampling with response time.
- *  When a new request is soon after another, the process time is decreased to maintain
- *  sampling at the expense of response time.
- * 
- *  ********NOTE*******
- *  7/22/2018 Made this a direct call from webserver so entire transaction is handled without
- *  returning to allow sampling. This seems to eliminate memory leak problems with sending the
- *  response data after essentially ending the transaction by returning from the initial webserver call.
- *  Improves query response times, but stops sampling for about 1.3-1.5sec for a typical graph request.
- * 
- *  Stopping sampling doesn't mean power is not logged.  It only means that changes to power
- *  during that period will not be measured. 
- * 
- *  Other solutions that can be explored in the future might be:
- * 
- *  1) sample power directly from within the webserver handler (ugh).
- *  2) determine what is not being cleaned up and find a way to do so. Suspect it's 
- *     request headers as the problem is more severe when digest auth headers are collected.
- *  3) Try using asyncwebserver.
- *   
+ *  feedData SERVICE.
+ *
+ *  GET /feed/data/ is the Emoncms graph API.  It can ask for up to 2000 rows of several
+ *  series, which takes too long to produce in the web server handler without stopping
+ *  sampling.  (It used to be a direct call that stopped sampling for 1.3-1.5 seconds for a
+ *  typical graph request.)
+ *
+ *  getFeedData validates the request, builds the list of series and sends the headers.
+ *  The rows are then generated by this SERVICE a few at a time between AC cycles.
+ *  serverAvailable is false until the response is complete.
+ *
+ *  The response is built directly in a fixed size chunk buffer, so heap use depends
+ *  only on the number of series.  Each chunk is written only when the client has room
+ *  for all of it, so a slow client doesn't hold up sampling either.
+ *
+ *  When the interval is a multiple of the History_log interval, rows are read from
+ *  the History_log even when the Current_log has them, as the values are the same
+ *  and there are 12 times fewer records to read.  Either way, the log is read with
+ *  an IotaLogScan, and times outside of it fall back to logReadKey.
  **************************************************************************************************/
 
-uint32_t getFeedData(){ //(struct serviceBlock* _serviceBlock){
-  // trace T_GFD
-
-  struct req {
-    req* next;
-    int channel;
-    char queryType;
-    Script* output;
-    req(){next=nullptr; channel=0; queryType=' '; output=nullptr;};
-    ~req(){delete next;};
-  }; 
-
-  static IotaLogRecord* logRecord = nullptr;
-  static IotaLogRecord* lastRecord = nullptr;
-  static size_t   chunkSize = 1600;
-  static char* buf = nullptr;
-  static size_t bufPos = 0;
-  static String*  replyData = nullptr;
-  static req*     reqRoot = nullptr;
-  static uint32_t startUnixTime;
-  static uint32_t endUnixTime;
-  static uint32_t intervalSeconds;
-  static uint32_t UnixTime;
-  static uint32_t lastReqTime = 0;
-  static uint32_t processInterval;
-  static uint32_t startTime;
-  static bool     modeRequest;
-  enum   states   {setup, process} static state = setup;
-       
-  switch (state) {
-    
-    case setup: {
-      trace(T_GFD,0);
-      startTime = millis();
-      processInterval = 3000 / (uint32_t)(frequency + 0.1);
-      if((millis() - lastReqTime) > 10000){
-        processInterval = 6000 / (uint32_t)(frequency + 0.1);
-      }
-      lastReqTime = millis();
-
-        // Validate the request parameters
-      
-      startUnixTime = server.arg("start").substring(0,10).toInt();
-      endUnixTime = server.arg("end").substring(0,10).toInt();
-      if(server.hasArg("interval")){
-        intervalSeconds = server.arg("interval").toInt();
-        modeRequest = false;;
-      }
-      else if(server.hasArg("mode")){
-        modeRequest = true;
-        if(server.arg("mode")== "daily") intervalSeconds = 86400;
-        else if(server.arg("mode") == "weekly") intervalSeconds = 86400 * 7;
-        else if(server.arg("mode") == "monthly") intervalSeconds = 86400 * 30;
-        else if(server.arg("mode") == "yearly") intervalSeconds = 86400 * 365;
-      }
-      if((startUnixTime % 5) ||
-         (endUnixTime % 5) ||
-         (intervalSeconds % 5) ||
-         (intervalSeconds <= 0) ||
-         (endUnixTime < startUnixTime) ||
-         ((endUnixTime - startUnixTime) / intervalSeconds > 2000)) {
-        server.send(400, "text/plain", "Invalid request");
-        state = setup;
-        serverAvailable = true;
-        return 0;    
+#define FEED_CHUNK_SIZE 1600              // Target chunk size
+#define FEED_VALUE_SIZE 24                // Largest value and separator
+#define FEED_TIMEOUT 30000                // ms client can stall before request is dropped
+
+struct feedReq {
+      feedReq*  next;
+      int       channel;
+      char      queryType;
+      Script*   output;
+      feedReq():next(nullptr),channel(0),queryType(' '),output(nullptr){};
+      ~feedReq(){delete next;};
+    };
+
+struct feedContext {
+      feedReq*        reqRoot;            // Head of list of series (dummy)
+      IotaLogScan*    scan;               // Sequential reader of scanLog
+      IotaLog*        scanLog;
+      IotaLogRecord*  logRecord;
+      IotaLogRecord*  lastRecord;
+      char*           buf;                // Chunk buffer, six bytes reserved for header
+      size_t          bufSize;            // Size of body + header
+      size_t          bufPos;             // End of body
+      size_t          rowSize;            // Largest row
+      uint32_t        UnixTime;           // Time of next row
+      uint32_t        endUnixTime;
+      uint32_t        intervalSeconds;
+      uint32_t        lastSent;           // millis() of last chunk write
+      bool            pending;            // Chunk is ready to send
+      bool            firstRow;
+      enum states {rows, last, end} state;
+      feedContext()
+      :reqRoot(nullptr), scan(nullptr), scanLog(nullptr), logRecord(nullptr), lastRecord(nullptr)
+      ,buf(nullptr), bufSize(0), bufPos(6), rowSize(0), UnixTime(0), endUnixTime(0), intervalSeconds(0)
+      ,lastSent(0), pending(false), firstRow(true), state(rows){};
+      ~feedContext(){
+        delete reqRoot;
+        delete scan;
+        delete logRecord;
+        delete lastRecord;
+        delete[] buf;
       }
-      
-          // Parse the ID parm into a list.
-      
-      String idParm = server.arg("id");
-      if( ! reqRoot) reqRoot = new req;
-      req* reqPtr = reqRoot;
-      int i = 0;
-      if(idParm.startsWith("[")){
-        idParm[idParm.length()-1] = ',';
-        i = 1;
-      } else {
-        idParm += ",";
+    };
+
+static feedContext* feedCtx = nullptr;
+
+void getFeedData(){
+  trace(T_GFD,0);
+
+      // Validate the request parameters
+
+  uint32_t startUnixTime = server.arg("start").substring(0,10).toInt();
+  uint32_t endUnixTime = server.arg("end").substring(0,10).toInt();
+  uint32_t intervalSeconds = 0;
+  if(server.hasArg("interval")){
+    intervalSeconds = server.arg("interval").toInt();
+  }
+  else if(server.hasArg("mode")){
+    if(server.arg("mode")== "daily") intervalSeconds = 86400;
+    else if(server.arg("mode") == "weekly") intervalSeconds = 86400 * 7;
+    else if(server.arg("mode") == "monthly") intervalSeconds = 86400 * 30;
+    else if(server.arg("mode") == "yearly") intervalSeconds = 86400 * 365;
+  }
+  if((startUnixTime % 5) ||
+     (endUnixTime % 5) ||
+     (intervalSeconds % 5) ||
+     (intervalSeconds <= 0) ||
+     (endUnixTime < startUnixTime) ||
+     ((endUnixTime - startUnixTime) / intervalSeconds > 2000)) {
+    server.send(400, "text/plain", "Invalid request");
+    return;
+  }
+
+  feedContext* ctx = new feedContext;
+  ctx->UnixTime = startUnixTime;
+  ctx->endUnixTime = endUnixTime;
+  ctx->intervalSeconds = intervalSeconds;
+
+      // Parse the ID parm into a list.
+
+  String idParm = server.arg("id");
+  ctx->reqRoot = new feedReq;
+  feedReq* reqPtr = ctx->reqRoot;
+  int count = 0;
+  int i = 0;
+  if(idParm.startsWith("[")){
+    idParm[idParm.length()-1] = ',';
+    i = 1;
+  } else {
+    idParm += ",";
+  }
+  while(i < idParm.length()){
+    reqPtr->next = new feedReq;
+    reqPtr = reqPtr->next;
+    count++;
+    String id = idParm.substring(i,idParm.indexOf(',',i));
+    String name = id.substring(2);
+    i = idParm.indexOf(',',i) + 1;
+    if(id.charAt(0) == 'I'){
+      for(int j=0; j<maxInputs; j++){
+        if(inputChannel[j]->isActive() &&
+           name.equals(inputChannel[j]->_name)){
+           reqPtr->channel = inputChannel[j]->_channel;
+           reqPtr->output = nullptr;
+           reqPtr->queryType = id.charAt(1);
+           break;
+        }
       }
-      while(i < idParm.length()){
-        reqPtr->next = new req;
-        reqPtr = reqPtr->next;
-        String id = idParm.substring(i,idParm.indexOf(',',i));
-        String name = id.substring(2);
-        i = idParm.indexOf(',',i) + 1;
-        if(id.charAt(0) == 'I'){
-          for(int j=0; j<maxInputs; j++){
-            if(inputChannel[j]->isActive() &&
-               name.equals(inputChannel[j]->_name)){
-               reqPtr->channel = inputChannel[j]->_channel;
-               reqPtr->output = nullptr;
-               reqPtr->queryType = id.charAt(1);
-               break;
-            }
-          }
+    }
+    else if(id.charAt(0) == 'O'){
+      Script* script = outputs->first();
+      while(script){
+        if(name.equals(script->name())){
+          reqPtr->channel = -1;
+          reqPtr->output = script;
+          reqPtr->queryType = id.charAt(1);
+          break;
         }
-        else if(id.charAt(0) == 'O'){
-          Script* script = outputs->first();
-          while(script){
-            if(name.equals(script->name())){
-              reqPtr->channel = -1;
-              reqPtr->output = script;
-              reqPtr->queryType = id.charAt(1);
-              break;
-            } 
-            script = script->next(); 
-          }  
+        script = script->next();
+      }
+    }
+  }
+
+      // Size the chunk buffer to hold at least one row and the closing
+      // bracket, plus room for the chunk header and footer.
+
+  ctx->rowSize = 4 + count * FEED_VALUE_SIZE;
+  ctx->bufSize = MAX(FEED_CHUNK_SIZE, ctx->rowSize + 6);
+  ctx->buf = new char[ctx->bufSize + 2];
+  ctx->buf[ctx->bufPos++] = '[';
+
+      // Choose the log to scan.
+
+  ctx->scanLog = &Current_log;
+  if(History_log.isOpen() &&
+     (intervalSeconds % History_log.interval()) == 0 &&
+     (startUnixTime % History_log.interval()) == 0){
+    ctx->scanLog = &History_log;
+  }
+  ctx->logRecord = new IotaLogRecord;
+  ctx->lastRecord = new IotaLogRecord;
+  if(startUnixTime >= History_log.firstKey()){
+    ctx->lastRecord->UNIXtime = startUnixTime - intervalSeconds;
+  } else {
+    ctx->lastRecord->UNIXtime = History_log.firstKey();
+  }
+  ctx->scan = new IotaLogScan(ctx->scanLog, ctx->lastRecord->UNIXtime, intervalSeconds, endUnixTime);
+  logReadKey(ctx->lastRecord);
+
+      // Setup to do it "chunky-style"
+
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200,"application/octet-stream","");
+  ctx->lastSent = millis();
+  feedCtx = ctx;
+  serverAvailable = false;
+  serviceBlock* sb = NewService(feedData, T_GFD);
+  sb->priority = priorityLow;
+}
+
+    // Read a record with the scan when it's in the scanned log.
+
+static int feedRead(feedContext* ctx, IotaLogRecord* record){
+  if(record->UNIXtime >= ctx->scanLog->firstKey() && record->UNIXtime <= ctx->scanLog->lastKey()){
+    return ctx->scan->readKey(record);
+  }
+  return logReadKey(record);
+}
+
+    // Append a value, or null if it isn't a number.
+
+static void feedValue(feedContext* ctx, double value, int decimals){
+  char* out = ctx->buf + ctx->bufPos;
+  int len = (isnan(value) || isinf(value)) ? 0 : formatFixed(out, FEED_VALUE_SIZE, value, decimals);
+  if(len <= 0 || len >= FEED_VALUE_SIZE){
+    memcpy(out, "null", 4);
+    len = 4;
+  }
+  ctx->bufPos += len;
+}
+
+static void feedNull(feedContext* ctx){
+  memcpy(ctx->buf + ctx->bufPos, "null", 4);
+  ctx->bufPos += 4;
+}
+
+uint32_t feedData(struct serviceBlock* _serviceBlock){
+  trace(T_GFD,1);
+  feedContext* ctx = feedCtx;
+
+  while(server.client().connected()){
+
+        // Write a completed chunk when the client can take it.
+
+    if(ctx->pending){
+      if(server.client().availableForWrite() < ctx->bufPos + 2){
+        if(millis() - ctx->lastSent > FEED_TIMEOUT){
+          log("feedData: client stalled, request abandoned.");
+          break;
         }
+        return 10;
       }
-          
-      logRecord = new IotaLogRecord;
-      lastRecord = new IotaLogRecord;
-     
-      if(startUnixTime >= History_log.firstKey()){   
-        lastRecord->UNIXtime = startUnixTime - intervalSeconds;
-      } else {
-        lastRecord->UNIXtime = History_log.firstKey();
+      trace(T_GFD,5);
+      sendChunk(ctx->buf, ctx->bufPos);
+      ctx->lastSent = millis();
+      ctx->pending = false;
+      ctx->bufPos = 6;
+      if(ctx->state == feedContext::end){
+        break;
       }
-      logReadKey(lastRecord);
-      
-          // Using String for a large buffer abuses the heap
-          // and takes up a lot of time. We will build 
-          // relatively short response elements with String
-          // and copy them to this larger buffer.
-
-      buf = new char[chunkSize+8];
-      bufPos = 6;
-      replyData = new String();
-      
-          // Setup buffer to do it "chunky-style"
-      
-      server.setContentLength(CONTENT_LENGTH_UNKNOWN);
-      server.send(200,"application/octet-stream","");
-      *replyData= "[";
-      UnixTime = startUnixTime;
-      state = process;
     }
-  
-    case process: {
-      trace(T_GFD,1);
-
-          // Loop to generate entries
-      
-      while(UnixTime <= endUnixTime) {
-        int rtc;
-        logRecord->UNIXtime = UnixTime;
-        logReadKey(logRecord);
-        trace(T_GFD,2);
-        *replyData += '[';  //  + String(UnixTime) + "000,";
-        double elapsedHours = logRecord->logHours - lastRecord->logHours;
-        req* reqPtr = reqRoot;
-        while((reqPtr = reqPtr->next) != nullptr){
-          int channel = reqPtr->channel;
-          if(rtc || logRecord->logHours == lastRecord->logHours){
-            *replyData +=  "null";
+
+        // After the last data chunk, send the terminating zero chunk.
+
+    else if(ctx->state == feedContext::last){
+      ctx->state = feedContext::end;
+      ctx->pending = true;
+    }
+
+        // Terminate the array after the last row.
+
+    else if(ctx->UnixTime > ctx->endUnixTime){
+      trace(T_GFD,7);
+      ctx->buf[ctx->bufPos++] = ']';
+      ctx->state = feedContext::last;
+      ctx->pending = true;
+    }
+
+        // Send the chunk if there isn't room for another row.
+
+    else if(ctx->bufPos + ctx->rowSize > ctx->bufSize){
+      ctx->pending = true;
+    }
+
+        // Generate a row.
+
+    else {
+      trace(T_GFD,2);
+      IotaLogRecord* logRecord = ctx->logRecord;
+      IotaLogRecord* lastRecord = ctx->lastRecord;
+      logRecord->UNIXtime = ctx->UnixTime;
+      int rtc = feedRead(ctx, logRecord);
+      if( ! ctx->firstRow){
+        ctx->buf[ctx->bufPos++] = ',';
+      }
+      ctx->firstRow = false;
+      ctx->buf[ctx->bufPos++] = '[';
+      double elapsedHours = logRecord->logHours - lastRecord->logHours;
+      ScriptContext context(lastRecord, logRecord);
+      ScriptContext energyContext(nullptr, logRecord);
+      feedReq* reqPtr = ctx->reqRoot;
+      bool first = true;
+      while((reqPtr = reqPtr->next) != nullptr){
+        int channel = reqPtr->channel;
+        if( ! first){
+          ctx->buf[ctx->bufPos++] = ',';
+        }
+        first = false;
+        if(rtc || logRecord->logHours == lastRecord->logHours){
+          feedNull(ctx);
+        }
+
+          // input channel
+
+        else if(channel >= 0){
+          trace(T_GFD,3);
+          if(reqPtr->queryType == 'V' || reqPtr->queryType == 'P') {
+            feedValue(ctx, (logRecord->accum1[channel] - lastRecord->accum1[channel]) / elapsedHours, 1);
           }
-  
-            // input channel
-
-          else if(channel >= 0){
-            trace(T_GFD,3);       
-            if(reqPtr->queryType == 'V') {
-              *replyData += String((logRecord->accum1[channel] - lastRecord->accum1[channel]) / elapsedHours,1);
-            } 
-            else if(reqPtr->queryType == 'P') {
-              *replyData += String((logRecord->accum1[channel] - lastRecord->accum1[channel]) / elapsedHours,1);
-            }
-            else if(reqPtr->queryType == 'E') {
-                *replyData += String((logRecord->accum1[channel] / 1000.0),3);              
-            } 
-            else {
-              *replyData += "null";
-            } 
+          else if(reqPtr->queryType == 'E') {
+            feedValue(ctx, logRecord->accum1[channel] / 1000.0, 3);
           }
-  
-           // output channel
-          
           else {
-            trace(T_GFD,4);
-            if(reqPtr->output == nullptr){
-              *replyData += "null";
-            }
-            else if(reqPtr->queryType == 'V'){
-              *replyData += String(reqPtr->output->run(lastRecord, logRecord, Volts), 1);
-            }
-            else if(reqPtr->queryType == 'P'){
-              *replyData += String(reqPtr->output->run(lastRecord, logRecord, Watts), 1);
-            }
-            else if(reqPtr->queryType == 'E'){
-                *replyData += String(reqPtr->output->run(nullptr, logRecord, kWh), 3);
-            }
-            else if(reqPtr->queryType == 'O'){
-              *replyData += String(reqPtr->output->run(lastRecord, logRecord), reqPtr->output->precision());
-            }
-            else {
-              *replyData += "null";
-            }
+            feedNull(ctx);
+          }
+        }
+
+          // output channel
+
+        else {
+          trace(T_GFD,4);
+          if(reqPtr->output == nullptr){
+            feedNull(ctx);
+          }
+          else if(reqPtr->queryType == 'V'){
+            feedValue(ctx, reqPtr->output->run(&context, Volts), 1);
+          }
+          else if(reqPtr->queryType == 'P'){
+            feedValue(ctx, reqPtr->output->run(&context, Watts), 1);
+          }
+          else if(reqPtr->queryType == 'E'){
+            feedValue(ctx, reqPtr->output->run(&energyContext, kWh), 3);
           }
-          if(replyData->endsWith("NaN") || replyData->endsWith("inf")){
-            replyData->remove(replyData->length()-3);
-            *replyData += "null";
+          else if(reqPtr->queryType == 'O'){
+            feedValue(ctx, reqPtr->output->run(&context), reqPtr->output->precision());
           }
-          *replyData += ',';
-        } 
-           
-        replyData->setCharAt(replyData->length()-1,']');
-        IotaLogRecord* swapRecord = lastRecord;
-        lastRecord = logRecord;
-        logRecord = swapRecord;
-        UnixTime += intervalSeconds;
-
-            // If not enough room in buffer for this segment, 
-            // Write the buffer chunk.
-
-        if((bufPos + replyData->length()) > (chunkSize - 3)){
-          sendChunk(buf, bufPos);
-          bufPos = 6;
-        }    
-
-            // Add this segment to buf.
-
-        trace(T_GFD,5);
-        memcpy(buf + bufPos, replyData->c_str(), replyData->length());
-        bufPos += replyData->length();
-        replyData->remove(0);
-        
-        *replyData += ',';
+          else {
+            feedNull(ctx);
+          }
+        }
       }
-      trace(T_GFD,7);
+      ctx->buf[ctx->bufPos++] = ']';
+      ctx->logRecord = lastRecord;
+      ctx->lastRecord = logRecord;
+      ctx->UnixTime += ctx->intervalSeconds;
 
-          // All entries generated, terminate Json and send.
-      
-      replyData->setCharAt(replyData->length()-1,']');
-      memcpy(buf + bufPos, replyData->c_str(), replyData->length());
-      bufPos += replyData->length();
-      sendChunk(buf, bufPos);
-
-      delete replyData;
-      replyData = nullptr;
-      
-          // Send terminating zero chunk, clean up and exit.    
-      
-      sendChunk(buf, 6);
-      server.client().stop();
-      trace(T_GFD,7);
-      delete[] buf;
-      buf = nullptr;
-      delete reqRoot;
-      reqRoot = nullptr;
-      delete logRecord;
-      logRecord = nullptr;
-      delete lastRecord;
-      lastRecord = nullptr;
-      state = setup;
-      serverAvailable = true;
-      return 0;                                       // Done for now, return without scheduling.
+          // Give way to sampling.
+
+      if((micros() + 2500) >= bingoTime){
+        return 1;
+      }
     }
   }
+
+      // Done, or client gone.
+
+  trace(T_GFD,6);
+  server.client().stop();
+  delete ctx;
+  feedCtx = nullptr;
+  serverAvailable = true;
   return 0;
-}
\ No newline at end of file
+}
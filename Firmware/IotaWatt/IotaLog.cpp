@@ -4,10 +4,10 @@
 */
 #include "IotaWatt.h"
 
-struct {
-  uint32_t UNIXtime;
-  uint32_t serial; 
-} recordKey;
+IotaLogKey recordKey;
+
+IotaLog* IotaLog::_queueList = nullptr;
+bool IotaLog::_writerActive = false;
 
 int IotaLog::begin (const char* path ){
 	if(IotaFile) return 0;
@@ -36,6 +36,16 @@ int IotaLog::begin (const char* path ){
 	
 	_fileSize = _physicalSize = IotaFile.size();
 
+			// A write interrupted while the file was growing can leave part of
+			// a record at the end. Drop it so reads stay record aligned.
+
+	if(_fileSize % _recordSize){
+		_fileSize -= _fileSize % _recordSize;
+		IotaFile.truncate(_fileSize);
+		_physicalSize = _fileSize;
+		log("IotaLog: Truncated partial record %s", _path);
+	}
+
 	if(_fileSize){
 			IotaFile.seek(0);
 			IotaFile.read((uint8_t*)&recordKey, sizeof(recordKey));
@@ -48,24 +58,53 @@ int IotaLog::begin (const char* path ){
 			_entries = _fileSize / _recordSize;
 	}
 
-			// If there are trailing zero recordKeys at the end,
-			// try to adjust _filesize down to match logical end of file.
+			// If there are trailing zero (preformatted) records at the end,
+			// binary search for the last record written and adjust 
+			// _filesize down to match logical end of file.
 
-	while(_fileSize && _lastSerial == 0){
-		IotaLogRecord* logRec = new IotaLogRecord;
-		_fileSize -= _recordSize;
-		IotaFile.seek(_fileSize - _recordSize);
-		IotaFile.read((uint8_t*)logRec, _recordSize);
-		_lastSerial = logRec->serial;
-		_lastKey = logRec->UNIXtime;
-		_entries--;	 
-		delete logRec;
+	if(_fileSize && _lastKey == 0){
+		if(_firstKey == 0){
+			_fileSize = 0;
+			_entries = 0;
+			_firstSerial = 0;
+			_lastSerial = -1;
+		}
+		else {
+			uint32_t low = 0;
+			uint32_t high = _entries - 1;
+			while((high - low) > 1){
+				uint32_t mid = (low + high) / 2;
+				IotaFile.seek(mid * _recordSize);
+				IotaFile.read((uint8_t*)&recordKey, sizeof(recordKey));
+				if(recordKey.UNIXtime){
+					low = mid;
+				} else {
+					high = mid;
+				}
+			}
+			_entries = low + 1;
+			_fileSize = _entries * _recordSize;
+			IotaFile.seek(_fileSize - _recordSize);
+			IotaFile.read((uint8_t*)&recordKey, sizeof(recordKey));
+			_lastKey = recordKey.UNIXtime;
+			_lastSerial = recordKey.serial;
+		}
 	}
 	
 	if(_firstKey > _lastKey){
 		_wrap = findWrap(0,_firstKey, _fileSize - _recordSize, _lastKey);
 		IotaFile.seek(_wrap);
 		IotaFile.read((uint8_t*)&recordKey, sizeof(recordKey));
+
+			// Zeroed records just before the wrap point leave findWrap at the
+			// start of the zero run. Step over them so they are treated as
+			// damage at the end of the log and handled by recover().
+
+		while(recordKey.UNIXtime == 0 && _wrap < (_fileSize - _recordSize)){
+			_wrap += _recordSize;
+			IotaFile.seek(_wrap);
+			IotaFile.read((uint8_t*)&recordKey, sizeof(recordKey));
+		}
 		_firstKey = recordKey.UNIXtime;
 		_firstSerial = recordKey.serial;
 		IotaFile.seek(_wrap - _recordSize);
@@ -79,13 +118,15 @@ int IotaLog::begin (const char* path ){
 	_maxFileSize = max(_fileSize, _maxFileSize);
 	
 	if(((int32_t) _lastSerial - _firstSerial + 1) != _entries){
-		log("IotaLog: file damaged %s\r\n", _path);
-		log("IotaLog: Creating diagnostic file.");
-		dumpFile();
-		log("IotaLog: Deleting %s and restarting.\r\n", _path);	
-		IotaFile.close();
-		SD.remove(_path);
-		ESP.restart();
+		log("IotaLog: file damaged %s", _path);
+		if(recover()){
+			log("IotaLog: Recovery failed, creating diagnostic file.");
+			dumpFile();
+			log("IotaLog: Deleting %s and restarting.\r\n", _path);	
+			IotaFile.close();
+			SD.remove(_path);
+			ESP.restart();
+		}
 	}
 		
 	for(int i=0; i<_cacheSize; i++){
@@ -96,6 +137,73 @@ int IotaLog::begin (const char* path ){
 	return 0;
 }
 
+		// Recover a log where the serials are not consistent with the number of entries,
+		// usually the result of a crash or power failure while writing.
+		// Binary search for the last logical record with the expected serial.
+		// Records after that are damaged:
+		//   If the log is not wrapped, they are truncated.
+		//   If wrapped, the file can't shrink, so they are rewritten as filler 
+		//   records that logically precede the oldest good record, carry no energy,
+		//   and will be the first to be overwritten.
+
+int IotaLog::recover(){
+	uint32_t low = 0;
+	uint32_t high = _entries;
+	while((high - low) > 1){
+		uint32_t mid = (low + high) / 2;
+		IotaFile.seek(((mid * _recordSize) + _wrap) % _fileSize);
+		IotaFile.read((uint8_t*)&recordKey, sizeof(recordKey));
+		if((int32_t)recordKey.serial == _firstSerial + (int32_t)mid){
+			low = mid;
+		} else {
+			high = mid;
+		}
+	}
+	uint32_t good = low + 1;
+	uint32_t damaged = _entries - good;
+	if(good < 2 || damaged == 0){
+		return 1;
+	}
+	uint32_t lastPos = ((low * _recordSize) + _wrap) % _fileSize;
+	IotaFile.seek(lastPos);
+	IotaFile.read((uint8_t*)&recordKey, sizeof(recordKey));
+	_lastKey = recordKey.UNIXtime;
+	_lastSerial = recordKey.serial;
+
+	if(_wrap == 0){
+		_fileSize = good * _recordSize;
+		_entries = good;
+		IotaFile.truncate(_fileSize);
+		_physicalSize = _fileSize;
+		log("IotaLog: Truncated %d damaged records, last entry %s", damaged, localDateString(_lastKey).c_str());
+		return 0;
+	}
+
+	if(_firstSerial < (int32_t)damaged || _firstKey < (damaged * _interval)){
+		return 1;
+	}
+	IotaLogRecord* filler = new IotaLogRecord;
+	IotaFile.seek(_wrap);
+	IotaFile.read((uint8_t*)filler, _recordSize);
+	uint32_t newWrap = (lastPos + _recordSize) % _fileSize;
+	for(int i=0; i<damaged; i++){
+		filler->serial = _firstSerial - damaged + i;
+		filler->UNIXtime = _firstKey - (damaged - i) * _interval;
+		IotaFile.seek((newWrap + i * _recordSize) % _fileSize);
+		IotaFile.write((char*)filler, _recordSize);
+		if((i % 32) == 31){
+			yield();
+		}
+	}
+	IotaFile.flush();
+	delete filler;
+	_wrap = newWrap;
+	_firstSerial -= damaged;
+	_firstKey -= damaged * _interval;
+	log("IotaLog: Replaced %d damaged records, last entry %s", damaged, localDateString(_lastKey).c_str());
+	return 0;
+}
+
 uint32_t IotaLog::findWrap(uint32_t highPos, uint32_t highKey, uint32_t lowPos, uint32_t lowKey){
 	struct {
 		uint32_t UNIXtime;
@@ -216,6 +324,7 @@ int IotaLog::readNext(IotaLogRecord* callerRecord){
 }
 
 int IotaLog::end(){
+	drain();
 	IotaFile.close();
 	return 0;
 }
@@ -232,6 +341,7 @@ int32_t IotaLog::lastSerial(){return _lastSerial;}
 uint32_t IotaLog::fileSize(){return _fileSize;}
 uint32_t IotaLog::readKeyIO(){return _readKeyIO;}
 uint32_t IotaLog::interval(){return _interval;}
+uint32_t IotaLog::recordSize(){return _recordSize;}
 
 uint32_t IotaLog::setDays(uint32_t days){
 	_maxFileSize = max(_fileSize, (uint32_t)(days * _recordSize * (86400UL / _interval)));
@@ -243,7 +353,13 @@ int IotaLog::readSerial(IotaLogRecord* callerRecord, int32_t serial){
 	if(serial < _firstSerial || serial > _lastSerial){
 			return 1;
 	}
-	int pos = ((serial - _firstSerial) * _recordSize + _wrap) % _fileSize;
+	if(serial > _lastSerial - _queueCount){
+		int slot = (_queueHead + _queueCount - (_lastSerial - serial) - 1) % _queueSize;
+		memcpy(callerRecord, _queueBuf + slot * _recordSize, _recordSize);
+		_readKeyIO++;
+		return 0;
+	}
+	int pos = IotaLogPosition(serial, _firstSerial, _recordSize, _wrap, _fileSize);
 	if(_writeCache && pos >= _writeCachePos && pos < (_writeCachePos + IOTALOG_BLOCK_SIZE)){
 		memcpy(callerRecord, _writeCacheBuf + (pos % IOTALOG_BLOCK_SIZE), _recordSize);
 	}
@@ -257,6 +373,41 @@ int IotaLog::readSerial(IotaLogRecord* callerRecord, int32_t serial){
 	_readKeyIO++;
 	return 0;
 };
+
+		// Read up to count consecutive records beginning with serial.
+		// The read stops short at the physical end of a wrapped file
+		// and at the boundary of the write cache, so the caller should
+		// expect fewer records and call again for the remainder.
+		// Returns the number of records read.
+
+int IotaLog::readBlock(uint8_t* buf, int32_t serial, int count){
+	if(!IotaFile || serial < _firstSerial || serial > _lastSerial){
+		return 0;
+	}
+	int32_t committed = _lastSerial - _queueCount;
+	if(serial > committed){
+		int index = serial - committed - 1;
+		int slot = (_queueHead + index) % _queueSize;
+		count = min(count, min(_queueCount - index, _queueSize - slot));
+		memcpy(buf, _queueBuf + slot * _recordSize, count * _recordSize);
+		return count;
+	}
+	count = min(count, (int)(committed - serial + 1));
+	uint32_t pos = IotaLogPosition(serial, _firstSerial, _recordSize, _wrap, _fileSize);
+	count = min(count, (int)((_fileSize - pos) / _recordSize));
+	if(_writeCache){
+		if(pos >= _writeCachePos){
+			count = min(count, (int)((_writeCachePos + IOTALOG_BLOCK_SIZE - pos) / _recordSize));
+			memcpy(buf, _writeCacheBuf + (pos % IOTALOG_BLOCK_SIZE), count * _recordSize);
+			return count;
+		}
+		count = min(count, (int)((_writeCachePos - pos) / _recordSize));
+	}
+	IotaFile.seek(pos);
+	IotaFile.read(buf, count * _recordSize);
+	_readKeyIO++;
+	return count;
+}
    
 int IotaLog::write (IotaLogRecord* callerRecord){
 
@@ -266,8 +417,41 @@ int IotaLog::write (IotaLogRecord* callerRecord){
 	if(callerRecord->UNIXtime <= _lastKey) {
 			return 1;
 	}
+
+		// If asynchronous, queue the record for IotaLogWriter.
+		// If the queue is full, commit the oldest now (back-pressure).
+		// The first record of a new log is always committed directly.
+
+	if(_queueSize && _entries){
+		if(_queueCount == _queueSize){
+			_queueStats.overflows++;
+			commitQueued();
+		}
+		callerRecord->serial = ++_lastSerial;
+		_lastKey = callerRecord->UNIXtime;
+		int slot = (_queueHead + _queueCount++) % _queueSize;
+		memcpy(_queueBuf + slot * _recordSize, callerRecord, _recordSize);
+		_queueTime[slot] = millis();
+		_queueStats.maxDepth = max(_queueStats.maxDepth, _queueCount);
+		if( ! _writerActive){
+			_writerActive = true;
+			serviceBlock* sb = NewService(IotaLogWriter, T_IotaLog);
+			sb->priority = priorityHigh;
+		}
+		return 0;
+	}
+
 	callerRecord->serial = ++_lastSerial;
 	_lastKey = callerRecord->UNIXtime;
+	return commit(callerRecord);
+}
+
+		// Physically write a record that has been assigned its serial.
+
+int IotaLog::commit(IotaLogRecord* callerRecord){
+	if(!IotaFile){
+			return 2;
+	}
 
 		// if log is (or should) wrap,
 		// overwrite oldest and set first to following record.
@@ -276,14 +460,16 @@ int IotaLog::write (IotaLogRecord* callerRecord){
 		if(_writeCache){
 			writeCache(false);
 		}
+		uint32_t key = callerRecord->UNIXtime;
+		int32_t serial = callerRecord->serial;
 		IotaFile.seek(_wrap);
 		_wrap = (_wrap + _recordSize) % _fileSize;
 		IotaFile.write((char*)callerRecord, _recordSize);
 		IotaFile.read((uint8_t*)callerRecord,8);
 		_firstKey = callerRecord->UNIXtime;
 		_firstSerial = callerRecord->serial;
-		callerRecord->UNIXtime = _lastKey;
-		callerRecord->serial = _lastSerial;
+		callerRecord->UNIXtime = key;
+		callerRecord->serial = serial;
 		return 0;
 	}
 
@@ -343,6 +529,7 @@ void IotaLog::writeCache(bool on){
 	if((on && _writeCache) || (!on && !_writeCache)){
 		return;
 	}
+	drain();
 	if(on){
 		_writeCacheBuf = new uint8_t[IOTALOG_BLOCK_SIZE];
 		_writeCachePos = _fileSize & ~(IOTALOG_BLOCK_SIZE - 1);
@@ -361,6 +548,90 @@ void IotaLog::writeCache(bool on){
 	}
 } 
 
+		// Set the depth of the asynchronous write queue.
+		// Zero commits anything queued and returns to synchronous writes.
+
+void IotaLog::asyncWrite(uint16_t depth){
+	if(depth == _queueSize){
+		return;
+	}
+	drain();
+	delete[] _queueBuf;
+	delete[] _queueTime;
+	_queueBuf = nullptr;
+	_queueTime = nullptr;
+	_queueSize = depth;
+	_queueHead = 0;
+	if(depth){
+		_queueBuf = new uint8_t[depth * _recordSize];
+		_queueTime = new uint32_t[depth];
+		IotaLog** link = &_queueList;
+		while(*link && *link != this) link = &(*link)->_queueNext;
+		*link = this;
+	}
+	else {
+		IotaLog** link = &_queueList;
+		while(*link && *link != this) link = &(*link)->_queueNext;
+		if(*link) *link = _queueNext;
+		_queueNext = nullptr;
+	}
+}
+
+bool IotaLog::congested(){
+	return _queueSize && _queueCount > (_queueSize / 2);
+}
+
+const IotaLogQueueStats& IotaLog::queueStats(){
+	_queueStats.size = _queueSize;
+	_queueStats.depth = _queueCount;
+	return _queueStats;
+}
+
+void IotaLog::commitQueued(){
+	if( ! _queueCount){
+		return;
+	}
+	uint32_t startUs = micros();
+	commit((IotaLogRecord*)(_queueBuf + _queueHead * _recordSize));
+	uint32_t elapsedUs = micros() - startUs;
+	_queueStats.worstWriteUs = max(_queueStats.worstWriteUs, elapsedUs);
+	_queueStats.maxLatencyMs = max(_queueStats.maxLatencyMs, (uint32_t)(millis() - _queueTime[_queueHead]));
+	_queueStats.commits++;
+	_queueHead = (_queueHead + 1) % _queueSize;
+	_queueCount--;
+}
+
+void IotaLog::drain(){
+	while(_queueCount){
+		commitQueued();
+	}
+}
+
+/*******************************************************************************************************
+ * IotaLogWriter is a Service that commits queued records of all asynchronous logs.
+ * It is created when a record is queued and ends when the queues are empty.
+ * One record is committed at a time, and only while there is time before the next sample,
+ * so a slow SD write does not delay sampling beyond the one that is underway.
+ ******************************************************************************************************/
+
+uint32_t IotaLogWriter(struct serviceBlock* _serviceBlock){
+	trace(T_IotaLog,0);
+	IotaLog* log = IotaLog::_queueList;
+	while(log){
+		while(log->_queueCount){
+			if(micros() > bingoTime){
+				return 1;
+			}
+			trace(T_IotaLog,1);
+			log->commitQueued();
+		}
+		log = log->_queueNext;
+	}
+	trace(T_IotaLog,2);
+	IotaLog::_writerActive = false;
+	return 0;
+}
+
 void IotaLog::dumpFile(){
 	setLedCycle(LED_DUMPING_LOG);
 	char diagPath[] = "iotaWatt/logDiag.txt";
@@ -402,3 +673,108 @@ void IotaLog::dumpFile(){
 	} while(filePos < IotaFile.size());
 	endLedCycle();
 }
+
+/*******************************************************************************************************
+ * IotaLogScan
+ ******************************************************************************************************/
+
+IotaLogScan::IotaLogScan(IotaLog* log, uint32_t begin, uint32_t step, uint32_t end)
+	:_log(log)
+	,_bufCount(0)
+	,_anchorSerial(-1)
+	,_anchorKey(0)
+	,_step(step)
+	,_end(end)
+{
+	_bufSize = max(2, (int)(IOTALOG_SCAN_BUFFER / _log->_recordSize));
+	_buf = new uint8_t[_bufSize * _log->_recordSize];
+	_oldRec = new IotaLogRecord;
+	_newRec = new IotaLogRecord;
+	_newRec->UNIXtime = begin;
+	readKey(_newRec);
+}
+
+IotaLogScan::~IotaLogScan(){
+	delete[] _buf;
+	delete _oldRec;
+	delete _newRec;
+}
+
+IotaLogRecord* IotaLogScan::oldRec(){return _oldRec;}
+IotaLogRecord* IotaLogScan::newRec(){return _newRec;}
+uint32_t IotaLogScan::key(){return _newRec->UNIXtime;}
+uint32_t IotaLogScan::endKey(){return _end;}
+
+bool IotaLogScan::next(){
+	return next(_newRec->UNIXtime + _step);
+}
+
+bool IotaLogScan::next(uint32_t key){
+	if(_newRec->UNIXtime >= _end){
+		return false;
+	}
+	IotaLogRecord* swap = _oldRec;
+	_oldRec = _newRec;
+	_newRec = swap;
+	_newRec->UNIXtime = min(key, _end);
+	readKey(_newRec);
+	return true;
+}
+
+IotaLogRecord* IotaLogScan::bufRec(int index){
+	return (IotaLogRecord*)(_buf + index * _log->_recordSize);
+}
+
+bool IotaLogScan::fill(int32_t serial){
+	_bufCount = _log->readBlock(_buf, serial, _bufSize);
+	return _bufCount > 0;
+}
+
+		// Keys are located in the read-ahead block when possible.
+		// When the key is beyond the block but within a block's worth 
+		// of records, the block is refilled starting with its last record.
+		// Anything else is a keyed read that becomes the anchor for
+		// the next block.
+
+int IotaLogScan::readKey(IotaLogRecord* callerRecord){
+	uint32_t interval = _log->_interval;
+	uint32_t key = callerRecord->UNIXtime - (callerRecord->UNIXtime % interval);
+	if( ! _log->isOpen() || _log->_entries == 0 || key <= _log->_firstKey || key >= _log->_lastKey){
+		return _log->readKey(callerRecord);
+	}
+	for(int pass=0; pass<3; pass++){
+		if(_bufCount){
+			IotaLogRecord* low = bufRec(0);
+			IotaLogRecord* high = bufRec(_bufCount - 1);
+			if(key < low->UNIXtime){
+				break;
+			}
+			if(key <= high->UNIXtime){
+				int index = min(_bufCount - 1, (int)((key - low->UNIXtime) / interval));
+				while(bufRec(index)->UNIXtime > key){
+					index--;
+				}
+				memcpy(callerRecord, bufRec(index), _log->_recordSize);
+				callerRecord->UNIXtime = key;
+				return 0;
+			}
+			int32_t highSerial = high->serial;
+			if((key - high->UNIXtime) / interval >= _bufSize || ! fill(highSerial)){
+				break;
+			}
+		}
+		else if(_anchorSerial >= 0 && key >= _anchorKey){
+			if((key - _anchorKey) / interval >= _bufSize || ! fill(_anchorSerial)){
+				break;
+			}
+		}
+		else {
+			break;
+		}
+	}
+	int rtc = _log->readKey(callerRecord);
+	_bufCount = 0;
+	_anchorSerial = callerRecord->serial;
+	_anchorKey = key;
+	return rtc;
+}
@@ -7,9 +7,15 @@
 #define IotaLog_h
 #include "SPI.h"
 #include "SD.h"
+#include "IotaLogRecord.h"
 
 #define IOTALOG_BLOCK_SIZE 512
 #define IOTALOG_PREFORMAT_RECORDS 24
+#define IOTALOG_SCAN_BUFFER 1024              // Read-ahead buffer size for IotaLogScan
+#define IOTALOG_ASYNC_DEPTH 4                 // Default depth of asynchronous write queue
+
+struct serviceBlock;
+uint32_t IotaLogWriter(struct serviceBlock* _serviceBlock);
 
 /*******************************************************************************************************
 ********************************************************************************************************
@@ -18,30 +24,26 @@ Maintains a log of fixed length, consecutive entries.
 All entries must be written with increasing keys.
 Entries are read by key value.
 When reading by key, the entry with the requested or next lower key is returned with the requested key.
+The record format is in IotaLogRecord.h.
 ********************************************************************************************************
 ********************************************************************************************************/
-struct IotaLogRecord {
-      uint32_t UNIXtime;        // Time period represented by this record
-      int32_t serial;           // record number in file
-      double logHours;          // Total hours of monitoring logged to date in this log
-      union {
-        struct {                // import/export log record (total size 32 bytes)
-          double Import;
-          double Export;
-        };
-        struct {                // Full datalog record (total size 256 bytes)
-          double accum1[15];
-          double accum2[15];
-        };
-      };
-      IotaLogRecord()
-      :UNIXtime(0)
-      ,serial(0)
-      ,logHours(0){};
-    };    
+
+struct IotaLogQueueStats {
+      uint16_t size;            // Capacity of queue (0 = synchronous)
+      uint16_t depth;           // Records currently queued
+      uint16_t maxDepth;        // High water mark
+      uint32_t commits;         // Records committed from the queue
+      uint32_t overflows;       // Writes that found the queue full and committed inline
+      uint32_t worstWriteUs;    // Longest single SD commit
+      uint32_t maxLatencyMs;    // Longest time from write() to commit
+      IotaLogQueueStats():size(0),depth(0),maxDepth(0),commits(0),overflows(0),worstWriteUs(0),maxLatencyMs(0){};
+    };
 
 class IotaLog
 {
+  friend class IotaLogScan;
+  friend uint32_t IotaLogWriter(struct serviceBlock*);
+
   public:
 
 	IotaLog(size_t recordSize = 256, int interval=5, int days = 365, int preformat=IOTALOG_PREFORMAT_RECORDS)
@@ -65,6 +67,12 @@ class IotaLog
       ,_writeCacheBuf(0)
       ,_writeCachePos(-IOTALOG_BLOCK_SIZE)
       ,_writeCache(false)
+      ,_queueBuf(0)
+      ,_queueTime(0)
+      ,_queueSize(0)
+      ,_queueHead(0)
+      ,_queueCount(0)
+      ,_queueNext(0)
     {
     _cacheKey = new uint32_t[_cacheSize];
     _cacheSerial = new int32_t[_cacheSize];
@@ -72,6 +80,7 @@ class IotaLog
 	  }
 	
 	~IotaLog(){
+    asyncWrite(0);
     IotaFile.close();
     delete[] _path;
     delete[] _cacheKey;
@@ -84,7 +93,10 @@ class IotaLog
     int readKey (IotaLogRecord* /* pointer to caller's buffer */);
     int readSerial(IotaLogRecord* callerRecord, int32_t serial); 
     int readNext(IotaLogRecord* /* pointer to caller's buffer */);
+    int readBlock(uint8_t* buf, int32_t serial, int count);
     void writeCache(bool on);
+    void asyncWrite(uint16_t depth);
+    bool congested();
     int end();
     
     boolean  isOpen();
@@ -95,7 +107,9 @@ class IotaLog
     uint32_t fileSize();
     uint32_t readKeyIO();
     uint32_t interval();
+    uint32_t recordSize();
     uint32_t setDays(uint32_t); 
+    const IotaLogQueueStats& queueStats();
 	 	      
     void     dumpFile();
 
@@ -104,7 +118,7 @@ class IotaLog
 	  File 	 IotaFile;
 
     char*    _path;                         // file pathname
-    uint16_t _interval;	                    // Posting interval to log. Currently tested only using 5.
+    uint32_t _interval;	                    // Posting interval to log.
     uint16_t _recordSize;      	  		      // Size of a log record
     uint32_t _fileSize;                     // Logical file size in bytes
     uint32_t _physicalSize;                 // Physical file size in bytes
@@ -130,6 +144,26 @@ class IotaLog
     uint32_t _writeCachePos;
     bool     _writeCache;
 
+        // Asynchronous write queue.
+        // Records are queued by write() with the logical state (_lastKey, _lastSerial)
+        // updated immediately. The physical state (_fileSize, _wrap, _firstKey...)
+        // is updated as IotaLogWriter commits them in the time available before bingoTime.
+
+    uint8_t* _queueBuf;                     // Queued records, _queueSize * _recordSize
+    uint32_t* _queueTime;                   // millis() when each queued record was written
+    uint16_t _queueSize;                    // Capacity of queue in records (0 = synchronous)
+    uint16_t _queueHead;                    // Index of oldest queued record
+    uint16_t _queueCount;                   // Number of queued records
+    IotaLog* _queueNext;                    // Next log in _queueList
+    IotaLogQueueStats _queueStats;
+    static IotaLog* _queueList;             // Logs with asynchronous writes
+    static bool _writerActive;              // IotaLogWriter Service is scheduled
+
+    int       commit(IotaLogRecord*);
+    void      commitQueued();
+    void      drain();
+
+    int       recover();
     uint32_t  findWrap(uint32_t highPos, uint32_t highKey, uint32_t lowPos, uint32_t lowKey);
     void      searchKey(IotaLogRecord* callerRecord, const uint32_t key,
                         const uint32_t lowKey, const int32_t lowSerial, 
@@ -137,4 +171,46 @@ class IotaLog
       
 };
 
+/*******************************************************************************************************
+********************************************************************************************************
+Class IotaLogScan
+Iterates over a range of an IotaLog, yielding pairs of records (oldRec, newRec) that bracket each step.
+Records are returned with readKey semantics (the requested or next lower entry, with the requested key)
+but are served from a read-ahead block rather than individual seek/read operations. Keys that are not
+near the current block fall back to IotaLog::readKey.
+The scan keeps all of its context, so it can be held by a Service and resumed on the next dispatch.
+********************************************************************************************************
+********************************************************************************************************/
+class IotaLogScan
+{
+  public:
+
+    IotaLogScan(IotaLog* log, uint32_t begin, uint32_t step, uint32_t end = 0xFFFFFFFFUL);
+    ~IotaLogScan();
+
+    bool            next();                     // Advance one step, false if at end of range
+    bool            next(uint32_t key);         // Advance to key, false if at end of range
+    int             readKey(IotaLogRecord*);    // Same as IotaLog::readKey, using the read-ahead block
+    IotaLogRecord*  oldRec();                   // Record at the beginning of the current step
+    IotaLogRecord*  newRec();                   // Record at the end of the current step
+    uint32_t        key();                      // Key of newRec
+    uint32_t        endKey();                   // Last key of the range
+
+  protected:
+
+    IotaLog*        _log;                       // The log being scanned
+    IotaLogRecord*  _oldRec;
+    IotaLogRecord*  _newRec;
+    uint8_t*        _buf;                       // Read-ahead block
+    int             _bufSize;                   // Capacity of _buf in records
+    int             _bufCount;                  // Records currently in _buf
+    int32_t         _anchorSerial;              // Serial of last keyed read (-1 if none)
+    uint32_t        _anchorKey;                 // Requested key of last keyed read
+    uint32_t        _step;                      // Seconds per step
+    uint32_t        _end;                       // Last key of range
+
+    IotaLogRecord*  bufRec(int index);
+    bool            fill(int32_t serial);
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,66 @@
+/*
+  IotaLogRecord.h - On-disk format of IotaLog files
+  
+  Kept free of Arduino dependencies so that host tools can share it.
+*/
+
+#ifndef IotaLogRecord_h
+#define IotaLogRecord_h
+#include <stdint.h>
+
+/*******************************************************************************************************
+An IotaLog file is an array of fixed length records, each beginning with an IotaLogKey.
+Serials are consecutive and keys are increasing in logical order.
+Until the file reaches its maximum size, records are in physical order and may be followed by 
+preformatted records of all zeros. After that the file wraps: new records overwrite the oldest,
+and logical record zero is at byte offset _wrap.
+*******************************************************************************************************/
+
+struct IotaLogKey {
+      uint32_t UNIXtime;        // Time period represented by this record
+      int32_t serial;           // record number in file
+    };
+
+struct IotaLogRecord {
+      uint32_t UNIXtime;        // Time period represented by this record
+      int32_t serial;           // record number in file
+      double logHours;          // Total hours of monitoring logged to date in this log
+      union {
+        struct {                // import/export log record (total size 32 bytes)
+          double Import;
+          double Export;
+        };
+        struct {                // Full datalog record (total size 256 bytes)
+          double accum1[15];
+          double accum2[15];
+        };
+      };
+      IotaLogRecord()
+      :UNIXtime(0)
+      ,serial(0)
+      ,logHours(0){};
+    };    
+
+      // Integration log record (32 bytes), the integrator's cumulative sums.
+
+struct intRecord {
+      uint32_t UNIXtime;        // Time period represented by this record
+      int32_t serial;           // record number in file
+      double sumPositive;       // Sum of positive intervals (import)
+      double sumNegative;       // Sum of the negative intervals (export)
+      double sumNet;            // Superfluous but need to fill to factor of blocksize (32)
+      intRecord()
+      :UNIXtime(0)
+      ,serial(0)
+      ,sumPositive(0)
+      ,sumNegative(0)
+      ,sumNet(0){};
+    };
+
+      // Byte offset of a record given its serial and the geometry of the file.
+
+inline uint32_t IotaLogPosition(int32_t serial, int32_t firstSerial, uint32_t recordSize, uint32_t wrap, uint32_t fileSize){
+  return ((uint32_t)(serial - firstSerial) * recordSize + wrap) % fileSize;
+}
+
+#endif
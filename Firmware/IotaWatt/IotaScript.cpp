@@ -40,6 +40,9 @@ Script::Script(JsonObject& JsonScript)
       ,_parm(nullptr)
       ,_constants(nullptr)
       ,_tokens(nullptr)
+      ,_program(nullptr)
+      ,_literals(nullptr)
+      ,_depth(0)
       ,_units(Watts)
       
     {
@@ -74,6 +77,9 @@ Script::Script(const char* name, const char* unit, const char* script)
       ,_parm(nullptr)
       ,_constants(nullptr)
       ,_tokens(nullptr)
+      ,_program(nullptr)
+      ,_literals(nullptr)
+      ,_depth(0)
       ,_units(Watts)
        
     {
@@ -93,6 +99,8 @@ Script::~Script() {
       delete[] _name;
       delete[] _tokens;
       delete[] _constants;
+      delete[] _program;
+      delete[] _literals;
     }
 
 Script*       Script::next() {return _next;}
@@ -259,18 +267,31 @@ bool    Script::encodeScript(const char* script){
 
     else {
       _tokens[0] = opEq;
+      compile();
       return false;
     }
   }
   _tokens[i] = 0;
-  return true;
+  return compile();
+}
+
+static double operate(double result, uint8_t token, double operand){
+        switch (token) {
+          case opAdd:  return result + operand;
+          case opSub:  return result - operand;
+          case opMult: return result * operand;
+          case opDiv:  return operand == 0 ? 0 : result / operand;
+          case opMin:  return result < operand ? result : operand;
+          case opMax:  return result > operand ? result : operand;
+          default:     return 0;        
+        }
 }
 
 double  Script::run(IotaLogRecord* oldRec, IotaLogRecord* newRec, const char* overideUnits){
         for(int i=0; i<unitsNone; i++){
           if(strcmp_ci(overideUnits,unitstr[i]) == 0){
             return run(oldRec, newRec, (units) i);
-          } 
+          }
         }
         return 0;
 }
@@ -280,259 +301,720 @@ double  Script::run(IotaLogRecord* oldRec, IotaLogRecord* newRec){
 }
 
 double  Script::run(IotaLogRecord* oldRec, IotaLogRecord* newRec, units Units){
-  double elapsedHours = 1.0;
-  if(oldRec){
-    elapsedHours = newRec->logHours - oldRec->logHours;
-  }
-  //Serial.printf("run Script %s, units %s\n", this->_name, unitstr[Units]);
-  uint8_t *tokens = _tokens;
+        ScriptContext context(oldRec, newRec);
+        return run(&context, Units);
+}
+
+double  Script::run(ScriptContext* context){
+        return run(context, _units);
+}
+
+          // Compound units are computed from two basic units.
+          // The program is executed once with a lane for each.
+
+double  Script::run(ScriptContext* context, units Units){
+  units laneUnits[SCRIPT_LANES];
+  double results[SCRIPT_LANES];
   double result;
 
   switch (Units)
   {
-  case Watts:
-  case Volts:
-  case Amps:
-  case Hz:
-  case Wh:
-  case VAR:
-  case VARh:
-    result = runRecursive(&tokens, oldRec, newRec, Units);
-    break;
-
-  case VA:
-  {
-    double var = runRecursive(&tokens, oldRec, newRec, VAR);
-    double watts = runRecursive(&tokens, oldRec, newRec, Watts);
-    result = sqrt(var * var + watts * watts);
-    break;
-          }
-          
-          case VAh:
-          {
-            double varh = runRecursive(&tokens, oldRec, newRec, VARh); 
-            double wh = runRecursive(&tokens, oldRec, newRec, Wh);
-            result = sqrt(varh * varh + wh * wh);
-            break;
-          }
+    case Watts:
+    case Volts:
+    case Amps:
+    case Hz:
+    case Wh:
+    case VAR:
+    case VARh:
+      laneUnits[0] = Units;
+      execute(context, laneUnits, 1, results);
+      result = results[0];
+      break;
+
+    case VA:
+      laneUnits[0] = VAR;
+      laneUnits[1] = Watts;
+      execute(context, laneUnits, 2, results);
+      result = sqrt(results[0] * results[0] + results[1] * results[1]);
+      break;
+
+    case VAh:
+      laneUnits[0] = VARh;
+      laneUnits[1] = Wh;
+      execute(context, laneUnits, 2, results);
+      result = sqrt(results[0] * results[0] + results[1] * results[1]);
+      break;
+
+    case kWh:
+      laneUnits[0] = Wh;
+      execute(context, laneUnits, 1, results);
+      result = results[0] / 1000.0;
+      break;
+
+    case PF:
+      laneUnits[0] = Watts;
+      laneUnits[1] = VA;
+      execute(context, laneUnits, 2, results);
+      result = results[0] / results[1];
+      break;
+
+    default:
+      result = 0.0;
+  }
 
-          case kWh:
-            result = runRecursive(&tokens, oldRec, newRec, Wh) / 1000.0; 
-            break;
+  if(result != result) return 0.0;
+  return result;
+}
 
-          case PF:
-          {
-            double watts = runRecursive(&tokens, oldRec, newRec, Watts);
-            double va = runRecursive(&tokens, oldRec, newRec, VA);
-            result = watts / va;
-            break;
-          }
+//*****************************************************************************************
+//
+//      Script compiler
+//
+//      Within each level of parentheses, a Script is evaluated left to right with no
+//      operator precedence, starting with zero. The result and the current operand of
+//      each level are kept as either a constant known at compile time, or code at the
+//      end of the program. An operand replaced by a later operand is discarded.
+//      Operations on two constants are folded, as are 0+x, x+0, x-0, x*1 and x/1.
+//      Adding zero would have turned a -0 into zero, so results are made positive
+//      zero when the program ends instead.
+//
+//*****************************************************************************************
+
+struct scriptCompiler {
+  uint8_t*  program;
+  int       pos;
+  double*   literals;
+  int       literalCount;
+  float*    constants;                  // Script constants
+  uint8_t*  token;                      // Next token to compile
+  bool      overflow;
+};
+
+struct scriptValue {
+  bool      isConst;
+  double    value;                      // Value if isConst
+  int       start;                      // Position of code if not
+};
+
+static const uint8_t binaryOps[] = {popEnd, popAdd, popSub, popMult, popDiv, popMin, popMax};
+
+static void compileConst(scriptCompiler* c, int at, double value){
+  int index = 0;
+  while(index < c->literalCount && c->literals[index] != value) index++;
+  if(index == c->literalCount){
+    if(index > 255){
+      c->overflow = true;
+      index = 0;
+    }
+    else {
+      c->literals[c->literalCount++] = value;
+    }
+  }
+  memmove(c->program + at + 2, c->program + at, c->pos - at);
+  c->program[at] = popConst;
+  c->program[at + 1] = index;
+  c->pos += 2;
+}
 
-          default:
-            result = 0.0;
-        }
-        
-        if(result != result) return 0.0;
+static void compileApply(scriptCompiler* c, scriptValue* result, uint8_t op, scriptValue* operand){
+  if(result->isConst && operand->isConst){
+    result->value = operate(result->value, op, operand->value);
+    return;
+  }
+  if(result->isConst){
+    result->isConst = false;
+    result->start = operand->start;
+    if(op == opAdd && result->value == 0){
+      return;
+    }
+    compileConst(c, operand->start, result->value);
+  }
+  else if(operand->isConst){
+    double value = operand->value;
+    if(((op == opAdd || op == opSub) && value == 0) || ((op == opMult || op == opDiv) && value == 1)){
+      return;
+    }
+    compileConst(c, c->pos, value);
+  }
+  c->program[c->pos++] = binaryOps[op];
+}
+
+static scriptValue compileLevel(scriptCompiler* c){
+  scriptValue result = {true, 0.0, c->pos};
+  scriptValue operand = {true, 0.0, c->pos};
+  uint8_t pendingOp = opAdd;
+  while(true){
+    uint8_t tokenType = *c->token & TOKEN_TYPE_MASK;
+    uint8_t tokenDetail = *c->token & ~TOKEN_TYPE_MASK;
+
+    if(tokenType == tokenOperator){
+      if(tokenDetail == opEq || tokenDetail == opPop){
+        compileApply(c, &result, pendingOp, &operand);
+        if(tokenDetail == opPop) c->token++;
         return result;
-                
+      }
+      c->token++;
+      if(tokenDetail == opAbs){
+        if(operand.isConst){
+          operand.value = fabs(operand.value);
+        }
+        else {
+          c->program[c->pos++] = popAbs;
+        }
+      }
+      else if(tokenDetail == opPush){
+        c->pos = operand.start;
+        operand = compileLevel(c);
+        if( ! operand.isConst){
+          c->program[c->pos++] = popNaN;
+        }
+        else {
+          c->pos = operand.start;
+          if(operand.value != operand.value) operand.value = 0;
+        }
+      }
+      else {
+        compileApply(c, &result, pendingOp, &operand);
+        pendingOp = tokenDetail;
+        operand.isConst = true;
+        operand.value = (tokenDetail == opMult || tokenDetail == opDiv) ? 1 : 0;
+        operand.start = c->pos;
+      }
+      continue;
+    }
+
+    c->pos = operand.start;
+    operand.isConst = false;
+    if(tokenType == tokenConstant){
+      operand.isConst = true;
+      operand.value = tokenDetail ? c->constants[tokenDetail - 1] : 0;
+      if(operand.value != operand.value) operand.value = 0;
+    }
+    else if(tokenType == tokenInput){
+      c->program[c->pos++] = popInput;
+      c->program[c->pos++] = tokenDetail;
+    }
+    else if(tokenType == tokenVirtual){
+      c->program[c->pos++] = popVirtual;
+      c->program[c->pos++] = tokenDetail;
+    }
+    else if(tokenType == tokenIntegration){
+      c->program[c->pos++] = popIntegration;
+      c->program[c->pos++] = tokenDetail;
+      c->program[c->pos++] = *(++c->token);
+    }
+    else {
+      operand.isConst = true;
+      operand.value = 0;
+    }
+    c->token++;
+  }
 }
 
-double  Script::runRecursive(uint8_t** tokens, IotaLogRecord* oldRec, IotaLogRecord* newRec, units Units){
-  double elapsedHours = 1.0;
-  if(oldRec){
-    elapsedHours = newRec->logHours - oldRec->logHours;
+bool    Script::compile(){
+  trace(T_Script, 40);
+  int tokenCount = 0;
+  while(_tokens[tokenCount]) tokenCount++;
+
+  scriptCompiler c;
+  c.program = new uint8_t[tokenCount * 5 + 4];
+  c.pos = 0;
+  c.literals = new double[tokenCount * 2 + 2];
+  c.literalCount = 0;
+  c.constants = _constants;
+  c.token = _tokens;
+  c.overflow = false;
+
+  scriptValue result = compileLevel(&c);
+  if(result.isConst){
+    c.pos = 0;
+    c.literalCount = 0;
+    compileConst(&c, 0, result.value);
   }
-  double result = 0.0;
-  double operand = 0.0;
-  uint8_t pendingOp = opAdd;
-  int vchannel;
-  uint8_t *token = *tokens;
-  do
+  c.program[c.pos++] = popEnd;
+
+      // Check the stack depth.
+
+  int depth = 0;
+  int maxDepth = 0;
+  for(int i=0; i<c.pos; i++){
+    switch (c.program[i]) {
+      case popIntegration: i++;
+      case popConst:
+      case popInput:
+      case popVirtual: i++; depth++; break;
+      case popAbs:
+      case popNaN:
+      case popEnd: break;
+      default: depth--;
+    }
+    maxDepth = MAX(maxDepth, depth);
+  }
+
+  bool success = ! c.overflow && maxDepth <= SCRIPT_STACK_DEPTH;
+  if( ! success){
+    log("Script: %s is too complex.", _name);
+    c.pos = 0;
+    c.literalCount = 0;
+    compileConst(&c, 0, 0.0);
+    c.program[c.pos++] = popEnd;
+  }
+
+  delete[] _program;
+  delete[] _literals;
+  _program = new uint8_t[c.pos];
+  memcpy(_program, c.program, c.pos);
+  _depth = success ? maxDepth : 1;
+  _literals = new double[MAX(c.literalCount, 1)];
+  memcpy(_literals, c.literals, c.literalCount * sizeof(double));
+  delete[] c.program;
+  delete[] c.literals;
+  trace(T_Script, 41, c.pos);
+  return success;
+}
+
+//*****************************************************************************************
+//
+//      Program execution
+//
+//      Each lane has its own stack and units. Operands that depend on units
+//      are evaluated for each lane, operators are applied to every lane.
+//
+//*****************************************************************************************
+
+static double inputOperand(units Units, double accum1, double accum2, double volts, double hz, double elapsedHours){
+  switch (Units)
   {
-    uint8_t tokenType = *token & TOKEN_TYPE_MASK;
-    uint8_t tokenDetail = *token & ~TOKEN_TYPE_MASK;
-    switch (tokenType)
+    case Watts:
+      return accum1 / elapsedHours;
+
+    case Volts:
+      return volts / elapsedHours;
+
+    case Amps:
     {
-      case tokenOperator:
+      double va = accum2 / elapsedHours;
+      double v = volts / elapsedHours;
+      return v != 0.0 ? va / v : v;
+    }
 
-        switch (tokenDetail)
-        {
-          case opAdd:
-          case opSub:
-          case opMult:
-          case opDiv:
-          case opMin:
-          case opMax:
-            result = operate(result, pendingOp, operand);
-            pendingOp = *token;
-            operand = 0;
-            if (tokenDetail == opDiv || tokenDetail == opMult)
-              operand = 1;
-            break;
+    case VA:
+      return accum2 / elapsedHours;
 
-          case opAbs:
-            if (operand < 0)
-              operand = 0 - operand;
-            break;
+    case VAh:
+      return accum2;
 
-          case opPush:
-            token++;
-            operand = runRecursive(&token, oldRec, newRec, Units);
-            break;
+    case Hz:
+      return hz / elapsedHours;
+
+    case Wh:
+      return accum1;
+
+    case VAR:
+    {
+      double va = accum2 / elapsedHours;
+      double watts = accum1 / elapsedHours;
+      return sqrt(va * va - watts * watts);
+    }
+
+    case VARh:
+      return sqrt(accum2 * accum2 - accum1 * accum1);
 
-          case opPop:
-            *tokens = token;
-            return operate(result, pendingOp, operand);
+    default:
+      return 0.0;
+  }
+}
+
+static double virtualOperand(int channel, IotaLogRecord* oldRec, IotaLogRecord* newRec, units Units){
+  double operand = 0;
+  if (channel == 0 && simsolar)
+  {
+    if (oldRec) {
+      double elapsed = newRec->logHours - oldRec->logHours;
+      operand = simsolar->energy(localTime(oldRec->UNIXtime), localTime(newRec->UNIXtime)) * elapsed / (double(newRec->UNIXtime - oldRec->UNIXtime) / 3600);
+      if(Units == Watts){
+        operand /= double(newRec->UNIXtime - oldRec->UNIXtime) / 3600;
+      }
+    }
+    else {
+      operand = simsolar->power(localTime(newRec->UNIXtime));
+    }
+  }
+  return operand;
+}
+
+void    Script::execute(ScriptContext* context, const units* laneUnits, int lanes, double* results){
+  IotaLogRecord* oldRec = context->_oldRec;
+  IotaLogRecord* newRec = context->_newRec;
+  double elapsedHours = context->_elapsedHours;
+  double stack[SCRIPT_STACK_DEPTH][SCRIPT_LANES];
+  int sp = -1;
+  const uint8_t* pc = _program;
+
+  while(true){
+    switch (*pc++)
+    {
+      case popEnd:
+        for(int l=0; l<lanes; l++){
+          results[l] = sp >= 0 ? stack[sp][l] + 0.0 : 0.0;
+        }
+        return;
 
-          case opEq:
-            return operate(result, pendingOp, operand);
-        } // switch (tokenDetail)
+      case popConst:
+      {
+        double value = _literals[*pc++];
+        sp++;
+        for(int l=0; l<lanes; l++) stack[sp][l] = value;
         break;
+      }
 
-      case tokenConstant:
-        if(tokenDetail){
-          operand = _constants[tokenDetail - 1];
+      case popInput:
+      {
+        int input = *pc++;
+        double accum1, accum2, volts, hz;
+        context->input(input, &accum1, &accum2);
+        context->input(inputChannel[input]->_vchannel, &volts, &hz);
+        volts *= inputChannel[input]->_vmult;
+        sp++;
+        for(int l=0; l<lanes; l++){
+          double operand = inputOperand(laneUnits[l], accum1, accum2, volts, hz, elapsedHours);
+          stack[sp][l] = operand == operand ? operand : 0;
         }
-        else {
-          operand = 0;
+        break;
+      }
+
+      case popVirtual:
+      {
+        int channel = *pc++;
+        sp++;
+        for(int l=0; l<lanes; l++){
+          double operand = virtualOperand(channel, oldRec, newRec, laneUnits[l]);
+          stack[sp][l] = operand == operand ? operand : 0;
         }
         break;
+      }
 
-      case tokenInput:
+      case popIntegration:
       {
-        int input = *token & ~TOKEN_TYPE_MASK;
-        double accum1 = newRec->accum1[input] - (oldRec ? oldRec->accum1[input] : 0);
-        double accum2 = newRec->accum2[input] - (oldRec ? oldRec->accum2[input] : 0);
-        ;
-        vchannel = inputChannel[input]->_vchannel;
-        double volts = (newRec->accum1[vchannel] - (oldRec ? oldRec->accum1[vchannel] : 0)) * inputChannel[input]->_vmult;
-        double hz = newRec->accum2[vchannel] - (oldRec ? oldRec->accum2[vchannel] : 0);
-
-        switch (Units)
-        {
+        trace(T_Script, 30);
+        int index = *pc++;
+        char method = *pc++;
+        sp++;
+        for(int l=0; l<lanes; l++){
+          stack[sp][l] = context->integration(index, method, laneUnits[l]);
+        }
+        trace(T_Script, 30);
+        break;
+      }
 
-          case Watts:
-            operand = accum1 / elapsedHours;
-            break;
+      case popAdd:
+        sp--;
+        for(int l=0; l<lanes; l++) stack[sp][l] += stack[sp+1][l];
+        break;
 
-          case Volts:
-            operand = volts / elapsedHours;
-            break;
+      case popSub:
+        sp--;
+        for(int l=0; l<lanes; l++) stack[sp][l] -= stack[sp+1][l];
+        break;
 
-          case Amps:
-          {
-            double va = accum2 / elapsedHours;
-            operand = volts / elapsedHours;
-            if (operand != 0.0)
-            {
-              operand = va / operand;
-            }
-            break;
-          }
+      case popMult:
+        sp--;
+        for(int l=0; l<lanes; l++) stack[sp][l] *= stack[sp+1][l];
+        break;
 
-          case VA:
-            operand = accum2 / elapsedHours;
-            break;
+      case popDiv:
+        sp--;
+        for(int l=0; l<lanes; l++){
+          stack[sp][l] = stack[sp+1][l] == 0 ? 0 : stack[sp][l] / stack[sp+1][l];
+        }
+        break;
 
-          case VAh:
-            operand = accum2;
-            break;
+      case popMin:
+        sp--;
+        for(int l=0; l<lanes; l++){
+          if( ! (stack[sp][l] < stack[sp+1][l])) stack[sp][l] = stack[sp+1][l];
+        }
+        break;
 
-          case Hz:
-            operand = hz / elapsedHours;
-            break;
+      case popMax:
+        sp--;
+        for(int l=0; l<lanes; l++){
+          if( ! (stack[sp][l] > stack[sp+1][l])) stack[sp][l] = stack[sp+1][l];
+        }
+        break;
 
-          case Wh:
-            operand = accum1;
-            break;
+      case popAbs:
+        for(int l=0; l<lanes; l++){
+          if(stack[sp][l] < 0) stack[sp][l] = 0 - stack[sp][l];
+        }
+        break;
 
-          case VAR:
-          {
-            double va = accum2 / elapsedHours;
-            double watts = accum1 / elapsedHours;
-            operand = sqrt(va * va - watts * watts);
-            break;
-          }
+      case popNaN:
+        for(int l=0; l<lanes; l++){
+          if(stack[sp][l] != stack[sp][l]) stack[sp][l] = 0;
+        }
+        break;
 
-          case VARh:
-          {
-            double vah = accum2;
-            double wh = accum1;
-            operand = sqrt(vah * vah - wh * wh);
-            break;
-          }
+      default:
+        for(int l=0; l<lanes; l++) results[l] = 0.0;
+        return;
+    }
+  }
+}
 
-          default:
-            operand = 0.0;
-            break;
-             
-        } // switch (units)
+//*****************************************************************************************
+//
+//      Batch execution
+//
+//      Runs the program over consecutive pairs of records, (records[i], records[i+1]),
+//      with a stack row for each pair. Each instruction is dispatched once per batch
+//      and applied to every pair in an inner loop, so dispatch costs are amortized.
+//      Compound units take a pass for each basic unit.
+//
+//      work, if provided, must have room for (_depth + 1) * pairs doubles.
+//      On the device keep batches small; the work area is allocated from the heap.
+//
+//*****************************************************************************************
+
+void    Script::runBatch(IotaLogRecord** records, int pairs, double* results, units Units, double* work){
+  if(pairs <= 0) return;
+  double* allocated = nullptr;
+  if( ! work){
+    work = allocated = new double[(_depth + 1) * pairs];
+  }
+  double* other = work + _depth * pairs;
+
+  switch (Units)
+  {
+    case Watts:
+    case Volts:
+    case Amps:
+    case Hz:
+    case Wh:
+    case VAR:
+    case VARh:
+      executeBatch(records, pairs, Units, results, work);
+      break;
+
+    case VA:
+    case VAh:
+      executeBatch(records, pairs, Units == VA ? VAR : VARh, results, work);
+      executeBatch(records, pairs, Units == VA ? Watts : Wh, other, work);
+      for(int i=0; i<pairs; i++){
+        results[i] = sqrt(results[i] * results[i] + other[i] * other[i]);
+      }
+      break;
+
+    case kWh:
+      executeBatch(records, pairs, Wh, results, work);
+      for(int i=0; i<pairs; i++){
+        results[i] /= 1000.0;
+      }
+      break;
+
+    case PF:
+      executeBatch(records, pairs, Watts, results, work);
+      executeBatch(records, pairs, VA, other, work);
+      for(int i=0; i<pairs; i++){
+        results[i] /= other[i];
+      }
+      break;
+
+    default:
+      for(int i=0; i<pairs; i++){
+        results[i] = 0.0;
+      }
+  }
+
+  for(int i=0; i<pairs; i++){
+    if(results[i] != results[i]) results[i] = 0.0;
+  }
+  delete[] allocated;
+}
+
+void    Script::executeBatch(IotaLogRecord** records, int pairs, units Units, double* results, double* work){
+  double* top = nullptr;                      // Stack row of top entry
+  int sp = -1;
+  const uint8_t* pc = _program;
+
+  while(true){
+    uint8_t op = *pc++;
+    if(op >= popAdd && op <= popMax){
+      sp--;
+      double* operand = top;
+      top = work + sp * pairs;
+      switch (op)
+      {
+        case popAdd:
+          for(int i=0; i<pairs; i++) top[i] += operand[i];
+          break;
+
+        case popSub:
+          for(int i=0; i<pairs; i++) top[i] -= operand[i];
+          break;
+
+        case popMult:
+          for(int i=0; i<pairs; i++) top[i] *= operand[i];
+          break;
+
+        case popDiv:
+          for(int i=0; i<pairs; i++) top[i] = operand[i] == 0 ? 0 : top[i] / operand[i];
+          break;
+
+        case popMin:
+          for(int i=0; i<pairs; i++) if( ! (top[i] < operand[i])) top[i] = operand[i];
+          break;
+
+        case popMax:
+          for(int i=0; i<pairs; i++) if( ! (top[i] > operand[i])) top[i] = operand[i];
+          break;
+      }
+      continue;
+    }
+
+    switch (op)
+    {
+      case popEnd:
+        for(int i=0; i<pairs; i++){
+          results[i] = top ? top[i] + 0.0 : 0.0;
+        }
+        return;
+
+      case popConst:
+      {
+        double value = _literals[*pc++];
+        top = work + ++sp * pairs;
+        for(int i=0; i<pairs; i++) top[i] = value;
         break;
       }
 
-      case tokenVirtual:
+      case popInput:
       {
-        operand = 0;
-        if (tokenDetail == 0 && simsolar)
-        {
-          if (oldRec) {
-            double elapsed = newRec->logHours - oldRec->logHours;
-            operand = simsolar->energy(localTime(oldRec->UNIXtime), localTime(newRec->UNIXtime)) * elapsed / (double(newRec->UNIXtime - oldRec->UNIXtime) / 3600);
-            if(Units == Watts){
-              operand /= double(newRec->UNIXtime - oldRec->UNIXtime) / 3600;
-            }
-          }
-          else {
-            operand = simsolar->power(localTime(newRec->UNIXtime));
-          }
+        int input = *pc++;
+        int vchannel = inputChannel[input]->_vchannel;
+        double vmult = inputChannel[input]->_vmult;
+        top = work + ++sp * pairs;
+        for(int i=0; i<pairs; i++){
+          IotaLogRecord* oldRec = records[i];
+          IotaLogRecord* newRec = records[i+1];
+          double operand = inputOperand(Units,
+                                        newRec->accum1[input] - oldRec->accum1[input],
+                                        newRec->accum2[input] - oldRec->accum2[input],
+                                        (newRec->accum1[vchannel] - oldRec->accum1[vchannel]) * vmult,
+                                        newRec->accum2[vchannel] - oldRec->accum2[vchannel],
+                                        newRec->logHours - oldRec->logHours);
+          top[i] = operand == operand ? operand : 0;
         }
         break;
       }
 
-      case tokenIntegration:
+      case popVirtual:
       {
-        trace(T_Script, 30);
-        int index = tokenDetail;
+        int channel = *pc++;
+        top = work + ++sp * pairs;
+        for(int i=0; i<pairs; i++){
+          double operand = virtualOperand(channel, records[i], records[i+1], Units);
+          top[i] = operand == operand ? operand : 0;
+        }
+        break;
+      }
+
+      case popIntegration:
+      {
+        trace(T_Script, 32);
+        int index = *pc++;
+        char method = *pc++;
         Script *integration = integrations->first();
         while (index && integration)
         {
           integration = integration->next();
           index--;
         }
-        if (!integration)
-        {
-          trace(T_Script, 31);  
-          return 0;
+        integrator* _integrator = integration ? (integrator *)(integration->getParm()) : nullptr;
+        top = work + ++sp * pairs;
+        for(int i=0; i<pairs; i++){
+          double operand = _integrator ? _integrator->run(records[i], records[i+1], Units, method) : 0;
+          top[i] = operand == operand ? operand : 0;
         }
-        integrator *_integrator = (integrator *)(integration->getParm());
-        char method = *(++token);
+        break;
+      }
 
-        // Get integrated value
+      case popAbs:
+        for(int i=0; i<pairs; i++) if(top[i] < 0) top[i] = 0 - top[i];
+        break;
 
-        trace(T_Script, 30);
-        operand = _integrator->run(oldRec, newRec, Units, method);
-        trace(T_Script, 30);
+      case popNaN:
+        for(int i=0; i<pairs; i++) if(top[i] != top[i]) top[i] = 0;
         break;
+
+      default:
+        for(int i=0; i<pairs; i++) results[i] = 0.0;
+        return;
+    }
+  }
+}
+
+//*****************************************************************************************
+//
+//      ScriptContext
+//
+//*****************************************************************************************
+
+ScriptContext::ScriptContext(IotaLogRecord* oldRec, IotaLogRecord* newRec)
+      :_oldRec(oldRec)
+      ,_newRec(newRec)
+      ,_elapsedHours(1.0)
+      ,_valid(0)
+      ,_integrations(0)
+    {
+      if(oldRec){
+        _elapsedHours = newRec->logHours - oldRec->logHours;
       }
-    } // switch (tokenType)
+    }
 
-    if (operand != operand)
-      operand = 0;
+IotaLogRecord*  ScriptContext::oldRec() {return _oldRec;}
 
-  } while(*token++);
-  return 0;
+IotaLogRecord*  ScriptContext::newRec() {return _newRec;}
+
+double          ScriptContext::elapsedHours() {return _elapsedHours;}
+
+void    ScriptContext::input(int channel, double* accum1, double* accum2){
+  if(channel < SCRIPT_CONTEXT_INPUTS && (_valid & (1UL << channel))){
+    *accum1 = _accum1[channel];
+    *accum2 = _accum2[channel];
+    return;
+  }
+  *accum1 = _newRec->accum1[channel] - (_oldRec ? _oldRec->accum1[channel] : 0);
+  *accum2 = _newRec->accum2[channel] - (_oldRec ? _oldRec->accum2[channel] : 0);
+  if(channel < SCRIPT_CONTEXT_INPUTS){
+    _accum1[channel] = *accum1;
+    _accum2[channel] = *accum2;
+    _valid |= 1UL << channel;
+  }
 }
 
-double    Script::operate(double result, uint8_t token, double operand){
-        switch (token) {
-          case opAdd:  return result + operand;
-          case opSub:  return result - operand;
-          case opMult: return result * operand;
-          case opDiv:  return operand == 0 ? 0 : result / operand;
-          case opMin:  return result < operand ? result : operand;
-          case opMax:  return result > operand ? result : operand;
-          default:     return 0;        
-        }
+double  ScriptContext::integration(int index, char method, units Units){
+  for(int i=0; i<_integrations; i++){
+    if(_integration[i].index == index && _integration[i].method == method && _integration[i].units == Units){
+      return _integration[i].value;
+    }
+  }
+  Script *script = integrations->first();
+  for(int i=index; i && script; i--){
+    script = script->next();
+  }
+  double value = 0;
+  if(script){
+    value = ((integrator *)(script->getParm()))->run(_oldRec, _newRec, Units, method);
+    if(value != value) value = 0;
+  }
+  if(_integrations < SCRIPT_CONTEXT_INTEGRATIONS){
+    _integration[_integrations].index = index;
+    _integration[_integrations].method = method;
+    _integration[_integrations].units = Units;
+    _integration[_integrations++].value = value;
+  }
+  return value;
 }
 
 Script* ScriptSet::script(const char *name){
@@ -546,6 +1028,25 @@ Script* ScriptSet::script(const char *name){
   return nullptr;
 }
 
+          // Run each Script in the set over consecutive pairs of records
+          // in its own units. results is columnar, count() * pairs, with
+          // the results of the first Script in results[0 .. pairs-1].
+
+int   ScriptSet::runBatch(IotaLogRecord** records, int pairs, double* results){
+  if(pairs <= 0) return 0;
+  int depth = 1;
+  for(Script* script = _listHead; script; script = script->_next){
+    depth = MAX(depth, script->_depth);
+  }
+  double* work = new double[(depth + 1) * pairs];
+  for(Script* script = _listHead; script; script = script->_next){
+    script->runBatch(records, pairs, results, script->_units, work);
+    results += pairs;
+  }
+  delete[] work;
+  return pairs;
+}
+
           // Sort the Scripts in the set
           // Uses callback comparison
           // Simple bubble sort
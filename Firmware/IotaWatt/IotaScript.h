@@ -37,6 +37,32 @@ enum opCodes // Must match opChars[] in .cpp
   opPop   = 9
 };
 
+    // Scripts are compiled into a postfix program for a stack machine.
+    // Constant subexpressions are folded and the left to right
+    // evaluation of each level is preserved.
+
+enum programOps
+{
+  popEnd = 0,           // End of program, result is top of stack
+  popConst,             // Push constant [index]
+  popInput,             // Push input [channel] in the units of the lane
+  popVirtual,           // Push virtual [channel]
+  popIntegration,       // Push integration [index][method]
+  popAdd,
+  popSub,
+  popMult,
+  popDiv,
+  popMin,
+  popMax,
+  popAbs,               // Absolute value of top of stack
+  popNaN                // Replace NaN at top of stack with zero
+};
+
+#define SCRIPT_STACK_DEPTH 16
+#define SCRIPT_LANES 2
+#define SCRIPT_CONTEXT_INPUTS 15          // Inputs cached in ScriptContext (MAXINPUTS)
+#define SCRIPT_CONTEXT_INTEGRATIONS 6     // Integration operands cached in ScriptContext
+
 #define TOKEN_TYPE_MASK 0B11100000
 #define SCRIPT_CHAR_INPUT '@'
 #define SCRIPT_CHAR_CONSTANT '#'
@@ -52,6 +78,47 @@ enum tokenTypes
   tokenVirtual = 0x80
 };
 
+/*******************************************************************************************************
+ScriptContext
+Everything about a pair of records that Scripts need, computed when first needed and shared by
+all of the Scripts run with the same context. When several outputs are computed from the same 
+pair of records, create a context for the pair and run each Script with it, so that the input 
+deltas and integrations are computed once per pair rather than once per output.
+The records must not change while the context is in use.
+*******************************************************************************************************/
+class ScriptContext {
+
+  friend class Script;
+
+  public:
+
+    ScriptContext(IotaLogRecord* oldRec, IotaLogRecord* newRec);
+
+    IotaLogRecord*  oldRec();
+    IotaLogRecord*  newRec();
+    double          elapsedHours();
+
+  protected:
+
+    IotaLogRecord*  _oldRec;
+    IotaLogRecord*  _newRec;
+    double          _elapsedHours;
+    uint32_t        _valid;                                 // Bit map of inputs in _accum1, _accum2
+    double          _accum1[SCRIPT_CONTEXT_INPUTS];         // newRec - oldRec
+    double          _accum2[SCRIPT_CONTEXT_INPUTS];
+
+    struct integration {
+      uint8_t       index;
+      char          method;
+      uint8_t       units;
+      double        value;
+    }               _integration[SCRIPT_CONTEXT_INTEGRATIONS];
+    uint8_t         _integrations;
+
+    void            input(int channel, double* accum1, double* accum2);
+    double          integration(int index, char method, units Units);
+};
+
 class Script {
 
   friend class ScriptSet;
@@ -72,6 +139,9 @@ class Script {
     double  run(IotaLogRecord* oldRec, IotaLogRecord* newRec); // Run this Script
     double  run(IotaLogRecord* oldRec, IotaLogRecord* newRec, units); // Run w/overide units
     double  run(IotaLogRecord* oldRec, IotaLogRecord* newRec, const char* overideUnits);
+    double  run(ScriptContext*);                  // Run with shared context
+    double  run(ScriptContext*, units);
+    void    runBatch(IotaLogRecord** records, int pairs, double* results, units Units, double* work = nullptr);
 
     void    print();
     int     precision();
@@ -83,11 +153,15 @@ class Script {
     void*       _parm;      // External parameter 
     float*      _constants; // Constant values referenced in Script
     uint8_t*    _tokens;    // Script tokens
+    uint8_t*    _program;   // Compiled program
+    double*     _literals;  // Constants referenced in program
+    uint8_t     _depth;     // Stack entries used by program
     units       _units;     // Units to be computed              
 
-    double    runRecursive(uint8_t**, IotaLogRecord* oldRec, IotaLogRecord* newRec, units Units);
-    double    operate(double, byte, double);
+    void      execute(ScriptContext*, const units* laneUnits, int lanes, double* results);
+    void      executeBatch(IotaLogRecord** records, int pairs, units Units, double* results, double* work);
     bool      encodeScript(const char* script);
+    bool      compile();
 
 };
 
@@ -130,6 +204,7 @@ class ScriptSet {
     size_t    count();      // Retrieve count of Scripts in the set.
     Script*   first();      // Get -> first Script in set
     Script*   script(const char *name);
+    int       runBatch(IotaLogRecord** records, int pairs, double* results);
 
   private:
 
@@ -98,6 +98,7 @@ extern simSolar *simsolar;
 #define IOTA_HISTORY_LOG_PATH "/iotawatt/histlog.log"
 #define IOTA_MESSAGE_LOG_PATH "/iotawatt/iotamsgs.txt"
 #define IOTA_AUTH_PATH        "/iotawatt/auth.txt"
+#define IOTA_UPLOAD_CKP_PATH  "/iotawatt/upload.ckp"
 #define IOTA_CONFIG_PATH      "/config.txt"
 #define IOTA_CONFIG_NEW_PATH  "/config+1.txt"
 #define IOTA_CONFIG_OLD_PATH  "/config-1.txt"
@@ -195,7 +196,8 @@ struct EEprom {
 #define T_influx1 32       // influxDB_v1_uploader
 #define T_integrator 33    // Integrator class  
 #define T_Script 34
-#define T_Scriptset 35                        
+#define T_Scriptset 35
+#define T_IotaLog 36       // IotaLog asynchronous writer                        
 
       // LED codes
 
@@ -299,7 +301,7 @@ extern char *HTTPSproxy;                  // Host for nginx (or other) reverse H
 extern uploader *influxDB_v1;
 extern uploader *influxDB_v2;
 extern uploader *Emoncms;
-extern int32_t uploaderBufferLimit;       // Dynamic limit to try to control overload during recovery
+extern int32_t uploaderBufferLimit;       // Initial post size limit, uploaders adjust their own from there
 extern int32_t uploaderBufferTotal;       // Total aggregate target of uploader buffers       
 
       // ******************* WiFi connection  *************************************
@@ -373,7 +375,8 @@ uint32_t  timeSync(struct serviceBlock*);
 uint32_t  updater(struct serviceBlock*);
 uint32_t  WiFiService(struct serviceBlock*);
 uint32_t  exportLog(struct serviceBlock *_serviceBlock);
-uint32_t  getFeedData(); //(struct serviceBlock*);
+uint32_t  feedData(struct serviceBlock*);
+void      getFeedData();
 
 uint32_t  logReadKey(IotaLogRecord* callerRecord);
 
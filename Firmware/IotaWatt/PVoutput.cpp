@@ -391,19 +391,21 @@ uint32_t PVoutput::tickUploadStatus(){
     int    lastExtended(-1); 
     bool   haveExtended[6]{false,false,false,false,false,false};
 
+    ScriptContext context(oldRecord, newRecord);
+    ScriptContext energyContext(nullptr, newRecord);
     Script* script = _outputs->first();
     trace(T_PVoutput,88);
     while(script){
         if(strcmp(script->name(),"generation") == 0){
-            energyGeneration = script->run(nullptr, newRecord, Wh) - _baseGeneration;
-            powerGeneration = script->run(oldRecord, newRecord, Watts);
+            energyGeneration = script->run(&energyContext, Wh) - _baseGeneration;
+            powerGeneration = script->run(&context, Watts);
         }
         else if(strcmp(script->name(),"consumption") == 0){
-            energyConsumption = script->run(nullptr, newRecord, Wh) - _baseConsumption;
-            powerConsumption = script->run(oldRecord, newRecord, Watts);  
+            energyConsumption = script->run(&energyContext, Wh) - _baseConsumption;
+            powerConsumption = script->run(&context, Watts);  
         }
         else if(strcmp(script->name(),"voltage") == 0){
-            voltage = script->run(oldRecord, newRecord, Volts);    
+            voltage = script->run(&context, Volts);    
         }
         else if(strstr(script->name(),"extended_") == script->name()){
             long ndx = strtol(script->name()+9,nullptr,10) - 1;
@@ -412,7 +414,7 @@ uint32_t PVoutput::tickUploadStatus(){
                     lastExtended = ndx;
                 }
                 haveExtended[ndx] = true;
-                extended[ndx] = script->run(oldRecord, newRecord);
+                extended[ndx] = script->run(&context);
                 extendedPrecision[ndx] = script->precision();
             }
         }
@@ -423,17 +425,24 @@ uint32_t PVoutput::tickUploadStatus(){
 
     trace(T_PVoutput,88);
     if(powerGeneration >= 0){
-        reqData.printf(",%.0f,%.0f", energyGeneration, powerGeneration);
+        reqData.print(',');
+        printFixed(reqData, energyGeneration, 0);
+        reqData.print(',');
+        printFixed(reqData, powerGeneration, 0);
     } else {
         reqData.print(",,");
     }
     if(powerConsumption >= 0){
-        reqData.printf(",%.0f,%.0f", energyConsumption, powerConsumption);
+        reqData.print(',');
+        printFixed(reqData, energyConsumption, 0);
+        reqData.print(',');
+        printFixed(reqData, powerConsumption, 0);
     } else {
         reqData.print(",,");
     }
     if(voltage >= 0){
-        reqData.printf(",,%.1f", voltage);
+        reqData.print(",,");
+        printFixed(reqData, voltage, 1);
     } else {
         reqData.print(",,");
     }
@@ -441,7 +450,7 @@ uint32_t PVoutput::tickUploadStatus(){
         for(int ndx=0; ndx<=lastExtended; ndx++){
             reqData.print(',');
             if(haveExtended[ndx]){
-                reqData.printf("%.*f", extendedPrecision[ndx], extended[ndx]);
+                printFixed(reqData, extended[ndx], extendedPrecision[ndx]);
             }
         }
     }
@@ -577,12 +586,20 @@ uint32_t PVoutput::handle_HTTPpost_s(){
     } else {
         request->send();
     }
+    delete response;
+    response = new PVresponse;
     _state = HTTPwait;
     return 1;
 }
 
 uint32_t PVoutput::handle_HTTPwait_s(){
     trace(T_PVoutput,120);
+
+            // Capture the response as it arrives.
+
+    if(request->readyState() >= 3){
+        response->feed(request);
+    }
     if(request->readyState() != 4){
         return 1;
     }
@@ -618,13 +635,6 @@ uint32_t PVoutput::handle_HTTPwait_s(){
     _errorCount = 0;
     delete[] _statusMessage;
     _statusMessage = nullptr;
-    trace(T_PVoutput,122);
-
-            // Capture response.
-
-    trace(T_PVoutput,121);
-    delete response;
-    response = new PVresponse(request); 
     trace(T_PVoutput,122);
 
             // Interpret response code.
@@ -760,10 +770,31 @@ bool PVoutput::config(const char* configObj){
 //
 //******************************************************************************************************************
 
-PVresponse::PVresponse(asyncHTTPrequest* request){
-    _response = new char[request->available()+1];
-    _response[request->available()] = 0;
-    request->responseRead((uint8_t*)_response, request->available());
+    // Only the leading sections are kept, up to PV_RESPONSE_SIZE.
+    // That covers the getsystem and getstatus fields and the error messages,
+    // while a long addbatchstatus response is just counted as it's read.
+
+PVresponse::PVresponse()
+    :_length(0)
+    ,_sections(0)
+{
+    _response = new char[PV_RESPONSE_SIZE + 1];
+    _response[0] = 0;
+}
+
+void PVresponse::parse(const char* data, size_t len){
+    if(len && ! _sections){
+        _sections = 1;
+    }
+    for(size_t i=0; i<len; i++){
+        if(data[i] == ';'){
+            _sections++;
+        }
+        if(_sections <= PV_RESPONSE_SECTIONS && _length < PV_RESPONSE_SIZE){
+            _response[_length++] = data[i];
+        }
+    }
+    _response[_length] = 0;
 }
 
 PVresponse::~PVresponse(){
@@ -771,13 +802,7 @@ PVresponse::~PVresponse(){
 }
 
 size_t  PVresponse::sections(){
-    char* pointer = _response;
-    if(*pointer == 0) return 0;
-    size_t section = 0;
-    while(*pointer){
-        if(*(pointer++) == ';') section++;
-    }
-    return section + 1;
+    return _sections;
 }
 
 size_t PVresponse::items(int section){
@@ -845,14 +870,16 @@ String  PVresponse::peek(int length, int offset){
     if((length + offset) > len){
         length = len - offset;
     }
-    char* str = new char[length+1];
-    memcpy(str, _response+offset, length);
-    str[length] = 0;
-    return String(str);
+    String str;
+    str.reserve(length);
+    while(length--){
+        str += _response[offset++];
+    }
+    return str;
 }
 
 size_t  PVresponse::length(){
-    return strlen(_response);
+    return _length;
 }
 
 bool    PVresponse::contains(const char* string){
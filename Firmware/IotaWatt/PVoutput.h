@@ -34,15 +34,24 @@
 #define PV_DEFAULT_STATUS_DAYS 14                   // max status update lookback days default
 #define PV_DONATOR_STATUS_DAYS 90                   // max status update lookback days donator
 
+#define PV_RESPONSE_SIZE 511                        // max response text retained
+#define PV_RESPONSE_SECTIONS 3                      // max sections retained
+
         // PVresponse class is used to capture the response from any PVoutut API request and make them
         // intelligible as sets of items delimited by commas within sets of sections delimited by semicolons.
+        // The response is fed to it as it arrives and only the leading sections are kept.
 
-class PVresponse {
+class PVresponse : public responseParser {
     private:
-        char*       _response;                                  // The raw response string
+        char*       _response;                                  // The leading sections of the response
+        size_t      _length;                                    // strlen(_response)
+        size_t      _sections;                                  // Sections in the whole response
+
+    protected:
+        void        parse(const char* data, size_t len);
 
     public:
-        PVresponse(asyncHTTPrequest* request);
+        PVresponse();
         ~PVresponse();
         size_t      sections();                                 // number of sections in response
         size_t      items(int section=0);                       // number of items in given section
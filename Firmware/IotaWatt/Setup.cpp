@@ -217,7 +217,7 @@ if(spiffsBegin()){
 
   server.on(F("/edit"), HTTP_POST, returnOK, handleFileUpload);
   server.onNotFound(handleRequest);
-  const char * headerkeys[] = {"X-configSHA256"};
+  const char * headerkeys[] = {"X-configSHA256", "Range"};
   size_t headerkeyssize = sizeof(headerkeys)/sizeof(char*);
   server.collectHeaders(headerkeys, headerkeyssize );
   server.begin();
@@ -229,7 +229,7 @@ uploader *influxDB_v1 = nullptr;
 uploader *influxDB_v2 = nullptr;
 uploader *Emoncms = nullptr;
 
-int32_t uploaderBufferLimit = 3000;          // Dynamic limit to try to control overload during recovery
+int32_t uploaderBufferLimit = 3000;          // Initial post size limit, uploaders adjust their own from there
 int32_t uploaderBufferTotal = 6000;          // Total aggregate target of uploader buffers       
 
 // ****************************** Timing and time data **********************************
@@ -50,6 +50,10 @@
         dropDead();
       }
 
+      // Queue writes so SD latency doesn't delay sampling.
+
+      Current_log.asyncWrite(IOTALOG_ASYNC_DEPTH);
+
       // Initialize the IotaLogRecord accums in case no context.
 
       for(int i=0; i<MAXINPUTS; i++){
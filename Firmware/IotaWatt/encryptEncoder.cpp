@@ -0,0 +1,116 @@
+#include "IotaWatt.h"
+#include "encryptEncoder.h"
+
+encryptEncoder::encryptEncoder(const uint8_t* key)
+    :_chunkLen(0)
+    ,_carryLen(0)
+{
+    memcpy(_key, key, 16);
+    _cipher.setKey(_key, 16);
+}
+
+encryptEncoder::~encryptEncoder(){
+    _sha.clear();
+    _hmac.clear();
+    _cipher.clear();
+    memset(_key, 0, 16);
+}
+
+void encryptEncoder::begin(xbuf& out, const uint8_t* iv){
+    trace(T_encryptEncode,0);
+    _sha.reset();
+    _hmac.resetHMAC(_key, 16);
+    _cipher.setIV(iv, 16);
+    _chunkLen = 0;
+    _carryLen = 0;
+    base64(out, iv, 16);
+}
+
+size_t encryptEncoder::encode(xbuf& in, xbuf& out, size_t maxBytes){
+    trace(T_encryptEncode,1);
+    size_t consumed = 0;
+    while(consumed < maxBytes){
+        size_t len = ENCRYPT_CHUNK - _chunkLen;
+        if(len > maxBytes - consumed){
+            len = maxBytes - consumed;
+        }
+        len = in.read(_chunk + _chunkLen, len);
+        if(len == 0){
+            break;
+        }
+        _sha.update(_chunk + _chunkLen, len);
+        _hmac.update(_chunk + _chunkLen, len);
+        _chunkLen += len;
+        consumed += len;
+        if(_chunkLen == ENCRYPT_CHUNK){
+            _cipher.encrypt(_chunk, _chunk, ENCRYPT_CHUNK);
+            base64(out, _chunk, ENCRYPT_CHUNK);
+            _chunkLen = 0;
+        }
+    }
+    return consumed;
+}
+
+    // PKCS7 pad the last partial chunk to whole blocks, which adds a
+    // whole block when it's empty, then encode the base64 remainder.
+
+void encryptEncoder::finish(xbuf& out, uint8_t* hash, uint8_t* hmac){
+    trace(T_encryptEncode,2);
+    uint8_t block[16];
+    size_t whole = _chunkLen & ~15;
+    if(whole){
+        _cipher.encrypt(_chunk, _chunk, whole);
+        base64(out, _chunk, whole);
+    }
+    size_t len = _chunkLen - whole;
+    memcpy(block, _chunk + whole, len);
+    memset(block + len, 16 - len, 16 - len);
+    _cipher.encrypt(block, block, 16);
+    base64(out, block, 16);
+    _chunkLen = 0;
+
+    if(_carryLen){
+        uint8_t in[3] = {0, 0, 0};
+        memcpy(in, _carry, _carryLen);
+        uint8_t code[4];
+        code[0] = pgm_read_byte(base64codes_P + (in[0] >> 2));
+        code[1] = pgm_read_byte(base64codes_P + ((in[0] << 4 | in[1] >> 4) & 0x3f));
+        code[2] = _carryLen == 2 ? pgm_read_byte(base64codes_P + ((in[1] << 2) & 0x3f)) : '=';
+        code[3] = '=';
+        out.write(code, 4);
+        _carryLen = 0;
+    }
+    _sha.finalize(hash, 32);
+    _hmac.finalizeHMAC(_key, 16, hmac, 32);
+}
+
+    // Base64 encode whole groups of three, carrying any remainder
+    // over to the next call.
+
+void encryptEncoder::base64(xbuf& out, const uint8_t* in, size_t len){
+    uint8_t code[ENCRYPT_CHUNK / 3 * 4 + 4];
+    size_t codeLen = 0;
+    while(_carryLen && _carryLen < 3 && len){
+        _carry[_carryLen++] = *in++;
+        len--;
+    }
+    if(_carryLen == 3){
+        code[codeLen++] = pgm_read_byte(base64codes_P + (_carry[0] >> 2));
+        code[codeLen++] = pgm_read_byte(base64codes_P + ((_carry[0] << 4 | _carry[1] >> 4) & 0x3f));
+        code[codeLen++] = pgm_read_byte(base64codes_P + ((_carry[1] << 2 | _carry[2] >> 6) & 0x3f));
+        code[codeLen++] = pgm_read_byte(base64codes_P + (_carry[2] & 0x3f));
+        _carryLen = 0;
+    }
+    while(len >= 3){
+        code[codeLen++] = pgm_read_byte(base64codes_P + (in[0] >> 2));
+        code[codeLen++] = pgm_read_byte(base64codes_P + ((in[0] << 4 | in[1] >> 4) & 0x3f));
+        code[codeLen++] = pgm_read_byte(base64codes_P + ((in[1] << 2 | in[2] >> 6) & 0x3f));
+        code[codeLen++] = pgm_read_byte(base64codes_P + (in[2] & 0x3f));
+        in += 3;
+        len -= 3;
+    }
+    while(len--){
+        _carry[_carryLen++] = *in++;
+    }
+    out.write(code, codeLen);
+}
@@ -0,0 +1,49 @@
+#ifndef ENCRYPTENCODER_H
+#define ENCRYPTENCODER_H
+
+#include <arduino.h>
+#include <xbuf.h>
+#include <Crypto.h>
+#include <AES.h>
+#include <CBC.h>
+#include <SHA256.h>
+
+// Encrypted Emoncms payload encoder.
+//
+// Hashes the plaintext (SHA256 and HMAC-SHA256), encrypts it with AES128-CBC and
+// base64 encodes the IV and ciphertext, all in one pass over the input.
+// Works a few blocks at a time, so the input and output can be the same xbuf.
+// The crypto contexts are members, so one encoder serves every post with a given key.
+//
+//  encryptEncoder* enc = new encryptEncoder(key);
+//  size_t len = buf.available();
+//  enc->begin(buf, iv);
+//  enc->encode(buf, buf, len);
+//  enc->finish(buf, hash, hmac);
+
+#define ENCRYPT_BLOCKS 3                                // AES blocks per step, 3 keeps base64 aligned
+#define ENCRYPT_CHUNK (ENCRYPT_BLOCKS * 16)
+
+class encryptEncoder {
+    public:
+        encryptEncoder(const uint8_t* key);            // 16 byte key for both AES and HMAC
+        ~encryptEncoder();
+
+        void    begin(xbuf& out, const uint8_t* iv);    // Reset and write the 16 byte IV
+        size_t  encode(xbuf& in, xbuf& out, size_t maxBytes);  // Encode up to maxBytes of in, returns bytes consumed
+        void    finish(xbuf& out, uint8_t* hash, uint8_t* hmac);  // Pad, flush and return 32 byte hashes
+
+    private:
+        SHA256          _sha;
+        SHA256          _hmac;
+        CBC<AES128>     _cipher;
+        uint8_t         _key[16];
+        uint8_t         _chunk[ENCRYPT_CHUNK];          // Plaintext, then ciphertext
+        uint8_t         _carry[3];                      // Bytes awaiting base64 encoding
+        uint8_t         _chunkLen;
+        uint8_t         _carryLen;
+
+        void    base64(xbuf& out, const uint8_t* in, size_t len);
+};
+
+#endif
@@ -0,0 +1,229 @@
+#include "gzip.h"
+
+// Deflate (RFC 1951) length and distance code tables.
+
+static const uint16_t lengthBase[29] PROGMEM = {
+    3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+static const uint8_t lengthExtra[29] PROGMEM = {
+    0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+static const uint16_t distanceBase[30] PROGMEM = {
+    1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,
+    1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+static const uint8_t distanceExtra[30] PROGMEM = {
+    0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+
+// CRC32 a nibble at a time, to keep the table small.
+
+static const uint32_t crcTable[16] PROGMEM = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+
+gzipEncoder::gzipEncoder()
+    :_crc(0xFFFFFFFF)
+    ,_size(0)
+    ,_bits(0)
+    ,_bitCount(0)
+    ,_pos(0)
+    ,_end(0)
+    ,_header(false)
+{
+    _window = new uint8_t[GZIP_WINDOW * 2];
+    _head = new int16_t[GZIP_HASH_SIZE];
+    _prev = new int16_t[GZIP_WINDOW];
+    for(int i=0; i<GZIP_HASH_SIZE; i++){
+        _head[i] = -1;
+    }
+}
+
+gzipEncoder::~gzipEncoder(){
+    delete[] _window;
+    delete[] _head;
+    delete[] _prev;
+}
+
+size_t gzipEncoder::encode(xbuf& in, xbuf& out, size_t maxBytes){
+    size_t consumed = 0;
+    while(consumed < maxBytes && in.available()){
+        if(_end == GZIP_WINDOW * 2){
+            slide();
+        }
+        size_t len = GZIP_WINDOW * 2 - _end;
+        if(len > maxBytes - consumed){
+            len = maxBytes - consumed;
+        }
+        len = in.read(_window + _end, len);
+        if(len == 0){
+            break;
+        }
+        for(int i=_end; i<_end+len; i++){
+            _crc ^= _window[i];
+            _crc = (_crc >> 4) ^ pgm_read_dword(crcTable + (_crc & 15));
+            _crc = (_crc >> 4) ^ pgm_read_dword(crcTable + (_crc & 15));
+        }
+        _end += len;
+        _size += len;
+        consumed += len;
+        deflate(out, false);
+    }
+    return consumed;
+}
+
+void gzipEncoder::finish(xbuf& out){
+    deflate(out, true);
+    putCode(out, 0, 7);                         // End of block
+    if(_bitCount){
+        putBits(out, 0, 8 - _bitCount);
+    }
+    uint32_t crc = ~_crc;
+    for(int i=0; i<4; i++){
+        out.write((uint8_t)(crc >> (i * 8)));
+    }
+    for(int i=0; i<4; i++){
+        out.write((uint8_t)(_size >> (i * 8)));
+    }
+}
+
+    // Encode the window up to where a maximum length match would
+    // run off the end of the input, or all of it if final.
+
+void gzipEncoder::deflate(xbuf& out, bool final){
+    if( ! _header){
+        static const uint8_t header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff};
+        out.write(header, 10);
+        putBits(out, 3, 3);                     // BFINAL, fixed Huffman
+        _header = true;
+    }
+    while(_pos < _end && (final || (_end - _pos) >= GZIP_MAX_MATCH)){
+        int distance;
+        int length = match(_pos, &distance);
+        if(length){
+            putMatch(out, length, distance);
+            while(length--){
+                insert(_pos++);
+            }
+        }
+        else {
+            putLiteral(out, _window[_pos]);
+            insert(_pos++);
+        }
+    }
+}
+
+static inline int hash(const uint8_t* bytes){
+    uint32_t key = (bytes[0] << 16) | (bytes[1] << 8) | bytes[2];
+    return ((uint32_t)(key * 2654435761U) >> 23) & (GZIP_HASH_SIZE - 1);
+}
+
+void gzipEncoder::insert(int pos){
+    if(pos + GZIP_MIN_MATCH > _end){
+        return;
+    }
+    int h = hash(_window + pos);
+    _prev[pos & (GZIP_WINDOW - 1)] = _head[h];
+    _head[h] = pos;
+}
+
+    // Find the longest match in the hash chain.
+    // Each _prev entry is valid until its position is GZIP_WINDOW behind,
+    // so the chain ends at the first candidate that far back.
+
+int gzipEncoder::match(int pos, int* distance){
+    int maxLength = _end - pos;
+    if(maxLength > GZIP_MAX_MATCH){
+        maxLength = GZIP_MAX_MATCH;
+    }
+    if(maxLength < GZIP_MIN_MATCH){
+        return 0;
+    }
+    const uint8_t* target = _window + pos;
+    int candidate = _head[hash(target)];
+    int best = GZIP_MIN_MATCH - 1;
+    for(int chain=GZIP_MAX_CHAIN; chain && candidate >= 0; chain--){
+        int offset = pos - candidate;
+        if(offset <= 0 || offset >= GZIP_WINDOW){
+            break;
+        }
+        const uint8_t* source = _window + candidate;
+        if(source[best] == target[best] && source[0] == target[0]){
+            int length = 1;
+            while(length < maxLength && source[length] == target[length]){
+                length++;
+            }
+            if(length > best){
+                best = length;
+                *distance = offset;
+                if(length == maxLength){
+                    break;
+                }
+            }
+        }
+        candidate = _prev[candidate & (GZIP_WINDOW - 1)];
+    }
+    return best >= GZIP_MIN_MATCH ? best : 0;
+}
+
+void gzipEncoder::putBits(xbuf& out, uint32_t value, int count){
+    _bits |= value << _bitCount;
+    _bitCount += count;
+    while(_bitCount >= 8){
+        out.write((uint8_t)_bits);
+        _bits >>= 8;
+        _bitCount -= 8;
+    }
+}
+
+    // Huffman codes are packed most significant bit first.
+
+void gzipEncoder::putCode(xbuf& out, uint32_t code, int count){
+    uint32_t reversed = 0;
+    for(int i=0; i<count; i++){
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
+    }
+    putBits(out, reversed, count);
+}
+
+void gzipEncoder::putLiteral(xbuf& out, int literal){
+    if(literal < 144){
+        putCode(out, 0x30 + literal, 8);
+    }
+    else if(literal < 256){
+        putCode(out, 0x190 + literal - 144, 9);
+    }
+    else if(literal < 280){
+        putCode(out, literal - 256, 7);
+    }
+    else {
+        putCode(out, 0xC0 + literal - 280, 8);
+    }
+}
+
+void gzipEncoder::putMatch(xbuf& out, int length, int distance){
+    int code = 28;
+    while(pgm_read_word(lengthBase + code) > length){
+        code--;
+    }
+    putLiteral(out, 257 + code);
+    putBits(out, length - pgm_read_word(lengthBase + code), pgm_read_byte(lengthExtra + code));
+    code = 29;
+    while(pgm_read_word(distanceBase + code) > distance){
+        code--;
+    }
+    putCode(out, code, 5);
+    putBits(out, distance - pgm_read_word(distanceBase + code), pgm_read_byte(distanceExtra + code));
+}
+
+    // Move the upper half of the window down, and age the hash positions.
+    // Only called when the window is full and encoding has passed the midpoint.
+
+void gzipEncoder::slide(){
+    memmove(_window, _window + GZIP_WINDOW, GZIP_WINDOW);
+    _pos -= GZIP_WINDOW;
+    _end -= GZIP_WINDOW;
+    for(int i=0; i<GZIP_HASH_SIZE; i++){
+        _head[i] = _head[i] >= GZIP_WINDOW ? _head[i] - GZIP_WINDOW : -1;
+    }
+    for(int i=0; i<GZIP_WINDOW; i++){
+        _prev[i] = _prev[i] >= GZIP_WINDOW ? _prev[i] - GZIP_WINDOW : -1;
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef GZIP_H
+#define GZIP_H
+
+#include <arduino.h>
+#include <xbuf.h>
+
+// Small footprint gzip (RFC 1952) encoder for uploader POST bodies.
+//
+// Compresses an xbuf into another xbuf as a single fixed-Huffman deflate block.
+// Matches are found with a hash chain over a GZIP_WINDOW sliding window, which is
+// plenty for line protocol and bulk JSON where the repetition is line to line.
+// Heap use is about 4*GZIP_WINDOW + 2*GZIP_HASH_SIZE bytes while encoding.
+//
+//  gzipEncoder* gz = new gzipEncoder;
+//  while(in.available()) gz->encode(in, out, 256);     // Can be spread across dispatches
+//  gz->finish(out);
+//  delete gz;
+
+#define GZIP_WINDOW 1024                // Match distance limit (power of 2)
+#define GZIP_HASH_SIZE 512              // Hash heads (power of 2)
+#define GZIP_MAX_CHAIN 8                // Match candidates tried
+#define GZIP_MIN_MATCH 3
+#define GZIP_MAX_MATCH 258
+
+class gzipEncoder {
+    public:
+        gzipEncoder();
+        ~gzipEncoder();
+
+        size_t  encode(xbuf& in, xbuf& out, size_t maxBytes);  // Compress up to maxBytes of in, returns bytes consumed
+        void    finish(xbuf& out);                              // Flush remaining input and write trailer
+        size_t  inputSize(){return _size;}
+
+    private:
+        uint8_t*    _window;            // 2 * GZIP_WINDOW bytes of input
+        int16_t*    _head;              // Most recent window position of each hash
+        int16_t*    _prev;              // Previous position with same hash
+        uint32_t    _crc;
+        uint32_t    _size;              // Total input bytes
+        uint32_t    _bits;              // Pending output bits
+        int         _bitCount;
+        int         _pos;               // Next window position to encode
+        int         _end;               // End of input in window
+        bool        _header;            // Header has been written
+
+        void        deflate(xbuf& out, bool final);
+        void        insert(int pos);
+        int         match(int pos, int* distance);
+        void        putBits(xbuf& out, uint32_t value, int count);
+        void        putCode(xbuf& out, uint32_t code, int count);
+        void        putLiteral(xbuf& out, int literal);
+        void        putMatch(xbuf& out, int length, int distance);
+        void        slide();
+};
+
+#endif
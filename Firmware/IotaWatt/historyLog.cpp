@@ -116,6 +116,9 @@ uint32_t historyLog(struct serviceBlock* _serviceBlock){
       while((History_log.lastKey() + History_log.interval()) <= Current_log.lastKey()){
         
         trace(T_history,5);
+        if(Current_log.congested()){
+          return 10;
+        }
         if( ! logRecord){
           logRecord = new IotaLogRecord;
           logRecord->UNIXtime = History_log.lastKey(); 
@@ -146,6 +149,7 @@ uint32_t historyLog(struct serviceBlock* _serviceBlock){
         }
       }
       trace(T_history, 9);
+      History_log.asyncWrite(2);
       synchronized = true;
       return 0; 
     }
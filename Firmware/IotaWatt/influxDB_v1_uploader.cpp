@@ -126,42 +126,39 @@ uint32_t influxDB_v1_uploader::handle_write_s(){
     // If not enough data to post, set wait and return.
 
     if(Current_log.lastKey() < (_lastSent + _interval + (_interval * _bulkSend))){
-        if(oldRecord){
-            delete oldRecord;
-            oldRecord = nullptr;
-            delete newRecord;
-            newRecord = nullptr;
-        }
+        delete _scan;
+        _scan = nullptr;
         return UTCtime() + 1;
     }
 
-    // If datalog buffers not allocated, do so now and prime latest.
+    // If datalog scan not started, do so now and prime latest.
 
     trace(T_influx1,60);
-    if(! oldRecord){
+    if(! _scan){
         trace(T_influx1,61);
-        oldRecord = new IotaLogRecord;
-        newRecord = new IotaLogRecord;
-        newRecord->UNIXtime = _lastSent + _interval;
-        Current_log.readKey(newRecord);
+        _scan = new uploadFeed(_lastSent + _interval, _interval);
+    }
+
+    // Compile the line protocol keys if new config or device name.
+
+    if( ! _keys || ! _keysDevice || strcmp(_keysDevice, deviceName) != 0){
+        buildKeys();
     }
 
     // Build post transaction from datalog records.
 
-    while(reqData.available() < uploaderBufferLimit && newRecord->UNIXtime < Current_log.lastKey()){
+    while(reqData.available() < _batchLimit && _scan->key() < Current_log.lastKey()){
 
         if(micros() > bingoTime){
             return 10;
         }
         
-        // Swap newRecord top oldRecord, read next into newRecord.
+        // Advance the scan to the next pair of records.
 
         trace(T_influx1,60);
-        IotaLogRecord *swap = oldRecord;
-        oldRecord = newRecord;
-        newRecord = swap;
-        newRecord->UNIXtime = oldRecord->UNIXtime + _interval;
-        Current_log.readKey(newRecord);
+        _scan->next();
+        IotaLogRecord *oldRecord = _scan->oldRec();
+        IotaLogRecord *newRecord = _scan->newRec();
 
         // Compute the time difference between log entries.
         // If zero, don't bother.
@@ -178,41 +175,34 @@ uint32_t influxDB_v1_uploader::handle_write_s(){
 
         // Build measurements for this interval
 
-        trace(T_influx1,62); 
-        String lastMeasurement;
-        String thisMeasurement;
-        Script *script = _outputs->first();
-        while(script)
-        {
-            trace(T_influx1,63);     
-            double value = script->run(oldRecord, newRecord);
+        trace(T_influx1,62);
+        char timestamp[16];
+        int timestampLen = sprintf_P(timestamp, PSTR(" %d\n"), oldRecord->UNIXtime);
+        int line = 0;
+        ScriptContext context(oldRecord, newRecord);
+        for(int i=0; i<_keyCount; i++){
+            trace(T_influx1,63);
+            influxKey* key = _keys + i;
+            double value = key->script->run(&context);
             if(value == value){
-                trace(T_influx1,64);   
-                thisMeasurement = varStr(_measurement, script);
-                if(_staticKeySet && thisMeasurement.equals(lastMeasurement)){
-                    reqData.printf_P(PSTR(",%s=%.*f"), varStr(_fieldKey, script).c_str(), script->precision(), value);
+                trace(T_influx1,64);
+                if(key->group == line){
+                    reqData.write(',');
                 } else {
-                    if(lastMeasurement.length()){
-                        reqData.printf(" %d\n", oldRecord->UNIXtime);
-                    }
-                    reqData.write(thisMeasurement);
-                    if(_tagSet){
-                        trace(T_influx1,64);
-                        influxTag* tag = _tagSet;
-                        while(tag){
-                            reqData.printf_P(PSTR(",%s=%s"), tag->key, varStr(tag->value, script).c_str());
-                            tag = tag->next;
-                        }
+                    if(line){
+                        reqData.write(timestamp, timestampLen);
                     }
-                    trace(T_influx1,65);
-                    reqData.printf_P(PSTR(" %s=%.*f"), varStr(_fieldKey, script).c_str(), script->precision(), value);
+                    reqData.write(key->text, key->prefixLen);
+                    line = key->group;
                 }
+                reqData.write(key->text + key->prefixLen, key->fieldLen);
+                printFixed(reqData, value, key->script->precision());
             }
-            lastMeasurement = thisMeasurement;
-            script = script->next();
+        }
+        if(line){
+            reqData.write(timestamp, timestampLen);
         }
         _lastPost = oldRecord->UNIXtime;
-        reqData.printf(" %d\n", _lastPost);
     }
 
     // Add optional heap measurement
@@ -231,10 +221,8 @@ uint32_t influxDB_v1_uploader::handle_write_s(){
         reqData.printf_P(PSTR(" value=%d %d\n"), ESP.getFreeHeap(), UTCtime());
     }       
 
-    delete oldRecord;
-    oldRecord = nullptr;
-    delete newRecord;
-    newRecord = nullptr; 
+    delete _scan;
+    _scan = nullptr; 
 
     // Initiate HTTP post.
 
@@ -244,7 +232,7 @@ uint32_t influxDB_v1_uploader::handle_write_s(){
         endpoint += "&rp=";
         endpoint += _retention;
     }
-    HTTPPost(endpoint.c_str(), checkWrite_s, "text/plain");
+    HTTPPost(endpoint.c_str(), checkWrite_s, "text/plain", _gzip);
     return 1;
 }
 
@@ -261,7 +249,8 @@ uint32_t influxDB_v1_uploader::handle_checkWrite_s(){
     if(_request->responseHTTPcode() == 204){
         delete[] _statusMessage;
         _statusMessage = nullptr;
-        _lastSent = _lastPost; 
+        _lastSent = _lastPost;
+        writeCheckpoint();
         _state = write_s;
         trace(T_influx1,93);
         return 1;
@@ -319,6 +308,7 @@ bool influxDB_v1_uploader::configCB(JsonObject& config){
     delete _retention;
     _retention = charstar(config.get<const char*>(F("retp")));
     _heap = config.get<bool>(F("heap"));
+    _gzip = config.get<bool>(F("gzip"));
 
     trace(T_influx1, 101);
     delete[] _measurement;
@@ -342,7 +332,6 @@ bool influxDB_v1_uploader::configCB(JsonObject& config){
     delete _tagSet;
     _tagSet = nullptr;
     JsonArray &tagset = config[F("tagset")];
-    _staticKeySet = true;
     if (tagset.success())
     {
         trace(T_influx1, 103);
@@ -354,17 +343,10 @@ bool influxDB_v1_uploader::configCB(JsonObject& config){
             _tagSet = tag;
             tag->key = charstar(tagset[i][F("key")].as<const char *>());
             tag->value = charstar(tagset[i][F("value")].as<const char *>());
-            if ((strstr(tag->value, "$units") != nullptr) || (strstr(tag->value, "$name") != nullptr))
-                _staticKeySet = false;
         }
     }
     
-    // sort the measurements by measurement name
-
-    const char *measurement = _measurement;
-    _outputs->sort([this](Script* a, Script* b)->int {
-        return strcmp(varStr(_measurement, a).c_str(), varStr(_measurement, b).c_str());
-    });
+    deleteKeys();
 
     // If port wasn't specified, set influxDB_v1 default port.
 
@@ -376,6 +358,73 @@ bool influxDB_v1_uploader::configCB(JsonObject& config){
 }
     
 
+/*****************************************************************************************
+ *          buildKeys()
+ *
+ *  Substitute the measurement, tag values and field-key for each output once,
+ *  rather than for every output of every record.  Keys are sorted by prefix
+ *  (measurement and tag-set), and consecutive keys with the same prefix and
+ *  different field-keys are grouped to be written as one line.
+ * **************************************************************************************/
+void influxDB_v1_uploader::buildKeys(){
+    trace(T_influx1,70);
+    deleteKeys();
+    _keys = new influxKey[_outputs->count()];
+    _keysDevice = charstar(deviceName);
+    for(Script* script = _outputs->first(); script; script = script->next()){
+        String text = varStr(_measurement, script);
+        influxTag* tag = _tagSet;
+        while(tag){
+            text += ',';
+            text += tag->key;
+            text += '=';
+            text += varStr(tag->value, script);
+            tag = tag->next;
+        }
+        text += ' ';
+        int prefixLen = text.length();
+        text += varStr(_fieldKey, script);
+        text += '=';
+
+            // Insert after keys with lesser or equal prefix.
+
+        int i = _keyCount++;
+        while(i > 0 && strcmp(_keys[i-1].text, text.c_str()) > 0 &&
+              (_keys[i-1].prefixLen != prefixLen || memcmp(_keys[i-1].text, text.c_str(), prefixLen))){
+            _keys[i] = _keys[i-1];
+            i--;
+        }
+        _keys[i].script = script;
+        _keys[i].text = charstar(text.c_str());
+        _keys[i].prefixLen = prefixLen;
+        _keys[i].fieldLen = text.length() - prefixLen;
+    }
+
+    trace(T_influx1,71);
+    int group = 0;
+    for(int i=0; i<_keyCount; i++){
+        influxKey* key = _keys + i;
+        bool join = i && key->prefixLen == key[-1].prefixLen && memcmp(key->text, key[-1].text, key->prefixLen) == 0;
+        for(int j=i-1; join && j >= 0 && _keys[j].group == group; j--){
+            if(key->fieldLen == _keys[j].fieldLen && memcmp(key->text + key->prefixLen, _keys[j].text + _keys[j].prefixLen, key->fieldLen) == 0){
+                join = false;
+            }
+        }
+        key->group = join ? group : ++group;
+    }
+}
+
+void influxDB_v1_uploader::deleteKeys(){
+    for(int i=0; i<_keyCount; i++){
+        delete[] _keys[i].text;
+    }
+    delete[] _keys;
+    _keys = nullptr;
+    _keyCount = 0;
+    delete[] _keysDevice;
+    _keysDevice = nullptr;
+}
+
 String influxDB_v1_uploader::varStr(const char* in, Script* script)
 {
     // Return String with variable substitutions.
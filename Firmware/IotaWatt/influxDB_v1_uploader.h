@@ -16,7 +16,9 @@ class influxDB_v1_uploader : public uploader
             _fieldKey(0),
             _database(0),
             _measurement(0),
-            _staticKeySet(false),
+            _keys(0),
+            _keyCount(0),
+            _keysDevice(0),
             _heap(false)
         {
             _id = charstar("influxDB_v1");
@@ -30,6 +32,7 @@ class influxDB_v1_uploader : public uploader
             delete[] _user;
             delete[] _pwd;
             delete _tagSet;
+            deleteKeys();
             delete _outputs;
             influxDB_v1 = nullptr;
         };
@@ -55,13 +58,25 @@ class influxDB_v1_uploader : public uploader
             }
         } *_tagSet;
 
+            // Precompiled line protocol for each output, in prefix order.
+            // Consecutive outputs in the same group share a line.
+
+        struct influxKey {
+            Script*    script;
+            char*      text;            // measurement,tagset and space, then field-key=
+            uint16_t   prefixLen;
+            uint16_t   fieldLen;
+            uint16_t   group;
+        } *_keys;
+        int _keyCount;
+        char* _keysDevice;              // Copy of deviceName when keys were built
+
         char *_user;
         char *_pwd;
         char *_retention;
         char *_fieldKey;
         char *_database;
         char *_measurement;
-        bool _staticKeySet;
         bool _heap;
 
         void queryLast();
@@ -73,6 +88,8 @@ class influxDB_v1_uploader : public uploader
 
         void setRequestHeaders();
         String varStr(const char *in, Script *script);
+        void buildKeys();
+        void deleteKeys();
         int scriptCompare(Script *a, Script *b);
 };
 
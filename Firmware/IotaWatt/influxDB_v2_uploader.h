@@ -5,6 +5,27 @@
 
 extern uint32_t influxDB_v2_dispatch(struct serviceBlock *serviceBlock);
 
+        // Finds the _time column in the header of the last sent query's CSV
+        // and keeps its value from the first row.
+
+class fluxTimeParser : public fieldParser
+{
+    public:
+        fluxTimeParser();
+        bool        row(){return _row;};            // A row followed the header
+        const char* time(){return _time;};          // _time of the first row, "" if none
+
+    protected:
+        void        field(const char* text, char delimiter);
+
+    private:
+        int16_t     _line;
+        int16_t     _column;
+        int16_t     _timeColumn;
+        bool        _row;
+        char        _time[RESPONSE_FIELD];
+};
+
 class influxDB_v2_uploader : public uploader 
 {
     public:
@@ -16,7 +37,9 @@ class influxDB_v2_uploader : public uploader
             _token(0),
             _measurement(0),
             _fieldKey(0),
-            _staticKeySet(false),
+            _keys(0),
+            _keyCount(0),
+            _keysDevice(0),
             _heap(false)
         {
             _id = charstar("influxDB_v2");
@@ -29,6 +52,7 @@ class influxDB_v2_uploader : public uploader
             delete[] _measurement;
             delete[] _fieldKey;
             delete _tagSet;
+            deleteKeys();
             delete _outputs;
             influxDB_v2 = nullptr;
         };
@@ -54,6 +78,19 @@ class influxDB_v2_uploader : public uploader
                 delete   next;
             }
         } *_tagSet;
+
+            // Precompiled line protocol for each output, in prefix order.
+            // Consecutive outputs in the same group share a line.
+
+        struct influxKey {
+            Script*    script;
+            char*      text;            // measurement,tagset and space, then field-key=
+            uint16_t   prefixLen;
+            uint16_t   fieldLen;
+            uint16_t   group;
+        } *_keys;
+        int _keyCount;
+        char* _keysDevice;              // Copy of deviceName when keys were built
         
         uint32_t _lookbackHours;
         char *_orgID;
@@ -61,7 +98,6 @@ class influxDB_v2_uploader : public uploader
         char *_token;
         char *_measurement;
         char *_fieldKey;
-        bool _staticKeySet;
         bool _heap;
 
         uint32_t handle_query_s();
@@ -72,6 +108,8 @@ class influxDB_v2_uploader : public uploader
 
         void setRequestHeaders();
         String varStr(const char *in, Script *script);
+        void buildKeys();
+        void deleteKeys();
         int scriptCompare(Script *a, Script *b);
 };
 
@@ -1,13 +1,22 @@
 #include "iotawatt.h"
  
-    // The integrator Service is created at startup to synchronize the 
-    // integration log with the datalog, including [re]creating.
+    // The integrator Service is created at startup to open the 
+    // integration log, including [re]creating.
+    // It then joins the integrator_sync Service, which brings all of the
+    // unsynchronized integration logs up to date in one pass of the datalog.
     // When the log catches up to the datalog, the datalog Service
     // takes over with direct calls to create new entries at the
     // same time as datalog records, eliminating race conditions. 
 
 const char intDirectory_P[] PROGMEM = IOTA_INTEGRATIONS_DIR;
 
+static integrator*  syncList = nullptr;         // Integrators being synchronized
+static IotaLogScan* syncScan = nullptr;         // Shared scan of the datalog
+static uint32_t     syncKey = 0;                // Start of next interval to integrate
+static uint32_t     syncPassKey = 0;            // syncKey when the pass began
+static uint32_t     syncPassMs = 0;             // millis() when the pass began
+static bool         syncActive = false;         // integrator_sync is scheduled
+
 uint32_t integrator_dispatch(struct serviceBlock* serviceBlock) {
     trace(T_integrator,0);
     integrator *_this = (integrator *)serviceBlock->serviceParm;
@@ -28,6 +37,8 @@ uint32_t integrator::dispatch(struct serviceBlock *serviceBlock)
         case initialize_s:
             serviceBlock->priority = priorityLow;
             return handle_initialize_s();
+        case index_s:
+            return handle_index_s();
         case integrate_s:
             return handle_integrate_s();
         case end_s:
@@ -39,19 +50,41 @@ uint32_t integrator::dispatch(struct serviceBlock *serviceBlock)
 }
 
 integrator::~integrator(){
-    _log->end();
-    String filepath(FPSTR(intDirectory_P));
-    filepath += "/";
-    filepath += _name;
-    filepath += ".log";
-    SD.remove(filepath.c_str());
+    integrator **link = &syncList;
+    while(*link){
+        if(*link == this){
+            *link = _syncNext;
+            break;
+        }
+        link = &(*link)->_syncNext;
+    }
+    if(_log){
+        _log->end();
+        SD.remove(logPath(".log").c_str());
+        delete _log;
+    }
+    if(_hourLog){
+        _hourLog->end();
+        SD.remove(logPath(".hrs").c_str());
+        delete _hourLog;
+    }
+    if(_dayLog){
+        _dayLog->end();
+        SD.remove(logPath(".day").c_str());
+        delete _dayLog;
+    }
     log("%s: Integration log %s deleted.", _id, _name);
-    delete _log;
     delete[] _name;
-    delete _oldRec;
-    delete _newRec;
 };
 
+String integrator::logPath(const char* suffix){
+    String filepath(FPSTR(intDirectory_P));
+    filepath += '/';
+    filepath += _name;
+    filepath += suffix;
+    return filepath;
+}
+
 uint32_t integrator::handle_initialize_s(){
     trace(T_integrator,10);
 
@@ -73,15 +106,13 @@ uint32_t integrator::handle_initialize_s(){
     // Open the integration log
 
     trace(T_integrator,10);
-    String filepath(FPSTR(intDirectory_P));
-    filepath += '/';
-    filepath += _name;
-    filepath += ".log";
+    String filepath = logPath(".log");
     _log = new IotaLog(sizeof(intRecord), 5, 366, 32);
     trace(T_integrator,10);
     if(_log->begin(filepath.c_str())){
         log("%s: Couldn't open integration file %s.", _id, filepath.c_str());
         delete _log;
+        _log = nullptr;
         return 0;
     }
     trace(T_integrator,10);
@@ -103,68 +134,268 @@ uint32_t integrator::handle_initialize_s(){
         log("%s: New log starting %s", _id, localDateString(_intRec.UNIXtime).c_str());
     }
 
+    // Open the hourly and daily logs.
+
+    _hourLog = openCheckpoints(".hrs", INTEGRATOR_HOUR, INTEGRATOR_HOUR_DAYS, 24);
+    _dayLog = openCheckpoints(".day", INTEGRATOR_DAY, INTEGRATOR_DAY_DAYS, 8);
+
     _log->writeCache(true);
+    _state = index_s;
+    return 1;
+}
+
+        // Open an hourly or daily log of checkpoints.
+        // These are copies of the integration log entries at each interval, 
+        // kept much longer than the integration log itself.
+        // If a log doesn't overlap the integration log, it belongs to an 
+        // earlier incarnation, so start over and rebuild it from the log.
+
+IotaLog* integrator::openCheckpoints(const char* suffix, uint32_t interval, uint32_t days, int preformat){
+    String filepath = logPath(suffix);
+    IotaLog* checkpoints = new IotaLog(sizeof(intRecord), interval, days, preformat);
+    if(checkpoints->begin(filepath.c_str()) == 0 && checkpoints->fileSize() &&
+      (_log->fileSize() == 0 || checkpoints->lastKey() < _log->firstKey())){
+        log("%s: Checkpoints %s don't match log, rebuilding.", _id, suffix);
+        delete checkpoints;
+        SD.remove(filepath.c_str());
+        checkpoints = new IotaLog(sizeof(intRecord), interval, days, preformat);
+        checkpoints->begin(filepath.c_str());
+    }
+    if( ! checkpoints->isOpen()){
+        log("%s: Couldn't open checkpoint file %s.", _id, filepath.c_str());
+        delete checkpoints;
+        return nullptr;
+    }
+    return checkpoints;
+}
+
+        // Add any checkpoints missing from the hourly and daily logs.
+
+uint32_t integrator::handle_index_s(){
+    trace(T_integrator,15);
+    if( ! backfill(_hourLog) || ! backfill(_dayLog)){
+        return 10;
+    }
     _state = integrate_s;
     return 1;
 }
 
+        // Copy integration log entries to a checkpoint log.
+        // Returns false if out of time.
+
+bool integrator::backfill(IotaLog* checkpoints){
+    if( ! checkpoints || _log->fileSize() == 0){
+        return true;
+    }
+    uint32_t interval = checkpoints->interval();
+    uint32_t key = checkpoints->lastKey() + interval;
+    if(checkpoints->fileSize() == 0){
+        key = _log->firstKey() + interval - 1;
+        key -= key % interval;
+    }
+    intRecord checkpoint;
+    while(key <= _log->lastKey()){
+        checkpoint.UNIXtime = key;
+        _log->readKey((IotaLogRecord*)&checkpoint);
+        checkpoints->write((IotaLogRecord*)&checkpoint);
+        key += interval;
+        if((micros() + 2500) >= bingoTime){
+            return false;
+        }
+    }
+    return true;
+}
+
+        // Write checkpoints when the integration log reaches them.
+
+void integrator::checkpoint(){
+    if(_hourLog && (_intRec.UNIXtime % INTEGRATOR_HOUR) == 0){
+        _hourLog->write((IotaLogRecord*)&_intRec);
+    }
+    if(_dayLog && (_intRec.UNIXtime % INTEGRATOR_DAY) == 0){
+        _dayLog->write((IotaLogRecord*)&_intRec);
+    }
+}
+
+static bool covers(IotaLog* checkpoints, uint32_t key){
+    return checkpoints && checkpoints->fileSize() && 
+           (key % checkpoints->interval()) == 0 &&
+           key >= checkpoints->firstKey() && key <= checkpoints->lastKey();
+}
+
+        // Read an integration record by key from the coarsest log that has it.
+        // The integration log has no holes, so checkpoints are exact.
+        // Keys older than the integration log that aren't a checkpoint
+        // are missing. The sums are returned as NaN so that any
+        // difference taken with them is missing too.
+
+int integrator::readIntRecord(intRecord* rec){
+    uint32_t key = rec->UNIXtime;
+    IotaLog* source = _log;
+    if(covers(_dayLog, key)){
+        source = _dayLog;
+    }
+    else if(covers(_hourLog, key)){
+        source = _hourLog;
+    }
+    else if(key < _log->firstKey()){
+        rec->sumPositive = NAN;
+        rec->sumNegative = NAN;
+        rec->sumNet = NAN;
+        return 1;
+    }
+    int rtc = source->readKey((IotaLogRecord*)rec);
+    rec->UNIXtime = key;
+    return rtc;
+}
+
+        // Earliest key available from any of the logs.
+
+uint32_t integrator::firstKey(){
+    uint32_t first = _log->firstKey();
+    if(_hourLog && _hourLog->fileSize()){
+        first = MIN(first, _hourLog->firstKey());
+    }
+    if(_dayLog && _dayLog->fileSize()){
+        first = MIN(first, _dayLog->firstKey());
+    }
+    return first;
+}
+
+        // Join the synchronization pass.
+        // This integrator's Service is done, integrator_sync
+        // takes it from here.
+
 uint32_t integrator::handle_integrate_s(){
-    
-    // While data is available
+    trace(T_integrator,20);
+    _state = sync_s;
+    _syncBegin = _intRec.UNIXtime;
+    _syncNext = syncList;
+    syncList = this;
+    if( ! syncActive){
+        syncActive = true;
+        serviceBlock *sb = NewService(integrator_sync, T_integrator);
+        sb->priority = priorityLow;
+    }
+    return 0;
+}
 
-    while(Current_log.lastKey() >= _intRec.UNIXtime + _interval){
+        // Integrate one interval from the synchronization pass and log it.
 
-        if(!_oldRec){
-            _oldRec = new IotaLogRecord;
-            _newRec = new IotaLogRecord;
-            _newRec->UNIXtime = _intRec.UNIXtime;
-            Current_log.readKey(_newRec);
+void integrator::integrate(ScriptContext* context){
+    double elapsed = context->elapsedHours();
+    if(elapsed == elapsed && elapsed > 0){
+        double value = _script->run(context, Wh);
+        if(value > 0){
+            _intRec.sumPositive += value;
         }
-
-        if(_newRec->UNIXtime < _intRec.UNIXtime + _interval){
-            IotaLogRecord *swapRec = _oldRec;
-            _oldRec = _newRec;
-            _newRec = swapRec;
-            _newRec->UNIXtime = _oldRec->UNIXtime + _interval;
-            _newRec->serial = _oldRec->serial;
-            Current_log.readNext(_newRec);
+        else {
+            _intRec.sumNegative += value;
         }
+        _intRec.sumNet += value;
+    }
+    _intRec.UNIXtime += _interval;
+    _log->write((IotaLogRecord *)&_intRec);
+    checkpoint();
+}
 
-        // If this record is within interval, add to integral.
-
-        if(_newRec->UNIXtime <= _intRec.UNIXtime + _interval){
-            double elapsed = _newRec->logHours - _oldRec->logHours;
-            if(elapsed == elapsed && elapsed > 0){
-                double value = _script->run(_oldRec, _newRec, "Wh");
-                if(value > 0){
-                    _intRec.sumPositive += value;
-                }
-                else {
-                    _intRec.sumNegative += value;
-                }
-                _intRec.sumNet += value;
-            }
+void integrator::synchronized(){
+    _log->writeCache(false);
+    _log->asyncWrite(IOTALOG_ASYNC_DEPTH);
+    if(_hourLog){
+        _hourLog->asyncWrite(2);
+    }
+    if(_dayLog){
+        _dayLog->asyncWrite(2);
+    }
+    _synchronized = true;
+    queryCacheClear();
+    log("%s: Synchronized.", _id);
+}
+
+/******************************************************************************************
+ * 
+ *  integrator_sync Service
+ * 
+ *  Brings unsynchronized integration logs up to date with one forward pass of the datalog.
+ *  The pass starts at the earliest integration log and integrators join as it reaches
+ *  their last entries, so each record pair is read once and the Scripts of all of the
+ *  integrators are run from the same ScriptContext.  An integrator added while the pass
+ *  is in progress with an earlier last entry restarts the pass from there.
+ *  The integration logs use their write cache until synchronized.
+ * 
+ *****************************************************************************************/
+
+uint32_t integrator_sync(struct serviceBlock* serviceBlock){
+    trace(T_integrator,30);
+    if( ! syncList){
+        delete syncScan;
+        syncScan = nullptr;
+        syncActive = false;
+        return 0;
+    }
+
+        // Start or restart the pass at the earliest integration.
+
+    uint32_t first = syncList->_intRec.UNIXtime;
+    for(integrator *i = syncList; i; i = i->_syncNext){
+        first = MIN(first, i->_intRec.UNIXtime);
+    }
+    if( ! syncScan || first < syncKey){
+        delete syncScan;
+        syncKey = first;
+        syncScan = new IotaLogScan(&Current_log, syncKey, Current_log.interval());
+        syncPassKey = syncKey;
+        syncPassMs = millis();
+    }
+
+        // Integrate while data is available.
+
+    uint32_t interval = Current_log.interval();
+    while(Current_log.lastKey() >= syncKey + interval){
+
+            // Give way to the datalog if its SD writes are backing up.
+
+        if(Current_log.congested()){
+            return 10;
         }
 
-        // If integration complete for this interval, log it.
+            // Advance the scan to the end of this interval.
+            // Holes in the datalog yield pairs of the same record,
+            // which have no elapsed time and are not integrated.
 
-        if(_newRec->UNIXtime >= _intRec.UNIXtime + _interval){
-            _intRec.UNIXtime += _interval;
-            _log->write((IotaLogRecord *)&_intRec);
+        syncScan->next(syncKey + interval);
+        ScriptContext context(syncScan->oldRec(), syncScan->newRec());
+        trace(T_integrator,31);
+        for(integrator *i = syncList; i; i = i->_syncNext){
+            if(i->_intRec.UNIXtime == syncKey){
+                i->integrate(&context);
+            }
         }
+        syncKey += interval;
 
         if((micros() + 2500) >= bingoTime){
             return 10;
         }
     }
-    
-    delete _oldRec;
-    _oldRec = nullptr;
-    delete _newRec;
-    _newRec = nullptr;
-    _log->writeCache(false);
-    _synchronized = true;
-    return 0;
+
+        // Caught up with the datalog.
+        // Hand off to the datalog Service.
+
+    trace(T_integrator,32);
+    integrator **link = &syncList;
+    while(*link){
+        integrator *i = *link;
+        if(i->_intRec.UNIXtime + interval > Current_log.lastKey()){
+            *link = i->_syncNext;
+            i->_syncNext = nullptr;
+            i->synchronized();
+        }
+        else {
+            link = &i->_syncNext;
+        }
+    }
+    return 1;
 }
 
             // This method is invoked from the datalog Service when after a new entry is written.
@@ -177,7 +408,7 @@ void integrator::newLogEntry(IotaLogRecord* oldRecord, IotaLogRecord* newRecord)
     if(_synchronized){
         double elapsed = newRecord->logHours - oldRecord->logHours;
         if(elapsed == elapsed && elapsed > 0){
-            double value = _script->run(oldRecord, newRecord, "Wh");
+            double value = _script->run(oldRecord, newRecord, Wh);
             if(value >= 0){
                 _intRec.sumPositive += value;
             }
@@ -187,6 +418,42 @@ void integrator::newLogEntry(IotaLogRecord* oldRecord, IotaLogRecord* newRecord)
         }
         _intRec.UNIXtime += _interval;
         _log->write((IotaLogRecord *)&_intRec);
+        checkpoint();
+    }
+}
+
+        // Status for /status?integrations.
+        // While synchronizing, progress is the percent of this integration's
+        // catch-up completed and eta is the estimated seconds remaining
+        // at the current rate of the pass.
+
+void integrator::getStatusJson(JsonObject& status){
+    status.set(F("name"), _name);
+    if(_state == initialize_s || _state == end_s || ! _log){
+        status.set(F("state"), "starting");
+        return;
+    }
+    status.set(F("firstkey"), _log->firstKey());
+    status.set(F("lastkey"), _log->lastKey());
+    if(_hourLog && _hourLog->fileSize()){
+        status.set(F("hourfirstkey"), _hourLog->firstKey());
+    }
+    if(_dayLog && _dayLog->fileSize()){
+        status.set(F("dayfirstkey"), _dayLog->firstKey());
+    }
+    if(_synchronized){
+        status.set(F("state"), "synchronized");
+        return;
+    }
+    status.set(F("state"), "synchronizing");
+    uint32_t lastKey = Current_log.lastKey();
+    uint32_t done = _intRec.UNIXtime - _syncBegin;
+    uint32_t total = lastKey - _syncBegin;
+    status.set(F("progress"), total ? (100.0 * done / total) : 100.0, 1);
+    uint32_t elapsedMs = millis() - syncPassMs;
+    if(syncKey > syncPassKey && elapsedMs > 1000){
+        double rate = double(syncKey - syncPassKey) / elapsedMs;
+        status.set(F("eta"), (uint32_t)((lastKey - MIN(lastKey, _intRec.UNIXtime)) / rate / 1000));
     }
 }
 
@@ -206,8 +473,12 @@ bool integrator::isSynchronized(){
     return _synchronized;
 }
 
+        // Once the Service has handed off to integrator_sync or the datalog,
+        // nothing else holds this integrator and it can be deleted now.
+        // Until then, the Service deletes it the next time it runs.
+
 void integrator::end(){
-    if(_synchronized){
+    if(_synchronized || _state == sync_s){
         delete this;
     }
     else {
@@ -223,7 +494,11 @@ uint32_t integrator::handle_end_s(){
 
 double integrator::run(IotaLogRecord *oldRecord, IotaLogRecord *newRecord, units Units, char method){
     trace(T_integrator, 0);
-    if( ! _synchronized || newRecord->UNIXtime < _log->firstKey()){
+    if( ! _synchronized){
+        return 0;
+    }
+    uint32_t first = firstKey();
+    if(newRecord->UNIXtime < first){
         return 0;
     }
     
@@ -232,7 +507,7 @@ double integrator::run(IotaLogRecord *oldRecord, IotaLogRecord *newRecord, units
     if (!oldRecord)
     {
         trace(T_integrator, 1);
-        double operand = _script->run(oldRecord, newRecord, "Watts");
+        double operand = _script->run(oldRecord, newRecord, Watts);
         trace(T_integrator, 1);
 
         if (method == '+' && operand < 0)
@@ -248,15 +523,20 @@ double integrator::run(IotaLogRecord *oldRecord, IotaLogRecord *newRecord, units
 
     
     double elapsedHours = 0;
-    if(oldRecord->UNIXtime >= _log->firstKey()){
+    if(oldRecord->UNIXtime >= first){
         trace(T_integrator, 3);
         elapsedHours = newRecord->logHours - oldRecord->logHours;
     }
     else {
         trace(T_integrator, 4);
         IotaLogRecord baseRecord;
-        baseRecord.UNIXtime = _log->firstKey();
-        Current_log.readKey(&baseRecord);
+        baseRecord.UNIXtime = first;
+        if(first >= Current_log.firstKey()){
+            Current_log.readKey(&baseRecord);
+        }
+        else {
+            History_log.readKey(&baseRecord);
+        }
         elapsedHours = newRecord->logHours - baseRecord.logHours;
     }
     trace(T_integrator, 5);
@@ -293,14 +573,14 @@ double integrator::run(IotaLogRecord *oldRecord, IotaLogRecord *newRecord, units
     if(oldRecord->UNIXtime != oldInt->UNIXtime){
         oldInt->UNIXtime = oldRecord->UNIXtime;
         trace(T_integrator, 9);
-        int rtc = _log->readKey((IotaLogRecord*)oldInt); 
+        int rtc = readIntRecord(oldInt);
         trace(T_integrator, 9, rtc);
     }
 
     if(newRecord->UNIXtime != newInt->UNIXtime){
         newInt->UNIXtime = newRecord->UNIXtime;
         trace(T_integrator, 10);
-        int rtc = _log->readKey((IotaLogRecord*)newInt);
+        int rtc = readIntRecord(newInt);
         trace(T_integrator, 10, rtc);
     }
 
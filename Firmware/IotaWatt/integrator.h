@@ -2,10 +2,21 @@
 #define INTEGRATOR_H
 
 #include "iotaScript.h"
+#include "IotaLogRecord.h"
+
+#define INTEGRATOR_HOUR 3600            // Interval of hourly log
+#define INTEGRATOR_HOUR_DAYS 3660       // Retention of hourly log (10 years)
+#define INTEGRATOR_DAY 86400            // Interval of daily log
+#define INTEGRATOR_DAY_DAYS 36600       // Retention of daily log (100 years)
 class Script;
+class ScriptContext;
+
+uint32_t integrator_sync(struct serviceBlock*);
 
 class integrator {
 
+    friend uint32_t integrator_sync(struct serviceBlock*);
+
     public:
         integrator() :  _name(0),
                         _id(0),
@@ -13,8 +24,10 @@ class integrator {
                         _interval(5),
                         _synchronized(false),
                         _log(0),
-                        _oldRec(0),
-                        _newRec(0),
+                        _hourLog(0),
+                        _dayLog(0),
+                        _syncNext(0),
+                        _syncBegin(0),
                         _state(initialize_s){};
 
         ~integrator();
@@ -37,17 +50,12 @@ class integrator {
         int _interval;                  // aggregation interval
         bool _synchronized;             // integration log is up to date with datalog
         IotaLog *_log;                  // integration log
-        IotaLogRecord *_oldRec;         // datalog records used during synchronization
-        IotaLogRecord *_newRec;
+        IotaLog *_hourLog;              // hourly checkpoints of integration log
+        IotaLog *_dayLog;               // daily checkpoints of integration log
+        integrator *_syncNext;          // next integrator being synchronized
+        uint32_t _syncBegin;            // time synchronization began
 
-        struct intRecord {
-            uint32_t UNIXtime;          // Time period represented by this record
-            int32_t serial;             // record number in file
-            double sumPositive;         // Sum of positive intervals (import)
-            double sumNegative;         // Sum of the negative intervals (export)
-            double sumNet;                 // Superfluous but need to fill to factor of blocksize (32)
-            intRecord() : UNIXtime(0), serial(0), sumPositive(0), sumNegative(0), sumNet(0){}; 
-        } _intRec;
+        intRecord _intRec;              // Current integration (IotaLogRecord.h)
 
         intRecord _cache1, _cache2;     // The integration log cache reduces reads during queries
         intRecord *oldInt = &_cache1;
@@ -55,13 +63,24 @@ class integrator {
 
         enum states {
             initialize_s,
+            index_s,
             integrate_s,
+            sync_s,
             end_s
         } _state;
 
         uint32_t handle_initialize_s();
+        uint32_t handle_index_s();
         uint32_t handle_integrate_s();
         uint32_t handle_end_s();
+        void     integrate(ScriptContext*);
+        void     synchronized();
+        IotaLog* openCheckpoints(const char* suffix, uint32_t interval, uint32_t days, int preformat);
+        bool     backfill(IotaLog* checkpoints);
+        void     checkpoint();
+        int      readIntRecord(intRecord*);
+        uint32_t firstKey();
+        String   logPath(const char* suffix);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,68 @@
+#include "responseParser.h"
+
+void responseParser::feed(asyncHTTPrequest* request){
+    char chunk[RESPONSE_CHUNK];
+    while(request->available()){
+        size_t len = request->responseRead((uint8_t*)chunk, RESPONSE_CHUNK);
+        if( ! len){
+            break;
+        }
+        parse(chunk, len);
+    }
+}
+
+fieldParser::fieldParser(const char* delimiters)
+    :_delimiters(delimiters)
+    ,_len(0)
+    ,_pending(false)
+{
+    _field[0] = 0;
+}
+
+void fieldParser::parse(const char* data, size_t len){
+    for(size_t i=0; i<len; i++){
+        char c = data[i];
+        if(c && strchr(_delimiters, c)){
+            _field[_len] = 0;
+            field(_field, c);
+            _len = 0;
+            _pending = false;
+        }
+        else {
+            _pending = true;
+            if(c != '\r' && _len < RESPONSE_FIELD - 1){
+                _field[_len++] = c;
+            }
+        }
+    }
+}
+
+void fieldParser::end(){
+    if(_pending){
+        _field[_len] = 0;
+        field(_field, 0);
+        _len = 0;
+        _pending = false;
+    }
+}
+
+headParser::headParser(size_t size)
+    :_size(size)
+    ,_len(0)
+{
+    _text = new char[size];
+    _text[0] = 0;
+}
+
+headParser::~headParser(){
+    delete[] _text;
+}
+
+void headParser::parse(const char* data, size_t len){
+    if(len > _size - 1 - _len){
+        len = _size - 1 - _len;
+    }
+    memcpy(_text + _len, data, len);
+    _len += len;
+    _text[_len] = 0;
+}
@@ -0,0 +1,71 @@
+#ifndef RESPONSEPARSER_H
+#define RESPONSEPARSER_H
+
+#include <arduino.h>
+#include <asyncHTTPrequest.h>
+
+// Push parsers for asyncHTTPrequest responses.
+//
+// feed() passes whatever the request has received so far to parse(), a chunk at a time,
+// releasing the request's buffer as it goes.  It's called while the response is arriving
+// (readyState 3) and once more when it's complete (readyState 4), so parse() sees the
+// response in arbitrary pieces and keeps its place between them in its own state.
+// Parsers hold only the fields they are looking for, never a copy of the whole response.
+//
+//  parser->feed(request);                  // Each dispatch in readyState 3 and 4
+//  if(request->readyState() == 4) parser->end();
+
+#define RESPONSE_CHUNK 64
+#define RESPONSE_FIELD 32
+
+class responseParser {
+    public:
+        responseParser(){};
+        virtual ~responseParser(){};
+
+        void            feed(asyncHTTPrequest* request);        // Parse what has arrived so far
+        virtual void    end(){};                                // The response is complete
+
+    protected:
+        virtual void    parse(const char* data, size_t len) = 0;
+};
+
+// Splits the response into fields at any of the delimiters and presents each to field()
+// with the delimiter that ended it.  Fields are truncated to RESPONSE_FIELD-1 characters
+// and carriage returns are dropped, so CRLF lines parse the same as LF.  A last field
+// without a delimiter is presented by end() with delimiter 0.
+
+class fieldParser : public responseParser {
+    public:
+        fieldParser(const char* delimiters);
+        void            end();
+
+    protected:
+        virtual void    field(const char* text, char delimiter) = 0;
+        void            parse(const char* data, size_t len);
+
+    private:
+        const char*     _delimiters;
+        char            _field[RESPONSE_FIELD];
+        uint8_t         _len;
+        bool            _pending;                               // Characters since last delimiter
+};
+
+// Keeps the first size-1 bytes of the response, null terminated.
+
+class headParser : public responseParser {
+    public:
+        headParser(size_t size);
+        ~headParser();
+        const char*     text(){return _text;};
+
+    protected:
+        void            parse(const char* data, size_t len);
+
+    private:
+        char*           _text;
+        size_t          _size;
+        size_t          _len;
+};
+
+#endif
@@ -91,6 +91,9 @@ boolean setConfig(const char* configPath){
   }
   
   //************************************** Process misc first level stuff **************************
+
+  queryAbortAll();
+  queryCacheClear();
   
   delete[] updateClass;
   updateClass = charstar(Config[F("update")] | "NONE");
@@ -13,6 +13,8 @@ void uploader::getStatusJson(JsonObject& status)
         status.set(F("status"), "running");
     }
     status.set(F("lastpost"), _lastSent);
+    status.set(F("batch"), _batchLimit);
+    status.set(F("rate"), _rate, 2);
     if(_statusMessage){
         status.set(F("message"), _statusMessage);
     }
@@ -75,13 +77,15 @@ uint32_t uploader::dispatch(struct serviceBlock *serviceBlock)
 
 void uploader::stop(){
     log("%s: stopped, Last post %s", _id, localDateString(_lastSent).c_str());
-    delete oldRecord;
-    oldRecord = nullptr;
-    delete newRecord;
-    newRecord = nullptr;
+    delete _scan;
+    _scan = nullptr;
     // delete _request;
     // _request = nullptr;
     reqData.flush();
+    delete _encoder;
+    _encoder = nullptr;
+    delete _gzipData;
+    _gzipData = nullptr;
     delete _url;
     _url = nullptr;
     trace(T_uploader, 7);
@@ -103,14 +107,14 @@ uint32_t uploader::handle_stopped_s(){
     _statusMessage = nullptr;
     trace(T_uploader,8);
     _lastSent = 0;
-    _state = query_s;
+    _state = resumeCheckpoint() ? write_s : query_s;
     return 1;
 }
 
 uint32_t uploader::handle_initialize_s(){
     trace(T_uploader,10);
     log("%s: Starting, interval:%d, url:%s", _id, _interval, _url->build().c_str());
-    _state = query_s;
+    _state = resumeCheckpoint() ? write_s : query_s;
     return 1;
 }
 
@@ -129,12 +133,15 @@ uint32_t uploader::handle_initialize_s(){
 // Subsystem to initiate HTTP transactions and wait for completion.
 // Handles directing to HTTPS proxy when configured and requested.
 
-void uploader::HTTPPost(const char* endpoint, states completionState, const char* contentType){
+void uploader::HTTPPost(const char* endpoint, states completionState, const char* contentType, bool gzip){
     
     // Build a request control block for this request,
     // set state to handle the request and return to caller.
     // Actual post is done in next tick handler.
-    
+    // The caller may set _response after this.
+
+    delete _response;
+    _response = nullptr;
     if( ! _POSTrequest){
         _POSTrequest = new POSTrequest;
     }
@@ -143,6 +150,9 @@ void uploader::HTTPPost(const char* endpoint, states completionState, const char
     delete _POSTrequest->contentType;
     _POSTrequest->contentType = charstar(contentType);
     _POSTrequest->completionState = completionState;
+    _POSTrequest->gzip = gzip;
+    _POSTrequest->compressed = false;
+    _postSize = reqData.available();
     _state = HTTPpost_s;
 }
 
@@ -164,6 +174,35 @@ uint32_t uploader::handle_HTTPpost_s(){
         return 1;
     }
 
+    // Compress the body if requested.
+    // Done a slice at a time to give way to sampling,
+    // and only when there's heap for the encoder.
+
+    if(_POSTrequest->gzip && ! _encoder && ESP.getFreeHeap() < UPLOAD_GZIP_HEAP){
+        _POSTrequest->gzip = false;
+    }
+    if(_POSTrequest->gzip && ! _POSTrequest->compressed){
+        if( ! _encoder){
+            trace(T_uploader,127);
+            _encoder = new gzipEncoder;
+            _gzipData = new xbuf;
+        }
+        while(reqData.available()){
+            if(micros() > bingoTime){
+                return 1;
+            }
+            _encoder->encode(reqData, *_gzipData, UPLOAD_GZIP_SLICE);
+        }
+        trace(T_uploader,128);
+        _encoder->finish(*_gzipData);
+        delete _encoder;
+        _encoder = nullptr;
+        reqData.write(_gzipData, _gzipData->available());
+        delete _gzipData;
+        _gzipData = nullptr;
+        _POSTrequest->compressed = true;
+    }
+
     _HTTPtoken = HTTPreserve(T_uploader);
     if( ! _HTTPtoken){
         return 15;
@@ -207,18 +246,23 @@ uint32_t uploader::handle_HTTPpost_s(){
         _request->setReqHeader(F("X-proxypass"),  _url->build().c_str());
     }
     _request->setReqHeader(F("content-type"), _POSTrequest->contentType);
+    if(_POSTrequest->compressed){
+        _request->setReqHeader(F("Content-Encoding"), F("gzip"));
+    }
     trace(T_uploader,124);
     setRequestHeaders();
     if( ! _request->send(&reqData, reqData.available())){
         trace(T_uploader,125);
         HTTPrelease(_HTTPtoken);
         reqData.flush();
+        _POSTrequest->compressed = false;
         delete _request;
         _request = nullptr;
         _lastPost = _lastSent;
         return UTCtime() + 5;
     }
     reqData.flush();
+    _postStart = millis();
     trace(T_uploader,126);
     _state = HTTPwait_s;
     return 10; 
@@ -226,9 +270,23 @@ uint32_t uploader::handle_HTTPpost_s(){
 
 uint32_t uploader::handle_HTTPwait_s(){
     trace(T_uploader,90);
+
+    // Parse a successful response as it arrives,
+    // so it isn't held whole in the request.
+
+    if(_request && _response && _request->readyState() >= 3 && _request->responseHTTPcode() == 200){
+        trace(T_uploader,92);
+        _response->feed(_request);
+        if(_request->readyState() == 4){
+            _response->end();
+        }
+    }
     if(_request && _request->readyState() == 4){
         HTTPrelease(_HTTPtoken);
         trace(T_uploader,91);
+        if(_POSTrequest->completionState == checkWrite_s){
+            batchControl(_request->responseHTTPcode(), millis() - _postStart);
+        }
         delete[] _statusMessage;
         _statusMessage = nullptr;
         _state = _POSTrequest->completionState;
@@ -261,6 +319,124 @@ uint32_t uploader::handle_delay_s(){
     return UTCtime() + 1;
 }
 
+    // Adjust the post size limit after each write.
+    // Additive increase when a full post succeeds quickly with heap to spare,
+    // halve on timeout, 413, server error or low heap.
+    // Also maintains the smoothed upload rate in records per second.
+
+void uploader::batchControl(int HTTPcode, uint32_t elapsed){
+    trace(T_uploader,94);
+    uint32_t heap = ESP.getFreeHeap();
+    if(HTTPcode < 0 || HTTPcode == 413 || HTTPcode >= 500 || heap < UPLOAD_HEAP_LOW){
+        _batchLimit = MAX(_batchLimit / 2, UPLOAD_BATCH_MIN);
+        return;
+    }
+    if(HTTPcode < 200 || HTTPcode >= 300){
+        return;
+    }
+    if(_postSize >= _batchLimit && elapsed < UPLOAD_BATCH_FAST && heap > UPLOAD_HEAP_HIGH){
+        _batchLimit = MIN(_batchLimit + UPLOAD_BATCH_STEP, UPLOAD_BATCH_MAX);
+    }
+    uint32_t now = millis();
+    if(_rateTime && now > _rateTime){
+        float rate = (float)((_lastPost - _lastSent) / _interval) * 1000.0 / (now - _rateTime);
+        _rate = _rate ? _rate * 0.75 + rate * 0.25 : rate;
+    }
+    _rateTime = now;
+}
+
+//********************************************************************************************************************
+//
+//          CCC   H   H  EEEEE   CCC   K   K  PPPP    OOO    III   N   N  TTTTT
+//         C   C  H   H  E      C   C  K  K   P   P  O   O    I    NN  N    T
+//         C      HHHHH  EEE    C      KKK    PPPP   O   O    I    N N N    T
+//         C   C  H   H  E      C   C  K  K   P      O   O    I    N  NN    T
+//          CCC   H   H  EEEEE   CCC   K   K  P       OOO    III   N   N    T
+//
+//********************************************************************************************************************
+
+// The time of the last acknowledged post is kept in a small file on the SD,
+// one record per uploader, so a restart can resume without querying the server
+// for it.  The record is only used while the configuration hash is unchanged.
+
+    // FNV-1a hash of whatever is printed to it.
+
+class hashPrint : public Print {
+    public:
+        hashPrint():_hash(2166136261UL){};
+        size_t write(uint8_t c){_hash = (_hash ^ c) * 16777619UL; return 1;}
+        uint32_t value(){return _hash;}
+    private:
+        uint32_t _hash;
+};
+
+struct uploadCheckpoint {
+    uint32_t    id;             // Hash of uploader _id
+    uint32_t    configHash;
+    uint32_t    lastSent;
+};
+
+static uint32_t idHash(const char* id){
+    hashPrint hash;
+    hash.print(id);
+    return hash.value();
+}
+
+int32_t uploader::findCheckpoint(File& file, uint32_t id){
+    uploadCheckpoint record;
+    file.seek(0);
+    while(file.read((uint8_t*)&record, sizeof(record)) == sizeof(record)){
+        if(record.id == id){
+            return file.position() - sizeof(record);
+        }
+    }
+    return -1;
+}
+
+bool uploader::resumeCheckpoint(){
+    trace(T_uploader,130);
+    File file = SD.open(IOTA_UPLOAD_CKP_PATH, FILE_READ);
+    if( ! file){
+        return false;
+    }
+    uploadCheckpoint record;
+    _checkpointPos = findCheckpoint(file, idHash(_id));
+    if(_checkpointPos >= 0){
+        file.seek(_checkpointPos);
+        file.read((uint8_t*)&record, sizeof(record));
+    }
+    file.close();
+    if(_checkpointPos < 0 ||
+       record.configHash != _configHash ||
+       record.lastSent > Current_log.lastKey() ||
+       record.lastSent < Current_log.firstKey()){
+        return false;
+    }
+    _lastSent = record.lastSent;
+    if( ! _stop){
+        log("%s: Resume posting at %s", _id, localDateString(_lastSent + _interval).c_str());
+    }
+    return true;
+}
+
+void uploader::writeCheckpoint(){
+    trace(T_uploader,131);
+    File file = SD.open(IOTA_UPLOAD_CKP_PATH, FILE_WRITE);
+    if( ! file){
+        return;
+    }
+    uploadCheckpoint record = {idHash(_id), _configHash, _lastSent};
+    if(_checkpointPos < 0){
+        _checkpointPos = findCheckpoint(file, record.id);
+        if(_checkpointPos < 0){
+            _checkpointPos = file.size() - (file.size() % sizeof(record));
+        }
+    }
+    file.seek(_checkpointPos);
+    file.write((uint8_t*)&record, sizeof(record));
+    file.close();
+}
+
 //********************************************************************************************************************
 //
 //               CCC     OOO    N   N   FFFFF   III    GGG
@@ -294,6 +470,20 @@ bool uploader::config(const char *jsonConfig)
     }
     _revision = config["revision"];
 
+    // Hash the configuration, less the revision and stop that change
+    // with a stop/start, to tell if the upload checkpoint still applies.
+
+    {
+        hashPrint hash;
+        for(JsonObject::iterator it = config.begin(); it != config.end(); ++it){
+            if(strcmp(it->key, "revision") && strcmp(it->key, "stop")){
+                hash.print(it->key);
+                it->value.printTo(hash);
+            }
+        }
+        _configHash = hash.value();
+    }
+
     // parse and validate url
 
     trace(T_uploader, 100);
@@ -358,6 +548,7 @@ bool uploader::config(const char *jsonConfig)
     if(uploaders){
         uploaderBufferLimit = MIN(uploaderBufferTotal / uploaders, 4000);
     }
+    _batchLimit = uploaderBufferLimit;
 
     // Callback to derived class for unique configuration requirements
     // if that goes OK (true) then start the Service.
@@ -379,4 +570,104 @@ bool uploader::config(const char *jsonConfig)
     return false;
 }
 
-bool uploader::configCB(JsonObject &) { return true; };
\ No newline at end of file
+bool uploader::configCB(JsonObject &) { return true; };
+/*****************************************************************************************
+ *      uploadFeed - Current_log scan shared by the uploaders
+ * 
+ *      Each uploader used to read every record it posted through its own read-ahead
+ *      block, so with three uploaders running every record was read from the SD at
+ *      least three times.  Now a key in the block of any feed is copied from there.
+ *      Otherwise the feed refills its own block, starting with the last record of 
+ *      whichever block ends just short of the key, so a lagging uploader reads 
+ *      ahead sequentially without disturbing the blocks of the others.  Anything 
+ *      else is a keyed read that anchors the block.
+ ****************************************************************************************/
+
+uploadFeed* uploadFeed::_feeds = nullptr;
+
+uploadFeed::uploadFeed(uint32_t begin, uint32_t step)
+    :_blockCount(0)
+    ,_step(step)
+{
+    _block = new uint8_t[UPLOAD_FEED_RECORDS * Current_log.recordSize()];
+    _oldRec = new IotaLogRecord;
+    _newRec = new IotaLogRecord;
+    _next = _feeds;
+    _feeds = this;
+    _newRec->UNIXtime = begin;
+    readKey(_newRec);
+}
+
+uploadFeed::~uploadFeed(){
+    uploadFeed** link = &_feeds;
+    while(*link != this){
+        link = &(*link)->_next;
+    }
+    *link = _next;
+    delete[] _block;
+    delete _oldRec;
+    delete _newRec;
+}
+
+IotaLogRecord* uploadFeed::oldRec(){return _oldRec;}
+IotaLogRecord* uploadFeed::newRec(){return _newRec;}
+uint32_t uploadFeed::key(){return _newRec->UNIXtime;}
+
+bool uploadFeed::next(){
+    IotaLogRecord* swap = _oldRec;
+    _oldRec = _newRec;
+    _newRec = swap;
+    _newRec->UNIXtime = _oldRec->UNIXtime + _step;
+    readKey(_newRec);
+    return true;
+}
+
+IotaLogRecord* uploadFeed::blockRec(int index){
+    return (IotaLogRecord*)(_block + index * Current_log.recordSize());
+}
+
+int uploadFeed::readKey(IotaLogRecord* callerRecord){
+    IotaLog* log = &Current_log;
+    uint32_t interval = log->interval();
+    uint32_t key = callerRecord->UNIXtime - (callerRecord->UNIXtime % interval);
+    if( ! log->isOpen() || log->fileSize() == 0 || key <= log->firstKey() || key >= log->lastKey()){
+        return log->readKey(callerRecord);
+    }
+    for(int pass=0; pass<2; pass++){
+        int32_t fillSerial = -1;
+        for(uploadFeed* feed = _feeds; feed; feed = feed->_next){
+            if(feed->_blockCount){
+                IotaLogRecord* low = feed->blockRec(0);
+                IotaLogRecord* high = feed->blockRec(feed->_blockCount - 1);
+                if(key >= low->UNIXtime && key <= high->UNIXtime){
+                    int index = min(feed->_blockCount - 1, (int)((key - low->UNIXtime) / interval));
+                    while(feed->blockRec(index)->UNIXtime > key){
+                        index--;
+                    }
+                    memcpy(callerRecord, feed->blockRec(index), log->recordSize());
+                    callerRecord->UNIXtime = key;
+                    return 0;
+                }
+                if(key > high->UNIXtime && (key - high->UNIXtime) / interval < UPLOAD_FEED_RECORDS){
+                    fillSerial = high->serial;
+                }
+            }
+        }
+
+            // Not in a block. Read ahead from the end of a block
+            // when close, else keyed read to find where to start.
+
+        if(fillSerial < 0){
+            int rtc = log->readKey(callerRecord);
+            if(rtc == 0){
+                _blockCount = log->readBlock(_block, callerRecord->serial, UPLOAD_FEED_RECORDS);
+            }
+            return rtc;
+        }
+        _blockCount = log->readBlock(_block, fillSerial, UPLOAD_FEED_RECORDS);
+        if(_blockCount == 0){
+            break;
+        }
+    }
+    return log->readKey(callerRecord);
+}
@@ -2,20 +2,62 @@
 #define UPLOADER_H
 #include "IotaWatt.h"
 #include "xurl.h"
+#include "gzip.h"
+#include "responseParser.h"
 
 #define DEFAULT_BUFFER_LIMIT 4000
+#define UPLOAD_FEED_RECORDS 6           // Records per read-ahead block
+#define UPLOAD_GZIP_SLICE 256           // Bytes compressed between checks for sampling
+#define UPLOAD_GZIP_HEAP 12000          // Minimum free heap to compress a post
+#define UPLOAD_BATCH_MIN 1000           // Smallest post limit (bytes)
+#define UPLOAD_BATCH_MAX 8000           // Largest post limit (bytes)
+#define UPLOAD_BATCH_STEP 500           // Increase after a full post that was quick
+#define UPLOAD_BATCH_FAST 1500          // Response time (ms) considered quick
+#define UPLOAD_HEAP_HIGH 20000          // Free heap needed to increase post limit
+#define UPLOAD_HEAP_LOW 12000           // Free heap that halves post limit
 
 extern uint32_t uploader_dispatch(struct serviceBlock *serviceBlock);
 
+        // Iterates over the Current_log like IotaLogScan, yielding pairs of records
+        // (oldRec, newRec) that bracket each step.  Each feed has a read-ahead block,
+        // and looks for records in the blocks of all of the feeds before reading, 
+        // so uploaders at about the same place in the log read it once between them.
+
+class uploadFeed
+{
+    public:
+        uploadFeed(uint32_t begin, uint32_t step);
+        ~uploadFeed();
+
+        bool            next();                 // Advance one step
+        IotaLogRecord*  oldRec();               // Record at the beginning of the current step
+        IotaLogRecord*  newRec();               // Record at the end of the current step
+        uint32_t        key();                  // Key of newRec
+
+    protected:
+
+        uploadFeed*     _next;                  // -> next feed in list
+        IotaLogRecord*  _oldRec;
+        IotaLogRecord*  _newRec;
+        uint8_t*        _block;                 // Read-ahead block
+        int             _blockCount;            // Records in block
+        uint32_t        _step;
+
+        static uploadFeed* _feeds;              // List of all feeds
+
+        int             readKey(IotaLogRecord*);
+        IotaLogRecord*  blockRec(int index);
+};
+
 class uploader
 {
     public:
         uploader() : 
-                    newRecord(0),
-                    oldRecord(0),
+                    _scan(0),
                     _state(initialize_s),
                     _url(0),
                     _request(0),
+                    _response(0),
                     _interval(0),
                     _bulkSend(1),
                     _revision(-1),
@@ -29,7 +71,17 @@ class uploader
                     _script(0),
                     _stop(false),
                     _end(false),
-                    _useProxyServer(true)
+                    _useProxyServer(true),
+                    _gzip(false),
+                    _encoder(0),
+                    _gzipData(0),
+                    _batchLimit(DEFAULT_BUFFER_LIMIT),
+                    _postSize(0),
+                    _postStart(0),
+                    _rateTime(0),
+                    _rate(0),
+                    _configHash(0),
+                    _checkpointPos(-1)
 
         {};
         
@@ -37,9 +89,11 @@ class uploader
             delete[] _statusMessage;
             delete _POSTrequest;
             delete _request;
-            delete newRecord;
-            delete oldRecord;
+            delete _response;
+            delete _scan;
             delete _url;
+            delete _encoder;
+            delete _gzipData;
         };
 
         uint32_t dispatch(struct serviceBlock *serviceBlock);
@@ -52,8 +106,7 @@ class uploader
 
     protected:
 
-        IotaLogRecord *newRecord;
-        IotaLogRecord *oldRecord;
+        uploadFeed *_scan;              // Datalog scan while building a post
 
         enum states {
             initialize_s,
@@ -73,13 +126,16 @@ class uploader
             char*   endpoint;
             char*   contentType;
             states  completionState;
-            POSTrequest():endpoint(nullptr),contentType(nullptr){};
+            bool    gzip;               // Compress the body
+            bool    compressed;         // Body is compressed
+            POSTrequest():endpoint(nullptr),contentType(nullptr),gzip(false),compressed(false){};
             ~POSTrequest(){delete[] endpoint; delete[] contentType;}
         };
 
         xurl* _url;
         xbuf reqData;
         asyncHTTPrequest *_request;
+        responseParser *_response;      // Parses a successful response as it arrives, set after HTTPPost
 
         int16_t _interval;
         int16_t _bulkSend;
@@ -90,6 +146,18 @@ class uploader
         bool _stop;
         bool _end;
         bool _useProxyServer;
+        bool _gzip;                     // Server accepts Content-Encoding: gzip
+        gzipEncoder *_encoder;          // Compressor while compressing a post
+        xbuf *_gzipData;                // Compressed post
+
+        int32_t _batchLimit;            // Current post size limit (bytes)
+        int32_t _postSize;              // Uncompressed size of current post
+        uint32_t _postStart;            // millis() when post sent
+        uint32_t _rateTime;             // millis() of last successful write
+        float _rate;                    // Smoothed records per second
+
+        uint32_t _configHash;           // Hash of configuration, less revision and stop
+        int32_t _checkpointPos;         // Position of checkpoint record, -1 if unknown
 
         uint32_t _lastSent;
         uint32_t _lastPost;
@@ -110,8 +178,12 @@ class uploader
         virtual uint32_t handle_HTTPwait_s();
         virtual uint32_t handle_delay_s();
 
-        virtual void HTTPPost(const char *endpoint, states completionState, const char *contentType);
+        virtual void HTTPPost(const char *endpoint, states completionState, const char *contentType, bool gzip = false);
         virtual void delay(uint32_t seconds, states resumeState);
+        void batchControl(int HTTPcode, uint32_t elapsed);
+        bool resumeCheckpoint();
+        void writeCheckpoint();
+        int32_t findCheckpoint(File& file, uint32_t id);
 };
 
 #endif
\ No newline at end of file
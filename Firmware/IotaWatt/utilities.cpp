@@ -102,6 +102,174 @@ void   hex2bin(uint8_t* out, const char* in, size_t len){
     }
 }
 
+/**************************************************************************************************
+ * Fixed point formatting of doubles, the same as printf("%.*f"), or with trim the same as "%#.*f" 
+ * with trailing fractional zeros and decimal point removed.  The result is correctly rounded 
+ * (nearest, ties to even) from the exact binary value using integer arithmetic, 
+ * so no printf, floating point library or heap.  Decimals are limited to 0-9.
+ * Like snprintf, output that doesn't fit in size is truncated, and the length of the untruncated
+ * result is returned, so a return of size or more means it didn't fit.
+ * ************************************************************************************************/
+static const uint32_t pow10_P[] PROGMEM = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+int formatFixed(char* buf, size_t size, double value, int decimals, bool trim){
+  int len = 0;
+  auto put = [&](char c){
+    if(len + 1 < (int)size) buf[len] = c;
+    len++;
+  };
+  auto putDigits = [&](uint32_t n, int width){
+    char digits[10];
+    int count = 0;
+    do {
+      digits[count++] = '0' + n % 10;
+      n /= 10;
+    } while(n || count < width);
+    while(count) put(digits[--count]);
+  };
+
+  decimals = MAX(0, MIN(9, decimals));
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  int exponent = (bits >> 52) & 0x7FF;
+  uint64_t mantissa = bits & 0xFFFFFFFFFFFFFULL;
+  if(bits >> 63){
+    put('-');
+  }
+  if(exponent == 0x7FF){
+    const char* special = mantissa ? "nan" : "inf";
+    while(*special) put(*special++);
+    if(size) buf[MIN(len, (int)size - 1)] = 0;
+    return len;
+  }
+  if(exponent){
+    mantissa |= 1ULL << 52;
+  }
+  int shift = 1075 - MAX(exponent, 1);             // value = mantissa / 2^shift
+  uint32_t scale = pgm_read_dword(pow10_P + decimals);
+  uint64_t integer = 0;
+  uint32_t fraction = 0;
+
+  if(shift <= -12){
+
+        // Integer too big for uint64. Build it in 32 bit limbs
+        // and divide out 9 digit chunks, least significant first.
+
+    uint32_t limb[36];
+    uint32_t chunk[36];
+    int limbs = (-shift) / 32 + 3;
+    memset(limb, 0, sizeof(limb));
+    int bit = (-shift) % 32;
+    limb[(-shift) / 32] = (uint32_t)(mantissa << bit);
+    limb[(-shift) / 32 + 1] = (uint32_t)((mantissa << bit) >> 32);
+    limb[(-shift) / 32 + 2] = bit ? (uint32_t)(mantissa >> (64 - bit)) : 0;
+    int chunks = 0;
+    while(limbs){
+      uint64_t rem = 0;
+      for(int i=limbs-1; i>=0; i--){
+        uint64_t cur = (rem << 32) | limb[i];
+        limb[i] = cur / 1000000000UL;
+        rem = cur % 1000000000UL;
+      }
+      chunk[chunks++] = rem;
+      while(limbs && limb[limbs-1] == 0) limbs--;
+    }
+    putDigits(chunk[--chunks], 1);
+    while(chunks) putDigits(chunk[--chunks], 9);
+  }
+  else {
+    uint64_t fractionBits = 0;
+    if(shift <= 0){
+      integer = mantissa << (-shift);
+    }
+    else if(shift < 64){
+      integer = mantissa >> shift;
+      fractionBits = mantissa & ((1ULL << shift) - 1);
+    }
+    else {
+      fractionBits = mantissa;
+    }
+
+        // fraction = round(fractionBits * scale / 2^shift), 
+        // with the product in 128 bits (hi:lo).
+
+    if(fractionBits && shift < 128){
+      uint64_t low = (fractionBits & 0xFFFFFFFFUL) * scale;
+      uint64_t mid = (fractionBits >> 32) * scale;
+      uint64_t lo = low + (mid << 32);
+      uint64_t hi = (mid >> 32) + (lo < low);
+      uint64_t q, remHi, remLo, halfHi, halfLo;
+      if(shift < 64){
+        q = (hi << (64 - shift)) | (lo >> shift);
+        remHi = 0;
+        remLo = lo & ((1ULL << shift) - 1);
+        halfHi = 0;
+        halfLo = 1ULL << (shift - 1);
+      }
+      else {
+        q = shift == 64 ? hi : hi >> (shift - 64);
+        remHi = shift == 64 ? 0 : hi & ((1ULL << (shift - 64)) - 1);
+        remLo = lo;
+        halfHi = shift == 64 ? 0 : 1ULL << (shift - 65);
+        halfLo = shift == 64 ? 1ULL << 63 : 0;
+      }
+      if(remHi > halfHi || (remHi == halfHi && (remLo > halfLo || (remLo == halfLo && ((decimals ? q : integer) & 1))))){
+        q++;
+      }
+      if(q >= scale){
+        q -= scale;
+        integer++;
+      }
+      fraction = q;
+    }
+    if(integer >= 1000000000UL){
+      uint64_t high = integer / 1000000000UL;
+      if(high >= 1000000000UL){
+        putDigits(high / 1000000000UL, 1);
+        putDigits(high % 1000000000UL, 9);
+      }
+      else {
+        putDigits(high, 1);
+      }
+      putDigits(integer % 1000000000UL, 9);
+    }
+    else {
+      putDigits(integer, 1);
+    }
+  }
+
+  if(decimals){
+    int fractionDigits = decimals;
+    if(trim){
+      while(fractionDigits && fraction % 10 == 0){
+        fraction /= 10;
+        fractionDigits--;
+      }
+    }
+    if(fractionDigits){
+      put('.');
+      putDigits(fraction, fractionDigits);
+    }
+  }
+  if(size){
+    buf[MIN(len, (int)size - 1)] = 0;
+  }
+  return len;
+}
+
+size_t printFixed(Print& out, double value, int decimals, bool trim){
+  char str[48];
+  int len = formatFixed(str, sizeof(str), value, decimals, trim);
+  if(len < (int)sizeof(str)){
+    return out.write((const uint8_t*)str, len);
+  }
+  char* big = new char[len + 1];
+  formatFixed(big, len + 1, value, decimals, trim);
+  size_t written = out.write((const uint8_t*)big, len);
+  delete[] big;
+  return written;
+}
+
 /**************************************************************************************************
  * Convert the contents of an xbuf to base64
  * ************************************************************************************************/
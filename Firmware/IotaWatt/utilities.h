@@ -18,6 +18,9 @@ String formatHex(uint32_t data);                    // Convert the input to a St
 String bin2hex(const uint8_t* in, size_t len);
 void   hex2bin(uint8_t* out, const char* in, size_t len); 
 
+int    formatFixed(char* buf, size_t size, double value, int decimals, bool trim = false); // printf("%.*f") without printf
+size_t printFixed(Print& out, double value, int decimals, bool trim = false);            // formatFixed to a Print (xbuf)
+
 void   base64encode(xbuf* buf);                     // Convert the contents of an xbuf to base64
 String base64encode(const uint8_t* in, size_t len); // Convert the input buffer to a base64 String
 
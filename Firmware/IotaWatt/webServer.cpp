@@ -82,6 +82,7 @@ void handleRequest(){
   if(serverOn(authAdmin, F("/auth"), HTTP_POST, handlePasswords)) return;
   if(serverOn(authUser,  F("/nullreq"), HTTP_GET, returnOK)) return;
   if(serverOn(authUser,  F("/query"), HTTP_GET, handleQuery)) return;
+  if(serverOn(authUser,  F("/export"), HTTP_GET, handleExport)) return;
   if(serverOn(authUser,  F("/DSTtest"), HTTP_GET, handleDSTtest)) return;
   if(serverOn(authAdmin, F("/update"), HTTP_GET, handleUpdate)) return;
 
@@ -495,6 +496,23 @@ void handlePasswords(){
   return;
 }
 
+      // Add asynchronous write queue statistics to a datalog status object.
+
+void datalogQueueStatus(JsonObject& datalog, IotaLog* log){
+  const IotaLogQueueStats& stats = log->queueStats();
+  if(stats.size == 0){
+    return;
+  }
+  JsonObject& queue = datalog.createNestedObject(F("queue"));
+  queue.set(F("size"), stats.size);
+  queue.set(F("depth"), stats.depth);
+  queue.set(F("maxdepth"), stats.maxDepth);
+  queue.set(F("commits"), stats.commits);
+  queue.set(F("overflows"), stats.overflows);
+  queue.set(F("worstwriteus"), stats.worstWriteUs);
+  queue.set(F("maxlatencyms"), stats.maxLatencyMs);
+}
+
 void handleStatus(){
   trace(T_WEB,0);
   uint32_t heapEntry = ESP.getFreeHeap();
@@ -550,7 +568,9 @@ void handleStatus(){
           }
           else if(inputChannel[i]->_type == channelTypePower){
             if(statRecord.accum1[i] > -2 && statRecord.accum1[i] < 2) statRecord.accum1[i] = 0;
-            channelObject.set(F("Watts"),String(statRecord.accum1[i],0));
+            char watts[24];
+            formatFixed(watts, sizeof(watts), statRecord.accum1[i], 0);
+            channelObject.set(F("Watts"),jsonBuffer.strdup(watts));
             double pf = statRecord.accum2[i];
             if(pf != 0){
               pf = statRecord.accum1[i] / pf;
@@ -576,12 +596,13 @@ void handleStatus(){
     Script* script = outputs->first();
     statRecord.UNIXtime = UTCtime();
     statRecord.logHours = 1;
+    ScriptContext context(nullptr, &statRecord);
     while(script){
       trace(T_WEB,16,1);
       JsonObject& channelObject = jsonBuffer.createObject();
       channelObject.set(F("name"),script->name());
       channelObject.set(F("units"),script->getUnits());
-      double value = script->run(nullptr, &statRecord);
+      double value = script->run(&context);
       channelObject.set(F("value"),value);
       outputArray.add(channelObject);
       script = script->next();
@@ -635,6 +656,28 @@ void handleStatus(){
       root["pvoutput"] = status;
     }
 
+    if(server.hasArg(F("integrations"))){
+      trace(T_WEB,24);
+      JsonArray& array = jsonBuffer.createArray();
+      Script *script = integrations->first();
+      while(script){
+        JsonObject& status = jsonBuffer.createObject();
+        if(script->getParm()){
+          ((integrator *)script->getParm())->getStatusJson(status);
+        }
+        array.add(status);
+        script = script->next();
+      }
+      root["integrations"] = array;
+    }
+
+    if(server.hasArg(F("querycache"))){
+      trace(T_WEB,25);
+      JsonObject& cache = jsonBuffer.createObject();
+      queryCacheStatus(cache);
+      root.set(F("querycache"),cache);
+    }
+
     if(server.hasArg(F("datalogs"))){
       trace(T_WEB,17);
       JsonArray& datalogs = jsonBuffer.createArray();
@@ -646,6 +689,7 @@ void handleStatus(){
       currlog.set(F("size"),Current_log.fileSize());
       currlog.set(F("interval"),Current_log.interval());
       //currlog.set("wrap",Current_log._wrap ? true : false);
+      datalogQueueStatus(currlog, &Current_log);
       datalogs.add(currlog);
 
       JsonObject& histlog = jsonBuffer.createObject();
@@ -654,6 +698,7 @@ void handleStatus(){
       histlog.set(F("lastkey"),History_log.lastKey());
       histlog.set(F("size"),History_log.fileSize());
       histlog.set(F("interval"),History_log.interval());
+      datalogQueueStatus(histlog, &History_log);
       datalogs.add(histlog);
 
       Script *script = integrations->first();
@@ -665,6 +710,7 @@ void handleStatus(){
         intlog.set(F("lastkey"),log->lastKey());
         intlog.set(F("size"),log->fileSize());
         intlog.set(F("interval"),log->interval());
+        datalogQueueStatus(intlog, log);
         datalogs.add(intlog);
         script = script->next();
       }
@@ -869,9 +915,7 @@ void handleGetFeedList(){
 }
 
 void handleGetFeedData(){
-  serverAvailable = false;
   getFeedData();
-  return;
 }
 
 // Had to roll our own streamFile function so we can set the actual partial
@@ -897,45 +941,34 @@ void sendMsgFile(File &dataFile, int32_t relPos){
 
 void handleQuery(){
   trace(T_WEB,50);
+  if( ! queryAvailable()){
+    trace(T_WEB,58);
+    server.sendHeader(F("Retry-After"), F("5"));
+    server.send(503, txtPlain_P, F("Too many queries in progress."));
+    return;
+  }
   CSVquery* query = new CSVquery();
   if( ! query->setup()){
     trace(T_WEB,51);
     String response("{\"error\":\"invalid query. ");
     response += query->failReason() + "\"}";
     server.send(400, txtPlain_P, response);
+    delete query;
   } else {
     trace(T_WEB,52);
-    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
-    //server.sendHeader(String("Connection"), String("keep-alive"));
-    if(server.hasArg(F("download"))){
+    if(server.hasArg(F("download")) || query->isBinary()){
       trace(T_WEB,53);
-      server.send(200,"application/octet-stream","");
+      queryStart(query, F("application/octet-stream"));
     }
     else if(query->isJson()){
       trace(T_WEB,54);
-      server.send(200, appJson_P, "");
+      queryStart(query, FPSTR(appJson_P));
     }
     else {
       trace(T_WEB,55);
-      server.send(200, txtPlain_P, "");
-    }
-      
-    uint8_t* buf = new uint8_t[1440];
-    int read = 0;
-    size_t size = 0;
-    trace(T_WEB,56);
-    while((read = query->readResult(buf, 1440))){
-      trace(T_WEB,57);
-      server.sendContent((char*)buf, read);
-      size += read;
-      trace(T_WEB,58);
-      yield();
-    }
-    trace(T_WEB,56);
-    //server.sendContent((char*)buf, 0);
-    delete buf;
-  }
-  delete query;
+      queryStart(query, FPSTR(txtPlain_P));
+    }
+  }
   trace(T_WEB,59);
 }
 
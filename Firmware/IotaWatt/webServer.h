@@ -38,6 +38,7 @@ void handleGraphDelete();
 void sendMsgFile(File &dataFile, int32_t relPos);
 void handlePasswords();
 void handleQuery();
+void handleExport();
 void handleUpdate();
 void handleDSTtest();
 
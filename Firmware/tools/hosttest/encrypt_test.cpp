@@ -0,0 +1,180 @@
+/***********************************************************************************************
+ * encrypt_test - encryptEncoder against the original Emoncms encryption on the host
+ *
+ * The Emoncms uploader used to encrypt a post in place: SHA256, HMAC-SHA256 and
+ * CBC<AES128> over 64-byte pieces of reqData with the ciphertext appended after the IV,
+ * then base64encode(&reqData) over the whole buffer. That path is reproduced here, with
+ * base64encode() from utilities.cpp, as the known answer for encryptEncoder.
+ *
+ *      (default)       950 cases: payloads of 1 to 300 bytes with three keys each, encoded
+ *                      in random step sizes with a new encoder, and 50 posts of up to
+ *                      3000 bytes through one encoder reused across posts. The base64
+ *                      output, SHA256 and HMAC must match the original exactly.
+ *      -b              times both for posts of 1000, 3000 and 8000 bytes
+ *
+ * Build (from Firmware/tools/hosttest):
+ *      g++ -O2 -std=gnu++11 -I include -I ../../IotaWatt -ffunction-sections -Wl,--gc-sections \
+ *          -o encrypt_test encrypt_test.cpp hostcore.cpp ../../IotaWatt/encryptEncoder.cpp \
+ *          ../../IotaWatt/utilities.cpp -fpermissive -lcrypto
+ *
+ * Usage:
+ *      encrypt_test [-b]
+ **********************************************************************************************/
+#include <chrono>
+#include <random>
+#include <string>
+#include "IotaWatt.h"
+#include "encryptEncoder.h"
+
+        // Firmware globals used by utilities
+
+messageLog Message_log;
+uint32_t bingoTime = 0xFFFFFFFF;
+const char base64codes_P[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+void trace(const uint8_t, const uint8_t, const uint8_t){}
+uint32_t localTime(uint32_t t){return t;}
+uint32_t UTC2Local(uint32_t t){return t;}
+messageLog::messageLog(){}
+size_t messageLog::write(const uint8_t c){return 1;}
+size_t messageLog::write(const uint8_t* buf, const size_t len){return len;}
+void messageLog::endMsg(){}
+
+        // The original emoncms_uploader::handle_write_s() encryption
+
+static void original(xbuf& reqData, const uint8_t* cryptoKey, const uint8_t* iv, uint8_t* sha, uint8_t* hmac){
+  SHA256* sha256 = new SHA256;
+  sha256->reset();
+  SHA256* shaHMAC = new SHA256;
+  shaHMAC->resetHMAC(cryptoKey, 16);
+  CBC<AES128>* cypher = new CBC<AES128>;
+  cypher->setIV(iv, 16);
+  cypher->setKey(cryptoKey, 16);
+  uint8_t* temp = new uint8_t[64 + 16];
+  size_t supply = reqData.available();
+  reqData.write(iv, 16);
+  while(supply){
+    size_t len = supply < 64 ? supply : 64;
+    reqData.read(temp, len);
+    supply -= len;
+    sha256->update(temp, len);
+    shaHMAC->update(temp, len);
+    if(len < 64 || supply == 0){
+      size_t padlen = 16 - (len % 16);
+      for(size_t i=0; i<padlen; i++){
+        temp[len + i] = padlen;
+      }
+      len += padlen;
+    }
+    cypher->encrypt(temp, temp, len);
+    reqData.write(temp, len);
+  }
+  delete[] temp;
+  delete cypher;
+  sha256->finalize(sha, 32);
+  shaHMAC->finalizeHMAC(cryptoKey, 16, hmac, 32);
+  delete sha256;
+  delete shaHMAC;
+  base64encode(&reqData);
+}
+
+static std::string payload(std::mt19937& rng, size_t size){
+  std::string out = "time=1700000000&data=[";
+  while(out.size() < size){
+    out += "[0,\"node\"," + std::to_string(rng() % 100000) + "." + std::to_string(rng() % 10) + "],";
+  }
+  out.resize(size);
+  return out;
+}
+
+static std::string contents(xbuf& buf){
+  std::string out(buf.available(), 0);
+  buf.read((uint8_t*)&out[0], out.size());
+  return out;
+}
+
+static int cases = 0;
+static int failures = 0;
+
+static void compare(encryptEncoder* encoder, const std::string& text, const uint8_t* key, const uint8_t* iv, size_t step){
+  xbuf want, got;
+  uint8_t wantSha[32], wantHmac[32], gotSha[32], gotHmac[32];
+  want.write((const uint8_t*)text.data(), text.size());
+  original(want, key, iv, wantSha, wantHmac);
+  got.write((const uint8_t*)text.data(), text.size());
+  size_t supply = got.available();
+  encoder->begin(got, iv);
+  while(supply){
+    supply -= encoder->encode(got, got, supply < step ? supply : step);
+  }
+  encoder->finish(got, gotSha, gotHmac);
+  cases++;
+  std::string wantText = contents(want);
+  std::string gotText = contents(got);
+  if(gotText != wantText || memcmp(gotSha, wantSha, 32) || memcmp(gotHmac, wantHmac, 32)){
+    if(failures++ < 10){
+      printf("FAIL %zu byte payload, step %zu: %s%s%s\n", text.size(), step, gotText != wantText ? "output " : "",
+             memcmp(gotSha, wantSha, 32) ? "SHA256 " : "", memcmp(gotHmac, wantHmac, 32) ? "HMAC" : "");
+    }
+  }
+}
+
+static void knownAnswers(){
+  std::mt19937 rng(7);
+  uint8_t key[16], iv[16];
+  for(size_t size=1; size<=300; size++){
+    for(int k=0; k<3; k++){
+      for(auto& b : key) b = rng();
+      for(auto& b : iv) b = rng();
+      std::string text = payload(rng, size);
+      encryptEncoder* encoder = new encryptEncoder(key);
+      compare(encoder, text, key, iv, 1 + rng() % 100);
+      delete encoder;
+    }
+  }
+  encryptEncoder* encoder = new encryptEncoder(key);
+  for(int post=0; post<50; post++){
+    for(auto& b : iv) b = rng();
+    compare(encoder, payload(rng, 100 + rng() % 2900), key, iv, 3000);
+  }
+  delete encoder;
+  printf("%d cases\n", cases);
+}
+
+static void bench(){
+  std::mt19937 rng(11);
+  uint8_t key[16], iv[16], sha[32], hmac[32];
+  for(auto& b : key) b = rng();
+  for(auto& b : iv) b = rng();
+  encryptEncoder* encoder = new encryptEncoder(key);
+  const int N = 2000;
+  for(size_t size : {1000, 3000, 8000}){
+    std::string text = payload(rng, size);
+    double originalUs = 0, encoderUs = 0;
+    for(int i=0; i<N; i++){
+      xbuf a, b;
+      a.write((const uint8_t*)text.data(), size);
+      b.write((const uint8_t*)text.data(), size);
+      auto t0 = std::chrono::steady_clock::now();
+      original(a, key, iv, sha, hmac);
+      auto t1 = std::chrono::steady_clock::now();
+      encoder->begin(b, iv);
+      encoder->encode(b, b, size);
+      encoder->finish(b, sha, hmac);
+      auto t2 = std::chrono::steady_clock::now();
+      originalUs += std::chrono::duration<double, std::micro>(t1 - t0).count();
+      encoderUs += std::chrono::duration<double, std::micro>(t2 - t1).count();
+    }
+    printf("%5zu bytes  original %6.1f us  encryptEncoder %6.1f us\n", size, originalUs / N, encoderUs / N);
+  }
+  delete encoder;
+}
+
+int main(int argc, char** argv){
+  if(argc > 1 && strcmp(argv[1], "-b") == 0){
+    bench();
+    return 0;
+  }
+  knownAnswers();
+  printf("%d failures\n", failures);
+  return failures ? 1 : 0;
+}
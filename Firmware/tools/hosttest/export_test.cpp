@@ -0,0 +1,138 @@
+/***********************************************************************************************
+ * export_test - /export on the host
+ *
+ * Writes a day of History_log with the firmware's IotaLog, then serves /export requests
+ * through handleExport() and the exportLog Service as the web server does. Two exports, one
+ * whole and one with a Range, are served at once, and a third is refused while they run.
+ * Each turn of the Service must write at most one buffer to each export, and the web server
+ * must stay available throughout. Each body is checked against the bytes of the log file.
+ *
+ * Build (from Firmware/tools/hosttest):
+ *      g++ -O2 -std=gnu++11 -I include -I ../../IotaWatt -ffunction-sections -Wl,--gc-sections \
+ *          -o export_test export_test.cpp hostcore.cpp ../../IotaWatt/ExportLog.cpp \
+ *          ../../IotaWatt/IotaLog.cpp ../../IotaWatt/utilities.cpp ../../IotaWatt/RTC.cpp -fpermissive -lcrypto
+ *
+ * Usage:
+ *      export_test [-v]
+ **********************************************************************************************/
+#include <unistd.h>
+#include "IotaWatt.h"
+
+#define T0 1577836800UL                             // 2020-01-01
+#define RECORDS 1440
+
+        // Firmware globals used by ExportLog
+
+ESP8266WebServer server(80);
+IotaLog Current_log(256, 5, 365, 0);
+IotaLog History_log(256, 60, 365, 0);
+messageLog Message_log;
+uint32_t bingoTime = 0xFFFFFFFF;
+IotaInputChannel* *inputChannel = nullptr;
+uint8_t maxInputs = 2;
+boolean serverAvailable = true;
+void trace(const uint8_t, const uint8_t, const uint8_t){}
+serviceBlock* NewService(Service, const uint8_t, void*){static serviceBlock sb; return &sb;}
+uint32_t localTime(){return T0;}
+uint32_t UTC2Local(uint32_t t){return t;}
+void setLedCycle(const char*){}
+void endLedCycle(){}
+
+static bool verbose = false;
+messageLog::messageLog(){}
+size_t messageLog::write(const uint8_t c){if(verbose) putchar(c); return 1;}
+size_t messageLog::write(const uint8_t* buf, const size_t len){if(verbose) fwrite(buf, 1, len, stdout); return len;}
+void messageLog::endMsg(){if(verbose) putchar('\n');}
+
+static int failures = 0;
+
+static void check(bool ok, const char* what){
+  printf("  %s %s\n", what, ok ? "ok" : "FAIL");
+  if( ! ok) failures++;
+}
+
+        // Start an export and return its connection.
+
+static std::shared_ptr<hostConnection> startExport(const std::map<std::string, std::string>& headers = {}){
+  server.hostRequest("/export", {}, headers);
+  auto conn = server.client().conn;
+  handleExport();
+  return conn;
+}
+
+        // Split a response into status line and body.
+
+static std::string body(const std::string& response){
+  size_t end = response.find("\r\n\r\n");
+  return end == std::string::npos ? std::string() : response.substr(end + 4);
+}
+
+static std::string status(const std::string& response){
+  return response.substr(0, response.find("\r\n"));
+}
+
+int main(int argc, char** argv){
+  for(int i=1; i<argc; i++){
+    if(strcmp(argv[i], "-v") == 0) verbose = true;
+  }
+  char root[] = "/tmp/export_testXXXXXX";
+  SD.root = mkdtemp(root);
+  History_log.begin("/iotawatt/history.log");
+  IotaLogRecord rec;
+  memset((void*)&rec, 0, sizeof(rec));
+  for(uint32_t i=0; i<RECORDS; i++){
+    rec.UNIXtime = T0 + i * 60;
+    rec.logHours = i / 60.0;
+    rec.accum1[0] = i;
+    History_log.write(&rec);
+  }
+  FILE* fp = fopen(SD.host("/iotawatt/history.log").c_str(), "rb");
+  std::string file(RECORDS * sizeof(IotaLogRecord), 0);
+  file.resize(fread(&file[0], 1, file.size(), fp));
+  fclose(fp);
+  printf("history log of %u records\n", (uint32_t)(file.size() / sizeof(IotaLogRecord)));
+
+  auto whole = startExport();
+  auto part = startExport({{"Range", "bytes=1000-99999"}});
+  auto refused = startExport();
+  check(status(refused->sent).find("503") != std::string::npos, "third export refused");
+  check(serverAvailable, "server available");
+
+        // Run the Service with no time to spare, so it yields
+        // after every step, until both are done.
+
+  serviceBlock sb;
+  bingoTime = 0;
+  exportLog(&sb);
+  exportLog(&sb);
+  check(body(whole->sent).size() == 1440 && body(part->sent).size() == 1440, "one buffer each per turn");
+  bool available = true;
+  int turns = 0;
+  while(exportLog(&sb) && turns++ < 10000){
+    available = available && serverAvailable;
+  }
+  bingoTime = 0xFFFFFFFF;
+  check(available, "server available while exporting");
+  check(whole->stopped && part->stopped, "exports complete");
+  check(status(whole->sent) == "HTTP/1.1 200 OK" && body(whole->sent) == file, "whole log");
+  check(status(part->sent) == "HTTP/1.1 206 Partial Content" && body(part->sent) == file.substr(1000, 99000), "range");
+
+        // A client that stops taking data is waited on, and one that
+        // disconnects is dropped so another export can start.
+
+  auto stalled = startExport();
+  stalled->window = 0;
+  check(exportLog(&sb) == 10 && ! stalled->stopped, "stalled export waits");
+  stalled->connected = false;
+  check(exportLog(&sb) == 0, "disconnected export dropped");
+  auto again = startExport();
+  while(exportLog(&sb));
+  check(body(again->sent) == file, "next export");
+
+  History_log.end();
+  SD.remove("/iotawatt/history.log");
+  SD.rmdir("/iotawatt");
+  rmdir(SD.root.c_str());
+  printf("%d failures\n", failures);
+  return failures;
+}
@@ -0,0 +1,185 @@
+/***********************************************************************************************
+ * format_test - formatFixed() and printFixed() against printf on the host
+ *
+ * Checks that formatFixed(value, decimals) produces exactly what snprintf("%.*f") does,
+ * and with trim what "%#.*f" does less trailing fractional zeros and decimal point.
+ * The return must be snprintf's, the length of the whole result even when it doesn't fit,
+ * and truncated output must match snprintf's into the same size buffer. printFixed must
+ * write the whole result, however long.
+ *
+ *      (default)       <count> random doubles (default 1000000): random bit patterns,
+ *                      quotients near typical readings, and exact decimal ties
+ *      -f <decimals>   every float, as a double, with that many decimals (4 billion values,
+ *                      about 50 minutes); optionally only the float bit patterns [from, to]
+ *      -b              times formatFixed and snprintf on typical readings
+ *
+ * Build (from Firmware/tools/hosttest):
+ *      g++ -O2 -std=gnu++11 -I include -I ../../IotaWatt -ffunction-sections -Wl,--gc-sections \
+ *          -o format_test format_test.cpp hostcore.cpp ../../IotaWatt/utilities.cpp \
+ *          -fpermissive -lcrypto
+ *
+ * Usage:
+ *      format_test [count] | -f <decimals> [from to] | -b
+ **********************************************************************************************/
+#include <chrono>
+#include <random>
+#include <string>
+#include "IotaWatt.h"
+
+        // Firmware globals used by utilities
+
+messageLog Message_log;
+uint32_t bingoTime = 0xFFFFFFFF;
+void trace(const uint8_t, const uint8_t, const uint8_t){}
+uint32_t localTime(uint32_t t){return t;}
+uint32_t UTC2Local(uint32_t t){return t;}
+messageLog::messageLog(){}
+size_t messageLog::write(const uint8_t c){return 1;}
+size_t messageLog::write(const uint8_t* buf, const size_t len){return len;}
+void messageLog::endMsg(){}
+
+        // printf reference
+
+static int reference(char* out, size_t size, double value, int decimals, bool trim){
+  if( ! trim){
+    return snprintf(out, size, "%.*f", decimals, value);
+  }
+  char full[400];
+  int len = snprintf(full, sizeof(full), "%#.*f", decimals, value);
+  if(strchr(full, '.') && ! strpbrk(full, "ni")){
+    while(full[len - 1] == '0') len--;
+    if(full[len - 1] == '.') len--;
+    full[len] = 0;
+  }
+  if(size){
+    snprintf(out, size, "%s", full);
+  }
+  return len;
+}
+
+struct stringPrint : public Print {
+  std::string text;
+  size_t write(uint8_t c){text += (char)c; return 1;}
+  size_t write(const uint8_t* buf, size_t len){text.append((const char*)buf, len); return len;}
+};
+
+static long failures = 0;
+
+static void fail(double value, int decimals, bool trim, const char* what, const char* got, const char* want){
+  if(failures++ < 20){
+    printf("FAIL %a decimals %d trim %d %s: got \"%s\" want \"%s\"\n", value, decimals, trim, what, got, want);
+  }
+}
+
+static void check(double value, int decimals, bool trim){
+  char got[400], want[400];
+  int gotLen = formatFixed(got, sizeof(got), value, decimals, trim);
+  int wantLen = reference(want, sizeof(want), value, decimals, trim);
+  if(strcmp(got, want)){
+    fail(value, decimals, trim, "text", got, want);
+  }
+  else if(gotLen != wantLen){
+    fail(value, decimals, trim, "length", std::to_string(gotLen).c_str(), std::to_string(wantLen).c_str());
+  }
+}
+
+        // Truncation and printFixed, for fewer values as they are slower.
+
+static void checkSizes(double value, int decimals, bool trim){
+  char got[400], want[400];
+  int wantLen = reference(want, sizeof(want), value, decimals, trim);
+  for(int size=0; size<=wantLen + 1; size++){
+    memset(got, 'x', sizeof(got));
+    memset(want, 'x', sizeof(want));
+    int gotLen = formatFixed(got, size, value, decimals, trim);
+    reference(want, size, value, decimals, trim);
+    if(gotLen != wantLen || memcmp(got, want, size + 1)){
+      got[size] = want[size] = 0;
+      fail(value, decimals, trim, ("size " + std::to_string(size)).c_str(), got, want);
+      return;
+    }
+  }
+  stringPrint out;
+  size_t written = printFixed(out, value, decimals, trim);
+  reference(want, sizeof(want), value, decimals, trim);
+  if(out.text != want || written != out.text.size()){
+    fail(value, decimals, trim, "printFixed", out.text.c_str(), want);
+  }
+}
+
+static void randomValues(long count){
+  std::mt19937_64 rng(42);
+  for(long n=0; n<count; n++){
+    uint64_t bits = rng();
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    if(n & 1){
+      value = (double)(int64_t)(rng() % 2000000000) / (double)(1 + rng() % 100000) - 5000;
+    }
+    if(n % 7 == 0){
+      value = (double)(int64_t)(rng() % 20000001 - 10000000) / 1000.0 + ((n & 8) ? 0.0005 : 0);
+    }
+    check(value, n % 10, (n >> 1) & 1);
+    if(n % 64 == 0){
+      checkSizes(value, n % 10, (n >> 1) & 1);
+    }
+  }
+  const double specials[] = {0.0, -0.0, INFINITY, -INFINITY, NAN, 1e300, -1e300, 1.7976931348623157e308,
+                             4.9406564584124654e-324, 0.5, 1.5, 2.5, 9.9999999995, 999999999.5};
+  for(double value : specials){
+    for(int decimals=0; decimals<10; decimals++){
+      check(value, decimals, false);
+      check(value, decimals, true);
+      checkSizes(value, decimals, false);
+      checkSizes(value, decimals, true);
+    }
+  }
+  printf("%ld random values and %d special values\n", count, (int)(sizeof(specials) / sizeof(specials[0])));
+}
+
+static void floats(int decimals, uint32_t from, uint32_t to){
+  for(uint64_t i=from; i<=to; i++){
+    uint32_t bits = i;
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    check((double)value, decimals, i & 1);
+  }
+  printf("floats 0x%08x-0x%08x with %d decimals\n", from, to, decimals);
+}
+
+static void bench(){
+  const int N = 2000000;
+  std::mt19937_64 rng(1);
+  double* values = new double[N];
+  for(int i=0; i<N; i++){
+    values[i] = (double)(int64_t)(rng() % 20000000) / 100.0 - 50000;
+  }
+  char buf[64];
+  volatile int sink = 0;
+  for(int decimals : {0, 1, 3}){
+    auto t0 = std::chrono::steady_clock::now();
+    for(int i=0; i<N; i++) sink += snprintf(buf, sizeof(buf), "%.*f", decimals, values[i]);
+    auto t1 = std::chrono::steady_clock::now();
+    for(int i=0; i<N; i++) sink += formatFixed(buf, sizeof(buf), values[i], decimals);
+    auto t2 = std::chrono::steady_clock::now();
+    printf("%d decimals  snprintf %6.1f ns  formatFixed %6.1f ns\n", decimals,
+           std::chrono::duration<double, std::nano>(t1 - t0).count() / N,
+           std::chrono::duration<double, std::nano>(t2 - t1).count() / N);
+  }
+  delete[] values;
+}
+
+int main(int argc, char** argv){
+  if(argc > 1 && strcmp(argv[1], "-b") == 0){
+    bench();
+    return 0;
+  }
+  if(argc > 2 && strcmp(argv[1], "-f") == 0){
+    floats(atoi(argv[2]), argc > 4 ? strtoul(argv[3], 0, 0) : 0, argc > 4 ? strtoul(argv[4], 0, 0) : 0xFFFFFFFF);
+  }
+  else {
+    randomValues(argc > 1 ? atol(argv[1]) : 1000000);
+  }
+  printf("%ld failures\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,148 @@
+/***********************************************************************************************
+ * gzip_bench - gzipEncoder ratio and speed on the host
+ *
+ * Compresses uploader post bodies with the firmware's gzipEncoder, 256 bytes per encode()
+ * call as the uploader does, and reports the compression ratio and microseconds per KB of
+ * input. The same posts are compressed by zlib at level 6 and with fixed Huffman codes for
+ * reference. Every gzipEncoder post is inflated by zlib and must match the input.
+ *
+ * Post bodies are cut from two generated streams:
+ *      influx          influxDB line protocol, eight outputs with tags, every 10 seconds
+ *      emoncms         Emoncms bulk JSON, eight random values per row
+ *
+ * Build (from Firmware/tools/hosttest):
+ *      g++ -O2 -std=gnu++11 -I include -I ../../IotaWatt -o gzip_bench gzip_bench.cpp \
+ *          ../../IotaWatt/gzip.cpp -lz
+ *
+ * Usage:
+ *      gzip_bench [post size]          (default 3000)
+ **********************************************************************************************/
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include "gzip.h"
+
+static std::string influx(){
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<double> watts(0, 3000), volts(118, 122), pf(0.8, 1);
+  const char* names[] = {"Main", "Solar", "HeatPump", "Volts", "Kitchen", "Dryer", "Furnace", "PF"};
+  std::string out;
+  char line[128];
+  for(uint32_t t=1600000000; t<1600000000 + 2000 * 10; t+=10){
+    for(int i=0; i<8; i++){
+      double value = i == 3 ? volts(rng) : (i == 7 ? pf(rng) : watts(rng));
+      snprintf(line, sizeof(line), "%s,device=iotawatt,location=home,units=Watts value=%.*f %u\n",
+               names[i], i == 7 ? 2 : 1, value, t);
+      out += line;
+    }
+  }
+  return out;
+}
+
+static std::string emoncms(){
+  std::mt19937 rng(2);
+  std::uniform_real_distribution<double> watts(0, 3000);
+  std::string out = "[";
+  char value[32];
+  for(uint32_t t=1600000000; t<1600000000 + 4000 * 10; t+=10){
+    out += (t == 1600000000 ? "[" : ",[") + std::to_string(t) + ",\"IotaWatt\"";
+    for(int i=0; i<8; i++){
+      snprintf(value, sizeof(value), ",%.1f", watts(rng));
+      out += value;
+    }
+    out += "]";
+  }
+  return out + "]";
+}
+
+        // Posts end at a line (or row) boundary at or before size,
+        // as the uploaders stop adding to a post at their buffer limit.
+
+static std::vector<std::string> posts(const std::string& stream, size_t size, char boundary){
+  std::vector<std::string> out;
+  size_t pos = 0;
+  while(pos < stream.size()){
+    size_t end = pos + size;
+    if(end >= stream.size()){
+      end = stream.size();
+    }
+    else {
+      size_t cut = stream.rfind(boundary, end - 1);
+      end = cut != std::string::npos && cut >= pos ? cut + 1 : end;
+    }
+    out.push_back(stream.substr(pos, end - pos));
+    pos = end;
+  }
+  return out;
+}
+
+static std::string zlibGzip(const std::string& in, int strategy){
+  z_stream z = {};
+  deflateInit2(&z, 6, Z_DEFLATED, 16 + MAX_WBITS, 8, strategy);
+  std::string out(deflateBound(&z, in.size()), 0);
+  z.next_in = (Bytef*)in.data();
+  z.avail_in = in.size();
+  z.next_out = (Bytef*)&out[0];
+  z.avail_out = out.size();
+  deflate(&z, Z_FINISH);
+  out.resize(z.total_out);
+  deflateEnd(&z);
+  return out;
+}
+
+static bool gunzip(const std::string& in, std::string& out){
+  z_stream z = {};
+  inflateInit2(&z, 16 + MAX_WBITS);
+  out.assign(in.size() * 20 + 1024, 0);
+  z.next_in = (Bytef*)in.data();
+  z.avail_in = in.size();
+  z.next_out = (Bytef*)&out[0];
+  z.avail_out = out.size();
+  int rtc = inflate(&z, Z_FINISH);
+  out.resize(z.total_out);
+  inflateEnd(&z);
+  return rtc == Z_STREAM_END && z.avail_in == 0;
+}
+
+static int failures = 0;
+
+static void bench(const char* name, const std::vector<std::string>& bodies){
+  size_t in = 0, out = 0, zlib6 = 0, zlibFixed = 0;
+  double us = 0;
+  for(const std::string& body : bodies){
+    xbuf req, gz;
+    req.write((const uint8_t*)body.data(), body.size());
+    auto t0 = std::chrono::steady_clock::now();
+    gzipEncoder* encoder = new gzipEncoder;
+    while(req.available()){
+      encoder->encode(req, gz, 256);
+    }
+    encoder->finish(gz);
+    delete encoder;
+    us += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+
+    std::string compressed(gz.available(), 0);
+    gz.read((uint8_t*)&compressed[0], compressed.size());
+    std::string inflated;
+    if( ! gunzip(compressed, inflated) || inflated != body){
+      if(failures++ < 5) printf("  %s FAIL: post %zu bytes doesn't inflate to its input\n", name, body.size());
+    }
+    in += body.size();
+    out += compressed.size();
+    zlib6 += zlibGzip(body, Z_DEFAULT_STRATEGY).size();
+    zlibFixed += zlibGzip(body, Z_FIXED).size();
+  }
+  printf("  %-8s %4zu posts %8zu bytes  ratio %.2f  %5.1f us/KB   zlib -6 %.2f  zlib fixed %.2f\n",
+         name, bodies.size(), in, (double)in / out, us / (in / 1024.0), (double)in / zlib6, (double)in / zlibFixed);
+}
+
+int main(int argc, char** argv){
+  size_t size = argc > 1 ? atoi(argv[1]) : 3000;
+  printf("posts of up to %zu bytes\n", size);
+  bench("influx", posts(influx(), size, '\n'));
+  bench("emoncms", posts(emoncms(), size, ']'));
+  printf("%d failures\n", failures);
+  return failures;
+}
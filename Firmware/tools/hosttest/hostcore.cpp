@@ -0,0 +1,112 @@
+/***********************************************************************************************
+ * Runtime for the host build environment in include/, linked into every harness.
+ **********************************************************************************************/
+#include <chrono>
+#include <thread>
+#include <random>
+#include <unistd.h>
+#include "include/hostcore.h"
+#include "include/SD.h"
+
+HardwareSerial Serial;
+EspClass ESP;
+SDClass SD;
+
+static const auto hostStart = std::chrono::steady_clock::now();
+
+uint32_t millis(){
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - hostStart).count();
+}
+
+uint32_t micros(){
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - hostStart).count();
+}
+
+void delay(uint32_t ms){std::this_thread::sleep_for(std::chrono::milliseconds(ms));}
+void delayMicroseconds(uint32_t us){std::this_thread::sleep_for(std::chrono::microseconds(us));}
+void yield(){}
+
+static std::mt19937 hostRandom(1);
+long random(long howbig){return howbig > 0 ? hostRandom() % howbig : 0;}
+long random(long howsmall, long howbig){return howsmall < howbig ? howsmall + random(howbig - howsmall) : howsmall;}
+void randomSeed(unsigned long seed){hostRandom.seed(seed);}
+
+char* dtostrf(double value, signed char width, unsigned char prec, char* buf){sprintf(buf, "%*.*f", width, prec, value); return buf;}
+char* itoa(int value, char* buf, int base){sprintf(buf, base == 16 ? "%x" : "%d", value); return buf;}
+char* ultoa(unsigned long value, char* buf, int base){sprintf(buf, base == 16 ? "%lx" : "%lu", value); return buf;}
+char* ltoa(long value, char* buf, int base){sprintf(buf, base == 16 ? "%lx" : "%ld", value); return buf;}
+
+        // SD files are opened for update, created if need be, like the SD library's FILE_WRITE.
+
+File SDClass::open(const char* path, int mode){
+  std::string name = host(path);
+  struct stat st;
+  if(stat(name.c_str(), &st) == 0 && S_ISDIR(st.st_mode)){
+    return File(nullptr, path, true);
+  }
+  FILE* fp = fopen(name.c_str(), mode == FILE_WRITE ? "r+b" : "rb");
+  if( ! fp && mode == FILE_WRITE){
+    fp = fopen(name.c_str(), "w+b");
+  }
+  if( ! fp){
+    return File();
+  }
+  stats.opens++;
+  if(mode == FILE_WRITE){
+    fseek(fp, 0, SEEK_END);
+  }
+  return File(fp, path);
+}
+
+bool SDClass::mkdir(const char* path){
+  std::string name = host(path);
+  for(size_t p = root.size() + 1; (p = name.find('/', p + 1)) != std::string::npos; ){
+    ::mkdir(name.substr(0, p).c_str(), 0755);
+  }
+  ::mkdir(name.c_str(), 0755);
+  return exists(path);
+}
+
+size_t File::write(const uint8_t* buf, size_t len){
+  if( ! _fp) return 0;
+  SD.stats.writes++;
+  SD.stats.writeBytes += len;
+  return fwrite(buf, 1, len, _fp);
+}
+
+int File::read(void* buf, uint32_t len){
+  if( ! _fp) return -1;
+  SD.stats.reads++;
+  SD.stats.readBytes += len;
+  return fread(buf, 1, len, _fp);
+}
+
+int File::peek(){
+  if( ! _fp) return -1;
+  int c = fgetc(_fp);
+  if(c != EOF) ungetc(c, _fp);
+  return c == EOF ? -1 : c;
+}
+
+int File::available(){return _fp ? size() - position() : 0;}
+
+bool File::seek(uint32_t pos){
+  if( ! _fp) return false;
+  SD.stats.seeks++;
+  return fseek(_fp, pos, SEEK_SET) == 0;
+}
+
+uint32_t File::position(){return _fp ? ftell(_fp) : 0;}
+
+uint32_t File::size(){
+  if( ! _fp) return 0;
+  fflush(_fp);
+  struct stat st;
+  return fstat(fileno(_fp), &st) == 0 ? st.st_size : 0;
+}
+
+bool File::truncate(uint32_t size){
+  if( ! _fp) return false;
+  fflush(_fp);
+  return ftruncate(fileno(_fp), size) == 0;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "hostcore.h"
+#include <type_traits>
+class JsonObject; class JsonArray;
+struct JsonKey{JsonKey(const char*){} JsonKey(char*){} JsonKey(const String&){} JsonKey(const __FlashStringHelper*){}};
+class JsonVariant {public:
+  JsonVariant(){}
+  template<class T> JsonVariant(const T&){}
+  template<class T> JsonVariant& operator=(const T&){return *this;}
+  template<class T> T& as()const{static T t; return t;}
+  template<class T> bool is()const{return false;}
+  operator int()const{return 0;} operator long()const{return 0;} operator unsigned long()const{return 0;} operator unsigned()const{return 0;}
+  operator double()const{return 0;} operator float()const{return 0;} operator bool()const{return 0;} operator const char*()const{return 0;}
+  operator String()const{return String();} operator JsonObject&()const; operator JsonArray&()const;
+  template<class K> JsonVariant operator[](K)const{return JsonVariant();}
+  bool success()const{return true;}
+  size_t size()const{return 0;}
+  template<class T> size_t printTo(T&)const{return 0;}
+  size_t printTo(char*,size_t)const{return 0;}
+  bool containsKey(JsonKey)const{return false;}
+  template<class T> bool set(const T&){return true;}
+  template<class T> bool operator==(const T&)const{return false;}
+  template<class T> bool operator!=(const T&)const{return false;}
+};
+class JsonArray {public:
+  template<class T> bool add(const T&){return true;}
+  template<class T> bool add(const T&,int){return true;}
+  JsonObject& createNestedObject(); JsonArray& createNestedArray();
+  JsonVariant operator[](int)const{return JsonVariant();}
+  JsonObject& getObj(int);
+  size_t size()const{return 0;}
+  bool success()const{return true;}
+  template<class T> size_t printTo(T&)const{return 0;}
+  size_t printTo(char*,size_t)const{return 0;}
+  size_t measureLength()const{return 0;}
+  template<class T> T& get(int)const{static T t; return t;}
+  typedef JsonVariant* iterator; iterator begin()const{return 0;} iterator end()const{return 0;}
+  template<class T> bool is(int)const{return false;}
+  void remove(int){}
+};
+struct JsonPair{const char* key; JsonVariant value;};
+class JsonObject {public:
+  template<class T> bool set(JsonKey,const T&){return true;}
+  template<class T> bool set(JsonKey,const T&,int){return true;}
+  template<class K> JsonVariant operator[](K)const{return JsonVariant();}
+  JsonObject& createNestedObject(JsonKey); 
+  JsonArray& createNestedArray(JsonKey);
+  bool containsKey(JsonKey)const{return false;}
+  bool success()const{return true;}
+  size_t size()const{return 0;}
+  template<class T> size_t printTo(T&)const{return 0;}
+  size_t printTo(char*,size_t)const{return 0;}
+  size_t measureLength()const{return 0;}
+  size_t prettyPrintTo(Print&)const{return 0;}
+  template<class T> T& get(JsonKey)const{static T t; return t;}
+  template<class T> bool is(JsonKey)const{return false;}
+  void remove(JsonKey){}
+  typedef JsonPair* iterator; iterator begin()const{return 0;} iterator end()const{return 0;}
+};
+class DynamicJsonBuffer {public:
+  DynamicJsonBuffer(size_t=256){}
+  char* strdup(const char* s){return (char*)s;}
+  JsonObject& createObject(); JsonArray& createArray();
+  JsonObject& parseObject(const char*); JsonObject& parseObject(const String&); JsonObject& parseObject(char*); JsonObject& parseObject(Stream&);
+  JsonArray& parseArray(const char*); JsonArray& parseArray(const String&); JsonArray& parseArray(char*);
+  JsonVariant parse(const char*);
+  size_t size(){return 0;}
+};
+template<size_t N> class StaticJsonBuffer: public DynamicJsonBuffer {};
+inline const char* RawJson(const char* s){return s;}
+inline const char* RawJson(const String& s){return s.c_str();}
+template<class T> bool operator==(const T&,const JsonVariant&){return false;}
+template<class T> bool operator!=(const T&,const JsonVariant&){return false;}
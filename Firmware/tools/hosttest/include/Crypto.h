@@ -0,0 +1,64 @@
+// Host versions of the rweather Crypto classes the firmware uses, on OpenSSL libcrypto (-lcrypto).
+#pragma once
+#include "hostcore.h"
+#include <openssl/evp.h>
+
+class SHA256 {
+  public:
+    SHA256():_ctx(EVP_MD_CTX_new()){reset();}
+    ~SHA256(){EVP_MD_CTX_free(_ctx);}
+    size_t hashSize() const {return 32;}
+    size_t blockSize() const {return 64;}
+    void reset(){EVP_DigestInit_ex(_ctx, EVP_sha256(), nullptr);}
+    void update(const void* data, size_t len){EVP_DigestUpdate(_ctx, data, len);}
+    void finalize(void* hash, size_t len){uint8_t d[32]; EVP_DigestFinal_ex(_ctx, d, nullptr); memcpy(hash, d, len < 32 ? len : 32);}
+    void resetHMAC(const void* key, size_t keyLen){pad(key, keyLen, 0x36); reset(); update(_pad, 64);}
+    void finalizeHMAC(const void* key, size_t keyLen, void* hash, size_t len){
+      uint8_t d[32]; finalize(d, 32); pad(key, keyLen, 0x5c); reset(); update(_pad, 64); update(d, 32); finalize(hash, len);
+    }
+    void clear(){reset();}
+  private:
+    EVP_MD_CTX* _ctx;
+    uint8_t _pad[64];
+    void pad(const void* key, size_t keyLen, uint8_t x){memset(_pad, 0, 64); memcpy(_pad, key, keyLen); for(auto& b : _pad) b ^= x;}
+};
+
+class AES128 {
+  public:
+    size_t keySize() const {return 16;}
+    size_t blockSize() const {return 16;}
+    bool setKey(const uint8_t* key, size_t len){memcpy(_key, key, 16); return len == 16;}
+    const uint8_t* key() const {return _key;}
+    void clear(){memset(_key, 0, 16);}
+  private:
+    uint8_t _key[16];
+};
+
+template<class T> class CBC {
+  public:
+    CBC():_ctx(EVP_CIPHER_CTX_new()),_init(false){}
+    ~CBC(){EVP_CIPHER_CTX_free(_ctx);}
+    size_t keySize() const {return 16;}
+    size_t ivSize() const {return 16;}
+    bool setKey(const uint8_t* key, size_t len){_cipher.setKey(key, len); _init = false; return len == 16;}
+    bool setIV(const uint8_t* iv, size_t len){memcpy(_iv, iv, 16); _init = false; return len == 16;}
+    void encrypt(uint8_t* out, const uint8_t* in, size_t len){
+      if( ! _init){
+        EVP_EncryptInit_ex(_ctx, EVP_aes_128_cbc(), nullptr, _cipher.key(), _iv);
+        EVP_CIPHER_CTX_set_padding(_ctx, 0);
+        _init = true;
+      }
+      int n; EVP_EncryptUpdate(_ctx, out, &n, in, len);
+    }
+    void clear(){_cipher.clear(); _init = false;}
+  private:
+    EVP_CIPHER_CTX* _ctx;
+    T _cipher;
+    uint8_t _iv[16];
+    bool _init;
+};
+
+class Ed25519 {
+  public:
+    static bool verify(const uint8_t*, const uint8_t*, const void*, size_t){return false;}
+};
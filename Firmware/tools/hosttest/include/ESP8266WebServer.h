@@ -0,0 +1,125 @@
+#pragma once
+#include "hostcore.h"
+#include "SD.h"
+#include "ESP8266WiFi.h"
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE, HTTP_OPTIONS };
+#define CONTENT_LENGTH_UNKNOWN ((size_t) -1)
+#define UPLOAD_FILE_START 0
+#define UPLOAD_FILE_WRITE 1
+#define UPLOAD_FILE_END 2
+struct HTTPUpload{int status; String filename; String name; String type; size_t totalSize; size_t currentSize; uint8_t buf[2048];};
+
+        // A client connection. Copies share the connection, as on the device.
+        // Everything written is appended to sent. The harness sets window to
+        // what availableForWrite() reports (0 to stall) and connected to drop it.
+
+struct hostConnection {
+  std::string sent;
+  size_t window = 65536;
+  bool connected = true;
+  bool stopped = false;
+};
+
+class WiFiClient: public Stream {
+  public:
+    std::shared_ptr<hostConnection> conn;
+    WiFiClient():conn(std::make_shared<hostConnection>()){}
+    size_t write(uint8_t c){return write(&c, 1);}
+    size_t write(const uint8_t* buf, size_t len){
+      if( ! conn->connected || conn->stopped) return 0;
+      conn->sent.append((const char*)buf, len);
+      return len;
+    }
+    using Print::write;
+    size_t write(File&){return 0;}
+    IPAddress remoteIP(){return IPAddress();}
+    bool connected(){return conn->connected && ! conn->stopped;}
+    size_t availableForWrite(){return connected() ? conn->window : 0;}
+    void stop(){conn->stopped = true;}
+    void setNoDelay(bool){}
+};
+
+        // Requests are set up by the harness with hostRequest(). Responses sent
+        // with send() and sendContent() are written to the client, so
+        // client().conn->sent holds the whole response.
+
+class ESP8266WebServer {
+  public:
+    ESP8266WebServer(int){}
+    typedef std::function<void(void)> THandlerFunction;
+    void on(const String&, HTTPMethod, THandlerFunction){}
+    void on(const String&, HTTPMethod, THandlerFunction, THandlerFunction){}
+    void on(const String&, THandlerFunction){}
+    void onNotFound(THandlerFunction){}
+    void onFileUpload(THandlerFunction){}
+    void begin(){}
+    void handleClient(){}
+
+    void hostRequest(const char* uri, const std::vector<std::pair<std::string, std::string>>& args = {},
+                     const std::map<std::string, std::string>& headers = {}){
+      _uri = uri;
+      _args = args;
+      _headers = headers;
+      _client = WiFiClient();
+      _code = 0;
+      _contentLength = CONTENT_LENGTH_UNKNOWN;
+    }
+    int hostCode(){return _code;}
+
+    int args(){return _args.size();}
+    String arg(int i){return i < (int)_args.size() ? String(_args[i].second.c_str()) : String();}
+    String argName(int i){return i < (int)_args.size() ? String(_args[i].first.c_str()) : String();}
+    String arg(const char* name){for(auto& a : _args) if(a.first == name) return String(a.second.c_str()); return String();}
+    String arg(const String& name){return arg(name.c_str());}
+    String arg(const __FlashStringHelper* name){return arg((const char*)name);}
+    bool hasArg(const char* name){for(auto& a : _args) if(a.first == name) return true; return false;}
+    bool hasArg(const String& name){return hasArg(name.c_str());}
+    bool hasArg(const __FlashStringHelper* name){return hasArg((const char*)name);}
+    String uri(){return String(_uri.c_str());}
+    HTTPMethod method(){return HTTP_GET;}
+    String header(const char* name){auto h = _headers.find(name); return h == _headers.end() ? String() : String(h->second.c_str());}
+    String header(const String& name){return header(name.c_str());}
+    String header(const __FlashStringHelper* name){return header((const char*)name);}
+    bool hasHeader(const char* name){return _headers.count(name) > 0;}
+    bool hasHeader(const String& name){return hasHeader(name.c_str());}
+    bool hasHeader(const __FlashStringHelper* name){return hasHeader((const char*)name);}
+    void collectHeaders(const char**, size_t){}
+
+    void send(int code, const char* type = 0, const String& content = String()){
+      _code = code;
+      String head = String("HTTP/1.1 ") + String(code) + "\r\n";
+      if(type) head += String("Content-Type: ") + type + "\r\n";
+      size_t length = _contentLength == CONTENT_LENGTH_UNKNOWN ? content.length() : _contentLength;
+      if(length != CONTENT_LENGTH_UNKNOWN) head += String("Content-Length: ") + String((unsigned long)length) + "\r\n";
+      head += _sendHeaders + "\r\n";
+      _sendHeaders = String();
+      _client.write(head.c_str(), head.length());
+      _client.write(content.c_str(), content.length());
+    }
+    void send(int code, const String& type, const String& content){send(code, type.c_str(), content);}
+    void send(int code, const char* type, const char* content){send(code, type, String(content));}
+    void send_P(int code, const char* type, const char* content){send(code, type, String(content));}
+    void send_P(int code, const char* type, const char* content, size_t len){send(code, type, String(std::string(content, len).c_str()));}
+    void sendHeader(const String& name, const String& value, bool = false){_sendHeaders += name + ": " + value + "\r\n";}
+    void sendHeader(const char* name, const char* value, bool first = false){sendHeader(String(name), String(value), first);}
+    void setContentLength(size_t length){_contentLength = length;}
+    void sendContent(const String& content){_client.write(content.c_str(), content.length());}
+    void sendContent(const char* content, size_t len){_client.write(content, len);}
+    void sendContent_P(const char* content){_client.write(content);}
+    void sendContent_P(const char* content, size_t len){_client.write(content, len);}
+    template<class T> size_t streamFile(T&, const String&){return 0;}
+    WiFiClient client(){return _client;}
+    HTTPUpload& upload();
+    bool authenticate(const char*, const char*){return true;}
+    void requestAuthentication(int = 0, const char* = 0, const String& = String()){}
+    String hostHeader();
+
+  private:
+    std::string _uri;
+    std::vector<std::pair<std::string, std::string>> _args;
+    std::map<std::string, std::string> _headers;
+    WiFiClient _client;
+    String _sendHeaders;
+    size_t _contentLength = CONTENT_LENGTH_UNKNOWN;
+    int _code = 0;
+};
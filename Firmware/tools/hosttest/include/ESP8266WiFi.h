@@ -0,0 +1,6 @@
+#pragma once
+#include "hostcore.h"
+class IPAddress{public: IPAddress(){} IPAddress(uint32_t){} IPAddress(int,int,int,int){} String toString()const; operator uint32_t()const{return 0;} uint8_t operator[](int)const{return 0;} bool fromString(const char*){return true;}};
+class WiFiClass{public: int status(){return 0;} bool isConnected(){return true;} IPAddress localIP(){return IPAddress();} int RSSI(){return 0;} String SSID(); String macAddress(); void hostname(const char*){} const char* hostname(); IPAddress gatewayIP(); IPAddress subnetMask(); IPAddress dnsIP(int=0); uint8_t* BSSID(){return 0;} int channel(){return 0;} void mode(int){} void begin(){} void disconnect(bool=false){} void setAutoReconnect(bool){} String BSSIDstr(); void setSleepMode(int){} };
+extern WiFiClass WiFi;
+#define WL_CONNECTED 3
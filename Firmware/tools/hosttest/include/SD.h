@@ -0,0 +1,69 @@
+// Host SD: Files are host files under SD.root, opened read/write the way the firmware uses them.
+#pragma once
+#include "hostcore.h"
+#include <sys/stat.h>
+
+#define FILE_READ 0
+#define FILE_WRITE 1
+
+struct hostIOstats {
+    uint32_t opens;
+    uint32_t seeks;
+    uint32_t reads;
+    uint64_t readBytes;
+    uint32_t writes;
+    uint64_t writeBytes;
+    void clear(){*this = hostIOstats();}
+};
+
+class File: public Stream {
+  public:
+    File():_fp(nullptr),_dir(false){}
+    File(FILE* fp, const std::string& path, bool dir=false):_fp(fp),_path(path),_dir(dir){}
+    size_t write(uint8_t c){return write(&c, 1);}
+    size_t write(const uint8_t* buf, size_t len);
+    using Print::write;
+    int read(){uint8_t c; return read(&c, 1) == 1 ? c : -1;}
+    int read(void* buf, uint32_t len);
+    int peek();
+    int available();
+    bool seek(uint32_t pos);
+    uint32_t position();
+    uint32_t size();
+    bool truncate(uint32_t size);
+    void flush(){if(_fp) fflush(_fp);}
+    void close(){if(_fp) fclose(_fp); _fp = nullptr; _dir = false;}
+    operator bool() const {return _fp != nullptr || _dir;}
+    const char* name(){return _path.c_str();}
+    bool isDirectory(){return _dir;}
+    File openNextFile(int=0){return File();}
+    void rewindDirectory(){}
+    uint32_t lastModified(){return 0;}
+  private:
+    FILE* _fp;
+    std::string _path;
+    bool _dir;
+};
+
+class SDClass {
+  public:
+    std::string root = "sdcard";                // Host directory that is the root of the SD card
+    hostIOstats stats;
+    bool begin(int, int=0){return true;}
+    File open(const char* path, int mode=FILE_READ);
+    File open(const String& path, int mode=FILE_READ){return open(path.c_str(), mode);}
+    bool exists(const char* path){struct stat st; return stat(host(path).c_str(), &st) == 0;}
+    bool exists(const String& path){return exists(path.c_str());}
+    bool exists(const __FlashStringHelper* path){return exists((const char*)path);}
+    bool mkdir(const char* path);
+    bool mkdir(const String& path){return mkdir(path.c_str());}
+    bool mkdir(const __FlashStringHelper* path){return mkdir((const char*)path);}
+    bool remove(const char* path){return ::remove(host(path).c_str()) == 0;}
+    bool remove(const String& path){return remove(path.c_str());}
+    bool rmdir(const char* path){return ::remove(host(path).c_str()) == 0;}
+    bool rmdir(const String& path){return rmdir(path.c_str());}
+    bool rename(const char* from, const char* to){return ::rename(host(from).c_str(), host(to).c_str()) == 0;}
+    std::string host(const char* path){return root + (*path == '/' ? "" : "/") + path;}
+};
+extern SDClass SD;
+typedef void (*dateTimeCB)(uint16_t*, uint16_t*);
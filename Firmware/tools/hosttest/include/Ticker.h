@@ -0,0 +1,3 @@
+#pragma once
+#include "hostcore.h"
+class Ticker{public: template<class F> void attach(float,F){} template<class F> void attach_ms(uint32_t,F){} template<class F,class A> void attach_ms(uint32_t,F,A){} template<class F> void once(float,F){} template<class F> void once_ms(uint32_t,F){} void detach(){}};
@@ -0,0 +1,3 @@
+#pragma once
+#include "hostcore.h"
+class WiFiManager{public: void setDebugOutput(bool){} void setConfigPortalTimeout(int){} bool startConfigPortal(const char*,const char* =0){return true;} void setAPCallback(void(*)(WiFiManager*)){} };
@@ -0,0 +1,4 @@
+#pragma once
+#include "hostcore.h"
+class TwoWire{public: void begin(){} void beginTransmission(int){} int endTransmission(bool=true){return 0;} size_t write(uint8_t){return 1;} int read(){return 0;} int requestFrom(int,int){return 0;} int available(){return 0;} void setClock(long){}};
+extern TwoWire Wire;
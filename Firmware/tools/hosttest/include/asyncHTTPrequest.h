@@ -0,0 +1,53 @@
+// Host asyncHTTPrequest: a harness loads the response with hostResponse() and hostState(),
+// then the firmware reads it through the usual interface.
+#pragma once
+#include "hostcore.h"
+#include "xbuf.h"
+
+class asyncHTTPrequest {
+  public:
+    bool open(const char*, const char*){_state = 1; return true;}
+    bool send(){_state = 2; return true;}
+    bool send(const char*){return send();}
+    bool send(const String&){return send();}
+    bool send(xbuf* body, size_t len){_sent.flush(); _sent.write(body, len); return send();}
+    bool send(const uint8_t* body, size_t len){_sent.flush(); _sent.write(body, len); return send();}
+    void setReqHeader(const char*, const char*){}
+    void setReqHeader(const char*, int){}
+    void setReqHeader(const __FlashStringHelper*, const char*){}
+    void setReqHeader(const __FlashStringHelper*, const __FlashStringHelper*){}
+    void setReqHeader(const __FlashStringHelper*, int){}
+    void setReqHeader(const __FlashStringHelper*, const String&){}
+    int readyState(){return _state;}
+    int responseHTTPcode(){return _code;}
+    String responseText(){return _response.readString();}
+    size_t available(){return _state >= 3 ? _response.available() : 0;}
+    size_t responseRead(uint8_t* buf, size_t len){return _state >= 3 ? _response.read(buf, len) : 0;}
+    void setTimeout(int){}
+    void setDebug(bool){}
+    bool debug(){return false;}
+    int respHeaderCount(){return 0;}
+    char* respHeaderName(int){return nullptr;}
+    char* respHeaderValue(int){return nullptr;}
+    char* respHeaderValue(const char*){return nullptr;}
+    char* respHeaderValue(const __FlashStringHelper*){return nullptr;}
+    bool respHeaderExists(const char*){return false;}
+    bool respHeaderExists(const __FlashStringHelper*){return false;}
+    String headers(){return String();}
+    uint32_t elapsedTime(){return 0;}
+    String version(){return "host";}
+    void abort(){_state = 4;}
+    void onReadyStateChange(std::function<void(void*, asyncHTTPrequest*, int)>, void* =0){}
+    void onData(std::function<void(void*, asyncHTTPrequest*, size_t)>, void* =0){}
+
+        // Harness side
+
+    void hostResponse(int code, const char* data, size_t len){_code = code; _response.write((const uint8_t*)data, len);}
+    void hostState(int state){_state = state;}
+    xbuf& hostSent(){return _sent;}
+  private:
+    int _state = 0;
+    int _code = 0;
+    xbuf _response;
+    xbuf _sent;
+};
@@ -0,0 +1,265 @@
+/***********************************************************************************************
+ * Host build environment for IoTaWatt firmware translation units.
+ *
+ * These headers stand in for the Arduino core and libraries so that firmware .cpp files can
+ * be compiled unmodified on Linux or macOS by the harnesses in Firmware/tools/hosttest.
+ * Only what the harnesses exercise is functional:
+ *      String, Print, Stream and Serial (stdout)
+ *      File and SD, on host files under SD.root
+ *      millis(), micros() and yield()
+ *      xbuf
+ *      SHA256, AES128 and CBC (OpenSSL libcrypto)
+ * Everything else (WiFi, web server, JSON...) is a declaration so the firmware compiles.
+ * ESP.restart() throws hostRestart so a harness can catch it.
+ **********************************************************************************************/
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <math.h>
+#include <functional>
+#include <string>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <vector>
+
+typedef bool boolean;
+typedef uint8_t byte;
+typedef uint32_t uint32;
+typedef int32_t int32;
+typedef uint16_t uint16;
+typedef uint8_t uint8;
+#undef unix
+
+#define PROGMEM
+#define ICACHE_RAM_ATTR
+#define PGM_P const char*
+#define PSTR(s) (s)
+#define F(s) ((const __FlashStringHelper*)(s))
+#define FPSTR(s) ((const __FlashStringHelper*)(s))
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define pgm_read_word(p) (*(const uint16_t*)(p))
+#define pgm_read_dword(p) (*(const uint32_t*)(p))
+#define memcpy_P memcpy
+#define strstr_P strstr
+#define strcasecmp_P strcasecmp
+#define strncasecmp_P strncasecmp
+#define strncpy_P strncpy
+#define strcat_P strcat
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define sprintf_P sprintf
+#define snprintf_P snprintf
+#ifndef min
+#define min(a,b) ((a)<(b)?(a):(b))
+#define max(a,b) ((a)>(b)?(a):(b))
+#endif
+#define PI 3.1415926535897932384626433832795
+#define HALF_PI 1.5707963267948966192313216916398
+#define TWO_PI 6.283185307179586476925286766559
+#define DEG_TO_RAD 0.017453292519943295769236907684886
+#define RAD_TO_DEG 57.295779513082320876798154814105
+#define constrain(x,a,b) ((x)<(a)?(a):((x)>(b)?(b):(x)))
+#define HEX 16
+#define DEC 10
+#define LOW 0
+#define HIGH 1
+#define OUTPUT 1
+#define INPUT 0
+
+class __FlashStringHelper;
+class String;
+
+class Print {
+  public:
+    virtual ~Print(){}
+    virtual size_t write(uint8_t) = 0;
+    virtual size_t write(const uint8_t* buf, size_t len){for(size_t i=0; i<len; i++) write(buf[i]); return len;}
+    size_t write(const char* str){return write((const uint8_t*)str, strlen(str));}
+    size_t write(const char* buf, size_t len){return write((const uint8_t*)buf, len);}
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+    size_t printf_P(const char* format, ...) __attribute__((format(printf, 2, 3)));
+    size_t vprintf(const char* format, va_list args);
+    size_t print(const char* str){return write(str);}
+    size_t print(const String&);
+    size_t print(const __FlashStringHelper* str){return write((const char*)str);}
+    size_t print(char c){return write((uint8_t)c);}
+    size_t print(int v, int base=10){return print((long)v, base);}
+    size_t print(unsigned v, int base=10){return print((unsigned long)v, base);}
+    size_t print(long v, int base=10){return base == 16 ? printf("%lx", v) : printf("%ld", v);}
+    size_t print(unsigned long v, int base=10){return base == 16 ? printf("%lx", v) : printf("%lu", v);}
+    size_t print(double v, int digits=2){return printf("%.*f", digits, v);}
+    size_t println(){return write("\r\n");}
+    template<class T> size_t println(T v){size_t n = print(v); return n + println();}
+    template<class T> size_t println(T v, int f){size_t n = print(v, f); return n + println();}
+    virtual void flush(){}
+};
+
+class Stream: public Print {
+  public:
+    virtual int available(){return 0;}
+    virtual int read(){return -1;}
+    virtual int peek(){return -1;}
+    size_t readBytes(char* buf, size_t len){size_t n=0; int c; while(n < len && (c = read()) >= 0) buf[n++] = c; return n;}
+    size_t readBytes(uint8_t* buf, size_t len){return readBytes((char*)buf, len);}
+    String readStringUntil(char);
+};
+
+class String {
+  public:
+    std::string s;
+    String(){}
+    String(const char* c){if(c) s = c;}
+    String(const String& o):s(o.s){}
+    String(const __FlashStringHelper* c){if(c) s = (const char*)c;}
+    explicit String(char c):s(1, c){}
+    explicit String(int v, int base=10){s = fmt(base == 16 ? "%x" : "%d", v);}
+    explicit String(unsigned v, int base=10){s = fmt(base == 16 ? "%x" : "%u", v);}
+    explicit String(long v, int base=10){s = fmt(base == 16 ? "%lx" : "%ld", v);}
+    explicit String(unsigned long v, int base=10){s = fmt(base == 16 ? "%lx" : "%lu", v);}
+    explicit String(double v, int digits=2){s = fmt("%.*f", digits, v);}
+    explicit String(float v, int digits=2){s = fmt("%.*f", digits, (double)v);}
+    String& operator=(const String& o){s = o.s; return *this;}
+    String& operator=(const char* c){s = c ? c : ""; return *this;}
+    String& operator+=(const String& o){s += o.s; return *this;}
+    String& operator+=(const char* c){if(c) s += c; return *this;}
+    String& operator+=(char c){s += c; return *this;}
+    String& operator+=(int v){s += fmt("%d", v); return *this;}
+    String& operator+=(unsigned v){s += fmt("%u", v); return *this;}
+    String& operator+=(long v){s += fmt("%ld", v); return *this;}
+    String& operator+=(unsigned long v){s += fmt("%lu", v); return *this;}
+    String& operator+=(double v){s += fmt("%.2f", v); return *this;}
+    String& operator+=(const __FlashStringHelper* c){s += (const char*)c; return *this;}
+    bool concat(const char* c){if(c) s += c; return true;}
+    bool concat(const String& c){s += c.s; return true;}
+    bool concat(char c){s += c; return true;}
+    bool concat(int v){s += fmt("%d", v); return true;}
+    bool concat(double v, int digits=2){s += fmt("%.*f", digits, v); return true;}
+    friend String operator+(const char* a, const String& b){String r(a); r += b; return r;}
+    friend String operator+(const String& a, const String& b){String r(a); r += b; return r;}
+    friend String operator+(const String& a, const char* b){String r(a); r += b; return r;}
+    friend String operator+(const String& a, char b){String r(a); r += b; return r;}
+    friend String operator+(const String& a, int b){String r(a); r += b; return r;}
+    friend String operator+(const String& a, const __FlashStringHelper* b){String r(a); r += b; return r;}
+    bool operator==(const String& o) const {return s == o.s;}
+    bool operator==(const char* o) const {return s == o;}
+    bool operator!=(const String& o) const {return s != o.s;}
+    bool operator!=(const char* o) const {return s != o;}
+    bool operator<(const String& o) const {return s < o.s;}
+    char operator[](unsigned i) const {return i < s.size() ? s[i] : 0;}
+    char& operator[](unsigned i){static char dummy; return i < s.size() ? s[i] : dummy;}
+    const char* c_str() const {return s.c_str();}
+    unsigned length() const {return s.size();}
+    int indexOf(char c, unsigned from=0) const {return pos(s.find(c, from));}
+    int indexOf(const char* c, unsigned from=0) const {return pos(s.find(c, from));}
+    int indexOf(const String& c, unsigned from=0) const {return pos(s.find(c.s, from));}
+    int lastIndexOf(char c) const {return pos(s.rfind(c));}
+    int lastIndexOf(const char* c) const {return pos(s.rfind(c));}
+    String substring(unsigned from) const {return from < s.size() ? String(s.substr(from).c_str()) : String();}
+    String substring(unsigned from, unsigned to) const {return from < to && from < s.size() ? String(s.substr(from, to - from).c_str()) : String();}
+    void remove(unsigned from){if(from < s.size()) s.erase(from);}
+    void remove(unsigned from, unsigned n){if(from < s.size()) s.erase(from, n);}
+    void trim(){size_t b = s.find_first_not_of(" \t\r\n"); size_t e = s.find_last_not_of(" \t\r\n"); s = b == std::string::npos ? "" : s.substr(b, e - b + 1);}
+    void toLowerCase(){for(auto& c : s) c = tolower(c);}
+    void toUpperCase(){for(auto& c : s) c = toupper(c);}
+    long toInt() const {return strtol(s.c_str(), nullptr, 10);}
+    float toFloat() const {return strtof(s.c_str(), nullptr);}
+    double toDouble() const {return strtod(s.c_str(), nullptr);}
+    bool equals(const String& o) const {return s == o.s;}
+    bool equals(const char* o) const {return s == o;}
+    bool equalsIgnoreCase(const String& o) const {return strcasecmp(s.c_str(), o.s.c_str()) == 0;}
+    bool startsWith(const String& o) const {return s.compare(0, o.s.size(), o.s) == 0;}
+    bool startsWith(const char* o) const {return startsWith(String(o));}
+    bool endsWith(const String& o) const {return s.size() >= o.s.size() && s.compare(s.size() - o.s.size(), o.s.size(), o.s) == 0;}
+    bool endsWith(const char* o) const {return endsWith(String(o));}
+    bool reserve(unsigned n){s.reserve(n); return true;}
+    char charAt(unsigned i) const {return (*this)[i];}
+    void setCharAt(unsigned i, char c){if(i < s.size()) s[i] = c;}
+    void replace(const String& a, const String& b){size_t p = 0; while(a.s.size() && (p = s.find(a.s, p)) != std::string::npos){s.replace(p, a.s.size(), b.s); p += b.s.size();}}
+    void replace(const char* a, const char* b){replace(String(a), String(b));}
+    void replace(char a, char b){for(auto& c : s) if(c == a) c = b;}
+    void toCharArray(char* buf, unsigned size) const {if(size){strncpy(buf, s.c_str(), size - 1); buf[size - 1] = 0;}}
+    void getBytes(uint8_t* buf, unsigned size) const {toCharArray((char*)buf, size);}
+    int compareTo(const String& o) const {return s.compare(o.s);}
+    operator bool() const {return true;}
+
+  private:
+    static int pos(size_t p){return p == std::string::npos ? -1 : (int)p;}
+    static std::string fmt(const char* format, ...){
+      char buf[64]; va_list args; va_start(args, format); vsnprintf(buf, sizeof(buf), format, args); va_end(args); return buf;
+    }
+};
+
+inline size_t Print::vprintf(const char* format, va_list args){
+  char buf[256];
+  va_list copy;
+  va_copy(copy, args);
+  int len = vsnprintf(buf, sizeof(buf), format, copy);
+  va_end(copy);
+  if(len < 0) return 0;
+  if((size_t)len < sizeof(buf)) return write((const uint8_t*)buf, len);
+  char* big = new char[len + 1];
+  vsnprintf(big, len + 1, format, args);
+  size_t n = write((const uint8_t*)big, len);
+  delete[] big;
+  return n;
+}
+inline size_t Print::printf(const char* format, ...){va_list a; va_start(a, format); size_t n = vprintf(format, a); va_end(a); return n;}
+inline size_t Print::printf_P(const char* format, ...){va_list a; va_start(a, format); size_t n = vprintf(format, a); va_end(a); return n;}
+inline size_t Print::print(const String& str){return write(str.c_str());}
+inline String Stream::readStringUntil(char end){String r; int c; while((c = read()) >= 0 && c != end) r += (char)c; return r;}
+
+class HardwareSerial: public Stream {
+  public:
+    bool quiet = true;                          // Harnesses set false to see firmware console output
+    size_t write(uint8_t c){if( ! quiet) fputc(c, stdout); return 1;}
+    using Print::write;
+    void begin(long){}
+    void setDebugOutput(bool){}
+};
+extern HardwareSerial Serial;
+
+struct hostRestart {};
+class EspClass {
+  public:
+    void restart(){throw hostRestart();}
+    void reset(){throw hostRestart();}
+    void wdtFeed(){}
+    uint32_t getFreeHeap(){return 40000;}
+    uint32_t getMaxFreeBlockSize(){return 30000;}
+    uint8_t getHeapFragmentation(){return 0;}
+    uint32_t getChipId(){return 0;}
+    uint32_t getCycleCount(){return 0;}
+    uint32_t getCpuFreqMHz(){return 80;}
+    uint32_t getFlashChipSize(){return 4194304;}
+    uint32_t getFreeSketchSpace(){return 0;}
+    uint32_t getVcc(){return 3300;}
+    String getResetReason(){return "host";}
+    String getSdkVersion(){return "host";}
+    String getCoreVersion(){return "host";}
+    void deepSleep(uint64_t){}
+};
+extern EspClass ESP;
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t);
+void delayMicroseconds(uint32_t);
+void yield();
+long random(long);
+long random(long, long);
+void randomSeed(unsigned long);
+inline void pinMode(int, int){}
+inline void digitalWrite(int, int){}
+inline int digitalRead(int){return 0;}
+char* dtostrf(double, signed char, unsigned char, char*);
+char* itoa(int, char*, int);
+char* ultoa(unsigned long, char*, int);
+char* ltoa(long, char*, int);
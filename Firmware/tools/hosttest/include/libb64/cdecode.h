@@ -0,0 +1,3 @@
+#pragma once
+#include "../hostcore.h"
+extern "C" int base64_decode_chars(const char*,int,char*);
@@ -0,0 +1,34 @@
+// Host xbuf: same interface as the asyncHTTPrequest xbuf, kept in a std::string.
+#pragma once
+#include "hostcore.h"
+
+class xbuf: public Print {
+  public:
+    xbuf(const uint16_t segSize=64):_pos(0){}
+    size_t write(uint8_t c){_data.push_back(c); return 1;}
+    size_t write(const uint8_t* buf, size_t len){_data.append((const char*)buf, len); return len;}
+    using Print::write;
+    size_t write(String str){return write(str.c_str());}
+    size_t write(xbuf* buf, size_t len=0){
+      if(len == 0 || len > buf->available()) len = buf->available();
+      _data.append(buf->_data, buf->_pos, len); buf->_pos += len; return len;
+    }
+    size_t available(){return _data.size() - _pos;}
+    int indexOf(const char c, const size_t begin=0){size_t p = _data.find(c, _pos + begin); return p == std::string::npos ? -1 : p - _pos;}
+    int indexOf(const char* str, const size_t begin=0){size_t p = _data.find(str, _pos + begin); return p == std::string::npos ? -1 : p - _pos;}
+    uint8_t read(){return available() ? (uint8_t)_data[_pos++] : 0;}
+    size_t read(uint8_t* buf, size_t len){len = peek(buf, len); remove(len); return len;}
+    uint8_t peek(){return available() ? (uint8_t)_data[_pos] : 0;}
+    size_t peek(uint8_t* buf, size_t len){if(len > available()) len = available(); memcpy(buf, _data.data() + _pos, len); return len;}
+    String readStringUntil(const char c){int i = indexOf(c); return readString(i < 0 ? available() : i + 1);}
+    String readStringUntil(const char* str){int i = indexOf(str); return readString(i < 0 ? available() : i + strlen(str));}
+    String readString(int len){String r = peekString(len); remove(r.length()); return r;}
+    String readString(){return readString(available());}
+    String peekString(int len){if(len < 0 || (size_t)len > available()) len = available(); return String(_data.substr(_pos, len).c_str());}
+    String peekString(){return peekString(available());}
+    void remove(size_t len){_pos += len < available() ? len : available(); if(_pos == _data.size()){_data.clear(); _pos = 0;}}
+    void flush(){_data.clear(); _pos = 0;}
+  private:
+    std::string _data;
+    size_t _pos;
+};
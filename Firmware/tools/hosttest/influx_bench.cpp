@@ -0,0 +1,216 @@
+/***********************************************************************************************
+ * influx_bench - influxDB line protocol generation on the host
+ *
+ * Writes a day of Current_log with eight inputs, configures the firmware's influxDB v1 and
+ * v2 uploaders with eight outputs, and times their handle_write_s() building posts from
+ * the whole log. HTTPPost() is replaced to count and discard each post, so only the
+ * datalog scan, Script evaluation and line protocol formatting are timed. Reports records
+ * and lines per second for a few measurement and tag configurations, and checks that
+ * every value of every record was written.
+ *
+ * The host has no Json parser, so the uploaders' private configuration is set directly.
+ *
+ * Build (from Firmware/tools/hosttest):
+ *      g++ -O2 -std=gnu++11 -I include -I ../../IotaWatt -ffunction-sections -Wl,--gc-sections \
+ *          -o influx_bench influx_bench.cpp hostcore.cpp ../../IotaWatt/influxDB_v1_uploader.cpp \
+ *          ../../IotaWatt/influxDB_v2_uploader.cpp ../../IotaWatt/uploader.cpp \
+ *          ../../IotaWatt/IotaLog.cpp ../../IotaWatt/IotaScript.cpp ../../IotaWatt/simSolar.cpp \
+ *          ../../IotaWatt/utilities.cpp ../../IotaWatt/gzip.cpp ../../IotaWatt/RTC.cpp \
+ *          ../../IotaWatt/xurl.cpp ../../IotaWatt/responseParser.cpp -fpermissive -lcrypto
+ *
+ * Usage:
+ *      influx_bench [hours]            (default 24)
+ **********************************************************************************************/
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "hostcore.h"
+#include "xbuf.h"
+#include "asyncHTTPrequest.h"
+#define private public
+#define protected public
+#include "IotaWatt.h"
+#include "influxDB_v1_uploader.h"
+#include "influxDB_v2_uploader.h"
+#undef private
+#undef protected
+
+#define T0 1577836800UL                             // 2020-01-01
+#define OUTPUTS 8
+
+        // Firmware globals used by the uploaders
+
+IotaLog Current_log(256, 5, 365, 0);
+IotaLog History_log(256, 60, 365, 0);
+messageLog Message_log;
+uint32_t bingoTime = 0xFFFFFFFF;
+IotaInputChannel* *inputChannel = nullptr;
+uint8_t maxInputs = MAXINPUTS;
+ScriptSet* integrations = nullptr;
+simSolar* simsolar = nullptr;
+bool RTCrunning = false;
+int32_t localTimeDiff = 0;
+char* deviceName = charstar("IotaWatt");
+uploader* influxDB_v1 = nullptr;
+uploader* influxDB_v2 = nullptr;
+uploader* Emoncms = nullptr;
+char* HTTPSproxy = nullptr;
+int32_t uploaderBufferLimit = 3000;
+int32_t uploaderBufferTotal = 24000;
+const char base64codes_P[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+static uint32_t now = T0;
+void trace(const uint8_t, const uint8_t, const uint8_t){}
+serviceBlock* NewService(Service, const uint8_t, void*){static serviceBlock sb; return &sb;}
+uint32_t UTCtime(){return now;}
+uint32_t localTime(){return now;}
+uint32_t localTime(uint32_t t){return t;}
+uint32_t UTC2Local(uint32_t t){return t;}
+double integrator::run(IotaLogRecord*, IotaLogRecord*, units, char){return 0;}
+void setLedCycle(const char*){}
+void endLedCycle(){}
+messageLog::messageLog(){}
+size_t messageLog::write(const uint8_t c){return 1;}
+size_t messageLog::write(const uint8_t* buf, const size_t len){return len;}
+void messageLog::endMsg(){}
+uint32_t HTTPreserve(uint16_t, bool){return 1;}
+void HTTPrelease(uint32_t){}
+
+        // Configuration and HTTP paths not run by the bench
+
+JsonObject& DynamicJsonBuffer::parseObject(const char*){abort();}
+JsonObject& DynamicJsonBuffer::parseObject(const String&){abort();}
+JsonVariant::operator JsonArray&() const {abort();}
+
+static const char* outputNames[OUTPUTS] = {"Main", "Solar", "HeatPump", "Volts", "Kitchen", "Dryer", "Furnace", "PF"};
+static const char* outputUnits[OUTPUTS] = {"Watts", "Watts", "Watts", "Volts", "Watts", "Watts", "Watts", "PF"};
+static const char* outputScripts[OUTPUTS] = {"@1+@2", "@3", "@4", "@0", "@5", "@6", "@7", "@1"};
+
+static void setupInputs(){
+  inputChannel = new IotaInputChannel*[MAXINPUTS];
+  for(int i=0; i<MAXINPUTS; i++){
+    inputChannel[i] = new IotaInputChannel(i);
+    inputChannel[i]->_vchannel = 0;
+    inputChannel[i]->_vmult = 1.0;
+    inputChannel[i]->_type = i ? channelTypePower : channelTypeVoltage;
+  }
+  integrations = new ScriptSet();
+}
+
+static ScriptSet* makeOutputs(){
+  ScriptSet* set = new ScriptSet();
+  Script** link = &set->_listHead;
+  for(int i=0; i<OUTPUTS; i++){
+    *link = new Script(outputNames[i], outputUnits[i], outputScripts[i]);
+    link = &(*link)->_next;
+  }
+  set->_count = OUTPUTS;
+  return set;
+}
+
+static void writeLog(uint32_t hours){
+  IotaLogRecord rec;
+  memset((void*)&rec, 0, sizeof(rec));
+  double step = 5.0 / 3600.0;
+  for(uint32_t t=T0; t<=T0 + hours * 3600; t+=5){
+    rec.UNIXtime = t;
+    rec.logHours += step;
+    for(int i=0; i<MAXINPUTS; i++){
+      double watts = i ? 100.0 * i + (t / 5) % 97 : 120.0 + (t / 5) % 7 * 0.1;
+      rec.accum1[i] += watts * step;
+      rec.accum2[i] += (i ? watts * 1.1 : 60.0) * step;
+    }
+    Current_log.write(&rec);
+  }
+  now = T0 + hours * 3600;
+}
+
+        // The uploader with its posts counted and discarded.
+
+template<class U> class bench : public U {
+  public:
+    size_t posts = 0;
+    size_t bytes = 0;
+    size_t lines = 0;
+    size_t values = 0;
+    void HTTPPost(const char*, typename U::states, const char*, bool) override {
+      posts++;
+      bytes += this->reqData.available();
+      while(this->reqData.available()){
+        String line = this->reqData.readStringUntil('\n');
+        lines++;
+        const char* fields = strchr(line.c_str(), ' ');
+        for(const char* c = fields; c && *c; c++){
+          if(*c == '=') values++;
+        }
+      }
+      this->_lastSent = this->_lastPost;
+    }
+};
+
+template<class U> static void configure(U* up, const char* measurement, const char* fieldKey,
+                                        std::vector<std::pair<const char*, const char*>> tags){
+  up->_measurement = charstar(measurement);
+  up->_fieldKey = charstar(fieldKey);
+  typename U::influxTag** link = &up->_tagSet;
+  for(auto& t : tags){
+    *link = new typename U::influxTag;
+    (*link)->key = charstar(t.first);
+    (*link)->value = charstar(t.second);
+    link = &(*link)->next;
+  }
+  up->_outputs = makeOutputs();
+  up->_interval = 5;
+  up->_bulkSend = 1;
+  up->_batchLimit = 3000;
+  up->_lastSent = T0;
+}
+
+static int failures = 0;
+
+template<class U> static void run(const char* name, const char* measurement, const char* fieldKey,
+                                  std::vector<std::pair<const char*, const char*>> tags, uint32_t hours){
+  bench<U>* up = new bench<U>;
+  configure(up, measurement, fieldKey, tags);
+  auto t0 = std::chrono::steady_clock::now();
+  while(Current_log.lastKey() >= up->_lastSent + up->_interval * (1 + up->_bulkSend)){
+    up->handle_write_s();
+  }
+  double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  uint32_t records = hours * 3600 / 5;
+  uint32_t expected = (records - 1) * OUTPUTS;      // The last interval waits for the next record
+  printf("  %-3s %-14s %-12s %d tags  %5.0fK records/s  %6.2fM lines/s  %4.0f bytes/record\n",
+         name, measurement, fieldKey, (int)tags.size(), records / s / 1000, up->lines / s / 1e6, (double)up->bytes / records);
+  if(up->values != expected){
+    printf("  FAIL: %zu values, expected %u\n", up->values, expected);
+    failures++;
+  }
+  delete up;
+}
+
+int main(int argc, char** argv){
+  uint32_t hours = argc > 1 ? atoi(argv[1]) : 24;
+  char root[] = "/tmp/influx_benchXXXXXX";
+  SD.root = mkdtemp(root);
+  setupInputs();
+  Current_log.begin("/iotawatt/current.log");
+  writeLog(hours);
+  printf("%u hours of datalog, %d outputs\n", hours, OUTPUTS);
+
+  std::vector<std::pair<const char*, const char*>> tags = {{"device", "$device"}, {"units", "$units"}};
+  run<influxDB_v1_uploader>("v1", "$name", "value", tags, hours);
+  run<influxDB_v1_uploader>("v1", "iotawatt", "$name", {{"device", "$device"}}, hours);
+  run<influxDB_v1_uploader>("v1", "$units", "$name", tags, hours);
+  run<influxDB_v2_uploader>("v2", "$name", "value", tags, hours);
+  run<influxDB_v2_uploader>("v2", "iotawatt", "$name", {{"device", "$device"}}, hours);
+
+  Current_log.end();
+  SD.remove("/iotawatt/current.log");
+  SD.rmdir("/iotawatt");
+  rmdir(SD.root.c_str());
+  printf("%d failures\n", failures);
+  return failures;
+}
@@ -0,0 +1,213 @@
+/***********************************************************************************************
+ * integration_bench - Integration queries over a year on the host
+ *
+ * Writes a year of 5 second integration log for one integration, opens it with the
+ * firmware's integrator Service and integrator_sync, then times integrator::run() over the
+ * year the way /query calls it: consecutive pairs of group boundaries, for group=1d and
+ * group=1h. Reports the time to open and synchronize, which includes building any
+ * checkpoint logs, and the time, SD reads and seeks for each query.
+ *
+ * Each log entry's sumPositive is its serial, so the Wh of every group is the number of
+ * 5 second intervals it holds. Every result is checked, and the totals depend only on the
+ * log, so builds from two versions of integrator.cpp can be compared directly.
+ *
+ * It then checks queries older than the 5 second log. The integration log is rewritten to
+ * hold only the last half of the range, with hourly and daily logs for all of it. Groups of
+ * 1d and 1h must still be exact, and 1 minute groups before the 5 second log must be missing,
+ * which Scripts see as zero.
+ *
+ * Build (from Firmware/tools/hosttest), where <src> is ../../IotaWatt or the Firmware/IotaWatt
+ * directory of another checkout:
+ *      g++ -O2 -std=gnu++11 -I include -I <src> -ffunction-sections -Wl,--gc-sections \
+ *          -o integration_bench integration_bench.cpp hostcore.cpp <src>/integrator.cpp \
+ *          <src>/IotaLog.cpp <src>/IotaScript.cpp <src>/simSolar.cpp <src>/utilities.cpp \
+ *          <src>/RTC.cpp -fpermissive -lcrypto
+ *
+ * Usage:
+ *      integration_bench [-v] [days]
+ **********************************************************************************************/
+#include <chrono>
+#include <unistd.h>
+#include "IotaWatt.h"
+
+#define T0 1577836800UL                             // 2020-01-01
+#define INTERVAL 5
+
+        // Firmware globals used by integrator
+
+IotaLog Current_log(256, INTERVAL, 365, 0);
+IotaLog History_log(256, 60, 365, 0);
+messageLog Message_log;
+uint32_t bingoTime = 0xFFFFFFFF;
+IotaInputChannel* *inputChannel = nullptr;
+uint8_t maxInputs = MAXINPUTS;
+ScriptSet* integrations = nullptr;
+simSolar* simsolar = nullptr;
+bool RTCrunning = false;
+int32_t localTimeDiff = 0;
+static uint32_t now = T0;
+void trace(const uint8_t, const uint8_t, const uint8_t){}
+serviceBlock* NewService(Service, const uint8_t, void*){static serviceBlock sb; return &sb;}
+uint32_t UTCtime(){return now;}
+uint32_t localTime(){return now;}
+uint32_t localTime(uint32_t t){return t;}
+uint32_t UTC2Local(uint32_t t){return t;}
+void queryCacheClear(){}
+void setLedCycle(const char*){}
+void endLedCycle(){}
+
+static bool verbose = false;
+messageLog::messageLog(){}
+size_t messageLog::write(const uint8_t c){if(verbose) putchar(c); return 1;}
+size_t messageLog::write(const uint8_t* buf, const size_t len){if(verbose) fwrite(buf, 1, len, stdout); return len;}
+void messageLog::endMsg(){if(verbose) putchar('\n');}
+
+static const char* logPath = "/iotawatt/integrations/bench.log";
+static const char* hourPath = "/iotawatt/integrations/bench.hrs";
+static const char* dayPath = "/iotawatt/integrations/bench.day";
+
+        // Write a log of the integration at every interval in [begin, end].
+
+static void writeLog(const char* path, uint32_t begin, uint32_t end, uint32_t interval){
+  FILE* fp = fopen(SD.host(path).c_str(), "wb");
+  static intRecord recs[4096];
+  uint32_t count = (end - begin) / interval + 1;
+  for(uint32_t serial=0; serial<count; ){
+    uint32_t n = 0;
+    for(; n<4096 && serial<count; n++, serial++){
+      recs[n].UNIXtime = begin + serial * interval;
+      recs[n].serial = serial;
+      recs[n].sumPositive = (recs[n].UNIXtime - T0) / INTERVAL;
+      recs[n].sumNegative = 0;
+      recs[n].sumNet = recs[n].sumPositive;
+    }
+    fwrite(recs, sizeof(intRecord), n, fp);
+  }
+  fclose(fp);
+}
+
+        // The integration log holds [T0 + detail days, T0 + days], and the datalog
+        // ends at the same key so the integrator is synchronized on open.
+        // If the integration log doesn't start at T0, the hourly and daily
+        // logs hold everything before it.
+
+static void writeLogs(uint32_t days, uint32_t detail = 0){
+  SD.mkdir("/iotawatt");
+  SD.mkdir("/iotawatt/integrations");
+  writeLog(logPath, T0 + detail * 86400, T0 + days * 86400, INTERVAL);
+  if(detail){
+    writeLog(hourPath, T0, T0 + days * 86400, 3600);
+    writeLog(dayPath, T0, T0 + days * 86400, 86400);
+  }
+
+  Current_log.begin("/iotawatt/current.log");
+  IotaLogRecord rec;
+  memset((void*)&rec, 0, sizeof(rec));
+  for(uint32_t t=T0 + days * 86400 - 60; t<=T0 + days * 86400; t+=INTERVAL){
+    rec.UNIXtime = t;
+    rec.logHours = (t - T0) / 3600.0;
+    Current_log.write(&rec);
+  }
+  now = T0 + days * 86400;
+}
+
+static int failures = 0;
+
+        // Wh of each group of a query over [begin, end], as /query gets them.
+        // Groups that start before detail, the first key of the 5 second log,
+        // have a value only when both ends are on an hour.
+
+static void query(integrator* integ, const char* name, uint32_t group, uint32_t begin, uint32_t end, uint32_t detail = T0){
+  IotaLogRecord oldRec, newRec;
+  double total = 0;
+  uint32_t groups = 0;
+  SD.stats.clear();
+  auto t0 = std::chrono::steady_clock::now();
+  for(uint32_t t=begin; t + group<=end; t+=group){
+    oldRec.UNIXtime = t;
+    oldRec.logHours = (t - T0) / 3600.0;
+    newRec.UNIXtime = t + group;
+    newRec.logHours = (t + group - T0) / 3600.0;
+    double wh = integ->run(&oldRec, &newRec, Wh, '+');
+    if(wh != wh) wh = 0;                              // Missing, as ScriptContext sees it
+    uint32_t expected = group / INTERVAL;
+    if(t < detail && (t % 3600 || (t + group) % 3600)){
+      expected = 0;
+    }
+    if(wh != expected && failures++ < 10){
+      printf("  %s FAIL at %u: %.1f Wh, expected %u\n", name, t, wh, expected);
+    }
+    total += wh;
+    groups++;
+  }
+  double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+  printf("  group=%-3s %5u groups  total %.0f Wh  %8.2f ms  %6u reads  %6u seeks\n",
+         name, groups, total, ms, SD.stats.reads, SD.stats.seeks);
+}
+
+uint32_t integrator_dispatch(struct serviceBlock*);     // The integrator Service
+
+        // Open and synchronize an integrator over the logs.
+
+static integrator* openIntegrator(){
+  Script* script = new Script("bench", "Watts", "@1");
+  integrator* integ = new integrator();
+  serviceBlock sb;
+  sb.serviceParm = integ;
+  integ->config(script);
+  while(integrator_dispatch(&sb) > 0);
+  while( ! integ->isSynchronized() && integrator_sync(&sb) > 0);
+  if( ! integ->isSynchronized()){
+    printf("  not synchronized\n");
+    exit(1);
+  }
+  return integ;
+}
+
+static void removeLogs(){
+  Current_log.end();
+  SD.remove("/iotawatt/current.log");
+  SD.remove(logPath);
+  SD.remove(hourPath);
+  SD.remove(dayPath);
+}
+
+int main(int argc, char** argv){
+  uint32_t days = 365;
+  for(int i=1; i<argc; i++){
+    if(strcmp(argv[i], "-v") == 0) verbose = true;
+    else if(atoi(argv[i]) > 0) days = atoi(argv[i]);
+  }
+  char root[] = "/tmp/integration_benchXXXXXX";
+  SD.root = mkdtemp(root);
+  integrations = new ScriptSet();
+  printf("integration log of %u days\n", days);
+  writeLogs(days);
+
+  auto t0 = std::chrono::steady_clock::now();
+  SD.stats.clear();
+  integrator* integ = openIntegrator();
+  double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+  printf("  open      %8.2f ms  %6u reads  %6u seeks\n", ms, SD.stats.reads, SD.stats.seeks);
+
+  uint32_t end = T0 + days * 86400;
+  query(integ, "1d", 86400, T0, end);
+  query(integ, "1h", 3600, T0, end);
+  delete integ;
+  removeLogs();
+
+  uint32_t detail = T0 + days / 2 * 86400;
+  printf("integration log of the last %u days\n", days - days / 2);
+  writeLogs(days, days / 2);
+  integ = openIntegrator();
+  query(integ, "1d", 86400, T0, end, detail);
+  query(integ, "1h", 3600, T0, end, detail);
+  query(integ, "1m", 60, detail - 86400, detail + 86400, detail);
+  delete integ;
+  removeLogs();
+  SD.rmdir("/iotawatt/integrations");
+  SD.rmdir("/iotawatt");
+  rmdir(SD.root.c_str());
+  printf("%d failures\n", failures);
+  return failures;
+}
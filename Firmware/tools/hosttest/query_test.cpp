@@ -0,0 +1,344 @@
+/***********************************************************************************************
+ * query_test - /query on the host
+ *
+ * Writes two hours of Current_log with the firmware's IotaLog, including a ten minute
+ * outage (a gap in the keys) and five minutes where logHours does not advance, and the
+ * same data each minute in History_log, then runs
+ * /query requests through CSVquery::setup() and readResult() and prints the responses.
+ *
+ * The min and max of each group are checked against a direct scan of the records, and
+ * queries that differ only in their options are checked not to share cached results.
+ * A query is also served through queryStart() and queryService() as /query does, and one
+ * is abandoned part way with queryAbortAll() and its output Scripts replaced, as
+ * setConfig() does. Add -g -fsanitize=address to the build to catch use of the deleted Scripts.
+ * The full output depends only on the log, so the output of builds from two versions of
+ * CSVquery.cpp can be compared with diff.
+ *
+ * Build (from Firmware/tools/hosttest), where <src> is ../../IotaWatt or the Firmware/IotaWatt
+ * directory of another checkout:
+ *      g++ -O2 -std=gnu++11 -I include -I <src> -ffunction-sections -Wl,--gc-sections \
+ *          -o query_test query_test.cpp hostcore.cpp <src>/CSVquery.cpp <src>/IotaScript.cpp \
+ *          <src>/IotaLog.cpp <src>/utilities.cpp <src>/simSolar.cpp <src>/RTC.cpp -fpermissive -lcrypto
+ *
+ * Usage:
+ *      query_test [-v]
+ **********************************************************************************************/
+#include <random>
+#include <vector>
+#include <unistd.h>
+#include "IotaWatt.h"
+
+#define T0 1577836800UL                             // 2020-01-01
+#define HOURS 2
+#define GAP_BEGIN (T0 + 2400)                       // Outage, no records
+#define GAP_END (T0 + 3000)
+#define FLAT_BEGIN (T0 + 4800)                      // Records, but logHours constant
+#define FLAT_END (T0 + 5100)
+
+        // Firmware globals used by CSVquery
+
+ESP8266WebServer server(80);
+IotaLog Current_log(256, 5, 365, 0);
+IotaLog History_log(256, 60, 365, 0);
+messageLog Message_log;
+uint32_t bingoTime = 0xFFFFFFFF;
+IotaInputChannel* *inputChannel = nullptr;
+uint8_t maxInputs = 2;
+ScriptSet* outputs = nullptr;
+ScriptSet* integrations = nullptr;
+simSolar* simsolar = nullptr;
+bool RTCrunning = false;
+int32_t localTimeDiff = 0;
+void trace(const uint8_t, const uint8_t, const uint8_t){}
+serviceBlock* NewService(Service, const uint8_t, void*){static serviceBlock sb; return &sb;}
+uint32_t UTCtime(){return T0 + HOURS * 3600;}
+uint32_t UTCtime(uint32_t t){return t;}
+uint32_t localTime(){return UTCtime();}
+uint32_t localTime(uint32_t t){return t;}
+uint32_t UTC2Local(uint32_t t){return t;}
+double integrator::run(IotaLogRecord*, IotaLogRecord*, units, char){return 0;}
+uint32_t logReadKey(IotaLogRecord* callerRecord){return Current_log.readKey(callerRecord);}
+void setLedCycle(const char*){}
+void endLedCycle(){}
+
+static bool verbose = false;
+messageLog::messageLog(){}
+size_t messageLog::write(const uint8_t c){if(verbose) putchar(c); return 1;}
+size_t messageLog::write(const uint8_t* buf, const size_t len){if(verbose) fwrite(buf, 1, len, stdout); return len;}
+void messageLog::endMsg(){if(verbose) putchar('\n');}
+
+        // Inputs are Volts (0) and Main (1).
+
+static void setupInputs(){
+  inputChannel = new IotaInputChannel*[MAXINPUTS];
+  for(int i=0; i<MAXINPUTS; i++){
+    inputChannel[i] = new IotaInputChannel(i);
+    inputChannel[i]->_vchannel = 0;
+    inputChannel[i]->_vmult = 1.0;
+  }
+  inputChannel[0]->_name = charstar("Volts");
+  inputChannel[0]->_type = channelTypeVoltage;
+  inputChannel[0]->_active = true;
+  inputChannel[1]->_name = charstar("Main");
+  inputChannel[1]->_type = channelTypePower;
+  inputChannel[1]->_active = true;
+  integrations = new ScriptSet();
+}
+
+        // Output Net is Main. ScriptSets are only built from Json, which
+        // the host doesn't parse, so the list is set directly.
+
+struct hostScriptSet {
+  size_t count;
+  Script* listHead;
+};
+static_assert(sizeof(hostScriptSet) == sizeof(ScriptSet), "ScriptSet layout");
+
+static void setupOutputs(){
+  outputs = new ScriptSet();
+  hostScriptSet* set = (hostScriptSet*)outputs;
+  set->count = 1;
+  set->listHead = new Script("Net", "Watts", "@1");
+}
+
+static std::vector<IotaLogRecord> records;
+
+static void writeLog(){
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<double> power(-1500.0, 6000.0);
+  std::uniform_real_distribution<double> volts(118.0, 124.0);
+  IotaLogRecord rec;
+  memset((void*)&rec, 0, sizeof(rec));
+  rec.logHours = 1000.0;
+  for(uint32_t t=T0; t<=T0 + HOURS * 3600; t+=5){
+    if(t > GAP_BEGIN && t < GAP_END) continue;
+    double hours = (t > FLAT_BEGIN && t <= FLAT_END) ? 0 : 5.0 / 3600.0;
+    rec.UNIXtime = t;
+    rec.logHours += hours;
+    rec.accum1[0] += volts(rng) * hours;
+    rec.accum2[0] += 60.0 * hours;
+    double watts = power(rng);
+    rec.accum1[1] += watts * hours;
+    rec.accum2[1] += fabs(watts) * 1.1 * hours;
+    Current_log.write(&rec);
+    records.push_back(rec);
+    if(t % 60 == 0){
+      History_log.write(&rec);
+    }
+  }
+}
+
+static std::string runQuery(std::vector<std::pair<std::string, std::string>> args, bool cached=false){
+  if( ! cached){
+    queryCacheClear();
+  }
+  server.hostRequest("/query", args);
+  CSVquery* query = new CSVquery;
+  std::string out;
+  if( ! query->setup()){
+    out = std::string("setup failed: ") + query->failReason().c_str();
+  }
+  else {
+    uint8_t buf[QUERY_CHUNK_SIZE];
+    size_t len;
+    while(len = query->readResult(buf, sizeof(buf)), len || ! query->complete()){
+      out.append((char*)buf, len);
+    }
+  }
+  delete query;
+  return out;
+}
+
+        // Serve a query with queryStart() and queryService().
+        // The client's write window is set to window, and the
+        // Service is run runs times, or until it ends if runs is 0.
+
+static std::shared_ptr<hostConnection> serveQuery(std::vector<std::pair<std::string, std::string>> args, size_t window, int runs){
+  queryCacheClear();
+  server.hostRequest("/query", args);
+  std::shared_ptr<hostConnection> conn = server.client().conn;
+  conn->window = window;
+  CSVquery* query = new CSVquery;
+  if( ! query->setup()){
+    delete query;
+    return conn;
+  }
+  queryStart(query, "text/plain");
+  serviceBlock sb;
+  for(int run=0; queryService(&sb) && (runs == 0 || ++run < runs); );
+  return conn;
+}
+
+        // Body of a chunked response.
+
+static std::string dechunk(const std::string& response){
+  std::string body;
+  size_t pos = response.find("\r\n\r\n");
+  if(pos == std::string::npos) return body;
+  pos += 4;
+  while(pos < response.size()){
+    size_t eol = response.find("\r\n", pos);
+    size_t len = strtoul(response.substr(pos, eol - pos).c_str(), nullptr, 16);
+    if(len == 0) break;
+    body += response.substr(eol + 2, len);
+    pos = eol + 2 + len + 2;
+  }
+  return body;
+}
+
+        // Direct min and max of Main watts for the group [begin, end).
+        // The scan steps by the interval, so each interval with data belongs
+        // to the group holding its end. After a gap in the keys, the interval
+        // ending with the first record back spans the gap.
+
+static bool directMinMax(uint32_t begin, uint32_t end, double* min, double* max){
+  bool first = true;
+  *min = *max = 0;
+  for(size_t i=1; i<records.size(); i++){
+    IotaLogRecord& oldRec = records[i - 1];
+    IotaLogRecord& newRec = records[i];
+    if(newRec.UNIXtime <= begin || newRec.UNIXtime > end || newRec.logHours == oldRec.logHours) continue;
+    double watts = (newRec.accum1[1] - oldRec.accum1[1]) / (newRec.logHours - oldRec.logHours);
+    if(first || watts < *min) *min = watts;
+    if(first || watts > *max) *max = watts;
+    first = false;
+  }
+  return ! first;
+}
+
+static int failures = 0;
+
+static void checkMinMax(const char* name, const std::string& csv, uint32_t group){
+  int lines = 0;
+  size_t pos = 0;
+  while(pos < csv.size()){
+    size_t eol = csv.find("\r\n", pos);
+    if(eol == std::string::npos) eol = csv.size();
+    std::string line = csv.substr(pos, eol - pos);
+    pos = eol + 2;
+    uint32_t time;
+    char minText[32], maxText[32];
+    if(sscanf(line.c_str(), "%u, %31[^,], %31[^,]", &time, minText, maxText) != 3) continue;
+    double min, max;
+    bool ok;
+    if(directMinMax(time, time + group, &min, &max)){
+      ok = fabs(atof(minText) - min) <= 0.05 && fabs(atof(maxText) - max) <= 0.05;
+    }
+    else {
+      ok = strcmp(minText, "null") == 0 && strcmp(maxText, "null") == 0;
+    }
+    if( ! ok){
+      printf("%s FAIL at %u: min %s max %s, expected %.1f %.1f\n", name, time, minText, maxText, min, max);
+      failures++;
+      return;
+    }
+    lines++;
+  }
+  printf("%s min/max ok, %d groups\n", name, lines);
+}
+
+int main(int argc, char** argv){
+  verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+  char root[] = "/tmp/query_testXXXXXX";
+  SD.root = mkdtemp(root);
+  setupInputs();
+  setupOutputs();
+  Current_log.begin("/iotawatt/current.log");
+  History_log.begin("/iotawatt/history.log");
+  writeLog();
+
+  std::string begin = std::to_string(T0);
+  std::string end = std::to_string(T0 + HOURS * 3600);
+  struct {
+    const char* name;
+    uint32_t group;
+    std::vector<std::pair<std::string, std::string>> args;
+  } queries[] = {
+    {"15m", 900, {{"select", "[time.utc.unix,Main.watts.min,Main.watts.max]"}, {"begin", begin}, {"end", end}, {"group", "15m"}, {"format", "csv"}}},
+    {"5m", 300, {{"select", "[time.utc.unix,Main.watts.min,Main.watts.max]"}, {"begin", begin}, {"end", end}, {"group", "5m"}, {"format", "csv"}}},
+    {"1h", 3600, {{"select", "[time.utc.unix,Main.watts.min,Main.watts.max]"}, {"begin", begin}, {"end", end}, {"group", "1h"}, {"format", "csv"}, {"resolution", "high"}}},
+    {"stats", 0, {{"select", "[time.utc.unix,Main.watts.stddev,Main.watts.p10,Main.watts.p50,Main.watts.p90,Main.watts,Main.va.max,Main.pf.min,Volts.volts.min,Volts.volts.max]"},
+                  {"begin", begin}, {"end", end}, {"group", "10m"}, {"format", "csv"}}},
+    {"json", 0, {{"select", "[time.utc.unix,Main.watts.min,Main.amps.max,Main.watts.p75]"},
+                 {"begin", begin}, {"end", end}, {"group", "20m"}, {"format", "json"}, {"header", "yes"}}},
+  };
+  for(auto& q : queries){
+    std::string out = runQuery(q.args);
+    printf("== %s\n%s\n", q.name, out.c_str());
+    if(q.group){
+      checkMinMax(q.name, out, q.group);
+    }
+  }
+
+        // A query that differs from a cached one only in its options must
+        // not be answered from the cache.
+
+  struct {
+    const char* name;
+    std::vector<std::pair<std::string, std::string>> first;
+    std::vector<std::pair<std::string, std::string>> second;
+  } variants[] = {
+    {"bin64 after bin", {{"select", "[time.utc.unix,Main.watts]"}, {"begin", begin}, {"end", end}, {"group", "15m"}, {"format", "bin"}},
+                        {{"select", "[time.utc.unix,Main.watts]"}, {"begin", begin}, {"end", end}, {"group", "15m"}, {"format", "bin64"}}},
+    {"low after high", {{"select", "[time.utc.unix,Main.watts.min,Main.watts.max]"}, {"begin", begin}, {"end", end}, {"group", "90m"}, {"format", "csv"}, {"resolution", "high"}},
+                       {{"select", "[time.utc.unix,Main.watts.min,Main.watts.max]"}, {"begin", begin}, {"end", end}, {"group", "90m"}, {"format", "csv"}, {"resolution", "low"}}},
+  };
+  for(auto& v : variants){
+    runQuery(v.first);
+    std::string cached = runQuery(v.second, true);
+    if(cached == runQuery(v.second)){
+      printf("%s ok\n", v.name);
+    }
+    else {
+      printf("%s FAIL: cached response differs\n", v.name);
+      failures++;
+    }
+  }
+
+        // Served by queryService, the body is the same.
+
+  {
+    auto& q = queries[0];
+    std::shared_ptr<hostConnection> conn = serveQuery(q.args, 65536, 0);
+    if(conn->stopped && dechunk(conn->sent) == runQuery(q.args) && queryAvailable()){
+      printf("queryService ok\n");
+    }
+    else {
+      printf("queryService FAIL: response differs\n");
+      failures++;
+    }
+  }
+
+        // A query stalled by its client is abandoned when the
+        // configuration changes, before its Scripts are deleted.
+
+  {
+    std::vector<std::pair<std::string, std::string>> args = {{"select", "[time.utc.unix,Net.watts.max,Net.watts.p90]"},
+        {"begin", begin}, {"end", end}, {"group", "1m"}, {"format", "csv"}};
+    std::shared_ptr<hostConnection> conn = serveQuery(args, 0, 1);
+    bool stalled = ! conn->stopped && dechunk(conn->sent).empty();
+    queryAbortAll();
+    delete outputs;
+    setupOutputs();
+    conn->window = 65536;
+    serviceBlock sb;
+    int runs = 0;
+    while(queryService(&sb) && runs++ < 10);
+    if(stalled && conn->stopped && runs == 0 && dechunk(conn->sent).empty()){
+      printf("queryAbortAll ok\n");
+    }
+    else {
+      printf("queryAbortAll FAIL: %s\n", stalled ? "query not abandoned" : "query didn't stall");
+      failures++;
+    }
+  }
+
+  Current_log.end();
+  History_log.end();
+  SD.remove("/iotawatt/current.log");
+  SD.remove("/iotawatt/history.log");
+  SD.rmdir("/iotawatt");
+  rmdir(SD.root.c_str());
+  printf("%d failures\n", failures);
+  return failures;
+}
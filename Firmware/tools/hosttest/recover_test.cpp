@@ -0,0 +1,279 @@
+/***********************************************************************************************
+ * recover_test - IotaLog::begin() and recover() on damaged datalogs
+ *
+ * Builds logs on the host the way IotaLog lays them out, damages them the ways a power
+ * failure or a failing card does, then opens them with the firmware's IotaLog::begin()
+ * and checks which records survive:
+ *
+ *      clean           unwrapped log, nothing to do
+ *      preformat       unwrapped log followed by preformatted (zero) records
+ *      torn            unwrapped log ending with part of a record
+ *      serials         unwrapped log whose last records have bad serials
+ *      wrapped         wrapped log, records before the wrap point have bad serials
+ *      zeroed          wrapped log, records before the wrap point zeroed
+ *      hopeless        nothing consistent, begin() falls back to delete and restart
+ *
+ * Surviving records must read back by key with their original serial and contents, and the
+ * serials must run consecutively from firstSerial to lastSerial. Records replaced in a
+ * wrapped log must carry no energy. Exit status is the number of failed cases.
+ *
+ * With -b, also times begin() and counts SD reads on a year of History_log and <days> of
+ * Current_log (default 30, about 130MB), clean and with a damaged tail.
+ *
+ * Build (from Firmware/tools/hosttest):
+ *      g++ -O2 -std=gnu++11 -I include -I ../../IotaWatt -ffunction-sections -Wl,--gc-sections \
+ *          -o recover_test recover_test.cpp hostcore.cpp ../../IotaWatt/IotaLog.cpp \
+ *          ../../IotaWatt/utilities.cpp ../../IotaWatt/RTC.cpp -fpermissive -lcrypto
+ *
+ * Usage:
+ *      recover_test [-v] [-b [days]]
+ **********************************************************************************************/
+#include <chrono>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "IotaWatt.h"
+
+#define RECORD_SIZE 256
+#define INTERVAL 5
+#define T0 1577836800UL                             // 2020-01-01
+
+        // Firmware globals used by IotaLog
+
+messageLog Message_log;
+uint32_t bingoTime = 0xFFFFFFFF;
+bool RTCrunning = false;
+int32_t localTimeDiff = 0;
+char* deviceName = nullptr;
+void trace(const uint8_t, const uint8_t, const uint8_t){}
+serviceBlock* NewService(Service, const uint8_t, void*){static serviceBlock sb; return &sb;}
+void setLedCycle(const char*){}
+void endLedCycle(){}
+uint32_t UTCtime(){return T0;}
+uint32_t localTime(){return T0;}
+uint32_t UTC2Local(uint32_t t){return t;}
+
+        // Message log is captured for the checks and shown with -v
+
+static std::string messages;
+static bool verbose = false;
+messageLog::messageLog(){}
+size_t messageLog::write(const uint8_t c){messages += (char)c; return 1;}
+size_t messageLog::write(const uint8_t* buf, const size_t len){messages.append((const char*)buf, len); return len;}
+void messageLog::endMsg(){
+  messages += '\n';
+  if(verbose) printf("    log: %s", messages.substr(messages.rfind('\n', messages.size() - 2) + 1).c_str());
+}
+
+static const char* path = "/iotawatt/test.log";
+
+        // A record with serial s has key T0 + s * INTERVAL and a marker value in accum1[0].
+
+static void makeRecord(IotaLogRecord* rec, int32_t serial){
+  memset((void*)rec, 0, RECORD_SIZE);
+  rec->UNIXtime = T0 + serial * INTERVAL;
+  rec->serial = serial;
+  rec->logHours = serial * INTERVAL / 3600.0;
+  rec->accum1[0] = serial * 10.0;
+}
+
+        // Write a log holding serials [0, count) in a file of fileRecords records.
+        // If count > fileRecords the log has wrapped, with serial s at position s % fileRecords.
+
+static void writeLog(uint32_t count, uint32_t fileRecords, uint32_t preformat=0){
+  FILE* fp = fopen(SD.host(path).c_str(), "wb");
+  IotaLogRecord rec;
+  uint32_t physical = count < fileRecords ? count : fileRecords;
+  for(uint32_t pos=0; pos<physical; pos++){
+    uint32_t serial = pos;
+    while(serial + fileRecords < count) serial += fileRecords;
+    makeRecord(&rec, serial);
+    fwrite(&rec, RECORD_SIZE, 1, fp);
+  }
+  memset((void*)&rec, 0, RECORD_SIZE);
+  for(uint32_t i=0; i<preformat; i++){
+    fwrite(&rec, RECORD_SIZE, 1, fp);
+  }
+  fclose(fp);
+}
+
+static void patch(uint32_t pos, const void* data, size_t len){
+  FILE* fp = fopen(SD.host(path).c_str(), "r+b");
+  fseek(fp, pos, SEEK_SET);
+  fwrite(data, len, 1, fp);
+  fclose(fp);
+}
+
+static void badSerial(uint32_t record){
+  int32_t serial = 0x5A5A5A5A + record;
+  patch(record * RECORD_SIZE + 4, &serial, 4);
+}
+
+static void zero(uint32_t record){
+  uint8_t buf[RECORD_SIZE] = {0};
+  patch(record * RECORD_SIZE, buf, RECORD_SIZE);
+}
+
+static uint32_t hostSize(){
+  struct stat st;
+  return stat(SD.host(path).c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+        // Open the log and check it holds exactly serials [first, last] of the original,
+        // preceded by filler records with no energy.
+
+static int failures = 0;
+
+static bool check(const char* name, bool ok, const char* what){
+  if( ! ok){
+    printf("  %-10s FAIL: %s\n", name, what);
+  }
+  return ok;
+}
+
+static void expect(const char* name, int32_t first, int32_t last, uint32_t fillers, uint32_t fileSize){
+  messages.clear();
+  IotaLog testLog(RECORD_SIZE, INTERVAL, 365, 0);
+  bool restarted = false;
+  try {
+    testLog.begin(path);
+  }
+  catch(hostRestart&){
+    restarted = true;
+  }
+  bool ok = check(name, ! restarted, "restarted");
+  ok = ok && check(name, testLog.firstSerial() == first - (int32_t)fillers, "firstSerial");
+  ok = ok && check(name, testLog.lastSerial() == last, "lastSerial");
+  ok = ok && check(name, testLog.firstKey() == T0 + (first - fillers) * INTERVAL, "firstKey");
+  ok = ok && check(name, testLog.lastKey() == T0 + last * INTERVAL, "lastKey");
+  ok = ok && check(name, testLog.fileSize() == fileSize, "fileSize");
+  ok = ok && check(name, hostSize() >= fileSize, "file shorter than log");
+  IotaLogRecord rec;
+  for(int32_t serial=testLog.firstSerial(); ok && serial<=last; serial++){
+    ok = check(name, testLog.readSerial(&rec, serial) == 0 && rec.serial == serial, "readSerial");
+    ok = ok && check(name, rec.UNIXtime == T0 + serial * INTERVAL, "key sequence");
+    if(ok && serial < first){
+      ok = check(name, rec.accum1[0] == first * 10.0 && rec.logHours == first * INTERVAL / 3600.0, "filler energy");
+    }
+  }
+  for(int32_t serial=first; ok && serial<=last; serial++){
+    rec.UNIXtime = T0 + serial * INTERVAL;
+    ok = check(name, testLog.readKey(&rec) == 0 && rec.serial == serial && rec.accum1[0] == serial * 10.0, "readKey contents");
+  }
+  if(ok){
+    printf("  %-10s ok  serials %d-%d, %u fillers, %u bytes\n", name, first, last, fillers, fileSize);
+  }
+  else {
+    failures++;
+  }
+}
+
+static void expectRestart(const char* name){
+  messages.clear();
+  IotaLog testLog(RECORD_SIZE, INTERVAL, 365, 0);
+  bool restarted = false;
+  try {
+    testLog.begin(path);
+  }
+  catch(hostRestart&){
+    restarted = true;
+  }
+  if(check(name, restarted && ! SD.exists(path), "expected delete and restart")){
+    printf("  %-10s ok  deleted and restarted\n", name);
+  }
+  else {
+    failures++;
+  }
+}
+
+static void cases(){
+  const uint32_t N = 1000;
+  const uint32_t FILE_RECORDS = 800;
+  printf("recovery cases\n");
+
+  writeLog(N, N + 1);
+  expect("clean", 0, N - 1, 0, N * RECORD_SIZE);
+
+  writeLog(N, N + 1, IOTALOG_PREFORMAT_RECORDS);
+  expect("preformat", 0, N - 1, 0, N * RECORD_SIZE);
+
+  writeLog(N + 1, N + 2);
+  truncate(SD.host(path).c_str(), N * RECORD_SIZE + 100);
+  expect("torn", 0, N - 1, 0, N * RECORD_SIZE);
+
+  writeLog(N, N + 1);
+  for(int i=1; i<=7; i++) badSerial(N - i);
+  expect("serials", 0, N - 8, 0, (N - 7) * RECORD_SIZE);
+
+        // Wrapped: serials [0, 2000) in 800 records, so the oldest is 1200
+        // at position 400, and the newest 1999 at position 399.
+
+  const uint32_t M = 2000;
+  const uint32_t wrap = M % FILE_RECORDS;
+  writeLog(M, FILE_RECORDS);
+  expect("wrapclean", M - FILE_RECORDS, M - 1, 0, FILE_RECORDS * RECORD_SIZE);
+
+  writeLog(M, FILE_RECORDS);
+  for(int i=1; i<=7; i++) badSerial(wrap - i);
+  expect("wrapped", M - FILE_RECORDS, M - 8, 7, FILE_RECORDS * RECORD_SIZE);
+
+  writeLog(M, FILE_RECORDS);
+  for(int i=1; i<=8; i++) zero(wrap - i);
+  expect("zeroed", M - FILE_RECORDS, M - 9, 8, FILE_RECORDS * RECORD_SIZE);
+
+  writeLog(N, N + 1);
+  for(uint32_t i=1; i<N; i++) badSerial(i);
+  expectRestart("hopeless");
+}
+
+        // Time begin() on a large log, clean and with a damaged tail.
+
+static void bench(const char* name, uint32_t interval, uint32_t records){
+  IotaLogRecord rec;
+  FILE* fp = fopen(SD.host(path).c_str(), "wb");
+  for(uint32_t serial=0; serial<records; serial++){
+    memset((void*)&rec, 0, RECORD_SIZE);
+    rec.UNIXtime = T0 + serial * interval;
+    rec.serial = serial;
+    fwrite(&rec, RECORD_SIZE, 1, fp);
+  }
+  fclose(fp);
+  for(int damaged=0; damaged<2; damaged++){
+    if(damaged){
+      for(int i=1; i<=16; i++) badSerial(records - i);
+    }
+    IotaLog testLog(RECORD_SIZE, interval, 400, 0);
+    SD.stats.clear();
+    auto t0 = std::chrono::steady_clock::now();
+    testLog.begin(path);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    printf("  %-18s %-8s %8u records  begin %7.2f ms  %3u reads  %3u seeks\n", name, damaged ? "damaged" : "clean",
+           (uint32_t)(testLog.lastSerial() - testLog.firstSerial() + 1), ms, SD.stats.reads, SD.stats.seeks);
+  }
+}
+
+int main(int argc, char** argv){
+  bool doBench = false;
+  int days = 30;
+  for(int i=1; i<argc; i++){
+    if(strcmp(argv[i], "-v") == 0) verbose = true;
+    else if(strcmp(argv[i], "-b") == 0){
+      doBench = true;
+      if(i + 1 < argc && atoi(argv[i + 1]) > 0) days = atoi(argv[++i]);
+    }
+  }
+  char root[] = "/tmp/recover_testXXXXXX";
+  SD.root = mkdtemp(root);
+  SD.mkdir("/iotawatt");
+
+  cases();
+  if(doBench){
+    printf("begin() timing\n");
+    bench("History_log 1 year", 60, 366 * 1440);
+    bench("Current_log days", 5, days * 17280);
+  }
+  SD.remove(path);
+  SD.rmdir("/iotawatt");
+  rmdir(SD.root.c_str());
+  printf("%d failures\n", failures);
+  return failures;
+}
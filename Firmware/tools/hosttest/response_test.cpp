@@ -0,0 +1,288 @@
+/***********************************************************************************************
+ * response_test - uploader response parsers fed as the response arrives
+ *
+ * Feeds responses to the firmware's push parsers through the host asyncHTTPrequest, split
+ * at every point into a part received while loading (readyState 3) and the rest on
+ * completion (readyState 4), and also a byte at a time. Each split must parse the same as
+ * the whole response, and every part must be drained from the request when it's fed.
+ *
+ *      flux            fluxTimeParser, the influxDB v2 last sent query
+ *      emoncms         emoncmsQueryParser, the Emoncms input/get query
+ *      head            headParser, the Emoncms write response
+ *      pvoutput        PVresponse
+ *
+ * Then runs the parsers in their uploaders: uploader::handle_HTTPwait_s() and
+ * PVoutput::handle_HTTPwait_s() must drain the response during readyState 3, and the
+ * completion states must act on what was parsed.
+ *
+ * Build (from Firmware/tools/hosttest):
+ *      g++ -O2 -std=gnu++11 -I include -I ../../IotaWatt -ffunction-sections -Wl,--gc-sections \
+ *          -o response_test response_test.cpp hostcore.cpp ../../IotaWatt/responseParser.cpp \
+ *          ../../IotaWatt/influxDB_v2_uploader.cpp ../../IotaWatt/Emoncms_uploader.cpp \
+ *          ../../IotaWatt/PVoutput.cpp ../../IotaWatt/uploader.cpp ../../IotaWatt/encryptEncoder.cpp \
+ *          ../../IotaWatt/IotaLog.cpp ../../IotaWatt/IotaScript.cpp ../../IotaWatt/simSolar.cpp \
+ *          ../../IotaWatt/utilities.cpp ../../IotaWatt/gzip.cpp ../../IotaWatt/RTC.cpp \
+ *          ../../IotaWatt/xurl.cpp -fpermissive -lcrypto
+ *
+ * Usage:
+ *      response_test
+ **********************************************************************************************/
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "hostcore.h"
+#include "xbuf.h"
+#include "asyncHTTPrequest.h"
+#define private public
+#define protected public
+#include "IotaWatt.h"
+#include "influxDB_v2_uploader.h"
+#include "Emoncms_uploader.h"
+#undef private
+#undef protected
+
+#define T0 1577836800UL                             // 2020-01-01
+
+        // Firmware globals used by the uploaders
+
+IotaLog Current_log(256, 5, 365, 0);
+IotaLog History_log(256, 60, 365, 0);
+messageLog Message_log;
+uint32_t bingoTime = 0xFFFFFFFF;
+IotaInputChannel* *inputChannel = nullptr;
+uint8_t maxInputs = MAXINPUTS;
+ScriptSet* integrations = nullptr;
+simSolar* simsolar = nullptr;
+bool RTCrunning = false;
+int32_t localTimeDiff = 0;
+char* deviceName = charstar("IotaWatt");
+uploader* influxDB_v1 = nullptr;
+uploader* influxDB_v2 = nullptr;
+uploader* Emoncms = nullptr;
+char* HTTPSproxy = nullptr;
+int32_t uploaderBufferLimit = 3000;
+int32_t uploaderBufferTotal = 24000;
+const char base64codes_P[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+const char hexcodes_P[] = "0123456789abcdef";
+void trace(const uint8_t, const uint8_t, const uint8_t){}
+serviceBlock* NewService(Service, const uint8_t, void*){static serviceBlock sb; return &sb;}
+uint32_t UTCtime(){return T0;}
+uint32_t localTime(){return T0;}
+uint32_t localTime(uint32_t t){return t;}
+uint32_t UTC2Local(uint32_t t){return t;}
+uint32_t local2UTC(uint32_t t){return t;}
+double integrator::run(IotaLogRecord*, IotaLogRecord*, units, char){return 0;}
+void setLedCycle(const char*){}
+void endLedCycle(){}
+messageLog::messageLog(){}
+size_t messageLog::write(const uint8_t c){return 1;}
+size_t messageLog::write(const uint8_t* buf, const size_t len){return len;}
+void messageLog::endMsg(){}
+uint32_t HTTPreserve(uint16_t, bool){return 1;}
+void HTTPrelease(uint32_t){}
+
+        // Configuration paths not run by the test
+
+JsonObject& DynamicJsonBuffer::parseObject(const char*){abort();}
+JsonObject& DynamicJsonBuffer::parseObject(const String&){abort();}
+JsonVariant::operator JsonArray&() const {abort();}
+
+static int failures = 0;
+
+static void check(bool ok, const char* what, const std::string& got, const std::string& want, const char* how){
+  if( ! ok && failures++ < 20){
+    printf("FAIL %s (%s): got \"%s\" want \"%s\"\n", what, how, got.c_str(), want.c_str());
+  }
+}
+
+        // Feed body to a new parser split at split, or a byte at a time with split < 0.
+        // Each part must be drained from the request as it's fed.
+
+template<class P, class... Args> static P* feed(const std::string& body, int split, Args... args){
+  P* parser = new P(args...);
+  asyncHTTPrequest request;
+  std::vector<size_t> parts;
+  for(size_t pos=0; pos<body.size(); pos++){
+    if(split < 0 || (int)pos == split) parts.push_back(pos);
+  }
+  parts.push_back(body.size());
+  request.hostState(3);
+  for(size_t i=0; i<parts.size(); i++){
+    size_t pos = i ? parts[i - 1] : 0;
+    if(i == parts.size() - 1){
+      request.hostState(4);
+    }
+    request.hostResponse(200, body.data() + pos, parts[i] - pos);
+    parser->feed(&request);
+    if(request.available()){
+      check(false, "drained", std::to_string(request.available()), "0", "feed");
+    }
+  }
+  parser->end();
+  return parser;
+}
+
+template<class P> static void splits(const std::string& body, std::function<void(P*, const char*)> verify){
+  for(int split=-1; split<=(int)body.size(); split++){
+    char how[32];
+    snprintf(how, sizeof(how), split < 0 ? "bytes" : "split %d", split);
+    P* parser = feed<P>(body, split);
+    verify(parser, how);
+    delete parser;
+  }
+}
+
+static void fluxCase(const char* name, const std::string& body, bool row, const char* time){
+  splits<fluxTimeParser>(body, [&](fluxTimeParser* p, const char* how){
+    check(p->row() == row, name, p->row() ? "row" : "no row", row ? "row" : "no row", how);
+    check(strcmp(p->time(), time) == 0, name, p->time(), time, how);
+  });
+}
+
+static void emoncmsCase(const char* name, const std::string& body, bool missing, uint32_t time){
+  splits<emoncmsQueryParser>(body, [&](emoncmsQueryParser* p, const char* how){
+    check(p->nodeMissing() == missing, name, p->nodeMissing() ? "missing" : "found", missing ? "missing" : "found", how);
+    check(p->lastTime() == time, name, std::to_string(p->lastTime()), std::to_string(time), how);
+  });
+}
+
+static void headCase(const char* name, const std::string& body){
+  std::string want = body.substr(0, 80);
+  for(int split=-1; split<=(int)body.size(); split++){
+    headParser* p = feed<headParser>(body, split, 81);
+    check(want == p->text(), name, p->text(), want, split < 0 ? "bytes" : std::to_string(split).c_str());
+    delete p;
+  }
+}
+
+static void pvoutputCase(const char* name, const std::string& body, size_t sections, const std::string& text){
+  splits<PVresponse>(body, [&](PVresponse* p, const char* how){
+    check(p->sections() == sections, name, std::to_string(p->sections()), std::to_string(sections), how);
+    check(text == p->_response && p->length() == text.size(), name, p->_response, text, how);
+  });
+}
+
+static void parsers(){
+  std::string header = ",result,table,_measurement,_time\r\n";
+  fluxCase("flux", header + ",_result,0,Main,1600000000\r\n,_result,1,Solar,1590000000\r\n\r\n", true, "1600000000");
+  fluxCase("flux time first", "_time,_measurement\r\n1600000000,Main\r\n", true, "1600000000");
+  fluxCase("flux no newline", header + ",_result,0,Main,1600000000", true, "1600000000");
+  fluxCase("flux empty", "\r\n", false, "");
+  fluxCase("flux header only", header, false, "");
+  fluxCase("flux header unterminated", ",result,table,_measurement,_time", false, "");
+  fluxCase("flux empty row", header + "\r\n", false, "");
+  fluxCase("flux no _time", ",result,table\r\n,_result,0\r\n", true, "");
+  fluxCase("flux long field", header + ",_result,0," + std::string(100, 'x') + ",1600000000\r\n", true, "1600000000");
+  fluxCase("flux nothing", "", false, "");
+
+  emoncmsCase("emoncms missing", "\"Node does not exist\"", true, 0);
+  emoncmsCase("emoncms", "{\"Main\":{\"time\":1600000000,\"value\":5},\"Solar\":{\"time\":1600000300,\"value\":2}}", false, 1600000300);
+  emoncmsCase("emoncms input named time", "{\"time\":{\"time\":1600000010,\"value\":1},\"Main\":{\"time\":16,\"value\":5}}", false, 1600000010);
+  emoncmsCase("emoncms unterminated", "{\"Main\":{\"value\":5,\"time\":1600000000", false, 1600000000);
+  emoncmsCase("emoncms null time", "{\"Main\":{\"time\":null,\"value\":5}}", false, 0);
+  emoncmsCase("emoncms repeated quote", "{\"\"time\":1600000000}", false, 1600000000);
+  emoncmsCase("emoncms other message", "\"Node does not exist yet\"", false, 0);
+  emoncmsCase("emoncms empty", "", false, 0);
+
+  headCase("head ok", "ok");
+  headCase("head long", std::string(200, 'y'));
+  headCase("head empty", "");
+
+  pvoutputCase("pvoutput", "System,1,2;a,b;c;d,e", 4, "System,1,2;a,b;c");
+  pvoutputCase("pvoutput one", "20200101,10:00", 1, "20200101,10:00");
+  pvoutputCase("pvoutput empty", "", 0, "");
+  std::string batch;
+  for(int i=0; i<100; i++) batch += "20200101,10:00,1;";
+  pvoutputCase("pvoutput batch", batch, 101, batch.substr(0, 3 * 17 - 1));
+  std::string longText(600, 'z');
+  pvoutputCase("pvoutput long", longText, 1, longText.substr(0, PV_RESPONSE_SIZE));
+}
+
+        // The parsers in their uploaders.
+        // Half the response arrives while loading, the rest on completion.
+
+template<class U> static void respond(U* up, int code, const std::string& body){
+  up->_request->hostState(3);
+  up->_request->hostResponse(code, body.data(), body.size() / 2);
+  up->handle_HTTPwait_s();
+  check(up->_state == U::HTTPwait_s, "waiting", std::to_string(up->_state), std::to_string(U::HTTPwait_s), "loading");
+  if(code == 200){
+    check(up->_request->available() == 0, "drained", std::to_string(up->_request->available()), "0", "loading");
+  }
+  up->_request->hostResponse(code, body.data() + body.size() / 2, body.size() - body.size() / 2);
+  up->_request->hostState(4);
+  up->handle_HTTPwait_s();
+}
+
+static void uploaders(){
+  influxDB_v2_uploader* v2 = new influxDB_v2_uploader;
+  v2->_request = new asyncHTTPrequest;
+  v2->_interval = 10;
+  v2->HTTPPost("/api/v2/query", influxDB_v2_uploader::checkQuery_s, "application/vnd.flux");
+  v2->_response = new fluxTimeParser;
+  v2->_state = influxDB_v2_uploader::HTTPwait_s;
+  respond(v2, 200, ",result,table,_measurement,_time\r\n,_result,0,Main,1600000000\r\n\r\n");
+  check(v2->_state == influxDB_v2_uploader::checkQuery_s, "v2 state", std::to_string(v2->_state), "checkQuery_s", "complete");
+  v2->handle_checkQuery_s();
+  check(v2->_lastSent == 1600000000 && v2->_state == influxDB_v2_uploader::write_s, "v2 lastSent",
+        std::to_string(v2->_lastSent), "1600000000", "checkQuery");
+
+  v2->HTTPPost("/api/v2/query", influxDB_v2_uploader::checkQuery_s, "application/vnd.flux");
+  check(v2->_response == nullptr, "v2 parser", "attached", "deleted", "HTTPPost");
+  v2->_response = new fluxTimeParser;
+  v2->_state = influxDB_v2_uploader::HTTPwait_s;
+  std::string error = "{\"code\":\"unauthorized\"}";
+  respond(v2, 401, error);
+  check(v2->_request->available() == error.size(), "v2 error", std::to_string(v2->_request->available()),
+        std::to_string(error.size()), "not parsed");
+  delete v2;
+
+  emoncms_uploader* em = new emoncms_uploader;
+  em->_request = new asyncHTTPrequest;
+  em->_interval = 10;
+  em->HTTPPost("/input/get?node=IotaWatt", emoncms_uploader::checkQuery_s, "application/x-www-form-urlencoded");
+  em->_response = new emoncmsQueryParser;
+  em->_state = emoncms_uploader::HTTPwait_s;
+  respond(em, 200, "{\"Main\":{\"time\":1600000005,\"value\":5},\"Solar\":{\"time\":1600000300,\"value\":2}}");
+  em->handle_checkQuery_s();
+  check(em->_lastSent == 1600000300 && em->_state == emoncms_uploader::write_s, "emoncms lastSent",
+        std::to_string(em->_lastSent), "1600000300", "checkQuery");
+
+  em->_lastPost = 1600000400;
+  em->HTTPPost("/input/bulk", emoncms_uploader::checkWrite_s, "application/x-www-form-urlencoded");
+  em->_response = new headParser(81);
+  em->_state = emoncms_uploader::HTTPwait_s;
+  respond(em, 200, "ok");
+  em->handle_checkWrite_s();
+  check(em->_lastSent == 1600000400 && em->_state == emoncms_uploader::write_s, "emoncms write",
+        std::to_string(em->_lastSent), "1600000400", "checkWrite");
+  delete em;
+
+  PVoutput* pv = new PVoutput;
+  pv->_id = charstar("PVoutput");
+  pv->request = new asyncHTTPrequest;
+  pv->_POSTrequest = new PVoutput::POSTrequest;
+  pv->_POSTrequest->completionState = PVoutput::checkUploadStatus;
+  pv->response = new PVresponse;
+  pv->_state = PVoutput::HTTPwait;
+  std::string limit = "Forbidden 403: Exceeded 60 requests per hour";
+  pv->request->hostState(3);
+  pv->request->hostResponse(403, limit.data(), 20);
+  pv->handle_HTTPwait_s();
+  check(pv->_state == PVoutput::HTTPwait && pv->request->available() == 0, "pvoutput", std::to_string(pv->request->available()), "0", "loading");
+  pv->request->hostResponse(403, limit.data() + 20, limit.size() - 20);
+  pv->request->hostState(4);
+  pv->handle_HTTPwait_s();
+  check(pv->_HTTPresponse == PVoutput::RATE_LIMIT && pv->_state == PVoutput::limitWait, "pvoutput rate limit",
+        std::to_string(pv->_HTTPresponse), std::to_string(PVoutput::RATE_LIMIT), "complete");
+  delete pv;
+}
+
+int main(int argc, char** argv){
+  parsers();
+  uploaders();
+  printf("%d failures\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,286 @@
+/***********************************************************************************************
+ * script_bench - Script evaluation on the host
+ *
+ * Times a realistic set of ten output Scripts run over consecutive pairs of log records,
+ * in Watts and in VA, and reports nanoseconds per Script evaluation. Versions with
+ * ScriptContext are also timed sharing one context per pair of records across the set, and
+ * versions with Script::runBatch in batches of 1, 4, 16 and 256 pairs.
+ *
+ * With -c <count>, instead prints the result of <count> random Scripts, each run in random
+ * units over a random pair of records. The scripts and records depend only on the count, so
+ * the output of builds from two versions of IotaScript.cpp can be compared with diff.
+ * Scripts use inputs, constants, parentheses, abs and all of the operators; integrations and
+ * virtual inputs are not generated. At most 31 constants are used, the limit of the token
+ * encoding. Where runBatch is available, each random Script is also run as a batch over all
+ * of the pairs, and any result that differs from run() is reported on stderr. The sign of
+ * zero results, and of the infinite PF of a zero VA, depends on how
+ * the zero was reached and is not compared: -0 is printed as 0 and -inf as inf.
+ *
+ * Build (from Firmware/tools/hosttest), where <src> is ../../IotaWatt or the Firmware/IotaWatt
+ * directory of another checkout:
+ *      g++ -O2 -std=gnu++11 -I include -I <src> -ffunction-sections -Wl,--gc-sections \
+ *          -o script_bench script_bench.cpp hostcore.cpp <src>/IotaScript.cpp \
+ *          <src>/simSolar.cpp <src>/utilities.cpp -fpermissive -lcrypto
+ *
+ * Usage:
+ *      script_bench [-c count]
+ *
+ * Comparing two versions:
+ *      script_bench_old -c 1000000 > old.txt
+ *      script_bench -c 1000000 > new.txt
+ *      diff old.txt new.txt
+ **********************************************************************************************/
+#include <chrono>
+#include <random>
+#include <string>
+#include "IotaWatt.h"
+
+        // Firmware globals used by IotaScript
+
+messageLog Message_log;
+uint32_t bingoTime = 0xFFFFFFFF;
+IotaInputChannel* *inputChannel = nullptr;
+uint8_t maxInputs = MAXINPUTS;
+ScriptSet* integrations = nullptr;
+simSolar* simsolar = nullptr;
+void trace(const uint8_t, const uint8_t, const uint8_t){}
+uint32_t localTime(uint32_t t){return t;}
+uint32_t UTC2Local(uint32_t t){return t;}
+double integrator::run(IotaLogRecord*, IotaLogRecord*, units, char){return 0;}
+messageLog::messageLog(){}
+size_t messageLog::write(const uint8_t c){return 1;}
+size_t messageLog::write(const uint8_t* buf, const size_t len){return len;}
+void messageLog::endMsg(){}
+
+static std::mt19937 rng;
+
+        // Script::runBatch, in versions that have it.
+
+#ifndef SCRIPT_STACK_DEPTH
+#define SCRIPT_STACK_DEPTH 16
+#endif
+
+template<typename S> static auto runBatch(S* script, IotaLogRecord** records, int pairs, double* results, units Units, double* work)
+    -> decltype(script->runBatch(records, pairs, results, Units, work), bool()){
+  script->runBatch(records, pairs, results, Units, work);
+  return true;
+}
+static bool runBatch(...){return false;}
+
+static int uniform(int n){
+  return std::uniform_int_distribution<int>(0, n - 1)(rng);
+}
+
+        // Input 0 is the voltage reference for all of the others.
+
+static void setupInputs(){
+  inputChannel = new IotaInputChannel*[MAXINPUTS];
+  for(int i=0; i<MAXINPUTS; i++){
+    inputChannel[i] = new IotaInputChannel(i);
+    inputChannel[i]->_vchannel = 0;
+    inputChannel[i]->_vmult = 1.0;
+  }
+  integrations = new ScriptSet();
+}
+
+        // Records with plausible accumulators, five seconds apart.
+
+static void makeRecords(IotaLogRecord* recs, int count){
+  std::uniform_real_distribution<double> power(-2000.0, 5000.0);
+  std::uniform_real_distribution<double> pf(0.5, 1.0);
+  memset((void*)recs, 0, count * sizeof(IotaLogRecord));
+  for(int i=0; i<count; i++){
+    IotaLogRecord* rec = recs + i;
+    IotaLogRecord* prev = i ? recs + i - 1 : nullptr;
+    double hours = 5.0 / 3600.0;
+    rec->UNIXtime = 1577836800UL + i * 5;
+    rec->serial = i;
+    rec->logHours = (prev ? prev->logHours : 100.0) + hours;
+    for(int j=0; j<MAXINPUTS; j++){
+      double watts = j == 0 ? 120.0 + uniform(10) : power(rng);
+      double va = j == 0 ? 60.0 : fabs(watts) / pf(rng);
+      rec->accum1[j] = (prev ? prev->accum1[j] : 0) + watts * hours;
+      rec->accum2[j] = (prev ? prev->accum2[j] : 0) + va * hours;
+    }
+  }
+}
+
+        // Random script of a level within parentheses.
+
+static void randomLevel(std::string& out, int depth, int& constants){
+  int terms = 1 + uniform(depth ? 4 : 6);
+  for(int t=0; t<terms; t++){
+    if(t || uniform(4) == 0){
+      out += "+-*/<>"[uniform(6)];
+    }
+    int kind = uniform(depth < 3 ? 10 : 8);
+    if(kind < 5 || (kind < 8 && constants >= 31)){
+      out += '@';
+      out += std::to_string(uniform(MAXINPUTS));
+    }
+    else if(kind < 8){
+      char constant[24];
+      static const char* values[] = {"0", "1", "2", "0.5", "1000", "3.14159", "-1", "240"};
+      snprintf(constant, sizeof(constant), "#%s", values[uniform(8)]);
+      out += constant;
+      constants++;
+    }
+    else {
+      out += '(';
+      randomLevel(out, depth + 1, constants);
+      out += ')';
+    }
+    if(uniform(8) == 0){
+      out += '|';
+    }
+  }
+}
+
+static void compare(int count){
+  const int RECORDS = 64;
+  IotaLogRecord* recs = new IotaLogRecord[RECORDS];
+  IotaLogRecord* recPtrs[RECORDS];
+  double batch[RECORDS];
+  double work[(SCRIPT_STACK_DEPTH + 1) * RECORDS];
+  int batchMismatches = 0;
+  makeRecords(recs, RECORDS);
+  for(int i=0; i<RECORDS; i++){
+    recPtrs[i] = recs + i;
+  }
+  for(int i=0; i<count; i++){
+    std::string script;
+    int constants = 0;
+    randomLevel(script, 0, constants);
+    units Units = (units)uniform(unitsNone);
+    int pair = uniform(RECORDS - 1);
+    Script* s = new Script("x", "Watts", script.c_str());
+    double result = s->run(recs + pair, recs + pair + 1, Units) + 0.0;
+    printf("%s %d %.17g\n", script.c_str(), (int)Units, isinf(result) ? INFINITY : result);
+    if(runBatch(s, recPtrs, RECORDS - 1, batch, Units, work)){
+      for(int p=0; p<RECORDS-1; p++){
+        double scalar = s->run(recs + p, recs + p + 1, Units);
+        if(memcmp(&scalar, &batch[p], sizeof(double)) && ! (scalar != scalar && batch[p] != batch[p])){
+          if(batchMismatches++ < 10){
+            fprintf(stderr, "batch mismatch: %s %d pair %d %.17g %.17g\n", script.c_str(), (int)Units, p, scalar, batch[p]);
+          }
+        }
+      }
+    }
+    delete s;
+  }
+  if(runBatch((Script*)nullptr, nullptr, 0, nullptr, Watts, nullptr)){
+    fprintf(stderr, "%d batch results differ from run()\n", batchMismatches);
+  }
+  delete[] recs;
+}
+
+        // A typical installation: mains, solar, a few circuits and some arithmetic.
+
+static const char* outputScripts[] = {
+  "@1+@2",
+  "@3",
+  "@1+@2-@3",
+  "@4+@5",
+  "@6",
+  "@7+@8+@9",
+  "(@1+@2)*#1.05",
+  "@10|",
+  "@11<#0",
+  "@1+@2+@3-@4-@5-@6-@7-@8-@9-@10-@11-@12"
+};
+#define OUTPUTS (sizeof(outputScripts) / sizeof(outputScripts[0]))
+
+        // Best of five timings, in ns per Script evaluation.
+
+template<typename F> static double timeit(F pass, int evaluations){
+  double best = 1e30;
+  for(int t=0; t<5; t++){
+    auto t0 = std::chrono::steady_clock::now();
+    pass();
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+    best = ns / evaluations < best ? ns / evaluations : best;
+  }
+  return best;
+}
+
+static void bench(){
+  const int RECORDS = 1024;
+  const int PASSES = 100;
+  IotaLogRecord* recs = new IotaLogRecord[RECORDS];
+  makeRecords(recs, RECORDS);
+  Script* scripts[OUTPUTS];
+  for(int i=0; i<OUTPUTS; i++){
+    scripts[i] = new Script("out", "Watts", outputScripts[i]);
+  }
+  int evaluations = PASSES * (RECORDS - 1) * OUTPUTS;
+  volatile double sink;
+  units benchUnits[] = {Watts, VA};
+  for(units Units : benchUnits){
+    const char* name = Units == Watts ? "Watts" : "VA";
+    printf("%-6s %d outputs  run(oldRec, newRec)  %6.1f ns per evaluation\n", name, (int)OUTPUTS, timeit([&]{
+      double sum = 0;
+      for(int p=0; p<PASSES; p++){
+        for(int r=0; r<RECORDS-1; r++){
+          for(int i=0; i<OUTPUTS; i++){
+            sum += scripts[i]->run(recs + r, recs + r + 1, Units);
+          }
+        }
+      }
+      sink = sum;
+    }, evaluations));
+
+#ifdef SCRIPT_CONTEXT_INPUTS
+    printf("%-6s %d outputs  run(ScriptContext*)  %6.1f ns per evaluation\n", name, (int)OUTPUTS, timeit([&]{
+      double sum = 0;
+      for(int p=0; p<PASSES; p++){
+        for(int r=0; r<RECORDS-1; r++){
+          ScriptContext context(recs + r, recs + r + 1);
+          for(int i=0; i<OUTPUTS; i++){
+            sum += scripts[i]->run(&context, Units);
+          }
+        }
+      }
+      sink = sum;
+    }, evaluations));
+#endif
+
+    IotaLogRecord* recPtrs[RECORDS];
+    for(int r=0; r<RECORDS; r++){
+      recPtrs[r] = recs + r;
+    }
+    double results[RECORDS];
+    double work[(SCRIPT_STACK_DEPTH + 1) * RECORDS];
+    for(int pairs : {1, 4, 16, 256}){
+      bool batched = true;
+      double ns = timeit([&]{
+        double sum = 0;
+        for(int p=0; p<PASSES; p++){
+          for(int r=0; r+pairs<RECORDS; r+=pairs){
+            for(int i=0; i<OUTPUTS; i++){
+              batched = runBatch(scripts[i], recPtrs + r, pairs, results, Units, work);
+              sum += results[0];
+            }
+          }
+        }
+        sink = sum;
+      }, PASSES * ((RECORDS - 1) / pairs) * pairs * OUTPUTS);
+      if( ! batched) break;
+      printf("%-6s %d outputs  runBatch, %3d pairs  %6.1f ns per evaluation\n", name, (int)OUTPUTS, pairs, ns);
+    }
+  }
+  for(int i=0; i<OUTPUTS; i++){
+    delete scripts[i];
+  }
+  delete[] recs;
+}
+
+int main(int argc, char** argv){
+  setupInputs();
+  if(argc > 2 && strcmp(argv[1], "-c") == 0){
+    compare(atoi(argv[2]));
+  }
+  else {
+    bench();
+  }
+  return 0;
+}
@@ -0,0 +1,598 @@
+/***********************************************************************************************
+ * iotalog - host command line tool for IoTaWatt log files
+ *
+ * Works with copies of the datalogs taken from the SD card:
+ *      /iotawatt/iotalog.log               Current log, 256 byte records, 5 second interval
+ *      /iotawatt/histlog.log               History log, 256 byte records, 60 second interval
+ *      /iotawatt/integrations/<name>.log   Integration logs, 32 byte records, 5 second interval
+ *
+ * The file is memory mapped and interpreted the same way IotaLog::begin() does on the device:
+ * trailing preformatted (zero) records are ignored and a wrapped file is read in logical order
+ * starting at the wrap point. The record formats and the mapping of serials to file positions
+ * are shared with the firmware (IotaLogRecord.h).
+ *
+ * Build (Linux or macOS):
+ *      make
+ *
+ * Usage:
+ *      iotalog verify  <log>
+ *      iotalog dump    <log> [-b begin] [-e end] [--bin -o out]
+ *      iotalog energy  <log> -b begin -e end
+ *      iotalog rebuild-history <currentlog> -o <histlog>
+ *      iotalog bench   <log> [-n lookups]
+ *
+ *  Options:
+ *      -b, -e      Begin/end of range as UNIXtime or UTC yyyy-mm-dd[Thh:mm[:ss]]
+ *      -r size     Record size (default: detected, 256 or 32)
+ *      -i seconds  Log interval (default: detected)
+ *      -o file     Output file
+ *      -n count    Number of random lookups for bench (default 1000000)
+ *
+ **********************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <random>
+#include "../../IotaWatt/IotaLogRecord.h"
+
+/***********************************************************************************************
+ * LogView - read only view of a memory mapped IotaLog file
+ **********************************************************************************************/
+class LogView {
+    public:
+        LogView():_base(nullptr),_physicalSize(0),_probes(0){};
+        ~LogView();
+
+        bool open(const char* path, uint32_t recordSize, uint32_t interval);
+        uint32_t find(uint32_t key, bool* exact = nullptr);     // Logical index at or below key
+        const IotaLogKey* key(uint32_t index){return (const IotaLogKey*)record(index);}
+        const uint8_t* record(uint32_t index){return _base + IotaLogPosition(_firstSerial + index, _firstSerial, _recordSize, _wrap, _fileSize);}
+
+        uint32_t recordSize(){return _recordSize;}
+        uint32_t interval(){return _interval;}
+        uint32_t entries(){return _entries;}
+        uint32_t wrap(){return _wrap;}
+        uint32_t zeroTail(){return _zeroTail;}
+        uint32_t physicalSize(){return _physicalSize;}
+        uint32_t firstKey(){return _firstKey;}
+        uint32_t lastKey(){return _lastKey;}
+        int32_t  firstSerial(){return _firstSerial;}
+        int32_t  lastSerial(){return _lastSerial;}
+        uint64_t probes(){return _probes;}
+
+    private:
+        const uint8_t* _base;
+        size_t   _physicalSize;
+        uint32_t _recordSize;
+        uint32_t _interval;
+        uint32_t _fileSize;                 // Logical size in bytes (excludes zero tail)
+        uint32_t _entries;
+        uint32_t _wrap;                     // Byte offset of logical record zero
+        uint32_t _zeroTail;                 // Number of trailing preformatted records
+        uint32_t _firstKey;
+        uint32_t _lastKey;
+        int32_t  _firstSerial;
+        int32_t  _lastSerial;
+        uint64_t _probes;                   // Records examined by find()
+
+        const IotaLogKey* physical(uint32_t index){return (const IotaLogKey*)(_base + (uint64_t)index * _recordSize);}
+};
+
+LogView::~LogView(){
+    if(_base){
+        munmap((void*)_base, _physicalSize);
+    }
+}
+
+bool LogView::open(const char* path, uint32_t recordSize, uint32_t interval){
+    int fd = ::open(path, O_RDONLY);
+    if(fd < 0){
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    _physicalSize = st.st_size;
+    if(_physicalSize < sizeof(intRecord)){
+        fprintf(stderr, "%s: empty or too small to be a log\n", path);
+        close(fd);
+        return false;
+    }
+    _base = (const uint8_t*)mmap(nullptr, _physicalSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(_base == MAP_FAILED){
+        _base = nullptr;
+        fprintf(stderr, "%s: mmap failed: %s\n", path, strerror(errno));
+        return false;
+    }
+    madvise((void*)_base, _physicalSize, MADV_SEQUENTIAL);
+
+        // Record size: the second record of a log begins with the next serial.
+
+    _recordSize = recordSize;
+    if( ! _recordSize){
+        _recordSize = sizeof(IotaLogRecord);
+        const IotaLogKey* first = (const IotaLogKey*)_base;
+        const size_t sizes[] = {sizeof(IotaLogRecord), sizeof(intRecord)};
+        for(size_t size : sizes){
+            if(_physicalSize >= 2 * size){
+                const IotaLogKey* second = (const IotaLogKey*)(_base + size);
+                if(second->serial == first->serial + 1 && second->UNIXtime > first->UNIXtime){
+                    _recordSize = size;
+                    break;
+                }
+            }
+        }
+    }
+    if(_physicalSize % _recordSize){
+        fprintf(stderr, "%s: size %zu is not a multiple of record size %u, ignoring %zu trailing bytes\n",
+                path, _physicalSize, _recordSize, _physicalSize % _recordSize);
+    }
+    _entries = _physicalSize / _recordSize;
+    _fileSize = _entries * _recordSize;
+    _wrap = 0;
+    _zeroTail = 0;
+
+        // Trailing zero records are preformatted space, binary search for the last written.
+
+    _firstKey = physical(0)->UNIXtime;
+    _firstSerial = physical(0)->serial;
+    if(_firstKey == 0){
+        fprintf(stderr, "%s: no records\n", path);
+        return false;
+    }
+    if(physical(_entries - 1)->UNIXtime == 0){
+        uint32_t low = 0;
+        uint32_t high = _entries - 1;
+        while((high - low) > 1){
+            uint32_t mid = (low + high) / 2;
+            if(physical(mid)->UNIXtime){
+                low = mid;
+            } else {
+                high = mid;
+            }
+        }
+        _zeroTail = _entries - low - 1;
+        _entries = low + 1;
+        _fileSize = _entries * _recordSize;
+    }
+    _lastKey = physical(_entries - 1)->UNIXtime;
+    _lastSerial = physical(_entries - 1)->serial;
+
+        // Wrapped if the first physical key is later than the last.
+        // Logical zero is the first physical record with a key less than the first.
+
+    if(_firstKey > _lastKey){
+        uint32_t low = 0;
+        uint32_t high = _entries - 1;
+        while((high - low) > 1){
+            uint32_t mid = (low + high) / 2;
+            if(physical(mid)->UNIXtime >= _firstKey){
+                low = mid;
+            } else {
+                high = mid;
+            }
+        }
+        _wrap = high * _recordSize;
+        _firstKey = physical(high)->UNIXtime;
+        _firstSerial = physical(high)->serial;
+        _lastKey = physical(low)->UNIXtime;
+        _lastSerial = physical(low)->serial;
+    }
+
+        // Interval: smallest step between the first few records.
+
+    _interval = interval;
+    if( ! _interval){
+        _interval = 0xFFFFFFFF;
+        for(uint32_t i=1; i<_entries && i<256; i++){
+            uint32_t step = key(i)->UNIXtime - key(i-1)->UNIXtime;
+            if(step && step < _interval) _interval = step;
+        }
+        if(_interval == 0xFFFFFFFF) _interval = 5;
+    }
+    return true;
+}
+
+        // Same semantics as IotaLog::readKey: the record with the requested
+        // or next lower key. Because keys increase by at least one interval
+        // per record, the distance in keys bounds the distance in records,
+        // so most lookups take one or two probes.
+
+uint32_t LogView::find(uint32_t target, bool* exact){
+    target -= target % _interval;
+    if(exact) *exact = false;
+    if(target <= _firstKey){
+        if(exact) *exact = target == _firstKey;
+        return 0;
+    }
+    if(target >= _lastKey){
+        if(exact) *exact = target == _lastKey;
+        return _entries - 1;
+    }
+    uint32_t low = 0;
+    uint32_t lowKey = _firstKey;
+    uint32_t high = _entries - 1;
+    uint32_t highKey = _lastKey;
+    while((high - low) > 1){
+        uint32_t above = (target - lowKey) / _interval;        // at most this many records above low
+        uint32_t below = (highKey - target) / _interval;       // at least...
+        uint32_t probe;
+        if(above < (high - low)){
+            probe = low + above;
+        } else if(below < (high - low) && (high - below) > low){
+            probe = high - below;
+        } else {
+            probe = low + (high - low) / 2;
+        }
+        _probes++;
+        uint32_t probeKey = key(probe)->UNIXtime;
+        if(probeKey == target){
+            if(exact) *exact = true;
+            return probe;
+        }
+        if(probeKey < target){
+            low = probe;
+            lowKey = probeKey;
+        } else {
+            high = probe;
+            highKey = probeKey;
+        }
+    }
+    return low;
+}
+
+/***********************************************************************************************
+ * Utilities
+ **********************************************************************************************/
+
+static uint32_t parseTime(const char* text){
+    char* end;
+    unsigned long value = strtoul(text, &end, 10);
+    if(*end == 0){
+        return value;
+    }
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    int n = sscanf(text, "%d-%d-%d%*c%d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+    if(n < 3){
+        fprintf(stderr, "invalid time: %s\n", text);
+        exit(2);
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    return timegm(&tm);
+}
+
+static const char* timeString(uint32_t UNIXtime){
+    static char buf[4][24];
+    static int next = 0;
+    char* str = buf[next++ % 4];
+    time_t t = UNIXtime;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(str, 24, "%Y-%m-%dT%H:%M:%SZ", &tm);
+    return str;
+}
+
+static double seconds(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void describe(LogView& log, const char* path){
+    printf("file:        %s\n", path);
+    printf("record size: %u, interval: %u\n", log.recordSize(), log.interval());
+    printf("entries:     %u (+%u preformatted), physical size %u\n", log.entries(), log.zeroTail(), log.physicalSize());
+    printf("wrapped:     %s", log.wrap() ? "yes" : "no");
+    if(log.wrap()) printf(" at offset %u", log.wrap());
+    printf("\n");
+    printf("first:       %s serial %d\n", timeString(log.firstKey()), log.firstSerial());
+    printf("last:        %s serial %d\n", timeString(log.lastKey()), log.lastSerial());
+}
+
+/***********************************************************************************************
+ * verify - check the invariants that IotaLog depends on
+ **********************************************************************************************/
+
+static int verify(LogView& log, const char* path){
+    auto start = std::chrono::steady_clock::now();
+    describe(log, path);
+    uint32_t serialErrors = 0;
+    uint32_t orderErrors = 0;
+    uint32_t alignErrors = 0;
+    uint32_t hoursErrors = 0;
+    uint32_t holes = 0;
+    uint64_t missing = 0;
+    uint32_t longestHole = 0;
+    uint32_t longestHoleKey = 0;
+    bool datalog = log.recordSize() == sizeof(IotaLogRecord);
+    double lastHours = 0;
+    const IotaLogKey* previous = nullptr;
+    for(uint32_t i=0; i<log.entries(); i++){
+        const IotaLogKey* rec = log.key(i);
+        if(rec->serial != log.firstSerial() + (int32_t)i){
+            if(serialErrors++ < 10){
+                printf("serial error: index %u serial %d expected %d\n", i, rec->serial, log.firstSerial() + i);
+            }
+        }
+        if(rec->UNIXtime % log.interval()){
+            if(alignErrors++ < 10){
+                printf("alignment error: serial %d key %u\n", rec->serial, rec->UNIXtime);
+            }
+        }
+        if(previous){
+            if(rec->UNIXtime <= previous->UNIXtime){
+                if(orderErrors++ < 10){
+                    printf("order error: serial %d key %s follows %s\n", rec->serial, timeString(rec->UNIXtime), timeString(previous->UNIXtime));
+                }
+            }
+            else if(rec->UNIXtime - previous->UNIXtime > log.interval()){
+                uint32_t gap = rec->UNIXtime - previous->UNIXtime;
+                holes++;
+                missing += gap / log.interval() - 1;
+                if(gap > longestHole){
+                    longestHole = gap;
+                    longestHoleKey = previous->UNIXtime;
+                }
+            }
+        }
+        if(datalog){
+            double hours = ((const IotaLogRecord*)rec)->logHours;
+            if(hours != hours || hours < lastHours){
+                if(hoursErrors++ < 10){
+                    printf("logHours error: serial %d %f follows %f\n", rec->serial, hours, lastHours);
+                }
+            }
+            else {
+                lastHours = hours;
+            }
+        }
+        previous = rec;
+    }
+    printf("holes:       %u, %llu missing entries", holes, (unsigned long long)missing);
+    if(holes) printf(", longest %u seconds after %s", longestHole, timeString(longestHoleKey));
+    printf("\n");
+    printf("errors:      serial %u, order %u, alignment %u, logHours %u\n", serialErrors, orderErrors, alignErrors, hoursErrors);
+    printf("elapsed:     %.3f seconds\n", seconds(start));
+    return (serialErrors || orderErrors || alignErrors || hoursErrors) ? 1 : 0;
+}
+
+/***********************************************************************************************
+ * dump - CSV or raw binary of a range, in logical order
+ **********************************************************************************************/
+
+static int dump(LogView& log, uint32_t begin, uint32_t end, bool binary, const char* outPath){
+    FILE* out = stdout;
+    if(outPath){
+        out = fopen(outPath, binary ? "wb" : "w");
+        if( ! out){
+            fprintf(stderr, "%s: %s\n", outPath, strerror(errno));
+            return 2;
+        }
+    }
+    else if(binary && isatty(fileno(stdout))){
+        fprintf(stderr, "binary dump needs -o or a redirected stdout\n");
+        return 2;
+    }
+    static char outBuf[1 << 20];
+    setvbuf(out, outBuf, _IOFBF, sizeof(outBuf));
+
+        // Records with keys in [begin, end]. find() returns the nearest
+        // record below, or the first or last when out of range,
+        // so check the keys of both ends.
+
+    uint32_t first = begin ? log.find(begin) : 0;
+    if(begin && log.key(first)->UNIXtime < begin) first++;
+    uint32_t last = end ? log.find(end) : log.entries() - 1;
+    bool empty = first >= log.entries() || first > last || (end && log.key(last)->UNIXtime > end);
+    bool datalog = log.recordSize() == sizeof(IotaLogRecord);
+
+    if( ! binary){
+        if(datalog){
+            fprintf(out, "UNIXtime,serial,logHours");
+            for(int i=0; i<15; i++) fprintf(out, ",accum1_%d", i);
+            for(int i=0; i<15; i++) fprintf(out, ",accum2_%d", i);
+            fprintf(out, "\n");
+        } else {
+            fprintf(out, "UNIXtime,serial,sumPositive,sumNegative,sumNet\n");
+        }
+    }
+    for(uint32_t i=first; i<=last && ! empty; i++){
+        const uint8_t* rec = log.record(i);
+        if(binary){
+            fwrite(rec, log.recordSize(), 1, out);
+        }
+        else if(datalog){
+            const IotaLogRecord* r = (const IotaLogRecord*)rec;
+            fprintf(out, "%u,%d,%.9g", r->UNIXtime, r->serial, r->logHours);
+            for(int j=0; j<15; j++) fprintf(out, ",%.9g", r->accum1[j]);
+            for(int j=0; j<15; j++) fprintf(out, ",%.9g", r->accum2[j]);
+            fputc('\n', out);
+        }
+        else {
+            const intRecord* r = (const intRecord*)rec;
+            fprintf(out, "%u,%d,%.9g,%.9g,%.9g\n", r->UNIXtime, r->serial, r->sumPositive, r->sumNegative, r->sumNet);
+        }
+    }
+    fflush(out);
+    if(out != stdout) fclose(out);
+    return 0;
+}
+
+/***********************************************************************************************
+ * energy - accumulated values between two keys
+ *
+ * For a datalog, accum1 is Wh for power channels (Vh for voltage channels) and accum2 is VAh
+ * (Hz-h); averages are over monitored hours (logHours), as the firmware computes them.
+ **********************************************************************************************/
+
+static int energy(LogView& log, uint32_t begin, uint32_t end){
+    if( ! begin || ! end || end <= begin){
+        fprintf(stderr, "energy needs -b begin and -e end\n");
+        return 2;
+    }
+    bool exact;
+    const uint8_t* oldRec = log.record(log.find(begin, &exact));
+    if(begin < log.firstKey()) printf("note: begin is before the first entry %s\n", timeString(log.firstKey()));
+    const uint8_t* newRec = log.record(log.find(end, &exact));
+    if(end > log.lastKey()) printf("note: end is after the last entry %s\n", timeString(log.lastKey()));
+    printf("range: %s to %s\n", timeString(begin), timeString(end));
+    if(log.recordSize() == sizeof(IotaLogRecord)){
+        const IotaLogRecord* o = (const IotaLogRecord*)oldRec;
+        const IotaLogRecord* n = (const IotaLogRecord*)newRec;
+        double hours = n->logHours - o->logHours;
+        printf("monitored hours: %.4f\n", hours);
+        printf("input     accum1 delta     accum1 avg       accum2 delta     accum2 avg\n");
+        for(int i=0; i<15; i++){
+            double d1 = n->accum1[i] - o->accum1[i];
+            double d2 = n->accum2[i] - o->accum2[i];
+            if(d1 == 0 && d2 == 0) continue;
+            printf("%5d %16.4f %14.4f %16.4f %14.4f\n", i, d1, hours > 0 ? d1 / hours : 0.0, d2, hours > 0 ? d2 / hours : 0.0);
+        }
+    }
+    else {
+        const intRecord* o = (const intRecord*)oldRec;
+        const intRecord* n = (const intRecord*)newRec;
+        printf("positive Wh: %.4f\n", n->sumPositive - o->sumPositive);
+        printf("negative Wh: %.4f\n", n->sumNegative - o->sumNegative);
+        printf("net Wh:      %.4f\n", n->sumPositive - o->sumPositive + n->sumNegative - o->sumNegative);
+    }
+    return 0;
+}
+
+/***********************************************************************************************
+ * rebuild-history - build a 60 second history log from a current log
+ *
+ * Same as the historyLog Service: one record per minute, each the current log
+ * record at or below the minute, with consecutive serials and no holes.
+ **********************************************************************************************/
+
+static int rebuildHistory(LogView& log, const char* outPath){
+    if( ! outPath){
+        fprintf(stderr, "rebuild-history needs -o <histlog>\n");
+        return 2;
+    }
+    if(log.recordSize() != sizeof(IotaLogRecord)){
+        fprintf(stderr, "rebuild-history needs a datalog (256 byte records)\n");
+        return 2;
+    }
+    FILE* out = fopen(outPath, "wb");
+    if( ! out){
+        fprintf(stderr, "%s: %s\n", outPath, strerror(errno));
+        return 2;
+    }
+    static char outBuf[1 << 20];
+    setvbuf(out, outBuf, _IOFBF, sizeof(outBuf));
+    auto start = std::chrono::steady_clock::now();
+    const uint32_t historyInterval = 60;
+    uint32_t firstKey = log.firstKey();
+    if(firstKey % historyInterval) firstKey += historyInterval - firstKey % historyInterval;
+    uint32_t key = firstKey;
+    IotaLogRecord rec;
+    int32_t serial = 0;
+    uint32_t index = 0;
+    for(; key <= log.lastKey(); key += historyInterval){
+        while(index + 1 < log.entries() && log.key(index + 1)->UNIXtime <= key) index++;
+        memcpy(&rec, log.record(index), sizeof(rec));
+        rec.UNIXtime = key;
+        rec.serial = serial++;
+        fwrite(&rec, sizeof(rec), 1, out);
+    }
+    fclose(out);
+    printf("%d history records, %s to %s, %.3f seconds\n", serial, timeString(firstKey),
+            timeString(key - historyInterval), seconds(start));
+    return 0;
+}
+
+/***********************************************************************************************
+ * bench - random keyed lookups
+ **********************************************************************************************/
+
+static int bench(LogView& log, uint32_t count){
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<uint32_t> dist(log.firstKey(), log.lastKey());
+    uint64_t check = 0;
+    uint32_t exactCount = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(uint32_t i=0; i<count; i++){
+        bool exact;
+        check += log.find(dist(rng), &exact);
+        exactCount += exact;
+    }
+    double elapsed = seconds(start);
+    printf("%u lookups in %.3f seconds, %.0f ns/lookup, %.2f probes/lookup, %.1f%% exact (%llu)\n",
+            count, elapsed, elapsed * 1e9 / count, (double)log.probes() / count, 100.0 * exactCount / count,
+            (unsigned long long)check);
+    return 0;
+}
+
+/***********************************************************************************************
+ * main
+ **********************************************************************************************/
+
+static void usage(){
+    fprintf(stderr,
+        "usage: iotalog <command> <log> [options]\n"
+        "  verify           check log invariants and report holes\n"
+        "  dump             CSV (default) or --bin raw records in logical order\n"
+        "  energy           accumulated values between -b and -e\n"
+        "  rebuild-history  build a history log from a current log (-o out)\n"
+        "  bench            random keyed lookups (-n count)\n"
+        "options: -b begin -e end -r recordsize -i interval -o out -n count --bin\n");
+    exit(2);
+}
+
+int main(int argc, char** argv){
+    if(argc < 3) usage();
+    const char* command = argv[1];
+    const char* path = argv[2];
+    uint32_t begin = 0;
+    uint32_t end = 0;
+    uint32_t recordSize = 0;
+    uint32_t interval = 0;
+    uint32_t count = 1000000;
+    const char* outPath = nullptr;
+    bool binary = false;
+    for(int i=3; i<argc; i++){
+        const char* arg = argv[i];
+        if(strcmp(arg, "--bin") == 0){
+            binary = true;
+            continue;
+        }
+        if(i + 1 >= argc) usage();
+        const char* value = argv[++i];
+        if(strcmp(arg, "-b") == 0) begin = parseTime(value);
+        else if(strcmp(arg, "-e") == 0) end = parseTime(value);
+        else if(strcmp(arg, "-r") == 0) recordSize = atoi(value);
+        else if(strcmp(arg, "-i") == 0) interval = atoi(value);
+        else if(strcmp(arg, "-o") == 0) outPath = value;
+        else if(strcmp(arg, "-n") == 0) count = atoi(value);
+        else usage();
+    }
+
+    LogView log;
+    auto start = std::chrono::steady_clock::now();
+    if( ! log.open(path, recordSize, interval)){
+        return 2;
+    }
+    double openTime = seconds(start);
+
+    if(strcmp(command, "verify") == 0) return verify(log, path);
+    if(strcmp(command, "dump") == 0) return dump(log, begin, end, binary, outPath);
+    if(strcmp(command, "energy") == 0) return energy(log, begin, end);
+    if(strcmp(command, "rebuild-history") == 0) return rebuildHistory(log, outPath);
+    if(strcmp(command, "bench") == 0){
+        describe(log, path);
+        printf("open: %.6f seconds\n", openTime);
+        return bench(log, count);
+    }
+    usage();
+    return 2;
+}